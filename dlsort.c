@@ -0,0 +1,556 @@
+/**
+ * GS1 Digital Link URI log sort and deduplication commandline application
+ *
+ * @author Copyright (c) 2021-2023 GS1 AISBL.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ *  Reads a log of Digital Link URIs, one per line, and writes the distinct
+ *  canonical URIs ordered by the packed value of a key AI.
+ *
+ *  Records are accumulated within the memory budget, then sorted,
+ *  deduplicated and written to a temporary file as a run. The runs are
+ *  finally merged, dropping records that were repeated across runs. Should
+ *  as many runs of a level accumulate as can be merged within the budget,
+ *  they are first merged into a single run of the next level, so that each
+ *  record is rewritten once per level.
+ *
+ *  All I/O is buffered by the program within the budget, so stdio streams
+ *  are unbuffered.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gs1dlparser.h"
+
+#define MAX_BATCH	256			// Most lines parsed before their keys are extracted
+#define MAX_LINE	2048
+#define MAX_URI		(GS1_DL_MAX_OUT_DLURI + 256)
+#define MAX_RUNS	128			// Maximum number of runs merged at once
+#define MAX_OPEN	(4 * (MAX_RUNS - 1) + 1)	// Runs held open, enough for four levels
+#define RECORD_HEADER	(2 * sizeof(uint64_t) + sizeof(uint32_t))
+#define MIN_READ_BUF	(1 << 16)		// Smallest read buffer per run; holds any record
+
+struct record {
+	uint64_t key;				// Packed key, or GS1_DL_KEY_INVALID
+	uint64_t fp;				// Fingerprint of the AI data
+	size_t offset;				// Canonical URI within the arena
+	uint32_t len;
+};
+
+struct writer {
+	FILE *f;
+	char *buf;
+	size_t used, size;
+	bool ok;				// Whether all writes have succeeded
+};
+
+struct run {
+	FILE *f;
+	char *buf;				// Read buffer; a share of the arena during a merge
+	size_t size, pos, fill;
+	bool have;				// Whether head holds an unconsumed record
+	struct record head;
+	const char *data;			// URI of the head record, within buf
+	int level;				// Number of merge passes that produced the run
+};
+
+static char line[MAX_LINE + 2], uri[MAX_URI], last[MAX_URI];	// Working buffers
+static char *arena, *ioBuf;
+static size_t arenaUsed, arenaSize, ioSize, batch;
+static struct record *records;
+static size_t numRecords, maxRecords;
+static struct run *runs;
+static int numRuns, fanIn, totalRuns;
+
+
+static int cmpRecord(const void *a, const void *b) {
+
+	const struct record *x = a, *y = b;
+	uint32_t n = x->len < y->len ? x->len : y->len;
+	int c;
+
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	if (x->fp != y->fp)
+		return x->fp < y->fp ? -1 : 1;
+	if ((c = memcmp(arena + x->offset, arena + y->offset, n)) != 0)
+		return c;
+	return x->len < y->len ? -1 : x->len > y->len ? 1 : 0;
+
+}
+
+
+static void initWriter(struct writer *w, FILE *f) {
+	w->f = f;
+	w->buf = ioBuf;
+	w->used = 0;
+	w->size = ioSize;
+	w->ok = true;
+}
+
+
+static bool flushWriter(struct writer *w) {
+
+	if (w->ok && w->used > 0 && fwrite(w->buf, 1, w->used, w->f) != w->used)
+		w->ok = false;
+	w->used = 0;
+
+	return w->ok;
+
+}
+
+
+static void put(struct writer *w, const void *data, size_t len) {
+
+	const char *p = data;
+	size_t n;
+
+	while (len > 0 && w->ok) {
+		if (w->used == w->size && !flushWriter(w))
+			return;
+		n = w->size - w->used < len ? w->size - w->used : len;
+		memcpy(w->buf + w->used, p, n);
+		w->used += n;
+		p += n;
+		len -= n;
+	}
+
+}
+
+
+static void putRecord(struct writer *w, const struct record *r, const char *data) {
+	put(w, &r->key, sizeof(r->key));
+	put(w, &r->fp, sizeof(r->fp));
+	put(w, &r->len, sizeof(r->len));
+	put(w, data, r->len);
+}
+
+
+static FILE *newTempFile(void) {
+
+	FILE *f;
+
+	if ((f = tmpfile()) == NULL) {
+		fprintf(stderr, "Error: Failed to create a temporary file\n");
+		return NULL;
+	}
+	setvbuf(f, NULL, _IONBF, 0);
+
+	return f;
+
+}
+
+
+/*
+ *  Ensure that the read buffer holds at least need unconsumed bytes,
+ *  shifting the remainder to the front before reading
+ *
+ */
+static bool fillRun(struct run *r, size_t need) {
+
+	if (r->fill - r->pos >= need)
+		return true;
+
+	memmove(r->buf, r->buf + r->pos, r->fill - r->pos);
+	r->fill -= r->pos;
+	r->pos = 0;
+	r->fill += fread(r->buf + r->fill, 1, r->size - r->fill, r->f);
+
+	return r->fill >= need;
+
+}
+
+
+static bool readHead(struct run *r) {
+
+	const char *p;
+
+	r->have = false;
+	if (!fillRun(r, RECORD_HEADER))
+		return !ferror(r->f) && r->fill == r->pos;
+
+	p = r->buf + r->pos;
+	memcpy(&r->head.key, p, sizeof(r->head.key));
+	memcpy(&r->head.fp, p + sizeof(r->head.key), sizeof(r->head.fp));
+	memcpy(&r->head.len, p + sizeof(r->head.key) + sizeof(r->head.fp), sizeof(r->head.len));
+	r->pos += RECORD_HEADER;
+
+	if (r->head.len > MAX_URI || !fillRun(r, r->head.len))
+		return false;
+	r->data = r->buf + r->pos;
+	r->pos += r->head.len;
+	r->have = true;
+
+	return true;
+
+}
+
+
+static int cmpHead(const struct run *x, const struct run *y) {
+
+	uint32_t n = x->head.len < y->head.len ? x->head.len : y->head.len;
+	int c;
+
+	if (x->head.key != y->head.key)
+		return x->head.key < y->head.key ? -1 : 1;
+	if (x->head.fp != y->head.fp)
+		return x->head.fp < y->head.fp ? -1 : 1;
+	if ((c = memcmp(x->data, y->data, n)) != 0)
+		return c;
+	return x->head.len < y->head.len ? -1 : x->head.len > y->head.len ? 1 : 0;
+
+}
+
+
+static void siftDown(int *heap, int n, int i) {
+
+	int c, t;
+
+	for (; (c = 2 * i + 1) < n; i = c) {
+		if (c + 1 < n && cmpHead(&runs[heap[c + 1]], &runs[heap[c]]) < 0)
+			c++;
+		if (cmpHead(&runs[heap[c]], &runs[heap[i]]) >= 0)
+			break;
+		t = heap[i];
+		heap[i] = heap[c];
+		heap[c] = t;
+	}
+
+}
+
+
+/*
+ *  k-way merge of the runs from first onwards with a binary heap, writing
+ *  each distinct record once, either as a URI line to out or, if out is
+ *  NULL, to a new run of the next level that replaces the merged runs. The
+ *  arena is shared between the read buffers.
+ *
+ */
+static bool mergeRuns(int first, FILE *out, unsigned long *written) {
+
+	int heap[MAX_RUNS], n = 0, i;
+	struct run *r;
+	struct writer w;
+	struct record lastHead;
+	bool haveLast = false;
+	size_t share;
+	FILE *f = out;
+
+	if (numRuns == first)
+		return true;
+	if (!f && (f = newTempFile()) == NULL)
+		return false;
+	initWriter(&w, f);
+
+	share = arenaSize / (size_t)(numRuns - first);
+	for (i = first; i < numRuns; i++) {
+		runs[i].buf = arena + (size_t)(i - first) * share;
+		runs[i].size = share;
+		runs[i].pos = runs[i].fill = 0;
+		if (!readHead(&runs[i]))
+			goto readFail;
+		if (runs[i].have)
+			heap[n++] = i;
+	}
+	for (i = n / 2 - 1; i >= 0; i--)
+		siftDown(heap, n, i);
+
+	while (n > 0) {
+
+		r = &runs[heap[0]];
+
+		if (!haveLast || r->head.key != lastHead.key || r->head.fp != lastHead.fp ||
+		    r->head.len != lastHead.len || memcmp(r->data, last, r->head.len) != 0) {
+			if (out) {
+				put(&w, r->data, r->head.len);
+				put(&w, "\n", 1);
+				(*written)++;
+			} else {
+				putRecord(&w, &r->head, r->data);
+			}
+			lastHead = r->head;
+			memcpy(last, r->data, r->head.len);
+			haveLast = true;
+		}
+
+		if (!readHead(r))
+			goto readFail;
+		if (!r->have)
+			heap[0] = heap[--n];
+		siftDown(heap, n, 0);
+
+	}
+
+	if (!flushWriter(&w) || (out && fflush(out) != 0) || (!out && fseek(f, 0, SEEK_SET) != 0)) {
+		fprintf(stderr, "Error: Failed to write %s\n", out ? "the output" : "a temporary file");
+		goto fail;
+	}
+
+	for (i = first; i < numRuns; i++)
+		fclose(runs[i].f);
+	numRuns = first;
+	if (!out) {
+		runs[numRuns].f = f;
+		runs[numRuns].level = runs[first].level + 1;
+		numRuns++;
+	}
+
+	return true;
+
+readFail:
+
+	fprintf(stderr, "Error: Failed to read a temporary file\n");
+
+fail:
+
+	if (!out)
+		fclose(f);
+	return false;
+
+}
+
+
+static bool writeRun(void) {
+
+	struct writer w;
+	FILE *f;
+	size_t i;
+	const struct record *r, *prev = NULL;
+
+	if ((f = newTempFile()) == NULL)
+		return false;
+	initWriter(&w, f);
+
+	qsort(records, numRecords, sizeof(records[0]), cmpRecord);
+
+	for (i = 0; i < numRecords; i++) {
+		r = &records[i];
+		if (prev && cmpRecord(prev, r) == 0)
+			continue;
+		putRecord(&w, r, arena + r->offset);
+		prev = r;
+	}
+
+	if (!flushWriter(&w) || fseek(f, 0, SEEK_SET) != 0) {
+		fprintf(stderr, "Error: Failed to write a temporary file\n");
+		fclose(f);
+		return false;
+	}
+
+	runs[numRuns].f = f;
+	runs[numRuns].level = 0;
+	numRuns++;
+	totalRuns++;
+	numRecords = 0;
+	arenaUsed = 0;
+
+	// Intermediate passes, now that the arena is free for read buffers. The
+	// levels of the runs never increase from first to last, so the newest
+	// runs of the same level are merged once there are fanIn of them. Only
+	// beyond four levels are runs of differing levels merged.
+	for (;;) {
+		for (i = (size_t)numRuns - 1; i > 0 && runs[i - 1].level == runs[numRuns - 1].level; i--)
+			;
+		if ((size_t)numRuns - i < (size_t)fanIn && numRuns < MAX_OPEN)
+			return true;
+		if (!mergeRuns(numRuns - fanIn, NULL, NULL))
+			return false;
+	}
+
+}
+
+
+/*
+ *  Extract the keys for a batch of parsed lines and add their canonical URIs
+ *  to the current run, spilling it when the budget is exhausted
+ *
+ */
+static bool addBatch(struct gs1DLparser *ctxs, size_t count, const char *ai, const char *domain) {
+
+	uint64_t keys[MAX_BATCH];
+	size_t i, len;
+	struct record *r;
+
+	gs1_getKeys64(ctxs, count, ai, keys);
+
+	for (i = 0; i < count; i++) {
+
+		if ((len = gs1_writeDLuri(&ctxs[i], domain, NULL, 0, uri, sizeof(uri))) == 0)
+			continue;
+
+		if ((numRecords == maxRecords || arenaUsed + len > arenaSize) && !writeRun())
+			return false;
+
+		r = &records[numRecords++];
+		r->key = keys[i];
+		gs1_fingerprint(&ctxs[i], NULL, &r->fp);
+		r->offset = arenaUsed;
+		r->len = (uint32_t)len;
+		memcpy(arena + arenaUsed, uri, len);
+		arenaUsed += len;
+
+	}
+
+	return true;
+
+}
+
+
+int main(int argc, char *argv[]) {
+
+	const char *ai = "01", *domain = "id.gs1.org";
+	unsigned long budget = 256, lines = 0, skipped = 0, written = 0;
+	struct gs1DLparser *ctxs = NULL;
+	char *inBuf = NULL;
+	FILE *in = stdin;
+	size_t n = 0, len, total, fixed;
+	int i, ret = 1;
+
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+		if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+			budget = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+			ai = argv[++i];
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			domain = argv[++i];
+		else
+			break;
+	}
+
+	if (i < argc - 1 || (i == argc - 1 && argv[i][0] == '-' && argv[i][1] != '\0') || budget < 1) {
+		printf("Usage: %s [-m <memory budget in MiB>] [-k <key AI>] [-d <domain>] [<log file>]\n", argv[0]);
+		printf("  Writes the distinct canonical DL URIs of a log, one URI per line, ordered by key\n");
+		printf("  Example: %s -m 512 -k 01 scans.log > distinct.log\n", argv[0]);
+		return 1;
+	}
+
+	if (i == argc - 1 && (in = fopen(argv[i], "r")) == NULL) {
+		fprintf(stderr, "Error: Cannot open %s\n", argv[i]);
+		return 1;
+	}
+
+	// A sixteenth of the budget each for the input and output buffers and
+	// for the batch of parser contexts. After the run table and the working
+	// buffers, three quarters of the remainder are for URI data and the rest
+	// for the index. During a merge the URI data is shared between the runs.
+	total = (size_t)budget * 1024 * 1024;
+	ioSize = total / 16;
+	batch = ioSize / sizeof(struct gs1DLparser) < MAX_BATCH ? ioSize / sizeof(struct gs1DLparser) : MAX_BATCH;
+	fixed = 2 * ioSize + batch * sizeof(struct gs1DLparser) + MAX_OPEN * sizeof(struct run) +
+		sizeof(line) + sizeof(uri) + sizeof(last);
+	len = total > fixed ? total - fixed : 0;
+	maxRecords = len / 4 / sizeof(struct record);
+	arenaSize = len - len / 4;
+	fanIn = arenaSize / MIN_READ_BUF < MAX_RUNS ? (int)(arenaSize / MIN_READ_BUF) : MAX_RUNS;
+	if (batch == 0 || fanIn < 2) {
+		fprintf(stderr, "Error: The memory budget is too small\n");
+		goto out;
+	}
+
+	inBuf = malloc(ioSize);
+	ioBuf = malloc(ioSize);
+	arena = malloc(arenaSize);
+	records = malloc(maxRecords * sizeof(struct record));
+	runs = malloc(MAX_OPEN * sizeof(struct run));
+	ctxs = malloc(batch * sizeof(struct gs1DLparser));
+	if (!inBuf || !ioBuf || !arena || !records || !runs || !ctxs) {
+		fprintf(stderr, "Error: Out of memory\n");
+		goto out;
+	}
+	setvbuf(in, inBuf, _IOFBF, ioSize);
+	setvbuf(stdout, NULL, _IONBF, 0);
+
+	while (fgets(line, sizeof(line), in)) {
+
+		len = strlen(line);
+		lines++;
+
+		// Discard the remainder of overlong lines
+		if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+			while (fgets(line, sizeof(line), in) && line[strlen(line) - 1] != '\n')
+				;
+			skipped++;
+			continue;
+		}
+
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		if (len == 0)
+			continue;
+
+		if (!gs1_parseDLuri(&ctxs[n], line)) {
+			skipped++;
+			continue;
+		}
+
+		if (++n == batch) {
+			if (!addBatch(ctxs, n, ai, domain))
+				goto out;
+			n = 0;
+		}
+
+	}
+
+	if (ferror(in)) {
+		fprintf(stderr, "Error: Failed to read the log\n");
+		goto out;
+	}
+
+	if ((n > 0 && !addBatch(ctxs, n, ai, domain)) || (numRecords > 0 && !writeRun()))
+		goto out;
+
+	// Merge the newest, smallest runs until the rest can be merged at once
+	while (numRuns > fanIn) {
+		i = numRuns - fanIn + 1 < fanIn ? numRuns - fanIn + 1 : fanIn;
+		if (!mergeRuns(numRuns - i, NULL, NULL))
+			goto out;
+	}
+
+	if (!mergeRuns(0, stdout, &written))
+		goto out;
+	if (ferror(stdout)) {
+		fprintf(stderr, "Error: Failed to write the output\n");
+		goto out;
+	}
+
+	fprintf(stderr, "Read %lu lines, skipped %lu, wrote %lu distinct URIs from %d runs\n",
+		lines, skipped, written, totalRuns);
+	ret = 0;
+
+out:
+
+	for (i = 0; i < numRuns; i++)
+		fclose(runs[i].f);
+	if (in != stdin) {
+		fclose(in);
+		free(inBuf);
+	}
+	free(ctxs);
+	free(ioBuf);
+	free(runs);
+	free(records);
+	free(arena);
+
+	return ret;
+
+}
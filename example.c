@@ -32,23 +32,39 @@ int main(int argc, char *argv[]) {
 	char out_json[GS1_DL_MAX_OUT_JSON];
 	char out_brkt[GS1_DL_MAX_OUT_BRKT];
 	char out_unbr[GS1_DL_MAX_OUT_UNBR];
+	char out_comp[GS1_DL_MAX_OUT_COMP];
+	char out_uri[GS1_DL_MAX_OUT_DLURI + 64];
+	char out_hri[GS1_DL_MAX_OUT_HRI];
 
 	struct gs1DLparser ctx;
 
+	bool ret;
+
 	if (argc != 2) {
-		printf("Usage: %s '<Digital Link URI>'\n", argv[0]);
+		printf("Usage: %s '<Digital Link URI, element string or JSON>'\n", argv[0]);
 		printf("  Example: %s 'https://id.gs1.org/01/09520123456788/10/ABC%%2F123/21/12345?17=180426'\n", argv[0]);
+		printf("  Example: %s '^010952012345678810ABC/123^2112345^17180426'\n", argv[0]);
+		printf("  Example: %s '(01)09520123456788(10)ABC/123(21)12345(17)180426'\n", argv[0]);
 		return 1;
 	}
 
 	strcpy(in, argv[1]);
 
-	if (!gs1_parseDLuri(&ctx, in)) {
+	if (*in == '^')
+		ret = gs1_parseUnbracketedAIelementString(&ctx, in);
+	else if (*in == '(')
+		ret = gs1_parseBracketedAIelementString(&ctx, in);
+	else if (*in == '{')
+		ret = gs1_parseJSON(&ctx, in);
+	else
+		ret = gs1_parseDLuri(&ctx, in);
+
+	if (!ret) {
 		printf("Error: %s\n", ctx.err);
 		return 1;
 	}
 
-	printf("Provided Digital Link URI:                                 %s\n", in);
+	printf("Provided input:                                            %s\n", in);
 
 	gs1_writeUnbracketedAIelementString(&ctx, false, false, out_unbr);
 	printf("Unbracketed element string:                                %s\n", out_unbr);
@@ -74,6 +90,22 @@ int main(int argc, char *argv[]) {
 	gs1_writeJSON(&ctx, true, out_json);
 	printf("JSON (fixed AIs first):                                    %s\n", out_json);
 
+	gs1_writeHRI(&ctx, false, out_hri, sizeof(out_hri));
+	printf("HRI:                                                       %s\n", out_hri);
+
+	gs1_writeHRI(&ctx, true, out_hri, sizeof(out_hri));
+	printf("HRI (data titles):                                         %s\n", out_hri);
+
+	if (gs1_writeDLuri(&ctx, "id.gs1.org", NULL, 0, out_uri, sizeof(out_uri)))
+		printf("Canonical DL URI:                                          %s\n", out_uri);
+	else
+		printf("Canonical DL URI:                                          (%s)\n", ctx.err);
+
+	if (gs1_writeCompressedDLpath(&ctx, out_comp))
+		printf("Compressed DL path component:                              %s\n", out_comp);
+	else
+		printf("Compressed DL path component:                              (%s)\n", ctx.err);
+
 	return 0;
 
 }
@@ -19,6 +19,7 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -26,6 +27,11 @@
 
 #include "gs1dlparser.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GS1_DL_SSE2
+#include <emmintrin.h>
+#endif
+
 
 #ifdef PRNT
 #define DEBUG_PRINT(...) do {				\
@@ -51,6 +57,9 @@
  */
 static const char *uriCharacters = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-._~:/?#[]@!$&'()*+,;=%";
 
+static const char *hexLower = "0123456789abcdef";
+static const char *hexUpper = "0123456789ABCDEF";
+
 
 /*
  *  List of Digital Link primary keys
@@ -89,6 +98,34 @@ static bool isDLpkey(const char* ai, size_t ailen) {
 }
 
 
+/*
+ *  Key qualifiers of the Digital Link primary keys that have them, in the
+ *  order in which they are written to the path info
+ *
+ */
+static const struct {
+	const char *pkey;
+	const char *quals[4];
+} dl_keyQualifiers[] = {
+	{ "01",   { "22", "10", "21", "235" } },
+	{ "414",  { "254", "7040" } },
+	{ "417",  { "7040" } },
+	{ "8006", { "22", "10", "21" } },
+	{ "8010", { "8011" } },
+	{ "8017", { "8019" } },
+	{ "8018", { "8019" } },
+};
+
+static const char* const* getDLkeyQualifiers(const char* ai, size_t ailen) {
+	size_t i;
+	for (i = 0; i < SIZEOF_ARRAY(dl_keyQualifiers); i++)
+		if (strlen(dl_keyQualifiers[i].pkey) == ailen &&
+		    strncmp(ai, dl_keyQualifiers[i].pkey, ailen) == 0)
+			return dl_keyQualifiers[i].quals;
+	return NULL;
+}
+
+
 /*
  *  AI prefixes that are defined as not requiring termination by an FNC1
  *  character
@@ -100,21 +137,64 @@ static bool isDLpkey(const char* ai, size_t ailen) {
  *  are not unprecedented.
  *
  */
-static const char *fixedAIprefixes[] = {
-	"00", "01", "02",
-	"03", "04",
-	"11", "12", "13", "14", "15", "16", "17", "18", "19",
-	"20",
-	"31", "32", "33", "34", "35", "36",
-	"41"
+static const struct {
+	const char *prefix;
+	int vallen;				// Length of the value that follows the AI
+} fixedAIprefixes[] = {
+	{ "00", 18 }, { "01", 14 }, { "02", 14 },
+	{ "03", 14 }, { "04", 16 },
+	{ "11", 6 }, { "12", 6 }, { "13", 6 }, { "14", 6 }, { "15", 6 }, { "16", 6 }, { "17", 6 }, { "18", 6 }, { "19", 6 },
+	{ "20", 2 },
+	{ "31", 6 }, { "32", 6 }, { "33", 6 }, { "34", 6 }, { "35", 6 }, { "36", 6 },
+	{ "41", 13 }
 };
 
-static bool isFNC1required(const char *ai) {
+/*
+ *  Length of the value of an AI with a predefined fixed length, otherwise 0
+ *
+ */
+static int fixedAIvalueLength(const char *ai) {
 	size_t i;
 	for (i = 0; i < SIZEOF_ARRAY(fixedAIprefixes); i++)
-		if (strncmp(fixedAIprefixes[i], ai, 2) == 0)
-			return false;
-	return true;
+		if (strncmp(fixedAIprefixes[i].prefix, ai, 2) == 0)
+			return fixedAIprefixes[i].vallen;
+	return 0;
+}
+
+static bool isFNC1required(const char *ai) {
+	return fixedAIvalueLength(ai) == 0;
+}
+
+
+/*
+ *  Length of an AI as determined by its first two digits
+ *
+ *  Used to identify AIs in unbracketed element strings, where they are not
+ *  delimited.
+ *
+ *  Prefixes that are not listed are unassigned.
+ *
+ */
+static const struct {
+	const char *prefix;
+	int ailen;
+} aiLengthByPrefix[] = {
+	{ "00", 2 }, { "01", 2 }, { "02", 2 }, { "03", 2 }, { "04", 2 },
+	{ "10", 2 }, { "11", 2 }, { "12", 2 }, { "13", 2 }, { "14", 2 }, { "15", 2 }, { "16", 2 }, { "17", 2 }, { "18", 2 }, { "19", 2 },
+	{ "20", 2 }, { "21", 2 }, { "22", 2 }, { "23", 3 }, { "24", 3 }, { "25", 3 },
+	{ "30", 2 }, { "31", 4 }, { "32", 4 }, { "33", 4 }, { "34", 4 }, { "35", 4 }, { "36", 4 }, { "37", 2 }, { "39", 4 },
+	{ "40", 3 }, { "41", 3 }, { "42", 3 }, { "43", 4 },
+	{ "70", 4 }, { "71", 3 }, { "72", 4 },
+	{ "80", 4 }, { "81", 4 }, { "82", 4 },
+	{ "90", 2 }, { "91", 2 }, { "92", 2 }, { "93", 2 }, { "94", 2 }, { "95", 2 }, { "96", 2 }, { "97", 2 }, { "98", 2 }, { "99", 2 }
+};
+
+static size_t getAIlength(const char *ai) {
+	size_t i;
+	for (i = 0; i < SIZEOF_ARRAY(aiLengthByPrefix); i++)
+		if (strncmp(aiLengthByPrefix[i].prefix, ai, 2) == 0)
+			return (size_t)aiLengthByPrefix[i].ailen;
+	return 0;
 }
 
 
@@ -141,7 +221,7 @@ static size_t URIunescape(char *out, size_t maxlen, const char *in, const size_t
 	char hex[3] = { 0 };
 
 	for (i = 0, j = 0; i < inlen && j < maxlen; i++, j++) {
-		if (i < inlen - 2 && in[i] == '%' && isxdigit(in[i+1]) && isxdigit(in[i+2])) {
+		if (i + 2 < inlen && in[i] == '%' && isxdigit(in[i+1]) && isxdigit(in[i+2])) {
 			hex[0] = in[i+1];
 			hex[1] = in[i+2];
 			out[j] = (char)strtoul(hex, NULL, 16);
@@ -159,1009 +239,8053 @@ static size_t URIunescape(char *out, size_t maxlen, const char *in, const size_t
 }
 
 
-bool gs1_parseDLuri(struct gs1DLparser *ctx, char *dlData) {
-
-	char *p, *r, *e, *ai, *outai, *outval;
-	char *pi = NULL;			// Path info
-	char *qp = NULL;			// Query params
-	char *fr = NULL;			// Fragment
-	char *dp = NULL;			// DL path info
-	bool ret;
-	size_t i;
-	size_t ailen, vallen;
-	char aival[GS1_DL_MAX_AI_LEN+1];	// Unescaped AI value
+/*
+ *  Characters that may appear unescaped in a path or query component
+ *
+ */
+static bool isURIunreserved(char c) {
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+	       c == '-' || c == '.' || c == '_' || c == '~';
+}
 
-	ctx->numAIs = 0;
-	*ctx->aiBuf = '\0';
-	*ctx->err = '\0';
+#ifdef GS1_DL_SSE2
+/*
+ *  True iff all 16 characters at p are unreserved
+ *
+ */
+static bool allURIunreserved16(const char *p) {
 
-	DEBUG_PRINT("\nParsing DL data: %s\n", dlData);
+	__m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);
+	__m128i lc = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	__m128i ok;
 
-	p = dlData;
+	ok = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	ok = _mm_or_si128(ok, _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lc, _mm_set1_epi8('z' + 1))));
+	ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+	ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+	ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+	ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8('~')));
 
-	if (strspn(p, uriCharacters) != strlen(p)) {
-		strcpy(ctx->err, "URI contains illegal characters");
-		goto fail;
-	}
+	return _mm_movemask_epi8(ok) == 0xFFFF;
 
-	if (strlen(p) >= 8 && strncmp(p, "https://", 8) == 0)
-		p += 8;
-	else if (strlen(p) >= 7 && strncmp(p, "http://", 7) == 0)
-		p += 7;
-	else {
-		strcpy(ctx->err, "Scheme must be http:// or https://");
-		goto fail;
-	}
+}
+#endif
 
-	DEBUG_PRINT("  Scheme %.*s\n", (int)(p-dlData-3), dlData);
 
-	if (((r = strchr(p, '/')) == NULL) || r-p < 1) {
-		strcpy(ctx->err, "URI must contain a domain and path info");
-		goto fail;
-	}
+/*
+ *  Percent-encode an input for use in either a path or query component.
+ *  Runs of unreserved characters are classified and copied a block at a
+ *  time where SIMD is available.
+ *
+ *  Sets the length of the output, which may be zero, and returns false if
+ *  it does not fit within maxlen characters.
+ *
+ */
+static bool URIescape(char *out, size_t maxlen, const char *in, const size_t inlen, size_t *outlen) {
 
-	DEBUG_PRINT("  Domain: %.*s\n", (int)(r-p), p);
+	size_t i = 0, j = 0, k;
 
-	pi = p = r;					// Skip the domain name
+	while (i < inlen) {
 
-	// Fragment character delimits end of data
-	if ((fr = strchr(pi, '#')) != NULL)
-		*fr++ = '\0';
+#ifdef GS1_DL_SSE2
+		if (inlen - i >= 16 && maxlen - j >= 16 && allURIunreserved16(in + i)) {
+			memcpy(out + j, in + i, 16);
+			i += 16;
+			j += 16;
+			continue;
+		}
+#endif
 
-	// Query parameter marker delimits end of path info
-	if ((qp = strchr(pi, '?')) != NULL)
-		*qp++ = '\0';
+		for (k = i + 16; i < inlen && i < k; i++) {
+			if (isURIunreserved(in[i])) {
+				if (j + 1 > maxlen)
+					return false;
+				out[j++] = in[i];
+			} else {
+				if (j + 3 > maxlen)
+					return false;
+				out[j++] = '%';
+				out[j++] = hexUpper[(unsigned char)in[i] >> 4];
+				out[j++] = hexUpper[(unsigned char)in[i] & 0x0F];
+			}
+		}
 
-	DEBUG_PRINT("  Path info: %s\n", pi);
-	DEBUG_PRINT("    Searching path info backwards for Digital Link primary key\n");
+	}
+	out[j] = '\0';
+	*outlen = j;
 
-	// Search backwards from the end of the path info looking for an
-	// "/AI/value" pair where AI is a DL primary key
-	while ((r = strrchr(pi, '/')) != NULL) {
+	return true;
 
-		*p = '/';				// Restore original pair separator
-							// Clobbers first character of path
-							// info on first iteration
+}
 
-		// Find start of AI
-		*r = '\0';				// Chop off value
-		p = strrchr(pi, '/'); 			// Beginning of AI
-		*r = '/';				// Restore original AI/value separator
-		if (!p)					// At beginning of path
-			break;
 
-		DEBUG_PRINT("      %s\n", p);
+/*
+ *  Append an AI element to the AI buffer and record it in the AI data
+ *
+ */
+static bool addAIelement(struct gs1DLparser *ctx, const char *ai, size_t ailen, const char *val, size_t vallen) {
 
-		ailen = (size_t)(r-p-1);
-		if (ailen < 2 || ailen > 4 || !allDigits(p+1, ailen)) {
-			DEBUG_PRINT("        Stopping. (%.*s) is not a valid form for an AI.\n", (int)ailen, p+1);
-			break;
-		}
+	char *outai, *outval;
 
-		if (isDLpkey(p+1, ailen)) {		// Found root of DL path info
-			dp = p;
-			break;
-		}
+	if (ctx->numAIs >= GS1_DL_MAX_AIS) {
+		strcpy(ctx->err, "Too many AIs");
+		return false;
+	}
 
-		*p = '\0';
+	outai = ctx->aiBuf + strlen(ctx->aiBuf);	// Save start of AI for AI data
+	writeAIbuf(ai, ailen);				// Write AI
+	outval = ctx->aiBuf + strlen(ctx->aiBuf);	// Save start of value for AI data
+	writeAIbuf(val, vallen);			// Write value
 
-	}
+	ctx->aiData[ctx->numAIs].ai = outai;
+	ctx->aiData[ctx->numAIs].ailen = (short)ailen;
+	ctx->aiData[ctx->numAIs].value = outval;
+	ctx->aiData[ctx->numAIs].vallen = (short)vallen;
+	ctx->aiData[ctx->numAIs].fnc1 = isFNC1required(outai);
+	ctx->aiData[ctx->numAIs].inQuery = false;
+	ctx->numAIs++;
 
-	if (!dp) {
-		strcpy(ctx->err, "No GS1 DL keys found in path info");
-		goto fail;
-	}
+	return true;
 
-	DEBUG_PRINT("  Stem: %.*s\n", (int)(dp-dlData), dlData);
+fail:
 
-	DEBUG_PRINT("  Processing DL path info part: %s\n", dp);
+	return false;
 
-	// Process each AI value pair in the DL path info
-	p = dp;
-	while (*p) {
-		p++;
-		r = strchr(p, '/');
+}
 
-		// AI is known to be valid since we previously walked over it
-		ai = p;
-		ailen = (size_t)(r-p);
 
-		if ((p = strchr(++r, '/')) == NULL)
-			p = r + strlen(r);
+/*
+ *  Compressed Digital Link URIs
+ *
+ *  The path info of a compressed DL URI ends with a single base64url
+ *  component that carries a bit string in which each AI is written as its
+ *  digits in 4-bit nibbles followed by its value, packed according to the
+ *  format of the AI:
+ *
+ *    - Fixed-length numeric: A binary integer of the minimum width capable
+ *      of holding that many digits.
+ *    - Variable-length numeric: A length indicator wide enough for the
+ *      maximum length, followed by the value as above.
+ *    - Alphanumeric: A 3-bit encoding indicator, a length indicator and then
+ *      the characters in the indicated encoding.
+ *
+ *  The bit string is zero-padded to a multiple of six bits.
+ *
+ *  Since we do not embed a complete AI table only AIs having an entry in
+ *  compAIformats can be processed. Optimised AI sequences (introduced by
+ *  nibbles A-F) and non-GS1 key-value pairs are not supported.
+ *
+ */
+#define COMP_ENC_NUMERIC	0		// Digits, as a binary integer
+#define COMP_ENC_HEX_LOWER	1		// [0-9a-f] in 4 bits
+#define COMP_ENC_HEX_UPPER	2		// [0-9A-F] in 4 bits
+#define COMP_ENC_BASE64URL	3		// [A-Za-z0-9_-] in 6 bits
+#define COMP_ENC_ASCII		4		// 7-bit ASCII
 
-		if (p == r) {
-			snprintf(ctx->err, sizeof(ctx->err), "AI (%.*s) value path element is empty", (int)ailen, ai);
-			goto fail;
-		}
+#define COMP_MAX_LIMBS		10		// 32-bit limbs for a binary integer of numBits[GS1_DL_MAX_AI_LEN] bits
 
-		// Reverse percent encoding
-		if ((vallen = URIunescape(aival, GS1_DL_MAX_AI_LEN, r, (size_t)(p-r), false)) == 0) {
-			sprintf(ctx->err, "Decoded AI (%.*s) from DL path info too long", (int)ailen, ai);
-			goto fail;
-		}
+static const char *b64urlAlphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
 
-		// Special handling of AI (01) to pad up to a GTIN-14
-		if (ailen == 2 && strncmp(ai, "01", 2) == 0 &&
-		    (vallen == 13 || vallen == 12 || vallen == 8)) {
-			for (i = 0; i <= 13; i++)
-				aival[13-i] = vallen >= i+1 ? aival[vallen-i-1] : '0';
-			aival[14] = '\0';
-			vallen = 14;
-		}
+/*
+ *  Base64url character to its 6-bit value plus one; zero for invalid
+ *  characters
+ *
+ */
+static const unsigned char b64urlValues[256] = {
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 63,  0,  0,
+	53, 54, 55, 56, 57, 58, 59, 60, 61, 62,  0,  0,  0,  0,  0,  0,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+	16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26,  0,  0,  0,  0, 64,
+	 0, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41,
+	42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+};
 
-		DEBUG_PRINT("    Extracted: (%.*s) %.*s\n", (int)ailen, ai, (int)vallen, aival);
+/*
+ *  Number of bits required to hold an n-digit numeric value, i.e.
+ *  ceil(n * log2(10))
+ *
+ */
+static const unsigned short numBits[GS1_DL_MAX_AI_LEN+1] = {
+	  0,   4,   7,  10,  14,  17,  20,  24,  27,  30,
+	 34,  37,  40,  44,  47,  50,  54,  57,  60,  64,
+	 67,  70,  74,  77,  80,  84,  87,  90,  94,  97,
+	100, 103, 107, 110, 113, 117, 120, 123, 127, 130,
+	133, 137, 140, 143, 147, 150, 153, 157, 160, 163,
+	167, 170, 173, 177, 180, 183, 187, 190, 193, 196,
+	200, 203, 206, 210, 213, 216, 220, 223, 226, 230,
+	233, 236, 240, 243, 246, 250, 253, 256, 260, 263,
+	266, 270, 273, 276, 280, 283, 286, 290, 293, 296,
+	299
+};
 
-		outai = ctx->aiBuf + strlen(ctx->aiBuf);	// Save start of AI for AI data
-		writeAIbuf(ai, ailen);				// Write AI
-		outval = ctx->aiBuf + strlen(ctx->aiBuf);	// Save start of value for AI data
-		writeAIbuf(aival, vallen);			// Write value
-
-		// Update the AI data
-		if (ctx->numAIs < GS1_DL_MAX_AIS) {
-			ctx->aiData[ctx->numAIs].ai = outai;
-			ctx->aiData[ctx->numAIs].ailen = (short)ailen;
-			ctx->aiData[ctx->numAIs].value = outval;
-			ctx->aiData[ctx->numAIs].vallen = (short)vallen;
-			ctx->aiData[ctx->numAIs].fnc1 = isFNC1required(outai);
-			ctx->numAIs++;
-		} else {
-			strcpy(ctx->err, "Too many AIs");
-			goto fail;
-		}
+/*
+ *  Number of bits required for a length indicator for values up to max
+ *
+ */
+static int lengthBits(unsigned int max) {
+	int n = 0;
+	while (max) {
+		n++;
+		max >>= 1;
 	}
+	return n;
+}
 
-	if (qp) {
-		DEBUG_PRINT("  Processing query params: %s\n", qp);
-	}
 
-	p = qp;
-	while (p && *p) {
+/*
+ *  Formats of the AIs that we can (de)compress. Each AI value consists of
+ *  one or two components. In the AI an "n" matches any digit; more specific
+ *  entries must precede wildcarded entries.
+ *
+ */
+struct compComponent {
+	char type;				// 'N' numeric; 'X' alphanumeric; 0 for none
+	bool fixed;				// Fixed length, otherwise variable
+	unsigned char len;			// Length, or maximum length if variable
+};
 
-		while (*p == '&')				// Jump any & separators
-			p++;
-		if ((r = strchr(p, '&')) == NULL)
-			r = p + strlen(p);			// Value-pair finishes at end of data
+struct compAIformat {
+	const char *ai;
+	struct compComponent c[2];
+};
 
-		// Discard parameters with no value
-		if ((e = memchr(p, '=', (size_t)(r-p))) == NULL) {
-			DEBUG_PRINT("    Skipped singleton:   %.*s\n", (int)(r-p), p);
-			p = r;
-			continue;
-		}
+#define C_N(l)	{ 'N', true,  l }
+#define C_NV(m)	{ 'N', false, m }
+#define C_XV(m)	{ 'X', false, m }
+#define C_NONE	{ 0,   false, 0 }
+
+static const struct compAIformat compAIformats[] = {
+	{ "00",   { C_N(18),  C_NONE    } },	// SSCC
+	{ "01",   { C_N(14),  C_NONE    } },	// GTIN
+	{ "02",   { C_N(14),  C_NONE    } },	// CONTENT
+	{ "10",   { C_XV(20), C_NONE    } },	// BATCH/LOT
+	{ "11",   { C_N(6),   C_NONE    } },	// PROD DATE
+	{ "12",   { C_N(6),   C_NONE    } },	// DUE DATE
+	{ "13",   { C_N(6),   C_NONE    } },	// PACK DATE
+	{ "15",   { C_N(6),   C_NONE    } },	// BEST BEFORE or BEST BY
+	{ "16",   { C_N(6),   C_NONE    } },	// SELL BY
+	{ "17",   { C_N(6),   C_NONE    } },	// USE BY or EXPIRY
+	{ "20",   { C_N(2),   C_NONE    } },	// VARIANT
+	{ "21",   { C_XV(20), C_NONE    } },	// SERIAL
+	{ "22",   { C_XV(20), C_NONE    } },	// CPV
+	{ "235",  { C_XV(28), C_NONE    } },	// TPX
+	{ "240",  { C_XV(30), C_NONE    } },	// ADDITIONAL ID
+	{ "241",  { C_XV(30), C_NONE    } },	// CUST. PART No.
+	{ "242",  { C_NV(6),  C_NONE    } },	// MTO VARIANT
+	{ "243",  { C_XV(20), C_NONE    } },	// PCN
+	{ "250",  { C_XV(30), C_NONE    } },	// SECONDARY SERIAL
+	{ "251",  { C_XV(30), C_NONE    } },	// REF. TO SOURCE
+	{ "253",  { C_N(13),  C_XV(17)  } },	// GDTI
+	{ "254",  { C_XV(20), C_NONE    } },	// GLN EXTENSION COMPONENT
+	{ "255",  { C_N(13),  C_NV(12)  } },	// GCN
+	{ "30",   { C_NV(8),  C_NONE    } },	// VAR. COUNT
+	{ "31nn", { C_N(6),   C_NONE    } },	// Trade and logistic measures
+	{ "32nn", { C_N(6),   C_NONE    } },
+	{ "33nn", { C_N(6),   C_NONE    } },
+	{ "34nn", { C_N(6),   C_NONE    } },
+	{ "35nn", { C_N(6),   C_NONE    } },
+	{ "36nn", { C_N(6),   C_NONE    } },
+	{ "37",   { C_NV(8),  C_NONE    } },	// COUNT
+	{ "390n", { C_NV(15), C_NONE    } },	// AMOUNT
+	{ "391n", { C_N(3),   C_NV(15)  } },	// AMOUNT (with ISO currency)
+	{ "392n", { C_NV(15), C_NONE    } },	// PRICE
+	{ "393n", { C_N(3),   C_NV(15)  } },	// PRICE (with ISO currency)
+	{ "394n", { C_N(4),   C_NONE    } },	// PRCNT OFF
+	{ "395n", { C_N(6),   C_NONE    } },	// PRICE/UoM
+	{ "400",  { C_XV(30), C_NONE    } },	// ORDER NUMBER
+	{ "401",  { C_XV(30), C_NONE    } },	// GINC
+	{ "402",  { C_N(17),  C_NONE    } },	// GSIN
+	{ "403",  { C_XV(30), C_NONE    } },	// ROUTE
+	{ "41n",  { C_N(13),  C_NONE    } },	// GLNs
+	{ "420",  { C_XV(20), C_NONE    } },	// SHIP TO POST
+	{ "421",  { C_N(3),   C_XV(9)   } },	// SHIP TO POST (with ISO country)
+	{ "422",  { C_N(3),   C_NONE    } },	// ORIGIN
+	{ "7003", { C_N(10),  C_NONE    } },	// EXPIRY TIME
+	{ "8003", { C_N(14),  C_XV(16)  } },	// GRAI
+	{ "8004", { C_XV(30), C_NONE    } },	// GIAI
+	{ "8006", { C_N(14),  C_N(4)    } },	// ITIP
+	{ "8010", { C_XV(30), C_NONE    } },	// CPID
+	{ "8011", { C_NV(12), C_NONE    } },	// CPID SERIAL
+	{ "8013", { C_XV(25), C_NONE    } },	// GMN
+	{ "8017", { C_N(18),  C_NONE    } },	// GSRN - PROVIDER
+	{ "8018", { C_N(18),  C_NONE    } },	// GSRN - RECIPIENT
+	{ "8019", { C_NV(10), C_NONE    } },	// SRIN
+	{ "8020", { C_XV(25), C_NONE    } },	// REF No.
+	{ "90",   { C_XV(30), C_NONE    } },	// INTERNAL
+	{ "9n",   { C_XV(90), C_NONE    } },	// INTERNAL
+};
 
-		// Numeric-only query parameters not matching valid form of an AI aren't permitted
-		ai = p;
-		ailen = (size_t)(e-p);
-		if (allDigits(p, ailen)) {
-			if (ailen < 2 || ailen > 4) {
-				sprintf(ctx->err, "Stopping. Numeric query parameter that is not a valid AI is illegal: %.*s...",
-					(ailen<10?(int)ailen:10), p);
-				goto fail;
-			}
-		} else {
-			// Skip non-numeric query parameters
-			DEBUG_PRINT("    Skipped:   %.*s\n", (int)(r-p), p);
-			p = r;
-			continue;
-		}
+static const struct compAIformat* lookupCompAIformat(const char *ai, size_t ailen) {
+	size_t i, j;
+	const char *f;
+	for (i = 0; i < SIZEOF_ARRAY(compAIformats); i++) {
+		f = compAIformats[i].ai;
+		for (j = 0; j < ailen && (f[j] == ai[j] || (f[j] == 'n' && ai[j] >= '0' && ai[j] <= '9')); j++);
+		if (j == ailen && f[j] == '\0')
+			return &compAIformats[i];
+	}
+	return NULL;
+}
 
-		e++;
-		if (r == e) {
-			snprintf(ctx->err, sizeof(ctx->err), "AI (%.*s) value query element is empty", (int)ailen, ai);
-			goto fail;
-		}
 
-		// Reverse percent encoding
-		if ((vallen = URIunescape(aival, GS1_DL_MAX_AI_LEN, e, (size_t)(r-e), true)) == 0) {
-			sprintf(ctx->err, "Decoded AI (%.*s) value from DL query params too long", (int)ailen, ai);
-			goto fail;
-		}
+/*
+ *  Reader for a base64url-encoded bit string that buffers up to 63 bits at
+ *  a time in a 64-bit word
+ *
+ */
+struct bitReader {
+	const char *p;				// Next unread character
+	const char *end;
+	uint64_t acc;				// Buffered bits, right-aligned
+	int nbits;				// Number of bits buffered
+};
 
-		// Special handling of AI (01) to pad up to a GTIN-14
-		if (ailen == 2 && strncmp(ai, "01", 2) == 0 &&
-		    (vallen == 13 || vallen == 12 || vallen == 8)) {
-			for (i = 0; i <= 13; i++)
-				aival[13-i] = vallen >= i+1 ? aival[vallen-i-1] : '0';
-			aival[14] = '\0';
-			vallen = 14;
-		}
+static size_t bitsRemaining(const struct bitReader *br) {
+	return (size_t)br->nbits + 6 * (size_t)(br->end - br->p);
+}
 
-		DEBUG_PRINT("    Extracted: (%.*s) %.*s\n", (int)ailen, ai, (int)vallen, aival);
+static bool readBits(struct bitReader *br, int n, uint32_t *v) {
 
-		outai = ctx->aiBuf + strlen(ctx->aiBuf);	// Save start of AI for AI data
-		writeAIbuf(ai, ailen);				// Write AI
-		outval = ctx->aiBuf + strlen(ctx->aiBuf);	// Save start of value for AI data
-		writeAIbuf(aival, vallen);			// Write value
-
-		// Update the AI data
-		if (ctx->numAIs < GS1_DL_MAX_AIS) {
-			ctx->aiData[ctx->numAIs].ai = outai;
-			ctx->aiData[ctx->numAIs].ailen = (short)ailen;
-			ctx->aiData[ctx->numAIs].value = outval;
-			ctx->aiData[ctx->numAIs].vallen = (short)vallen;
-			ctx->aiData[ctx->numAIs].fnc1 = isFNC1required(outai);
-			ctx->numAIs++;
-		} else {
-			strcpy(ctx->err, "Too many AIs");
-			goto fail;
+	if (n > 32 || (size_t)n > bitsRemaining(br))
+		return false;
+
+	if (br->nbits < n) {
+		while (br->nbits <= 57 && br->p < br->end) {
+			br->acc = (br->acc << 6) | (uint64_t)(b64urlValues[(unsigned char)*br->p++] - 1);
+			br->nbits += 6;
 		}
+	}
 
-		p = r;
+	br->nbits -= n;
+	*v = (uint32_t)((br->acc >> br->nbits) & ((UINT64_C(1) << n) - 1));
 
-	}
+	return true;
 
-	if (fr) {
-		DEBUG_PRINT("  Fragment: %s\n", fr);
-	}
+}
 
-	DEBUG_PRINT("Parsing DL data successful\n\n");
 
-	ret = true;
+/*
+ *  Read an n-digit numeric value that is held as a binary integer. Values of
+ *  up to 19 digits fit within a 64-bit word, otherwise a multi-precision
+ *  conversion is performed.
+ *
+ */
+static bool readNumeric(struct bitReader *br, size_t n, char *out) {
 
-out:
+	int bits = numBits[n], k;
+	uint32_t w, limbs[COMP_MAX_LIMBS] = { 0 };
+	uint64_t v = 0, t;
+	size_t i;
+	int l;
+
+	if (n <= 19) {
+		for (; bits > 0; bits -= k) {
+			k = bits > 32 ? bits - 32 : bits;
+			if (!readBits(br, k, &w))
+				return false;
+			v = (v << k) | w;
+		}
+		for (i = n; i > 0; i--) {
+			out[i-1] = (char)('0' + v % 10);
+			v /= 10;
+		}
+		return v == 0;				// Value must have fitted in n digits
+	}
 
-	if (qp)			// Restore original query parameter delimiter
-		*(qp-1) = '?';
+	// Read big-endian bits into little-endian 32-bit limbs
+	for (; bits > 0; bits -= k) {
+		k = bits % 32 ? bits % 32 : 32;
+		if (!readBits(br, k, &limbs[(bits-1)/32]))
+			return false;
+	}
 
-	if (fr)			// Restore original fragment delimiter
-		*(fr-1) = '#';
+	// Extract decimal digits by repeated division
+	for (i = n; i > 0; i--) {
+		t = 0;
+		for (l = COMP_MAX_LIMBS - 1; l >= 0; l--) {
+			t = (t << 32) | limbs[l];
+			limbs[l] = (uint32_t)(t / 10);
+			t %= 10;
+		}
+		out[i-1] = (char)('0' + t);
+	}
+	for (l = 0; l < COMP_MAX_LIMBS; l++)
+		if (limbs[l])
+			return false;
 
-	return ret;
+	return true;
 
-fail:
+}
 
-	if (*ctx->err == '\0')
-		strcpy(ctx->err, "Failed to parse DL data");
 
-	DEBUG_PRINT("Parsing DL data failed: %s\n", ctx->err);
+static bool readAlphanumeric(struct bitReader *br, uint32_t enc, size_t len, char *out) {
 
-	ctx->numAIs = 0;
-	ret = false;
-	goto out;
+	size_t i;
+	uint32_t v;
+
+	switch (enc) {
+	case COMP_ENC_NUMERIC:
+		return readNumeric(br, len, out);
+	case COMP_ENC_HEX_LOWER:
+	case COMP_ENC_HEX_UPPER:
+		for (i = 0; i < len; i++) {
+			if (!readBits(br, 4, &v))
+				return false;
+			out[i] = (enc == COMP_ENC_HEX_LOWER ? hexLower : hexUpper)[v];
+		}
+		return true;
+	case COMP_ENC_BASE64URL:
+		for (i = 0; i < len; i++) {
+			if (!readBits(br, 6, &v))
+				return false;
+			out[i] = b64urlAlphabet[v];
+		}
+		return true;
+	case COMP_ENC_ASCII:
+		for (i = 0; i < len; i++) {
+			if (!readBits(br, 7, &v) || v == 0)
+				return false;
+			out[i] = (char)v;
+		}
+		return true;
+	default:
+		return false;
+	}
 
 }
 
 
-void gs1_writeUnbracketedAIelementString(struct gs1DLparser *ctx, bool fixedFirst, bool extraFNC1, char *out) {
+/*
+ *  Extract the AI elements from the base64url component of a compressed DL
+ *  URI
+ *
+ */
+static bool decompressDLpath(struct gs1DLparser *ctx, const char *in, size_t inlen) {
+
+	struct bitReader br = { in, in + inlen, 0, 0 };
+	const struct compAIformat *fmt;
+	const struct compComponent *c;
+	char ai[4];
+	char val[GS1_DL_MAX_AI_LEN+1];
+	size_t i, ailen, vallen, len;
+	uint32_t v, enc;
+
+	for (i = 0; i < inlen; i++) {
+		if (!b64urlValues[(unsigned char)in[i]]) {
+			DEBUG_PRINT("    Not compressed. Illegal character in component\n");
+			return false;
+		}
+	}
 
-	int i;
-	struct gs1AIelement ai;
-	char *p = out;
-	bool fixedPass = true;		// First pass extracts predefined fixed-length AIs
+	while (bitsRemaining(&br) >= 8) {
 
-	*p++ = '^';
+		// AI digits are read until they match an AI of known format
+		fmt = NULL;
+		for (ailen = 0; ailen < 4 && !fmt; ) {
+			if (!readBits(&br, 4, &v) || v > 9) {
+				DEBUG_PRINT("    Unsupported AI data at %d bits from the end\n", (int)bitsRemaining(&br));
+				return false;
+			}
+			ai[ailen++] = (char)('0' + v);
+			if (ailen >= 2)
+				fmt = lookupCompAIformat(ai, ailen);
+		}
+		if (!fmt) {
+			DEBUG_PRINT("    Unknown AI (%.*s) in compressed data\n", (int)ailen, ai);
+			return false;
+		}
 
-nextPass:
+		vallen = 0;
+		for (i = 0; i < SIZEOF_ARRAY(fmt->c) && fmt->c[i].type; i++) {
+			c = &fmt->c[i];
+			enc = COMP_ENC_NUMERIC;
+			if (c->type == 'X' && !readBits(&br, 3, &enc))
+				goto bad;
+			len = c->len;
+			if (!c->fixed) {
+				// Only a variable component following a fixed one is optional
+				if (!readBits(&br, lengthBits(c->len), &v) || (v == 0 && (i == 0 || !fmt->c[i-1].fixed)) ||
+				    v > c->len)
+					goto bad;
+				len = v;
+			}
+			if (!readAlphanumeric(&br, enc, len, val + vallen))
+				goto bad;
+			vallen += len;
+		}
 
-	for (i = 0; i < ctx->numAIs; i++) {
-		ai = ctx->aiData[i];
+		DEBUG_PRINT("    Decompressed: (%.*s) %.*s\n", (int)ailen, ai, (int)vallen, val);
 
-		if (fixedFirst && !(fixedPass ^ ai.fnc1))
-			continue;
+		if (!addAIelement(ctx, ai, ailen, val, vallen))
+			return false;
 
-		p += sprintf(p, "%.*s%.*s", ai.ailen, ai.ai, ai.vallen, ai.value);
-		if (extraFNC1 || ai.fnc1)
-			*p++ = '^';
 	}
 
-	if (fixedFirst && fixedPass) {
-		fixedPass = false;
-		goto nextPass;
+	// Only zero padding may remain
+	if (!readBits(&br, (int)bitsRemaining(&br), &v) || v != 0) {
+		DEBUG_PRINT("    Non-zero padding in compressed data\n");
+		return false;
 	}
 
-	if (*(p-1) == '^')
-		p--;
+	return ctx->numAIs > 0;
 
-	*p = '\0';
+bad:
 
-	return;
+	DEBUG_PRINT("    Invalid value for AI (%.*s) in compressed data\n", (int)ailen, ai);
+	return false;
 
 }
 
 
-void gs1_writeBracketedAIelementString(struct gs1DLparser *ctx, bool fixedFirst, char *out) {
+/*
+ *  Character classes for selecting the encoding of an alphanumeric value.
+ *  Each bit indicates that the character is representable in the
+ *  corresponding encoding.
+ *
+ */
+#define COMP_CLS_NUMERIC	(1 << COMP_ENC_NUMERIC)
+#define COMP_CLS_HEX_LOWER	(1 << COMP_ENC_HEX_LOWER)
+#define COMP_CLS_HEX_UPPER	(1 << COMP_ENC_HEX_UPPER)
+#define COMP_CLS_BASE64URL	(1 << COMP_ENC_BASE64URL)
+#define COMP_CLS_ASCII		(1 << COMP_ENC_ASCII)
+
+static const unsigned char compCharClasses[256] = {
+	 0, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 24, 16, 16,
+	31, 31, 31, 31, 31, 31, 31, 31, 31, 31, 16, 16, 16, 16, 16, 16,
+	16, 28, 28, 28, 28, 28, 28, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+	24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 16, 16, 16, 16, 24,
+	16, 26, 26, 26, 26, 26, 26, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+	24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 16, 16, 16, 16, 16,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+};
 
-	int i, j;
-	struct gs1AIelement ai;
-	char *p = out;
-	bool fixedPass = true;		// First pass extracts predefined fixed-length AIs
 
-nextPass:
+/*
+ *  Writer for a base64url-encoded bit string that accumulates bits in a
+ *  64-bit word and emits a character for each complete sextet
+ *
+ */
+struct bitWriter {
+	char *out;				// Next output character
+	uint64_t acc;				// Pending bits, right-aligned
+	int nbits;				// Number of bits pending
+};
 
-	for (i = 0; i < ctx->numAIs; i++) {
-		ai = ctx->aiData[i];
+// Callers write at most 32 bits at a time, so at most 37 bits are pending
+static void writeBits(struct bitWriter *bw, uint32_t v, int n) {
 
-		if (fixedFirst && !(fixedPass ^ ai.fnc1))
-			continue;
+	bw->acc = (bw->acc << n) | v;
+	bw->nbits += n;
+	while (bw->nbits >= 6) {
+		bw->nbits -= 6;
+		*bw->out++ = b64urlAlphabet[(bw->acc >> bw->nbits) & 0x3F];
+	}
 
-		p += sprintf(p, "(%.*s)", ai.ailen, ai.ai);
-		for (j = 0; j < ai.vallen; j++) {
-			if (ai.value[j] == '(')	 // Escape data "("
-				*p++ = '\\';
-			*p++ = ai.value[j];
+}
+
+// Zero-pad to a character boundary and terminate
+static void flushBits(struct bitWriter *bw) {
+	if (bw->nbits)
+		writeBits(bw, 0, 6 - bw->nbits);
+	*bw->out = '\0';
+}
+
+
+/*
+ *  Write an n-digit numeric value as a binary integer, the inverse of
+ *  readNumeric
+ *
+ */
+static void writeNumeric(struct bitWriter *bw, const char *in, size_t n) {
+
+	int bits = numBits[n], k;
+	uint32_t limbs[COMP_MAX_LIMBS] = { 0 };
+	uint64_t v = 0, t;
+	size_t i;
+	int l;
+
+	if (n <= 19) {
+		for (i = 0; i < n; i++)
+			v = v * 10 + (uint64_t)(in[i] - '0');
+		if (bits > 32) {
+			writeBits(bw, (uint32_t)(v >> 32), bits - 32);
+			bits = 32;
 		}
+		writeBits(bw, (uint32_t)v, bits);
+		return;
 	}
 
-	if (fixedFirst && fixedPass) {
-		fixedPass = false;
-		goto nextPass;
+	for (i = 0; i < n; i++) {
+		t = (uint64_t)(in[i] - '0');
+		for (l = 0; l < COMP_MAX_LIMBS; l++) {
+			t += (uint64_t)limbs[l] * 10;
+			limbs[l] = (uint32_t)t;
+			t >>= 32;
+		}
 	}
 
-	*p = '\0';
-
-	return;
+	for (; bits > 0; bits -= k) {
+		k = bits % 32 ? bits % 32 : 32;
+		writeBits(bw, limbs[(bits-1)/32] & (uint32_t)((UINT64_C(1) << k) - 1), k);
+	}
 
 }
 
 
-void gs1_writeJSON(struct gs1DLparser *ctx, bool fixedFirst, char *out) {
-
-	int i, j;
-	struct gs1AIelement ai;
-	char *p = out;
-	bool fixedPass = true;		// First pass extracts predefined fixed-length AIs
-
-	*p++ = '{';
+/*
+ *  Write an alphanumeric value using whichever of the encodings available to
+ *  its characters results in the fewest bits
+ *
+ */
+static bool writeAlphanumeric(struct bitWriter *bw, const struct compComponent *c, const char *in, size_t len) {
 
-nextPass:
+	unsigned int cls = 0xFF;
+	uint32_t enc = COMP_ENC_ASCII;
+	int best = 7 * (int)len;
+	size_t i;
 
-	for (i = 0; i < ctx->numAIs; i++) {
-		ai = ctx->aiData[i];
+	for (i = 0; i < len; i++)
+		cls &= compCharClasses[(unsigned char)in[i]];
 
-		if (fixedFirst && !(fixedPass ^ ai.fnc1))
-			continue;
+	if (!(cls & COMP_CLS_ASCII))
+		return false;
 
-		p += sprintf(p, "\"%.*s\":\"", ai.ailen, ai.ai);
-		for (j = 0; j < ai.vallen; j++) {
-			if (ai.value[j] == '\\' || ai.value[j] == '"')		// Escape backslash and double-quote
-				*p++ = '\\';
-			*p++ = ai.value[j];
-		}
-		*p++ = '"';
-		*p++ = ',';
+	if ((cls & COMP_CLS_BASE64URL) && 6 * (int)len < best) {
+		enc = COMP_ENC_BASE64URL;
+		best = 6 * (int)len;
 	}
-
-	if (fixedFirst && fixedPass) {
-		fixedPass = false;
-		goto nextPass;
+	if ((cls & COMP_CLS_HEX_UPPER) && 4 * (int)len < best) {
+		enc = COMP_ENC_HEX_UPPER;
+		best = 4 * (int)len;
+	}
+	if ((cls & COMP_CLS_HEX_LOWER) && 4 * (int)len <= best) {
+		enc = COMP_ENC_HEX_LOWER;
+		best = 4 * (int)len;
+	}
+	if ((cls & COMP_CLS_NUMERIC) && numBits[len] <= best)
+		enc = COMP_ENC_NUMERIC;
+
+	writeBits(bw, enc, 3);
+	writeBits(bw, (uint32_t)len, lengthBits(c->len));
+
+	switch (enc) {
+	case COMP_ENC_NUMERIC:
+		writeNumeric(bw, in, len);
+		break;
+	case COMP_ENC_HEX_LOWER:
+	case COMP_ENC_HEX_UPPER:
+		for (i = 0; i < len; i++)
+			writeBits(bw, (uint32_t)(in[i] <= '9' ? in[i] - '0' : (in[i] | 0x20) - 'a' + 10), 4);
+		break;
+	case COMP_ENC_BASE64URL:
+		for (i = 0; i < len; i++)
+			writeBits(bw, (uint32_t)(b64urlValues[(unsigned char)in[i]] - 1), 6);
+		break;
+	default:
+		for (i = 0; i < len; i++)
+			writeBits(bw, (uint32_t)in[i], 7);
+		break;
 	}
 
-	*--p = '}';	// Gobble last comma
-	*++p = '\0';
+	return true;
 
-	return;
+}
 
+
+bool gs1_parseDLuri(struct gs1DLparser *ctx, char *dlData) {
+	return gs1_parseDLuriEx(ctx, dlData, 0);
 }
 
 
-#ifdef UNIT_TESTS
+/*
+ *  Record a non-AI query parameter, without decoding, if there is space
+ *
+ */
+static void addQueryParam(struct gs1DLparser *ctx, const char *name, size_t namelen, const char *value, size_t vallen) {
 
-#if defined(__clang__)
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wgnu-folding-constant"
-#pragma clang diagnostic ignored "-Wimplicit-int-float-conversion"
-#pragma clang diagnostic ignored "-Wsign-conversion"
-#pragma clang diagnostic ignored "-Wdeclaration-after-statement"
-#elif defined(__GNUC__)
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wconversion"
-#pragma GCC diagnostic ignored "-Wsign-conversion"
-#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
-#endif
-#include "acutest.h"
-#if defined(__clang__)
-#pragma clang diagnostic pop
-#elif defined(__GNUC__)
-#pragma GCC diagnostic pop
-#endif
+	struct gs1DLqueryParam *qp;
 
+	if (ctx->numQueryParams >= GS1_DL_MAX_QUERY_PARAMS)
+		return;
 
-static void test_parseDLuri(struct gs1DLparser *ctx, bool should_succeed, const char *dlData,
-			    const char* expect_unbracketed_unsorted,
-			    const char* expect_unbracketed_ExtraFNC1_unsorted,
-			    const char* expect_bracketed_unsorted,
-			    const char* expect_JSON_unsorted,
-			    const char* expect_unbracketed_sorted,
-			    const char* expect_unbracketed_ExtraFNC1_sorted,
-			    const char* expect_bracketed_sorted,
-			    const char* expect_JSON_sorted) {
+	qp = &ctx->queryParams[ctx->numQueryParams++];
+	qp->name = name;
+	qp->namelen = namelen;
+	qp->value = value;
+	qp->vallen = vallen;
 
-	char in[256];
-	char out[256];
-	char casename[256];
+}
 
-	sprintf(casename, "%s", dlData);
-	TEST_CASE(casename);
 
-	strcpy(in, dlData);
+bool gs1_parseDLuriEx(struct gs1DLparser *ctx, char *dlData, unsigned int options) {
 
-	TEST_CHECK(gs1_parseDLuri(ctx, in) ^ (!should_succeed));
-	TEST_MSG("Err: %s", ctx->err);
+	char *p, *r, *e, *ai;
+	char *pi = NULL;			// Path info
+	char *qp = NULL;			// Query params
+	char *fr = NULL;			// Fragment
+	char *dp = NULL;			// DL path info
+	bool ret;
+	size_t i;
+	size_t ailen, vallen;
+	char aival[GS1_DL_MAX_AI_LEN+1];	// Unescaped AI value
 
-	TEST_CHECK(strcmp(dlData, in) == 0);
-	TEST_MSG("Input data was erroneously clobbered: %s", in);
+	ctx->numAIs = 0;
+	ctx->numQueryParams = 0;
+	memset(&ctx->uriParts, 0, sizeof(ctx->uriParts));
+	*ctx->aiBuf = '\0';
+	*ctx->err = '\0';
 
-	if (!should_succeed)
-		return;
+	DEBUG_PRINT("\nParsing DL data: %s\n", dlData);
 
-	gs1_writeUnbracketedAIelementString(ctx, false, false, out);
-	TEST_CHECK(strcmp(out, expect_unbracketed_unsorted) == 0);
-	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_unbracketed_unsorted, ctx->err);
+	p = dlData;
 
-	gs1_writeUnbracketedAIelementString(ctx, false, true, out);
-	TEST_CHECK(strcmp(out, expect_unbracketed_ExtraFNC1_unsorted) == 0);
-	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_unbracketed_ExtraFNC1_unsorted, ctx->err);
+	if (strspn(p, uriCharacters) != strlen(p)) {
+		strcpy(ctx->err, "URI contains illegal characters");
+		goto fail;
+	}
 
-	gs1_writeBracketedAIelementString(ctx, false, out);
-	TEST_CHECK(strcmp(out, expect_bracketed_unsorted) == 0);
-	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_bracketed_unsorted, ctx->err);
+	if (strlen(p) >= 8 && strncmp(p, "https://", 8) == 0)
+		p += 8;
+	else if (strlen(p) >= 7 && strncmp(p, "http://", 7) == 0)
+		p += 7;
+	else {
+		strcpy(ctx->err, "Scheme must be http:// or https://");
+		goto fail;
+	}
 
-	gs1_writeJSON(ctx, false, out);
-	TEST_CHECK(strcmp(out, expect_JSON_unsorted) == 0);
-	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_JSON_unsorted, ctx->err);
+	DEBUG_PRINT("  Scheme %.*s\n", (int)(p-dlData-3), dlData);
 
-	gs1_writeUnbracketedAIelementString(ctx, true, false, out);
-	TEST_CHECK(strcmp(out, expect_unbracketed_sorted) == 0);
-	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_unbracketed_sorted, ctx->err);
+	ctx->uriParts.scheme.offset = 0;
+	ctx->uriParts.scheme.len = (size_t)(p-dlData-3);
 
-	gs1_writeUnbracketedAIelementString(ctx, true, true, out);
-	TEST_CHECK(strcmp(out, expect_unbracketed_ExtraFNC1_sorted) == 0);
-	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_unbracketed_ExtraFNC1_sorted, ctx->err);
+	if (((r = strchr(p, '/')) == NULL) || r-p < 1) {
+		strcpy(ctx->err, "URI must contain a domain and path info");
+		goto fail;
+	}
 
-	gs1_writeBracketedAIelementString(ctx, true, out);
-	TEST_CHECK(strcmp(out, expect_bracketed_sorted) == 0);
-	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_bracketed_sorted, ctx->err);
+	DEBUG_PRINT("  Domain: %.*s\n", (int)(r-p), p);
 
-	gs1_writeJSON(ctx, true, out);
-	TEST_CHECK(strcmp(out, expect_JSON_sorted) == 0);
-	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_JSON_sorted, ctx->err);
+	ctx->uriParts.domain.offset = (size_t)(p-dlData);
+	ctx->uriParts.domain.len = (size_t)(r-p);
 
-}
+	pi = p = r;					// Skip the domain name
 
-static void test_dl_parseDLuri(void) {
+	// Fragment character delimits end of data
+	if ((fr = strchr(pi, '#')) != NULL) {
+		*fr++ = '\0';
+		ctx->uriParts.fragment.offset = (size_t)(fr-dlData);
+		ctx->uriParts.fragment.len = strlen(fr);
+	}
 
-	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	// Query parameter marker delimits end of path info
+	if ((qp = strchr(pi, '?')) != NULL)
+		*qp++ = '\0';
 
-	/*
-	 *  Order of expected output params:
+	DEBUG_PRINT("  Path info: %s\n", pi);
+	DEBUG_PRINT("    Searching path info backwards for Digital Link primary key\n");
+
+	// Search backwards from the end of the path info looking for an
+	// "/AI/value" pair where AI is a DL primary key
+	while ((r = strrchr(pi, '/')) != NULL) {
+
+		*p = '/';				// Restore original pair separator
+							// Clobbers first character of path
+							// info on first iteration
+
+		// Find start of AI
+		*r = '\0';				// Chop off value
+		p = strrchr(pi, '/'); 			// Beginning of AI
+		*r = '/';				// Restore original AI/value separator
+		if (!p)					// At beginning of path
+			break;
+
+		DEBUG_PRINT("      %s\n", p);
+
+		ailen = (size_t)(r-p-1);
+		if (ailen < 2 || ailen > 4 || !allDigits(p+1, ailen)) {
+			DEBUG_PRINT("        Stopping. (%.*s) is not a valid form for an AI.\n", (int)ailen, p+1);
+			break;
+		}
+
+		if (isDLpkey(p+1, ailen)) {		// Found root of DL path info
+			dp = p;
+			break;
+		}
+
+		*p = '\0';
+
+	}
+
+	if (dp) {
+
+		DEBUG_PRINT("  Stem: %.*s\n", (int)(dp-dlData), dlData);
+
+		r = dp;
+
+		DEBUG_PRINT("  Processing DL path info part: %s\n", dp);
+
+	} else {
+
+		// Otherwise the final path component may carry compressed AI data
+		r = strrchr(pi, '/');
+
+		DEBUG_PRINT("    Attempting decompression of final path component: %s\n", r ? r+1 : "");
+
+		if (!r || !decompressDLpath(ctx, r+1, strlen(r+1))) {
+			strcpy(ctx->err, "No GS1 DL keys found in path info");
+			goto fail;
+		}
+
+		DEBUG_PRINT("  Stem: %.*s\n", (int)(r-dlData), dlData);
+
+	}
+
+	// Stem lies between the domain and the AI data, without separating "/"
+	ctx->uriParts.stem.offset = (size_t)(pi+1-dlData);
+	ctx->uriParts.stem.len = r > pi ? (size_t)(r-pi-1) : 0;
+
+	// Process each AI value pair in the DL path info
+	p = dp;
+	while (p && *p) {
+		p++;
+		r = strchr(p, '/');
+
+		// AI is known to be valid since we previously walked over it
+		ai = p;
+		ailen = (size_t)(r-p);
+
+		if ((p = strchr(++r, '/')) == NULL)
+			p = r + strlen(r);
+
+		if (p == r) {
+			snprintf(ctx->err, sizeof(ctx->err), "AI (%.*s) value path element is empty", (int)ailen, ai);
+			goto fail;
+		}
+
+		// Reverse percent encoding
+		if ((vallen = URIunescape(aival, GS1_DL_MAX_AI_LEN, r, (size_t)(p-r), false)) == 0) {
+			sprintf(ctx->err, "Decoded AI (%.*s) from DL path info too long", (int)ailen, ai);
+			goto fail;
+		}
+
+		// Special handling of AI (01) to pad up to a GTIN-14
+		if (ailen == 2 && strncmp(ai, "01", 2) == 0 &&
+		    (vallen == 13 || vallen == 12 || vallen == 8)) {
+			for (i = 0; i <= 13; i++)
+				aival[13-i] = vallen >= i+1 ? aival[vallen-i-1] : '0';
+			aival[14] = '\0';
+			vallen = 14;
+		}
+
+		DEBUG_PRINT("    Extracted: (%.*s) %.*s\n", (int)ailen, ai, (int)vallen, aival);
+
+		if (!addAIelement(ctx, ai, ailen, aival, vallen))
+			goto fail;
+	}
+
+	if (qp) {
+		DEBUG_PRINT("  Processing query params: %s\n", qp);
+	}
+
+	p = qp;
+	while (p && *p) {
+
+		while (*p == '&')				// Jump any & separators
+			p++;
+		if ((r = strchr(p, '&')) == NULL)
+			r = p + strlen(p);			// Value-pair finishes at end of data
+
+		// Discard parameters with no value
+		if ((e = memchr(p, '=', (size_t)(r-p))) == NULL) {
+			DEBUG_PRINT("    Skipped singleton:   %.*s\n", (int)(r-p), p);
+			if ((options & GS1_DL_PARSE_QUERY_PARAMS) && r > p && !allDigits(p, (size_t)(r-p)))
+				addQueryParam(ctx, p, (size_t)(r-p), NULL, 0);
+			p = r;
+			continue;
+		}
+
+		// Numeric-only query parameters not matching valid form of an AI aren't permitted
+		ai = p;
+		ailen = (size_t)(e-p);
+		if (allDigits(p, ailen)) {
+			if (ailen < 2 || ailen > 4) {
+				sprintf(ctx->err, "Stopping. Numeric query parameter that is not a valid AI is illegal: %.*s...",
+					(ailen<10?(int)ailen:10), p);
+				goto fail;
+			}
+		} else {
+			// Skip non-numeric query parameters
+			DEBUG_PRINT("    Skipped:   %.*s\n", (int)(r-p), p);
+			if (options & GS1_DL_PARSE_QUERY_PARAMS)
+				addQueryParam(ctx, p, ailen, e+1, (size_t)(r-e-1));
+			p = r;
+			continue;
+		}
+
+		e++;
+		if (r == e) {
+			snprintf(ctx->err, sizeof(ctx->err), "AI (%.*s) value query element is empty", (int)ailen, ai);
+			goto fail;
+		}
+
+		// Reverse percent encoding
+		if ((vallen = URIunescape(aival, GS1_DL_MAX_AI_LEN, e, (size_t)(r-e), true)) == 0) {
+			sprintf(ctx->err, "Decoded AI (%.*s) value from DL query params too long", (int)ailen, ai);
+			goto fail;
+		}
+
+		// Special handling of AI (01) to pad up to a GTIN-14
+		if (ailen == 2 && strncmp(ai, "01", 2) == 0 &&
+		    (vallen == 13 || vallen == 12 || vallen == 8)) {
+			for (i = 0; i <= 13; i++)
+				aival[13-i] = vallen >= i+1 ? aival[vallen-i-1] : '0';
+			aival[14] = '\0';
+			vallen = 14;
+		}
+
+		DEBUG_PRINT("    Extracted: (%.*s) %.*s\n", (int)ailen, ai, (int)vallen, aival);
+
+		if (!addAIelement(ctx, ai, ailen, aival, vallen))
+			goto fail;
+		ctx->aiData[ctx->numAIs - 1].inQuery = true;
+
+		p = r;
+
+	}
+
+	if (fr) {
+		DEBUG_PRINT("  Fragment: %s\n", fr);
+	}
+
+	DEBUG_PRINT("Parsing DL data successful\n\n");
+
+	ret = true;
+
+out:
+
+	if (qp)			// Restore original query parameter delimiter
+		*(qp-1) = '?';
+
+	if (fr)			// Restore original fragment delimiter
+		*(fr-1) = '#';
+
+	return ret;
+
+fail:
+
+	if (*ctx->err == '\0')
+		strcpy(ctx->err, "Failed to parse DL data");
+
+	DEBUG_PRINT("Parsing DL data failed: %s\n", ctx->err);
+
+	ctx->numAIs = 0;
+	ctx->numQueryParams = 0;
+	memset(&ctx->uriParts, 0, sizeof(ctx->uriParts));
+	ret = false;
+	goto out;
+
+}
+
+
+
+size_t gs1_decodeQueryParam(const char *in, size_t inlen, char *out) {
+	return URIunescape(out, inlen, in, inlen, true);
+}
+
+bool gs1_parseUnbracketedAIelementString(struct gs1DLparser *ctx, const char *data) {
+
+	const char *p, *r, *ai;
+	const char *end = data + strlen(data);
+	size_t ailen, vallen;
+
+	ctx->numAIs = 0;
+	ctx->numQueryParams = 0;
+	memset(&ctx->uriParts, 0, sizeof(ctx->uriParts));
+	*ctx->aiBuf = '\0';
+	*ctx->err = '\0';
+
+	DEBUG_PRINT("\nParsing unbracketed element string: %s\n", data);
+
+	p = data;
+	if (*p++ != '^') {
+		strcpy(ctx->err, "Element string must begin with FNC1 (\"^\")");
+		goto fail;
+	}
+
+	while (p < end) {
+
+		// The first two digits determine the length of the AI
+		ai = p;
+		if (end - p < 2 || !allDigits(p, 2) || (ailen = getAIlength(p)) == 0 ||
+		    (size_t)(end - p) < ailen || !allDigits(p, ailen)) {
+			snprintf(ctx->err, sizeof(ctx->err), "Unrecognised AI at: %.*s...", (end-p<4?(int)(end-p):4), p);
+			goto fail;
+		}
+		p += ailen;
+
+		// Predefined fixed-length AIs are not terminated by FNC1
+		if ((vallen = (size_t)fixedAIvalueLength(ai)) != 0) {
+			if ((size_t)(end - p) < vallen) {
+				snprintf(ctx->err, sizeof(ctx->err), "AI (%.*s) value is too short", (int)ailen, ai);
+				goto fail;
+			}
+			r = p + vallen;
+		} else {
+			if ((r = memchr(p, '^', (size_t)(end - p))) == NULL)
+				r = end;
+			vallen = (size_t)(r - p);
+		}
+
+		if (vallen == 0) {
+			snprintf(ctx->err, sizeof(ctx->err), "AI (%.*s) value is empty", (int)ailen, ai);
+			goto fail;
+		}
+
+		if (vallen > GS1_DL_MAX_AI_LEN) {
+			snprintf(ctx->err, sizeof(ctx->err), "AI (%.*s) value is too long", (int)ailen, ai);
+			goto fail;
+		}
+
+		DEBUG_PRINT("  Extracted: (%.*s) %.*s\n", (int)ailen, ai, (int)vallen, p);
+
+		if (!addAIelement(ctx, ai, ailen, p, vallen))
+			goto fail;
+
+		p = r;
+		if (*p == '^')				// Separator, required or otherwise
+			p++;
+
+	}
+
+	if (ctx->numAIs == 0) {
+		strcpy(ctx->err, "No AIs found in element string");
+		goto fail;
+	}
+
+	DEBUG_PRINT("Parsing unbracketed element string successful\n\n");
+
+	return true;
+
+fail:
+
+	if (*ctx->err == '\0')
+		strcpy(ctx->err, "Failed to parse unbracketed element string");
+
+	DEBUG_PRINT("Parsing unbracketed element string failed: %s\n", ctx->err);
+
+	ctx->numAIs = 0;
+	return false;
+
+}
+
+
+bool gs1_parseBracketedAIelementString(struct gs1DLparser *ctx, const char *data) {
+
+	const char *p, *r, *ai;
+	size_t ailen, vallen;
+	char aival[GS1_DL_MAX_AI_LEN+1];	// Unescaped AI value
+
+	ctx->numAIs = 0;
+	ctx->numQueryParams = 0;
+	memset(&ctx->uriParts, 0, sizeof(ctx->uriParts));
+	*ctx->aiBuf = '\0';
+	*ctx->err = '\0';
+
+	DEBUG_PRINT("\nParsing bracketed element string: %s\n", data);
+
+	p = data;
+	if (*p != '(') {
+		strcpy(ctx->err, "Bracketed element string must begin with \"(\"");
+		goto fail;
+	}
+
+	while (*p) {
+
+		// At "(" of the next AI
+		ai = ++p;
+		if ((r = strchr(p, ')')) == NULL) {
+			strcpy(ctx->err, "Unterminated AI in bracketed element string");
+			goto fail;
+		}
+		ailen = (size_t)(r - p);
+		if (ailen < 2 || ailen > 4 || !allDigits(ai, ailen)) {
+			snprintf(ctx->err, sizeof(ctx->err), "Invalid AI: (%.*s)", (ailen<10?(int)ailen:10), ai);
+			goto fail;
+		}
+		p = r + 1;
+
+		// Value runs until the next unescaped "("
+		for (vallen = 0; *p && *p != '('; p++) {
+			if (*p == '\\' && *(p+1) == '(')
+				p++;
+			if (vallen == GS1_DL_MAX_AI_LEN) {
+				snprintf(ctx->err, sizeof(ctx->err), "AI (%.*s) value is too long", (int)ailen, ai);
+				goto fail;
+			}
+			aival[vallen++] = *p;
+		}
+
+		if (vallen == 0) {
+			snprintf(ctx->err, sizeof(ctx->err), "AI (%.*s) value is empty", (int)ailen, ai);
+			goto fail;
+		}
+
+		DEBUG_PRINT("  Extracted: (%.*s) %.*s\n", (int)ailen, ai, (int)vallen, aival);
+
+		if (!addAIelement(ctx, ai, ailen, aival, vallen))
+			goto fail;
+
+	}
+
+	DEBUG_PRINT("Parsing bracketed element string successful\n\n");
+
+	return true;
+
+fail:
+
+	if (*ctx->err == '\0')
+		strcpy(ctx->err, "Failed to parse bracketed element string");
+
+	DEBUG_PRINT("Parsing bracketed element string failed: %s\n", ctx->err);
+
+	ctx->numAIs = 0;
+	return false;
+
+}
+
+
+/*
+ *  Skip JSON whitespace
+ *
+ */
+static const char* skipJSONwhitespace(const char *p) {
+	while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+		p++;
+	return p;
+}
+
+
+/*
+ *  Decode the JSON string whose opening quote is at *pp into out, advancing
+ *  *pp beyond the closing quote. Runs of unescaped characters are copied in
+ *  bulk.
+ *
+ *  Escaped code points are written as UTF-8. Unescaped control characters
+ *  are accepted since gs1_writeJSON() does not escape them. NUL is rejected.
+ *
+ */
+static bool JSONunescape(const char **pp, char *out, size_t maxlen, size_t *outlen) {
+
+	const char *p = *pp + 1;
+	size_t j = 0, n;
+	unsigned long cp, lo;
+	char hex[5] = { 0 };
+
+	for (;;) {
+
+		n = strcspn(p, "\"\\");
+		if (j + n > maxlen)
+			return false;
+		memcpy(out + j, p, n);
+		j += n;
+		p += n;
+
+		if (*p == '"')
+			break;
+		if (*p == '\0')
+			return false;			// Unterminated
+
+		// At a backslash
+		p++;
+		if (*p == 'u') {
+			if (strspn(p+1, "0123456789abcdefABCDEF") < 4)
+				return false;
+			memcpy(hex, p+1, 4);
+			cp = strtoul(hex, NULL, 16);
+			p += 5;
+			if (cp >= 0xD800 && cp <= 0xDBFF) {	// Surrogate pair
+				if (*p != '\\' || *(p+1) != 'u')
+					return false;
+				if (strspn(p+2, "0123456789abcdefABCDEF") < 4)
+					return false;
+				memcpy(hex, p+2, 4);
+				lo = strtoul(hex, NULL, 16);
+				if (lo < 0xDC00 || lo > 0xDFFF)
+					return false;
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+				p += 6;
+			} else if (cp >= 0xDC00 && cp <= 0xDFFF)
+				return false;
+			if (cp == 0)
+				return false;
+			n = cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+			if (j + n > maxlen)
+				return false;
+			switch (n) {
+			case 1:
+				out[j++] = (char)cp;
+				break;
+			case 2:
+				out[j++] = (char)(0xC0 | (cp >> 6));
+				out[j++] = (char)(0x80 | (cp & 0x3F));
+				break;
+			case 3:
+				out[j++] = (char)(0xE0 | (cp >> 12));
+				out[j++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+				out[j++] = (char)(0x80 | (cp & 0x3F));
+				break;
+			default:
+				out[j++] = (char)(0xF0 | (cp >> 18));
+				out[j++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+				out[j++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+				out[j++] = (char)(0x80 | (cp & 0x3F));
+				break;
+			}
+			continue;
+		}
+
+		if (j + 1 > maxlen)
+			return false;
+		switch (*p) {
+		case '"':  out[j++] = '"';  break;
+		case '\\': out[j++] = '\\'; break;
+		case '/':  out[j++] = '/';  break;
+		case 'b':  out[j++] = '\b'; break;
+		case 'f':  out[j++] = '\f'; break;
+		case 'n':  out[j++] = '\n'; break;
+		case 'r':  out[j++] = '\r'; break;
+		case 't':  out[j++] = '\t'; break;
+		default:
+			return false;
+		}
+		p++;
+
+	}
+
+	out[j] = '\0';
+	*outlen = j;
+	*pp = p + 1;
+
+	return true;
+
+}
+
+
+bool gs1_parseJSON(struct gs1DLparser *ctx, const char *json) {
+
+	const char *p = json;
+	char ai[5];
+	char aival[GS1_DL_MAX_AI_LEN+1];	// Unescaped AI value
+	size_t ailen, vallen;
+
+	ctx->numAIs = 0;
+	ctx->numQueryParams = 0;
+	memset(&ctx->uriParts, 0, sizeof(ctx->uriParts));
+	*ctx->aiBuf = '\0';
+	*ctx->err = '\0';
+
+	DEBUG_PRINT("\nParsing JSON: %s\n", json);
+
+	p = skipJSONwhitespace(p);
+	if (*p++ != '{') {
+		strcpy(ctx->err, "JSON data must be an object");
+		goto fail;
+	}
+
+	p = skipJSONwhitespace(p);
+	if (*p == '}') {
+		strcpy(ctx->err, "No AIs found in JSON object");
+		goto fail;
+	}
+
+	for (;;) {
+
+		if (*p != '"' || !JSONunescape(&p, ai, 4, &ailen) || ailen < 2 || !allDigits(ai, ailen)) {
+			strcpy(ctx->err, "JSON object key is not a valid AI");
+			goto fail;
+		}
+
+		p = skipJSONwhitespace(p);
+		if (*p++ != ':') {
+			snprintf(ctx->err, sizeof(ctx->err), "Expected \":\" after AI (%.*s) key", (int)ailen, ai);
+			goto fail;
+		}
+
+		p = skipJSONwhitespace(p);
+		if (*p != '"' || !JSONunescape(&p, aival, GS1_DL_MAX_AI_LEN, &vallen)) {
+			snprintf(ctx->err, sizeof(ctx->err), "AI (%.*s) value is not a valid string or is too long", (int)ailen, ai);
+			goto fail;
+		}
+
+		if (vallen == 0) {
+			snprintf(ctx->err, sizeof(ctx->err), "AI (%.*s) value is empty", (int)ailen, ai);
+			goto fail;
+		}
+
+		DEBUG_PRINT("  Extracted: (%.*s) %.*s\n", (int)ailen, ai, (int)vallen, aival);
+
+		if (!addAIelement(ctx, ai, ailen, aival, vallen))
+			goto fail;
+
+		p = skipJSONwhitespace(p);
+		if (*p == '}')
+			break;
+		if (*p++ != ',') {
+			strcpy(ctx->err, "Expected \",\" or \"}\" in JSON object");
+			goto fail;
+		}
+		p = skipJSONwhitespace(p);
+
+	}
+
+	p = skipJSONwhitespace(p + 1);
+	if (*p) {
+		strcpy(ctx->err, "Unexpected data after JSON object");
+		goto fail;
+	}
+
+	DEBUG_PRINT("Parsing JSON successful\n\n");
+
+	return true;
+
+fail:
+
+	if (*ctx->err == '\0')
+		strcpy(ctx->err, "Failed to parse JSON");
+
+	DEBUG_PRINT("Parsing JSON failed: %s\n", ctx->err);
+
+	ctx->numAIs = 0;
+	return false;
+
+}
+
+
+/*
+ *  Write an unbracketed element string with the given FNC1 character,
+ *  optionally replacing the leading FNC1 with a symbology identifier.
+ *  Returns the length of the output, or zero if it does not fit within
+ *  maxlen bytes including a terminating NUL.
+ *
+ *  Separators are written ahead of the AI that follows them so that there is
+ *  no trailing FNC1 to remove.
+ *
+ */
+static size_t writeUnbracketed(struct gs1DLparser *ctx, bool fixedFirst, bool extraFNC1,
+			       char fnc1, const char *symId, char *out, size_t maxlen) {
+
+	int i;
+	size_t n;
+	struct gs1AIelement ai;
+	char *p = out;
+	const char *end = out + maxlen - 1;	// Reserve space for the terminator
+	bool fixedPass = true;		// First pass extracts predefined fixed-length AIs
+	bool sep = false;		// Whether a separator is due before the next AI
+
+	if (maxlen == 0)
+		return 0;
+
+	if (ctx->numAIs == 0)
+		goto done;
+
+	n = symId ? strlen(symId) : 1;
+	if ((size_t)(end - p) < n)
+		goto overflow;
+	if (symId)
+		memcpy(p, symId, n);
+	else
+		*p = fnc1;
+	p += n;
+
+nextPass:
+
+	for (i = 0; i < ctx->numAIs; i++) {
+		ai = ctx->aiData[i];
+
+		if (fixedFirst && !(fixedPass ^ ai.fnc1))
+			continue;
+
+		if (end - p < sep + ai.ailen + ai.vallen)
+			goto overflow;
+
+		if (sep)
+			*p++ = fnc1;
+		memcpy(p, ai.ai, (size_t)ai.ailen);
+		p += ai.ailen;
+		memcpy(p, ai.value, (size_t)ai.vallen);
+		p += ai.vallen;
+
+		sep = extraFNC1 || ai.fnc1;
+	}
+
+	if (fixedFirst && fixedPass) {
+		fixedPass = false;
+		goto nextPass;
+	}
+
+done:
+
+	*p = '\0';
+
+	return (size_t)(p - out);
+
+overflow:
+
+	*out = '\0';
+
+	return 0;
+
+}
+
+
+void gs1_writeUnbracketedAIelementString(struct gs1DLparser *ctx, bool fixedFirst, bool extraFNC1, char *out) {
+	writeUnbracketed(ctx, fixedFirst, extraFNC1, '^', NULL, out, GS1_DL_MAX_OUT_UNBR);
+}
+
+
+size_t gs1_writeBarcodeAIelementString(struct gs1DLparser *ctx, bool fixedFirst, bool extraFNC1,
+				       char fnc1, const char *symId, char *out, size_t maxlen) {
+	return writeUnbracketed(ctx, fixedFirst, extraFNC1, fnc1, symId, out, maxlen);
+}
+
+
+void gs1_writeBracketedAIelementString(struct gs1DLparser *ctx, bool fixedFirst, char *out) {
+
+	int i, j;
+	struct gs1AIelement ai;
+	char *p = out;
+	bool fixedPass = true;		// First pass extracts predefined fixed-length AIs
+
+nextPass:
+
+	for (i = 0; i < ctx->numAIs; i++) {
+		ai = ctx->aiData[i];
+
+		if (fixedFirst && !(fixedPass ^ ai.fnc1))
+			continue;
+
+		p += sprintf(p, "(%.*s)", ai.ailen, ai.ai);
+		for (j = 0; j < ai.vallen; j++) {
+			if (ai.value[j] == '(')	 // Escape data "("
+				*p++ = '\\';
+			*p++ = ai.value[j];
+		}
+	}
+
+	if (fixedFirst && fixedPass) {
+		fixedPass = false;
+		goto nextPass;
+	}
+
+	*p = '\0';
+
+	return;
+
+}
+
+
+void gs1_writeJSON(struct gs1DLparser *ctx, bool fixedFirst, char *out) {
+
+	int i, j;
+	struct gs1AIelement ai;
+	char *p = out;
+	bool fixedPass = true;		// First pass extracts predefined fixed-length AIs
+
+	*p++ = '{';
+
+nextPass:
+
+	for (i = 0; i < ctx->numAIs; i++) {
+		ai = ctx->aiData[i];
+
+		if (fixedFirst && !(fixedPass ^ ai.fnc1))
+			continue;
+
+		p += sprintf(p, "\"%.*s\":\"", ai.ailen, ai.ai);
+		for (j = 0; j < ai.vallen; j++) {
+			if (ai.value[j] == '\\' || ai.value[j] == '"')		// Escape backslash and double-quote
+				*p++ = '\\';
+			*p++ = ai.value[j];
+		}
+		*p++ = '"';
+		*p++ = ',';
+	}
+
+	if (fixedFirst && fixedPass) {
+		fixedPass = false;
+		goto nextPass;
+	}
+
+	*--p = '}';	// Gobble last comma
+	*++p = '\0';
+
+	return;
+
+}
+
+
+/*
+ *  Data titles for the human readable interpretation, where "n" matches any
+ *  digit
+ *
+ */
+static const struct {
+	const char *ai;
+	const char *title;
+} dataTitles[] = {
+	{ "00", "SSCC" }, { "01", "GTIN" }, { "02", "CONTENT" },
+	{ "10", "BATCH/LOT" }, { "11", "PROD DATE" }, { "12", "DUE DATE" },
+	{ "13", "PACK DATE" }, { "15", "BEST BEFORE or BEST BY" }, { "16", "SELL BY" },
+	{ "17", "USE BY OR EXPIRY" }, { "20", "VARIANT" }, { "21", "SERIAL" },
+	{ "22", "CPV" }, { "235", "TPX" }, { "240", "ADDITIONAL ID" },
+	{ "241", "CUST. PART No." }, { "242", "MTO VARIANT" }, { "243", "PCN" },
+	{ "250", "SECONDARY SERIAL" }, { "251", "REF. TO SOURCE" }, { "253", "GDTI" },
+	{ "254", "GLN EXTENSION COMPONENT" }, { "255", "GCN" }, { "30", "VAR. COUNT" },
+	{ "310n", "NET WEIGHT (kg)" }, { "311n", "LENGTH (m)" }, { "312n", "WIDTH (m)" },
+	{ "313n", "HEIGHT (m)" }, { "314n", "AREA (m2)" }, { "315n", "NET VOLUME (l)" },
+	{ "316n", "NET VOLUME (m3)" }, { "320n", "NET WEIGHT (lb)" }, { "330n", "GROSS WEIGHT (kg)" },
+	{ "37", "COUNT" }, { "390n", "AMOUNT" }, { "391n", "AMOUNT" },
+	{ "392n", "PRICE" }, { "393n", "PRICE" }, { "400", "ORDER NUMBER" },
+	{ "401", "GINC" }, { "402", "GSIN" }, { "403", "ROUTE" },
+	{ "410", "SHIP TO LOC" }, { "411", "BILL TO" }, { "412", "PURCHASE FROM" },
+	{ "413", "SHIP FOR LOC" }, { "414", "LOC No." }, { "415", "PAY TO" },
+	{ "416", "PROD/SERV LOC" }, { "417", "PARTY" }, { "420", "SHIP TO POST" },
+	{ "422", "ORIGIN" }, { "7003", "EXPIRY TIME" }, { "8003", "GRAI" },
+	{ "8004", "GIAI" }, { "8006", "ITIP" }, { "8010", "CPID" },
+	{ "8011", "CPID SERIAL" }, { "8017", "GSRN - PROVIDER" }, { "8018", "GSRN - RECIPIENT" },
+	{ "8020", "REF No." }, { "90", "INTERNAL" }, { "9n", "INTERNAL" },
+};
+
+
+static const char* lookupDataTitle(const char *ai, size_t ailen) {
+	size_t i, j;
+	const char *f;
+	for (i = 0; i < SIZEOF_ARRAY(dataTitles); i++) {
+		f = dataTitles[i].ai;
+		for (j = 0; j < ailen && (f[j] == ai[j] || (f[j] == 'n' && ai[j] >= '0' && ai[j] <= '9')); j++);
+		if (j == ailen && f[j] == '\0')
+			return dataTitles[i].title;
+	}
+	return NULL;
+}
+
+
+size_t gs1_writeHRI(struct gs1DLparser *ctx, bool withDataTitles, char *out, size_t maxlen) {
+
+	int i;
+	size_t n;
+	const char *title;
+	const struct gs1AIelement *ai;
+	char *p = out;
+	const char *end = out + maxlen - 1;		// Reserve space for the terminator
+
+	*ctx->err = '\0';
+
+	if (maxlen == 0)
+		goto overflow;
+
+	for (i = 0; i < ctx->numAIs; i++) {
+		ai = &ctx->aiData[i];
+		title = withDataTitles ? lookupDataTitle(ai->ai, (size_t)ai->ailen) : NULL;
+
+		// "[TITLE ](AI) value", space separated
+		n = (i > 0 ? 1 : 0) + (title ? strlen(title) + 1 : 0) + (size_t)ai->ailen + 3 + (size_t)ai->vallen;
+		if ((size_t)(end - p) < n)
+			goto overflow;
+
+		if (i > 0)
+			*p++ = ' ';
+		if (title) {
+			memcpy(p, title, strlen(title));
+			p += strlen(title);
+			*p++ = ' ';
+		}
+		*p++ = '(';
+		memcpy(p, ai->ai, (size_t)ai->ailen);
+		p += ai->ailen;
+		*p++ = ')';
+		*p++ = ' ';
+		memcpy(p, ai->value, (size_t)ai->vallen);
+		p += ai->vallen;
+	}
+
+	*p = '\0';
+
+	return (size_t)(p - out);
+
+overflow:
+
+	strcpy(ctx->err, "Output buffer is too small");
+
+	if (maxlen)
+		*out = '\0';
+
+	return 0;
+
+}
+
+
+bool gs1_writeCompressedDLpath(struct gs1DLparser *ctx, char *out) {
+
+	int i;
+	size_t j, len, pos;
+	struct gs1AIelement ai;
+	const struct compAIformat *fmt;
+	const struct compComponent *c;
+	struct bitWriter bw = { out, 0, 0 };
+
+	*ctx->err = '\0';
+
+	for (i = 0; i < ctx->numAIs; i++) {
+		ai = ctx->aiData[i];
+
+		if ((fmt = lookupCompAIformat(ai.ai, (size_t)ai.ailen)) == NULL) {
+			snprintf(ctx->err, sizeof(ctx->err), "AI (%.*s) cannot be compressed", ai.ailen, ai.ai);
+			goto fail;
+		}
+
+		for (j = 0; j < (size_t)ai.ailen; j++)
+			writeBits(&bw, (uint32_t)(ai.ai[j] - '0'), 4);
+
+		for (j = 0, pos = 0; j < SIZEOF_ARRAY(fmt->c) && fmt->c[j].type; j++) {
+			c = &fmt->c[j];
+
+			// Fixed-length components take their length; the final
+			// variable-length component takes the remainder, which may
+			// be empty if it follows a fixed-length component
+			len = c->fixed ? c->len : (size_t)ai.vallen - pos;
+			if (pos + len > (size_t)ai.vallen || len > c->len ||
+			    (len == 0 && (j == 0 || !fmt->c[j-1].fixed)))
+				goto badValue;
+
+			if (c->type == 'N') {
+				if (!allDigits(ai.value + pos, len))
+					goto badValue;
+				if (!c->fixed)
+					writeBits(&bw, (uint32_t)len, lengthBits(c->len));
+				writeNumeric(&bw, ai.value + pos, len);
+			} else if (!writeAlphanumeric(&bw, c, ai.value + pos, len))
+				goto badValue;
+
+			pos += len;
+		}
+		if (pos != (size_t)ai.vallen)
+			goto badValue;
+
+	}
+
+	flushBits(&bw);
+
+	return true;
+
+badValue:
+
+	snprintf(ctx->err, sizeof(ctx->err), "AI (%.*s) value cannot be compressed", ai.ailen, ai.ai);
+
+fail:
+
+	*out = '\0';
+	return false;
+
+}
+
+
+/*
+ *  Write an AI element as "/AI/value" for the path info or as "?AI=value" or
+ *  "&AI=value" for the query params. Returns the new output position or
+ *  NULL if the output would exceed end.
+ *
+ */
+static char* writeURIelement(char *p, const char *end, char sep, const struct gs1AIelement *ai, char assign) {
+
+	size_t n;
+
+	if (end - p < ai->ailen + 2)
+		return NULL;
+
+	*p++ = sep;
+	memcpy(p, ai->ai, (size_t)ai->ailen);
+	p += ai->ailen;
+	*p++ = assign;
+
+	if (!URIescape(p, (size_t)(end - p), ai->value, (size_t)ai->vallen, &n))
+		return NULL;
+
+	return p + n;
+
+}
+
+
+size_t gs1_writeDLuri(struct gs1DLparser *ctx, const char *domain, const char *stem, unsigned int options, char *out, size_t maxlen) {
+
+	int i, pk;
+	size_t j, n;
+	char sep;
+	char *p = out;
+	const char *end = out + maxlen - 1;		// Reserve space for the terminator
+	const char* const* quals;
+	bool used[GS1_DL_MAX_AIS] = { false };
+	char comp[GS1_DL_MAX_OUT_COMP];
+
+	*ctx->err = '\0';
+
+	if (maxlen == 0)
+		goto overflow;
+
+	n = strlen(domain);
+	if ((size_t)(end - p) < n + 8)
+		goto overflow;
+	memcpy(p, "https://", 8);
+	memcpy(p + 8, domain, n);
+	p += n + 8;
+
+	if (stem && *stem) {
+		n = strlen(stem);
+		if ((size_t)(end - p) < n + 1)
+			goto overflow;
+		*p++ = '/';
+		memcpy(p, stem, n);
+		p += n;
+	}
+
+	if (options & GS1_DL_URI_COMPRESSED) {
+		if (!gs1_writeCompressedDLpath(ctx, comp))
+			goto fail;
+		n = strlen(comp);
+		if ((size_t)(end - p) < n + 1)
+			goto overflow;
+		*p++ = '/';
+		memcpy(p, comp, n);
+		p += n;
+		goto done;
+	}
+
+	// The first primary key in the AI data roots the path info
+	for (pk = 0; pk < ctx->numAIs; pk++)
+		if (isDLpkey(ctx->aiData[pk].ai, (size_t)ctx->aiData[pk].ailen))
+			break;
+	if (pk == ctx->numAIs) {
+		strcpy(ctx->err, "No GS1 DL primary key in AI data");
+		goto fail;
+	}
+
+	if ((p = writeURIelement(p, end, '/', &ctx->aiData[pk], '/')) == NULL)
+		goto overflow;
+	used[pk] = true;
+
+	// Key qualifiers follow in their predefined order
+	quals = getDLkeyQualifiers(ctx->aiData[pk].ai, (size_t)ctx->aiData[pk].ailen);
+	for (j = 0; quals && j < SIZEOF_ARRAY(dl_keyQualifiers[0].quals) && quals[j]; j++) {
+		for (i = 0; i < ctx->numAIs; i++) {
+			if (used[i] || strlen(quals[j]) != (size_t)ctx->aiData[i].ailen ||
+			    strncmp(quals[j], ctx->aiData[i].ai, (size_t)ctx->aiData[i].ailen) != 0)
+				continue;
+			if ((p = writeURIelement(p, end, '/', &ctx->aiData[i], '/')) == NULL)
+				goto overflow;
+			used[i] = true;
+			break;
+		}
+	}
+
+	// Everything else becomes a query parameter
+	sep = '?';
+	for (i = 0; i < ctx->numAIs; i++) {
+		if (used[i])
+			continue;
+		if ((p = writeURIelement(p, end, sep, &ctx->aiData[i], '=')) == NULL)
+			goto overflow;
+		sep = '&';
+	}
+
+done:
+
+	*p = '\0';
+
+	return (size_t)(p - out);
+
+overflow:
+
+	strcpy(ctx->err, "Output buffer is too small");
+
+fail:
+
+	if (maxlen)
+		*out = '\0';
+
+	return 0;
+
+}
+
+
+/*
+ *  EPC Pure Identity URNs, as defined by the GS1 EPC Tag Data Standard
+ *
+ *  The structure of each EPC scheme depends upon the length of the GS1 Company
+ *  Prefix at the start of its key, which is not derivable from the key itself
+ *  and must be provided by a user-provided lookup.
+ *
+ */
+
+static const struct gs1AIelement* findAIelement(const struct gs1DLparser *ctx, const char *ai) {
+
+	int i;
+	size_t n = strlen(ai);
+
+	for (i = 0; i < ctx->numAIs; i++)
+		if ((size_t)ctx->aiData[i].ailen == n && memcmp(ctx->aiData[i].ai, ai, n) == 0)
+			return &ctx->aiData[i];
+
+	return NULL;
+
+}
+
+
+static bool isAI(const struct gs1AIelement *ai, const char *want) {
+	return strlen(want) == (size_t)ai->ailen && memcmp(ai->ai, want, (size_t)ai->ailen) == 0;
+}
+
+
+/*
+ *  Determine the length of the GS1 Company Prefix at the start of the digits,
+ *  which must leave at least one further character. Returns 0 on failure.
+ *
+ */
+static size_t lookupGCPlength(struct gs1DLparser *ctx, gs1_gcpLengthFunc gcpLength, void *arg,
+			      const char *digits, size_t len, size_t maxgcp) {
+
+	int gcp = gcpLength(arg, digits, len);
+
+	if (gcp <= 0) {
+		strcpy(ctx->err, "GS1 Company Prefix length is unknown");
+		return 0;
+	}
+	if ((size_t)gcp > maxgcp) {
+		strcpy(ctx->err, "GS1 Company Prefix length is invalid for the key");
+		return 0;
+	}
+
+	return (size_t)gcp;
+
+}
+
+
+/*
+ *  Write a key as "GCP.reference", with any leading indicator or extension
+ *  digit moved to the start of the reference and the check digit (at refEnd)
+ *  dropped.
+ *
+ */
+static char* writeEPCscheme(char *p, const char *scheme) {
+
+	size_t n = strlen(scheme);
+
+	memcpy(p, scheme, n);
+
+	return p + n;
+
+}
+
+
+static char* writeEPCkey(char *p, const char *key, bool indicator, size_t refEnd, size_t gcp) {
+
+	size_t off = indicator ? 1 : 0;
+
+	memcpy(p, key + off, gcp);
+	p += gcp;
+	*p++ = '.';
+	if (indicator)
+		*p++ = key[0];
+	memcpy(p, key + off + gcp, refEnd - off - gcp);
+
+	return p + refEnd - off - gcp;
+
+}
+
+
+/*
+ *  Write a URN component, percent-encoding the characters that are reserved
+ *  within an EPC URN as well as any that are not printable ASCII.
+ *
+ */
+static char* writeEPCescaped(char *p, const char *in, size_t len) {
+
+	size_t i;
+	unsigned char c;
+
+	for (i = 0; i < len; i++) {
+		c = (unsigned char)in[i];
+		if (c <= 0x20 || c >= 0x7F || strchr("\"#%&/<>?", c)) {
+			*p++ = '%';
+			*p++ = hexUpper[c >> 4];
+			*p++ = hexUpper[c & 0x0F];
+		} else
+			*p++ = (char)c;
+	}
+
+	return p;
+
+}
+
+
+size_t gs1_writeEPCuri(struct gs1DLparser *ctx, gs1_gcpLengthFunc gcpLength, void *arg, char *out, size_t maxlen) {
+
+	int i;
+	size_t gcp, vlen, n;
+	const char *v;
+	const char *scheme = NULL;
+	const struct gs1AIelement *pk, *ext;
+	char urn[GS1_DL_MAX_OUT_EPC];
+	char *p = urn;
+
+	*ctx->err = '\0';
+
+	if (!gcpLength) {
+		strcpy(ctx->err, "No GCP length lookup function");
+		goto fail;
+	}
+
+	// The first primary key in the AI data determines the EPC scheme
+	for (i = 0; i < ctx->numAIs; i++)
+		if (isDLpkey(ctx->aiData[i].ai, (size_t)ctx->aiData[i].ailen))
+			break;
+	if (i == ctx->numAIs) {
+		strcpy(ctx->err, "No GS1 DL primary key in AI data");
+		goto fail;
+	}
+	pk = &ctx->aiData[i];
+	v = pk->value;
+	vlen = (size_t)pk->vallen;
+
+	if (isAI(pk, "01") || isAI(pk, "8006")) {
+
+		// GTIN or ITIP, qualified to an instance (or a GTIN+lot class)
+		if (vlen != (isAI(pk, "01") ? 14 : 18) || !allDigits(v, vlen))
+			goto badkey;
+		if ((gcp = lookupGCPlength(ctx, gcpLength, arg, v + 1, 13, 12)) == 0)
+			goto fail;
+		ext = findAIelement(ctx, "21");
+		if (isAI(pk, "8006"))
+			scheme = "urn:epc:id:itip:";
+		else if (ext)
+			scheme = "urn:epc:id:sgtin:";
+		else if ((ext = findAIelement(ctx, "235")) != NULL)
+			scheme = "urn:epc:id:upui:";
+		else if ((ext = findAIelement(ctx, "10")) != NULL)
+			scheme = "urn:epc:class:lgtin:";
+		if (!ext) {
+			sprintf(ctx->err, "AI (%.*s) requires a serial number for an EPC", pk->ailen, pk->ai);
+			goto fail;
+		}
+		p = writeEPCscheme(p, scheme);
+		p = writeEPCkey(p, v, true, 13, gcp);
+		if (vlen == 18) {					// ITIP piece and total
+			*p++ = '.';
+			*p++ = v[14];
+			*p++ = v[15];
+			*p++ = '.';
+			*p++ = v[16];
+			*p++ = v[17];
+		}
+		*p++ = '.';
+		p = writeEPCescaped(p, ext->value, (size_t)ext->vallen);
+
+	} else if (isAI(pk, "00")) {
+
+		if (vlen != 18 || !allDigits(v, vlen))
+			goto badkey;
+		if ((gcp = lookupGCPlength(ctx, gcpLength, arg, v + 1, 17, 12)) == 0)
+			goto fail;
+		p = writeEPCscheme(p, "urn:epc:id:sscc:");
+		p = writeEPCkey(p, v, true, 17, gcp);
+
+	} else if (isAI(pk, "414") || isAI(pk, "417")) {
+
+		if (vlen != 13 || !allDigits(v, vlen))
+			goto badkey;
+		if ((gcp = lookupGCPlength(ctx, gcpLength, arg, v, 13, 12)) == 0)
+			goto fail;
+		if (isAI(pk, "417")) {
+			p = writeEPCscheme(p, "urn:epc:id:pgln:");
+			p = writeEPCkey(p, v, false, 12, gcp);
+		} else {
+			p = writeEPCscheme(p, "urn:epc:id:sgln:");
+			p = writeEPCkey(p, v, false, 12, gcp);
+			*p++ = '.';
+			if ((ext = findAIelement(ctx, "254")) != NULL)
+				p = writeEPCescaped(p, ext->value, (size_t)ext->vallen);
+			else
+				*p++ = '0';				// No extension
+		}
+
+	} else if (isAI(pk, "8003")) {
+
+		// GRAI has a leading zero digit, and an EPC requires the serial
+		if (vlen <= 14 || v[0] != '0' || !allDigits(v, 14))
+			goto badkey;
+		if ((gcp = lookupGCPlength(ctx, gcpLength, arg, v + 1, 13, 12)) == 0)
+			goto fail;
+		p = writeEPCscheme(p, "urn:epc:id:grai:");
+		p = writeEPCkey(p, v + 1, false, 12, gcp);
+		*p++ = '.';
+		p = writeEPCescaped(p, v + 14, vlen - 14);
+
+	} else if (isAI(pk, "253") || isAI(pk, "255")) {
+
+		// GDTI or GCN, for which an EPC requires the serial component
+		if (vlen <= 13 || !allDigits(v, 13))
+			goto badkey;
+		if ((gcp = lookupGCPlength(ctx, gcpLength, arg, v, 13, 12)) == 0)
+			goto fail;
+		p = writeEPCscheme(p, isAI(pk, "253") ? "urn:epc:id:gdti:" : "urn:epc:id:sgcn:");
+		p = writeEPCkey(p, v, false, 12, gcp);
+		*p++ = '.';
+		p = writeEPCescaped(p, v + 13, vlen - 13);
+
+	} else if (isAI(pk, "8017") || isAI(pk, "8018") || isAI(pk, "402")) {
+
+		n = isAI(pk, "402") ? 17 : 18;
+		if (vlen != n || !allDigits(v, vlen))
+			goto badkey;
+		if ((gcp = lookupGCPlength(ctx, gcpLength, arg, v, n, 12)) == 0)
+			goto fail;
+		p = writeEPCscheme(p, isAI(pk, "402") ? "urn:epc:id:gsin:" : isAI(pk, "8017") ? "urn:epc:id:gsrnp:" : "urn:epc:id:gsrn:");
+		p = writeEPCkey(p, v, false, n - 1, gcp);
+
+	} else if (isAI(pk, "8004") || isAI(pk, "401") || isAI(pk, "8010")) {
+
+		// Alphanumeric reference following the GCP
+		if (vlen == 0)
+			goto badkey;
+		for (n = 0; n < vlen && n < 12 && v[n] >= '0' && v[n] <= '9'; n++);
+		if ((gcp = lookupGCPlength(ctx, gcpLength, arg, v, n, n < vlen ? n : n - 1)) == 0)
+			goto fail;
+		ext = NULL;
+		if (isAI(pk, "8010") && (ext = findAIelement(ctx, "8011")) == NULL) {
+			strcpy(ctx->err, "AI (8010) requires a serial number for an EPC");
+			goto fail;
+		}
+		p = writeEPCscheme(p, isAI(pk, "8004") ? "urn:epc:id:giai:" : isAI(pk, "401") ? "urn:epc:id:ginc:" : "urn:epc:id:cpi:");
+		memcpy(p, v, gcp);
+		p += gcp;
+		*p++ = '.';
+		p = writeEPCescaped(p, v + gcp, vlen - gcp);
+		if (ext) {
+			*p++ = '.';
+			p = writeEPCescaped(p, ext->value, (size_t)ext->vallen);
+		}
+
+	} else {
+		sprintf(ctx->err, "No EPC scheme for primary key (%.*s)", pk->ailen, pk->ai);
+		goto fail;
+	}
+
+	// urn is sized by GS1_DL_MAX_OUT_EPC for the longest scheme
+	n = (size_t)(p - urn);
+	if (n >= maxlen) {
+		strcpy(ctx->err, "Output buffer is too small");
+		goto fail;
+	}
+	memcpy(out, urn, n);
+	out[n] = '\0';
+
+	return n;
+
+badkey:
+
+	sprintf(ctx->err, "AI (%.*s) value is not a valid key for an EPC", pk->ailen, pk->ai);
+
+fail:
+
+	if (maxlen)
+		*out = '\0';
+
+	return 0;
+
+}
+
+
+size_t gs1_writeEPCuriBatch(struct gs1DLparser *ctxs, size_t count, gs1_gcpLengthFunc gcpLength, void *arg,
+			    char *out, size_t stride, size_t *lens) {
+
+	size_t i, ok = 0;
+
+	for (i = 0; i < count; i++) {
+		lens[i] = gs1_writeEPCuri(&ctxs[i], gcpLength, arg, out + i * stride, stride);
+		if (lens[i])
+			ok++;
+	}
+
+	return ok;
+
+}
+
+
+/*
+ *  GS1 Company Prefix length index
+ *
+ *  The prefixes are flattened into disjoint ranges over the 12-digit space
+ *  that starts each key, so that the most specific prefix wins. The ranges
+ *  are bucketed by their first four digits and each bucket is a sorted run
+ *  of 32-bit entries holding the remaining eight digits of the range start
+ *  shifted left by four bits, ORed with the GCP length. Every bucket opens
+ *  with an entry for its first key so that a lookup never needs to consult
+ *  a neighbouring bucket.
+ *
+ *  Layout, in host byte order:
+ *
+ *    uint32_t magic;
+ *    uint32_t count;
+ *    uint32_t dir[GCP_INDEX_BUCKETS + 1];		// Index of each bucket's first entry
+ *    uint32_t entries[count];
+ *
+ */
+
+#define GCP_INDEX_MAGIC		0x31504347U		// "GCP1" on little-endian hosts
+#define GCP_INDEX_BUCKETS	10000
+#define GCP_INDEX_BUCKET_SPAN	100000000ULL		// Remaining eight digits
+#define GCP_INDEX_HEADER	(2 + GCP_INDEX_BUCKETS + 1)	// uint32_t words before the entries
+
+struct gcpIndexBuilder {
+	uint32_t *buf;
+	size_t cap;					// Capacity in uint32_t words
+	size_t n;					// Entries written or counted
+	uint32_t bucket;				// Next bucket to open
+	unsigned int val;				// Currently active GCP length
+	uint64_t lastEntry;				// Position of the last entry written
+};
+
+
+static uint64_t gcpPrefixStart(const char *prefix) {
+
+	uint64_t v = 0;
+	size_t i, n = strlen(prefix);
+
+	for (i = 0; i < 12; i++)
+		v = v * 10 + (uint64_t)(i < n ? prefix[i] - '0' : 0);
+
+	return v;
+
+}
+
+
+static int cmpGCPprefix(const void *a, const void *b) {
+
+	const struct gs1GCPprefix *x = a, *y = b;
+	uint64_t sx = gcpPrefixStart(x->prefix), sy = gcpPrefixStart(y->prefix);
+	size_t lx = strlen(x->prefix), ly = strlen(y->prefix);
+
+	// Enclosing prefixes sort before those that they contain
+	if (sx != sy)
+		return sx < sy ? -1 : 1;
+	return lx < ly ? -1 : lx > ly ? 1 : 0;
+
+}
+
+
+static void gcpIndexPut(struct gcpIndexBuilder *b, size_t at, uint32_t entry) {
+	if (GCP_INDEX_HEADER + at < b->cap)
+		b->buf[GCP_INDEX_HEADER + at] = entry;
+}
+
+
+/*
+ *  Record that the GCP length val applies from pos onwards. Positions must
+ *  be non-decreasing.
+ *
+ */
+static void gcpIndexEmit(struct gcpIndexBuilder *b, uint64_t pos, unsigned int val) {
+
+	uint32_t bucket = (uint32_t)(pos / GCP_INDEX_BUCKET_SPAN);
+	uint32_t residual = (uint32_t)(pos % GCP_INDEX_BUCKET_SPAN);
+
+	// Open any buckets up to and including that of pos
+	while (b->bucket <= bucket) {
+		if (b->bucket < GCP_INDEX_BUCKETS) {
+			if (b->bucket == bucket && residual == 0)
+				b->val = val;
+			if (2 + b->bucket < b->cap)
+				b->buf[2 + b->bucket] = (uint32_t)b->n;
+			gcpIndexPut(b, b->n++, b->val);
+			b->lastEntry = (uint64_t)b->bucket * GCP_INDEX_BUCKET_SPAN;
+		}
+		b->bucket++;
+	}
+
+	if (val == b->val || bucket >= GCP_INDEX_BUCKETS) {
+		b->val = val;
+		return;
+	}
+
+	if (pos == b->lastEntry)			// Inner range replaces its container
+		b->n--;
+	gcpIndexPut(b, b->n++, residual << 4 | val);
+	b->lastEntry = pos;
+	b->val = val;
+
+}
+
+
+size_t gs1_buildGCPindex(struct gs1GCPprefix *prefixes, size_t count, void *buf, size_t maxlen) {
+
+	size_t i, j, n, sp = 0;
+	uint64_t start, span;
+	struct {
+		uint64_t end;
+		unsigned int val;
+	} stack[12];
+	struct gcpIndexBuilder b = { NULL, 0, 0, 0, 0, (uint64_t)-1 };
+
+	for (i = 0; i < count; i++) {
+		n = strlen(prefixes[i].prefix);
+		if (n < 1 || n > 12 || !allDigits(prefixes[i].prefix, n) ||
+		    prefixes[i].gcpLength < 0 || prefixes[i].gcpLength > 12)
+			return 0;
+	}
+
+	qsort(prefixes, count, sizeof(prefixes[0]), cmpGCPprefix);
+
+	b.buf = buf;
+	b.cap = buf ? maxlen / sizeof(uint32_t) : 0;
+
+	for (i = 0; i < count; i++) {
+
+		if (i > 0 && strcmp(prefixes[i].prefix, prefixes[i-1].prefix) == 0)
+			return 0;				// Duplicate prefix
+
+		start = gcpPrefixStart(prefixes[i].prefix);
+
+		// Leave the ranges that finish before this one
+		while (sp > 0 && stack[sp-1].end <= start) {
+			sp--;
+			gcpIndexEmit(&b, stack[sp].end, sp > 0 ? stack[sp-1].val : 0);
+		}
+
+		// Each enclosing range has a shorter prefix, so at most 12 are open
+		n = strlen(prefixes[i].prefix);
+		for (span = 1, j = n; j < 12; j++)
+			span *= 10;
+		stack[sp].end = start + span;
+		stack[sp].val = (unsigned int)prefixes[i].gcpLength;
+		gcpIndexEmit(&b, start, stack[sp].val);
+		sp++;
+
+	}
+
+	while (sp > 0) {
+		sp--;
+		gcpIndexEmit(&b, stack[sp].end, sp > 0 ? stack[sp-1].val : 0);
+	}
+	gcpIndexEmit(&b, (uint64_t)GCP_INDEX_BUCKETS * GCP_INDEX_BUCKET_SPAN, 0);
+
+	n = GCP_INDEX_HEADER + b.n;
+	if (n <= b.cap) {
+		b.buf[0] = GCP_INDEX_MAGIC;
+		b.buf[1] = (uint32_t)b.n;
+		b.buf[2 + GCP_INDEX_BUCKETS] = (uint32_t)b.n;
+	}
+
+	return n * sizeof(uint32_t);
+
+}
+
+
+bool gs1_loadGCPindex(struct gs1GCPindex *idx, const void *buf, size_t len) {
+
+	const uint32_t *w = buf;
+	size_t i;
+
+	if (((uintptr_t)buf & (sizeof(uint32_t) - 1)) != 0 ||
+	    len < GCP_INDEX_HEADER * sizeof(uint32_t) || w[0] != GCP_INDEX_MAGIC ||
+	    len != (GCP_INDEX_HEADER + (size_t)w[1]) * sizeof(uint32_t))
+		return false;
+
+	// Buckets must be non-empty and within the entries
+	if (w[2] != 0 || w[2 + GCP_INDEX_BUCKETS] != w[1])
+		return false;
+	for (i = 0; i < GCP_INDEX_BUCKETS; i++)
+		if (w[2 + i] >= w[2 + i + 1])
+			return false;
+
+	idx->dir = w + 2;
+	idx->entries = w + GCP_INDEX_HEADER;
+	idx->count = w[1];
+
+	return true;
+
+}
+
+
+int gs1_lookupGCPlength(void *arg, const char *digits, size_t len) {
+
+	static const unsigned char bits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+	const struct gs1GCPindex *idx = arg;
+	uint32_t bucket = 0, key = 0, lo, hi, mid, n;
+	size_t i;
+	char c;
+#ifdef GS1_DL_SSE2
+	__m128i k;
+#endif
+
+	// Digits beyond those provided are taken as zero
+	for (i = 0; i < 12; i++) {
+		c = i < len ? digits[i] : '0';
+		if (c < '0' || c > '9')
+			return 0;
+		if (i < 4)
+			bucket = bucket * 10 + (uint32_t)(c - '0');
+		else
+			key = key * 10 + (uint32_t)(c - '0');
+	}
+	key = key << 4 | 0x0F;					// Sorts after any entry at this key
+
+	// Narrow the bucket to a short run, then count the entries not after the key
+	lo = idx->dir[bucket];
+	hi = idx->dir[bucket + 1];
+	while (hi - lo > 16) {
+		mid = lo + (hi - lo) / 2;
+		if (idx->entries[mid] <= key)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	n = 0;
+#ifdef GS1_DL_SSE2
+	// Entries and key are below 2^31 so signed comparison suffices
+	k = _mm_set1_epi32((int)key);
+	for (; hi - lo - n >= 4; n += 4) {
+		int gt = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(
+				_mm_loadu_si128((const __m128i *)(idx->entries + lo + n)), k)));
+		if (gt != 0) {
+			n += 4 - bits[gt];			// Sorted, so only a suffix is after the key
+			break;
+		}
+	}
+#else
+	(void)bits;
+#endif
+	for (; lo + n < hi && idx->entries[lo + n] <= key; n++);
+
+	if (n == 0)
+		return 0;
+
+	return (int)(idx->entries[lo + n - 1] & 0x0F);
+
+}
+
+
+/*
+ *  EPC binary encodings, as defined by the GS1 EPC Tag Data Standard
+ *
+ *  The bit string is packed most significant bit first into 64-bit words,
+ *  i.e. the EPC header occupies the top byte of the first word.
+ *
+ */
+
+static const struct {
+	unsigned char gcpDigits;
+	unsigned char gcpBits;
+	unsigned char refBits;
+} epcPartitions[2][7] = {
+	{	// SGTIN: Indicator digit and item reference
+		{ 12, 40,  4 }, { 11, 37,  7 }, { 10, 34, 10 }, {  9, 30, 14 },
+		{  8, 27, 17 }, {  7, 24, 20 }, {  6, 20, 24 },
+	},
+	{	// SSCC: Extension digit and serial reference
+		{ 12, 40, 18 }, { 11, 37, 21 }, { 10, 34, 24 }, {  9, 30, 28 },
+		{  8, 27, 31 }, {  7, 24, 34 }, {  6, 20, 38 },
+	},
+};
+
+
+static void putEPCbits(uint64_t *words, size_t *pos, uint64_t v, unsigned int n) {
+
+	size_t w = *pos / 64;
+	unsigned int room = 64 - (unsigned int)(*pos % 64);
+
+	if (n <= room)
+		words[w] |= v << (room - n);
+	else {
+		words[w] |= v >> (n - room);
+		words[w + 1] |= v << (64 - (n - room));
+	}
+	*pos += n;
+
+}
+
+
+static uint64_t getEPCbits(const uint64_t *words, size_t *pos, unsigned int n) {
+
+	size_t w = *pos / 64;
+	unsigned int room = 64 - (unsigned int)(*pos % 64);
+	uint64_t v;
+
+	if (n <= room)
+		v = words[w] >> (room - n);
+	else
+		v = words[w] << (n - room) | words[w + 1] >> (64 - (n - room));
+	*pos += n;
+
+	return n == 64 ? v : v & ((UINT64_C(1) << n) - 1);
+
+}
+
+
+/*
+ *  SGTIN-198 serials are limited to the GS1 AI encodable character set 82
+ *
+ */
+static bool isCSET82(char c) {
+
+	static const char cset82[] =
+		"!\"%&'()*+,-./0123456789:;<=>?ABCDEFGHIJKLMNOPQRSTUVWXYZ_abcdefghijklmnopqrstuvwxyz";
+
+	return c != '\0' && strchr(cset82, c) != NULL;
+
+}
+
+
+static uint64_t digitsToU64(const char *digits, size_t n) {
+
+	uint64_t v = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		v = v * 10 + (uint64_t)(digits[i] - '0');
+
+	return v;
+
+}
+
+
+/*
+ *  Write v as exactly n digits, with leading zeros
+ *
+ */
+static void u64ToDigits(char *out, uint64_t v, size_t n) {
+	while (n--) {
+		out[n] = (char)('0' + v % 10);
+		v /= 10;
+	}
+}
+
+
+/*
+ *  GS1 modulo 10 check digit for the given data digits
+ *
+ */
+static char gs1CheckDigit(const char *digits, size_t n) {
+
+	unsigned int sum = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sum += (unsigned int)(digits[n - 1 - i] - '0') * (i % 2 == 0 ? 3 : 1);
+
+	return (char)('0' + (10 - sum % 10) % 10);
+
+}
+
+
+size_t gs1_writeEPCbinary(struct gs1DLparser *ctx, unsigned int scheme, unsigned int filter,
+			  gs1_gcpLengthFunc gcpLength, void *arg, uint64_t *words, size_t maxwords) {
+
+	const struct gs1AIelement *key, *ser = NULL;
+	const char *keyAI = scheme == GS1_DL_EPC_SSCC_96 ? "00" : "01";
+	size_t bits, keylen, gcp, pos = 0, i;
+	int part;
+	uint64_t ref;
+
+	*ctx->err = '\0';
+
+	if (scheme != GS1_DL_EPC_SGTIN_96 && scheme != GS1_DL_EPC_SGTIN_198 && scheme != GS1_DL_EPC_SSCC_96) {
+		strcpy(ctx->err, "Unsupported EPC binary scheme");
+		return 0;
+	}
+	bits = scheme == GS1_DL_EPC_SGTIN_198 ? 198 : 96;
+	if (maxwords < (bits + 63) / 64) {
+		strcpy(ctx->err, "Output buffer is too small");
+		return 0;
+	}
+	if (filter > 7) {
+		strcpy(ctx->err, "EPC filter value must be 0 to 7");
+		return 0;
+	}
+
+	keylen = scheme == GS1_DL_EPC_SSCC_96 ? 18 : 14;
+	if ((key = findAIelement(ctx, keyAI)) == NULL) {
+		sprintf(ctx->err, "AI (%s) is required for the EPC binary scheme", keyAI);
+		return 0;
+	}
+	if ((size_t)key->vallen != keylen || !allDigits(key->value, keylen)) {
+		sprintf(ctx->err, "AI (%s) value is not a valid key for an EPC", keyAI);
+		return 0;
+	}
+
+	// Partitions provide for GCPs of 6 to 12 digits
+	if ((gcp = lookupGCPlength(ctx, gcpLength, arg, key->value + 1, keylen - 2, 12)) == 0)
+		return 0;
+	if (gcp < 6) {
+		strcpy(ctx->err, "GS1 Company Prefix length is invalid for the key");
+		return 0;
+	}
+	part = 12 - (int)gcp;
+
+	if (scheme != GS1_DL_EPC_SSCC_96) {
+		if ((ser = findAIelement(ctx, "21")) == NULL) {
+			strcpy(ctx->err, "AI (21) is required for the EPC binary scheme");
+			return 0;
+		}
+		if (scheme == GS1_DL_EPC_SGTIN_96) {
+			// Integer serials only, without leading zeros
+			if (ser->vallen < 1 || ser->vallen > 12 || !allDigits(ser->value, (size_t)ser->vallen) ||
+			    (ser->vallen > 1 && ser->value[0] == '0') ||
+			    digitsToU64(ser->value, (size_t)ser->vallen) >= UINT64_C(1) << 38) {
+				strcpy(ctx->err, "AI (21) value cannot be encoded as SGTIN-96");
+				return 0;
+			}
+		} else {
+			if (ser->vallen < 1 || ser->vallen > 20) {
+				strcpy(ctx->err, "AI (21) value cannot be encoded as SGTIN-198");
+				return 0;
+			}
+			for (i = 0; i < (size_t)ser->vallen; i++) {
+				if (!isCSET82(ser->value[i])) {
+					strcpy(ctx->err, "AI (21) value cannot be encoded as SGTIN-198");
+					return 0;
+				}
+			}
+		}
+	}
+
+	// Indicator or extension digit leads the reference; check digit is dropped
+	ref = (uint64_t)(key->value[0] - '0');
+	for (i = 1 + gcp; i < keylen - 1; i++)
+		ref = ref * 10 + (uint64_t)(key->value[i] - '0');
+
+	memset(words, 0, (bits + 63) / 64 * sizeof(uint64_t));
+	putEPCbits(words, &pos, scheme, 8);
+	putEPCbits(words, &pos, filter, 3);
+	putEPCbits(words, &pos, (uint64_t)part, 3);
+	putEPCbits(words, &pos, digitsToU64(key->value + 1, gcp), epcPartitions[scheme == GS1_DL_EPC_SSCC_96][part].gcpBits);
+	putEPCbits(words, &pos, ref, epcPartitions[scheme == GS1_DL_EPC_SSCC_96][part].refBits);
+
+	if (scheme == GS1_DL_EPC_SGTIN_96)
+		putEPCbits(words, &pos, digitsToU64(ser->value, (size_t)ser->vallen), 38);
+	else if (scheme == GS1_DL_EPC_SGTIN_198)
+		for (i = 0; i < (size_t)ser->vallen; i++)		// 7-bit characters, zero padded
+			putEPCbits(words, &pos, (uint64_t)ser->value[i], 7);
+	// SSCC-96 has 24 reserved zero bits
+
+	return bits;
+
+}
+
+
+bool gs1_parseEPCbinary(struct gs1DLparser *ctx, const uint64_t *words, size_t numwords, unsigned int *filter) {
+
+	unsigned int scheme, f, part, refDigits;
+	size_t pos = 0, keylen, gcp, i;
+	uint64_t cp, ref, max, v;
+	char key[18], ser[21];
+
+	ctx->numAIs = 0;
+	ctx->numQueryParams = 0;
+	memset(&ctx->uriParts, 0, sizeof(ctx->uriParts));
+	*ctx->aiBuf = '\0';
+	*ctx->err = '\0';
+
+	if (numwords < 2) {
+		strcpy(ctx->err, "EPC binary data is too short");
+		goto fail;
+	}
+
+	scheme = (unsigned int)getEPCbits(words, &pos, 8);
+	if (scheme != GS1_DL_EPC_SGTIN_96 && scheme != GS1_DL_EPC_SGTIN_198 && scheme != GS1_DL_EPC_SSCC_96) {
+		strcpy(ctx->err, "Unsupported EPC binary header");
+		goto fail;
+	}
+	if (scheme == GS1_DL_EPC_SGTIN_198 && numwords < 4) {
+		strcpy(ctx->err, "EPC binary data is too short");
+		goto fail;
+	}
+
+	f = (unsigned int)getEPCbits(words, &pos, 3);
+	part = (unsigned int)getEPCbits(words, &pos, 3);
+	if (part > 6) {
+		strcpy(ctx->err, "Invalid EPC partition value");
+		goto fail;
+	}
+
+	keylen = scheme == GS1_DL_EPC_SSCC_96 ? 18 : 14;
+	gcp = epcPartitions[scheme == GS1_DL_EPC_SSCC_96][part].gcpDigits;
+	refDigits = (unsigned int)(keylen - 1 - gcp);
+	cp = getEPCbits(words, &pos, epcPartitions[scheme == GS1_DL_EPC_SSCC_96][part].gcpBits);
+	ref = getEPCbits(words, &pos, epcPartitions[scheme == GS1_DL_EPC_SSCC_96][part].refBits);
+
+	for (max = 1, i = 0; i < gcp; i++)
+		max *= 10;
+	if (cp >= max) {
+		strcpy(ctx->err, "EPC company prefix is out of range");
+		goto fail;
+	}
+	for (max = 1, i = 0; i < refDigits; i++)
+		max *= 10;
+	if (ref >= max) {
+		strcpy(ctx->err, "EPC reference is out of range");
+		goto fail;
+	}
+
+	// Move the indicator or extension digit back to the front of the key
+	u64ToDigits(key + gcp, ref, refDigits);
+	key[0] = key[gcp];
+	u64ToDigits(key + 1, cp, gcp);
+	key[keylen - 1] = gs1CheckDigit(key, keylen - 1);
+
+	if (!addAIelement(ctx, scheme == GS1_DL_EPC_SSCC_96 ? "00" : "01", 2, key, keylen))
+		goto fail;
+
+	if (scheme == GS1_DL_EPC_SGTIN_96) {
+		v = getEPCbits(words, &pos, 38);
+		i = sizeof(ser) - 1;
+		do {
+			ser[--i] = (char)('0' + v % 10);
+			v /= 10;
+		} while (v);
+		if (!addAIelement(ctx, "21", 2, ser + i, sizeof(ser) - 1 - i))
+			goto fail;
+	} else if (scheme == GS1_DL_EPC_SGTIN_198) {
+		for (i = 0; i < 20 && (ser[i] = (char)getEPCbits(words, &pos, 7)) != '\0'; i++) {
+			if (!isCSET82(ser[i])) {
+				strcpy(ctx->err, "Invalid character in EPC serial number");
+				goto fail;
+			}
+		}
+		if (i == 0) {
+			strcpy(ctx->err, "EPC serial number is empty");
+			goto fail;
+		}
+		while (pos < 198) {				// Zero padded after the terminator
+			if (getEPCbits(words, &pos, 7) != 0) {
+				strcpy(ctx->err, "Non-zero padding in EPC serial number");
+				goto fail;
+			}
+		}
+		if (!addAIelement(ctx, "21", 2, ser, i))
+			goto fail;
+	}
+
+	if (filter)
+		*filter = f;
+
+	return true;
+
+fail:
+
+	DEBUG_PRINT("Parsing EPC binary failed: %s\n", ctx->err);
+
+	ctx->numAIs = 0;
+	return false;
+
+}
+
+
+/*
+ *  Dates and measures
+ *
+ *  Dates (YYMMDD) are packed as the number of days since 1970-01-01. The
+ *  century is resolved with the sliding window of the GS1 General
+ *  Specifications relative to a reference year, and DD=00 denotes the last
+ *  day of the month.
+ *
+ *  Measures (31nn to 36nn) are fixed-point integers whose number of implied
+ *  decimal places is the final digit of the AI.
+ *
+ */
+
+static const unsigned char daysInMonth[13] = { 0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+
+static bool isLeapYear(int y) {
+	return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+}
+
+
+/*
+ *  Days from 1970-01-01 to the given proleptic Gregorian date
+ *
+ */
+static int32_t daysFromCivil(int y, unsigned int m, unsigned int d) {
+
+	int era, yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (int)(m > 2 ? m - 3 : m + 9) + 2) / 5 + (int)d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return (int32_t)(era * 146097 + doe - 719468);
+
+}
+
+
+static bool packDate(unsigned int yy, unsigned int mm, unsigned int dd, int refYear, int32_t *days) {
+
+	int y, diff = (int)yy - refYear % 100;
+	unsigned int last;
+
+	if (yy > 99 || mm < 1 || mm > 12)
+		return false;
+
+	y = refYear - refYear % 100 + (int)yy;
+	if (diff >= 51)
+		y -= 100;
+	else if (diff <= -50)
+		y += 100;
+
+	last = daysInMonth[mm] + (mm == 2 && isLeapYear(y) ? 1U : 0U);
+	if (dd > last)
+		return false;
+	if (dd == 0)
+		dd = last;
+
+	*days = daysFromCivil(y, mm, dd);
+
+	return true;
+
+}
+
+
+/*
+ *  Convert 48 characters, i.e. eight 6-digit fields, into 24 two-digit
+ *  values. Returns false if any character is not a digit.
+ *
+ */
+static bool digitPairs48(const char *in, uint16_t *out) {
+
+	int i;
+#ifdef GS1_DL_SSE2
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i lowByte = _mm_set1_epi16(0xFF);
+	const __m128i ten = _mm_set1_epi16(10);
+	__m128i ok = _mm_set1_epi8(-1);
+
+	for (i = 0; i < 3; i++) {
+		__m128i v = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)(const void *)(in + 16 * i)), zero);
+		ok = _mm_and_si128(ok, _mm_cmpeq_epi8(_mm_max_epu8(v, nine), nine));
+		// Little-endian, so the first digit of each pair is the low byte
+		v = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(v, lowByte), ten), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *)(void *)(out + 8 * i), v);
+	}
+
+	return _mm_movemask_epi8(ok) == 0xFFFF;
+#else
+	for (i = 0; i < 24; i++) {
+		if (!allDigits(in + 2 * i, 2))
+			return false;
+		out[i] = (uint16_t)((in[2 * i] - '0') * 10 + in[2 * i + 1] - '0');
+	}
+
+	return true;
+#endif
+
+}
+
+
+static bool decodeDate(const char *yymmdd, int refYear, int32_t *days) {
+
+	if (!allDigits(yymmdd, 6))
+		return false;
+
+	return packDate((unsigned int)((yymmdd[0] - '0') * 10 + yymmdd[1] - '0'),
+			(unsigned int)((yymmdd[2] - '0') * 10 + yymmdd[3] - '0'),
+			(unsigned int)((yymmdd[4] - '0') * 10 + yymmdd[5] - '0'), refYear, days);
+
+}
+
+
+static bool isDateAI(const char *ai, size_t ailen) {
+	return ailen == 2 && ai[0] == '1' && ai[1] >= '1' && ai[1] <= '7' && ai[1] != '4';
+}
+
+
+static bool isMeasureAI(const char *ai, size_t ailen) {
+	return ailen == 4 && ai[0] == '3' && ai[1] >= '1' && ai[1] <= '6' && allDigits(ai + 2, 2);
+}
+
+
+bool gs1_getDate(struct gs1DLparser *ctx, const char *ai, int refYear, int32_t *days) {
+
+	const struct gs1AIelement *e;
+
+	*ctx->err = '\0';
+
+	if (!isDateAI(ai, strlen(ai))) {
+		sprintf(ctx->err, "AI (%.4s) is not a date", ai);
+		return false;
+	}
+	if ((e = findAIelement(ctx, ai)) == NULL) {
+		sprintf(ctx->err, "AI (%s) not found", ai);
+		return false;
+	}
+	if (e->vallen != 6 || !decodeDate(e->value, refYear, days)) {
+		sprintf(ctx->err, "AI (%s) value is not a valid date", ai);
+		return false;
+	}
+
+	return true;
+
+}
+
+
+bool gs1_getMeasure(struct gs1DLparser *ctx, const char *ai, uint32_t *value, int *decimals) {
+
+	int i;
+	size_t ailen = strlen(ai);
+	const struct gs1AIelement *e = NULL;
+
+	*ctx->err = '\0';
+
+	if (ailen != 3 && ailen != 4) {
+		sprintf(ctx->err, "AI (%.4s) is not a measure", ai);
+		return false;
+	}
+
+	// Three digits match the measure with any number of decimal places
+	for (i = 0; i < ctx->numAIs && !e; i++)
+		if (isMeasureAI(ctx->aiData[i].ai, (size_t)ctx->aiData[i].ailen) &&
+		    memcmp(ctx->aiData[i].ai, ai, ailen) == 0)
+			e = &ctx->aiData[i];
+	if (!e) {
+		sprintf(ctx->err, "AI (%s) not found", ai);
+		return false;
+	}
+	if (e->vallen != 6 || !allDigits(e->value, 6)) {
+		sprintf(ctx->err, "AI (%.4s) value is not a valid measure", e->ai);
+		return false;
+	}
+
+	*value = (uint32_t)digitsToU64(e->value, 6);
+	*decimals = e->ai[3] - '0';
+
+	return true;
+
+}
+
+
+size_t gs1_decodeDates(const char *yymmdd, size_t count, int refYear, int32_t *days) {
+
+	size_t i = 0, j, valid = 0;
+	uint16_t pairs[24];
+
+	// Eight dates at a time, falling back to individual decoding on error
+	for (; i + 8 <= count; i += 8) {
+		if (!digitPairs48(yymmdd + 6 * i, pairs)) {
+			for (j = 0; j < 8; j++)
+				if (decodeDate(yymmdd + 6 * (i + j), refYear, &days[i + j]))
+					valid++;
+				else
+					days[i + j] = GS1_DL_DATE_INVALID;
+			continue;
+		}
+		for (j = 0; j < 8; j++)
+			if (packDate(pairs[3 * j], pairs[3 * j + 1], pairs[3 * j + 2], refYear, &days[i + j]))
+				valid++;
+			else
+				days[i + j] = GS1_DL_DATE_INVALID;
+	}
+
+	for (; i < count; i++)
+		if (decodeDate(yymmdd + 6 * i, refYear, &days[i]))
+			valid++;
+		else
+			days[i] = GS1_DL_DATE_INVALID;
+
+	return valid;
+
+}
+
+
+static size_t decodeMeasures(const char *digits, size_t count, uint32_t *values) {
+
+	size_t i, valid = 0;
+
+	for (i = 0; i < count; i++) {
+		if (allDigits(digits + 6 * i, 6)) {
+			values[i] = (uint32_t)digitsToU64(digits + 6 * i, 6);
+			valid++;
+		} else
+			values[i] = GS1_DL_MEASURE_INVALID;
+	}
+
+	return valid;
+
+}
+
+
+size_t gs1_decodeMeasures(const char *digits, size_t count, uint32_t *values) {
+
+	size_t i = 0, j, valid = 0;
+	uint16_t pairs[24];
+
+	// Eight values at a time, falling back to individual decoding on error
+	for (; i + 8 <= count; i += 8) {
+		if (!digitPairs48(digits + 6 * i, pairs)) {
+			valid += decodeMeasures(digits + 6 * i, 8, values + i);
+			continue;
+		}
+		for (j = 0; j < 8; j++)
+			values[i + j] = (uint32_t)pairs[3 * j] * 10000 + (uint32_t)pairs[3 * j + 1] * 100 + pairs[3 * j + 2];
+		valid += 8;
+	}
+
+	return valid + decodeMeasures(digits + 6 * i, count - i, values + i);
+
+}
+
+
+/*
+ *  Numeric keys as 64-bit integers
+ *
+ *  Digits are converted eight at a time within a 64-bit word (SWAR), after
+ *  left-padding any leading partial group with zeros.
+ *
+ */
+
+static uint64_t loadLE64(const char *p) {
+
+	const unsigned char *u = (const unsigned char *)p;
+
+	// Assembled independently of host byte order; a single load on most targets
+	return (uint64_t)u[0]       | (uint64_t)u[1] << 8  | (uint64_t)u[2] << 16 | (uint64_t)u[3] << 24 |
+	       (uint64_t)u[4] << 32 | (uint64_t)u[5] << 40 | (uint64_t)u[6] << 48 | (uint64_t)u[7] << 56;
+
+}
+
+
+static uint32_t loadLE32(const char *p) {
+
+	const unsigned char *u = (const unsigned char *)p;
+
+	return (uint32_t)u[0] | (uint32_t)u[1] << 8 | (uint32_t)u[2] << 16 | (uint32_t)u[3] << 24;
+
+}
+
+
+static void storeLE32(char *p, uint32_t v) {
+
+	unsigned char *u = (unsigned char *)p;
+
+	u[0] = (unsigned char)v;
+	u[1] = (unsigned char)(v >> 8);
+	u[2] = (unsigned char)(v >> 16);
+	u[3] = (unsigned char)(v >> 24);
+
+}
+
+
+static void storeLE64(char *p, uint64_t v) {
+	storeLE32(p, (uint32_t)v);
+	storeLE32(p + 4, (uint32_t)(v >> 32));
+}
+
+
+static bool eightDigitsSWAR(uint64_t v) {
+	return (((v & UINT64_C(0xF0F0F0F0F0F0F0F0)) |
+		 (((v + UINT64_C(0x0606060606060606)) & UINT64_C(0xF0F0F0F0F0F0F0F0)) >> 4)) ==
+		UINT64_C(0x3333333333333333));
+}
+
+
+static uint32_t parseEightDigitsSWAR(uint64_t v) {
+
+	// Combine adjacent digits, then pairs, then quads
+	v = (v & UINT64_C(0x0F0F0F0F0F0F0F0F)) * 2561 >> 8;
+	v = (v & UINT64_C(0x00FF00FF00FF00FF)) * 6553601 >> 16;
+
+	return (uint32_t)((v & UINT64_C(0x0000FFFF0000FFFF)) * UINT64_C(42949672960001) >> 32);
+
+}
+
+
+static bool digitsToKey64(const char *digits, size_t len, uint64_t *key) {
+
+	char first[8];
+	size_t r = len % 8;
+	uint64_t v, acc = 0;
+
+	if (len == 0 || len > 19)
+		return false;
+
+	if (r) {
+		memset(first, '0', sizeof(first));
+		memcpy(first + 8 - r, digits, r);
+		v = loadLE64(first);
+		if (!eightDigitsSWAR(v))
+			return false;
+		acc = parseEightDigitsSWAR(v);
+		digits += r;
+		len -= r;
+	}
+
+	for (; len; digits += 8, len -= 8) {
+		v = loadLE64(digits);
+		if (!eightDigitsSWAR(v))
+			return false;
+		acc = acc * 100000000 + parseEightDigitsSWAR(v);
+	}
+
+	*key = acc;
+
+	return true;
+
+}
+
+
+bool gs1_getKey64(struct gs1DLparser *ctx, const char *ai, uint64_t *key) {
+
+	const struct gs1AIelement *e;
+
+	*ctx->err = '\0';
+
+	if ((e = findAIelement(ctx, ai)) == NULL) {
+		sprintf(ctx->err, "AI (%.4s) not found", ai);
+		return false;
+	}
+	if (!digitsToKey64(e->value, (size_t)e->vallen, key)) {
+		sprintf(ctx->err, "AI (%.4s) value is not numeric with at most 19 digits", ai);
+		return false;
+	}
+
+	return true;
+
+}
+
+
+size_t gs1_getKeys64(struct gs1DLparser *ctxs, size_t count, const char *ai, uint64_t *keys) {
+
+	size_t i, valid = 0;
+
+	for (i = 0; i < count; i++) {
+		if (gs1_getKey64(&ctxs[i], ai, &keys[i]))
+			valid++;
+		else
+			keys[i] = GS1_DL_KEY_INVALID;
+	}
+
+	return valid;
+
+}
+
+
+/*
+ *  Predicate filters over batches of contexts
+ *
+ *  Rows are processed in groups of 64, matching a word of the selection
+ *  bitmap. For each term the relevant AI is extracted from each row into a
+ *  column of packed values, which is then compared as a whole against the
+ *  compiled constant.
+ *
+ */
+
+void gs1_filterInit(struct gs1DLfilter *filter, int refYear) {
+	filter->numTerms = 0;
+	filter->refYear = refYear;
+	*filter->err = '\0';
+}
+
+
+static struct gs1DLfilterTerm* addFilterTerm(struct gs1DLfilter *filter, int kind, const char *ai) {
+
+	struct gs1DLfilterTerm *term;
+	size_t ailen = strlen(ai);
+
+	*filter->err = '\0';
+
+	if (ailen < 2 || ailen > 4 || !allDigits(ai, ailen)) {
+		strcpy(filter->err, "Filter AI must be 2 to 4 digits");
+		return NULL;
+	}
+	if (filter->numTerms >= GS1_DL_MAX_FILTER_TERMS) {
+		strcpy(filter->err, "Too many filter terms");
+		return NULL;
+	}
+
+	term = &filter->terms[filter->numTerms];
+	memset(term, 0, sizeof(*term));
+	term->kind = kind;
+	strcpy(term->ai, ai);
+
+	return term;
+
+}
+
+
+bool gs1_filterHasAI(struct gs1DLfilter *filter, const char *ai) {
+
+	if (!addFilterTerm(filter, GS1_DL_FILTER_HAS_AI, ai))
+		return false;
+	filter->numTerms++;
+
+	return true;
+
+}
+
+
+bool gs1_filterKeyPrefix(struct gs1DLfilter *filter, const char *ai, const char *prefix) {
+
+	struct gs1DLfilterTerm *term;
+	size_t keylen, plen = strlen(prefix), i;
+
+	if ((term = addFilterTerm(filter, GS1_DL_FILTER_KEY_PREFIX, ai)) == NULL)
+		return false;
+
+	// Prefix becomes a range of key values
+	keylen = (size_t)fixedAIvalueLength(ai);
+	if (!isDLpkey(ai, strlen(ai)) || keylen == 0 || keylen > 19) {
+		sprintf(filter->err, "AI (%s) is not a numeric key of predefined length", ai);
+		return false;
+	}
+	if (plen < 1 || plen > keylen || !allDigits(prefix, plen)) {
+		sprintf(filter->err, "Prefix for AI (%s) must be 1 to %d digits", ai, (int)keylen);
+		return false;
+	}
+
+	term->lo = digitsToU64(prefix, plen);
+	for (term->span = 1, i = plen; i < keylen; i++)
+		term->span *= 10;
+	term->lo *= term->span;
+	term->keylen = (int)keylen;
+
+	filter->numTerms++;
+
+	return true;
+
+}
+
+
+bool gs1_filterDate(struct gs1DLfilter *filter, const char *ai, int op, int year, int month, int day) {
+
+	struct gs1DLfilterTerm *term;
+
+	if ((term = addFilterTerm(filter, GS1_DL_FILTER_DATE, ai)) == NULL)
+		return false;
+
+	if (!isDateAI(ai, strlen(ai))) {
+		sprintf(filter->err, "AI (%s) is not a date", ai);
+		return false;
+	}
+	if (op < GS1_DL_FILTER_LT || op > GS1_DL_FILTER_GT) {
+		strcpy(filter->err, "Invalid filter comparison");
+		return false;
+	}
+	if (month < 1 || month > 12 || day < 1 ||
+	    day > daysInMonth[month] + (month == 2 && isLeapYear(year) ? 1 : 0)) {
+		strcpy(filter->err, "Invalid filter date");
+		return false;
+	}
+
+	term->op = op;
+	term->days = daysFromCivil(year, (unsigned int)month, (unsigned int)day);
+
+	filter->numTerms++;
+
+	return true;
+
+}
+
+
+#ifdef GS1_DL_SSE2
+/*
+ *  Unsigned 64-bit a < b in each lane, from 32-bit signed comparisons
+ *
+ */
+static __m128i cmpltu64(__m128i a, __m128i b) {
+
+	const __m128i sign = _mm_set1_epi32((int)0x80000000);
+	__m128i lt = _mm_cmplt_epi32(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign));
+	__m128i eq = _mm_cmpeq_epi32(a, b);
+
+	// High halves decide unless equal, when the low halves do
+	return _mm_or_si128(_mm_shuffle_epi32(lt, _MM_SHUFFLE(3, 3, 1, 1)),
+			    _mm_and_si128(_mm_shuffle_epi32(eq, _MM_SHUFFLE(3, 3, 1, 1)),
+					  _mm_shuffle_epi32(lt, _MM_SHUFFLE(2, 2, 0, 0))));
+
+}
+#endif
+
+
+/*
+ *  Bit i set iff lo <= keys[i] < lo + span. Missing keys (GS1_DL_KEY_INVALID)
+ *  lie beyond any range of 19-digit keys.
+ *
+ */
+static uint64_t matchKeyRange(const uint64_t *keys, size_t n, uint64_t lo, uint64_t span) {
+
+	size_t i = 0;
+	uint64_t m = 0;
+#ifdef GS1_DL_SSE2
+	const __m128i vlo = _mm_set_epi32((int)(uint32_t)(lo >> 32), (int)(uint32_t)lo,
+					  (int)(uint32_t)(lo >> 32), (int)(uint32_t)lo);
+	const __m128i vspan = _mm_set_epi32((int)(uint32_t)(span >> 32), (int)(uint32_t)span,
+					    (int)(uint32_t)(span >> 32), (int)(uint32_t)span);
+
+	for (; i + 2 <= n; i += 2) {
+		__m128i d = _mm_sub_epi64(_mm_loadu_si128((const __m128i *)(const void *)(keys + i)), vlo);
+		m |= (uint64_t)_mm_movemask_pd(_mm_castsi128_pd(cmpltu64(d, vspan))) << i;
+	}
+#endif
+
+	for (; i < n; i++)
+		m |= (uint64_t)(keys[i] - lo < span) << i;
+
+	return m;
+
+}
+
+
+static bool compareDate(int32_t d, int op, int32_t v) {
+	switch (op) {
+		case GS1_DL_FILTER_LT:	return d < v;
+		case GS1_DL_FILTER_LE:	return d <= v;
+		case GS1_DL_FILTER_EQ:	return d == v;
+		case GS1_DL_FILTER_GE:	return d >= v;
+		default:		return d > v;
+	}
+}
+
+
+/*
+ *  Bit i set iff dates[i] is valid and compares with v
+ *
+ */
+static uint64_t matchDates(const int32_t *dates, size_t n, int op, int32_t v) {
+
+	size_t i = 0;
+	uint64_t m = 0;
+#ifdef GS1_DL_SSE2
+	const __m128i vv = _mm_set1_epi32(v);
+	const __m128i invalid = _mm_set1_epi32(GS1_DL_DATE_INVALID);
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i d = _mm_loadu_si128((const __m128i *)(const void *)(dates + i));
+		__m128i r;
+		switch (op) {
+			case GS1_DL_FILTER_LT:	r = _mm_cmplt_epi32(d, vv); break;
+			case GS1_DL_FILTER_LE:	r = _mm_or_si128(_mm_cmplt_epi32(d, vv), _mm_cmpeq_epi32(d, vv)); break;
+			case GS1_DL_FILTER_EQ:	r = _mm_cmpeq_epi32(d, vv); break;
+			case GS1_DL_FILTER_GE:	r = _mm_or_si128(_mm_cmpgt_epi32(d, vv), _mm_cmpeq_epi32(d, vv)); break;
+			default:		r = _mm_cmpgt_epi32(d, vv); break;
+		}
+		r = _mm_andnot_si128(_mm_cmpeq_epi32(d, invalid), r);
+		m |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(r)) << i;
+	}
+#endif
+
+	for (; i < n; i++)
+		m |= (uint64_t)(dates[i] != GS1_DL_DATE_INVALID && compareDate(dates[i], op, v)) << i;
+
+	return m;
+
+}
+
+
+size_t gs1_filterBatch(const struct gs1DLfilter *filter, const struct gs1DLparser *ctxs, size_t count, uint64_t *bitmap) {
+
+	size_t base, n, i, selected = 0;
+	int t;
+	uint64_t m, keys[64];
+	int32_t dates[64];
+	const struct gs1DLfilterTerm *term;
+	const struct gs1AIelement *e;
+
+	for (base = 0; base < count; base += 64) {
+
+		n = count - base < 64 ? count - base : 64;
+		m = n == 64 ? ~UINT64_C(0) : (UINT64_C(1) << n) - 1;
+
+		for (t = 0; t < filter->numTerms && m; t++) {
+			term = &filter->terms[t];
+			switch (term->kind) {
+			case GS1_DL_FILTER_HAS_AI:
+				for (i = 0; i < n; i++)
+					if (!findAIelement(&ctxs[base + i], term->ai))
+						m &= ~(UINT64_C(1) << i);
+				break;
+			case GS1_DL_FILTER_KEY_PREFIX:
+				for (i = 0; i < n; i++)
+					if ((e = findAIelement(&ctxs[base + i], term->ai)) == NULL || e->vallen != term->keylen ||
+					    !digitsToKey64(e->value, (size_t)e->vallen, &keys[i]))
+						keys[i] = GS1_DL_KEY_INVALID;
+				m &= matchKeyRange(keys, n, term->lo, term->span);
+				break;
+			default:
+				for (i = 0; i < n; i++)
+					if ((e = findAIelement(&ctxs[base + i], term->ai)) == NULL ||
+					    e->vallen != 6 || !decodeDate(e->value, filter->refYear, &dates[i]))
+						dates[i] = GS1_DL_DATE_INVALID;
+				m &= matchDates(dates, n, term->op, term->days);
+				break;
+			}
+		}
+
+		bitmap[base / 64] = m;
+		for (; m; m &= m - 1)
+			selected++;
+
+	}
+
+	return selected;
+
+}
+
+/*
+ *  Aggregation of scan counts per key
+ *
+ *  An open-addressing table with linear probing over caller-provided slots.
+ *  When the table becomes too full its contents are sorted and appended to
+ *  the spill file as a run, and the table is emptied. The output is a merge
+ *  of the runs with the sorted remainder of the table, with the free slots
+ *  of the table shared out as read buffers for the runs.
+ *
+ */
+
+#define AGG_READ_AHEAD	8			// Records in the fallback read buffer
+
+struct aggSource {
+	long pos;					// Next unread record in the spill file
+	size_t remaining;				// Unread records in the spill file
+	struct gs1DLaggEntry *buf;			// Read buffer of size records
+	size_t size;
+	struct gs1DLaggEntry fallback[AGG_READ_AHEAD];	// Used when the table has too few free slots
+	const struct gs1DLaggEntry *head, *end;
+};
+
+
+static void aggClear(struct gs1DLaggregator *agg) {
+
+	size_t i;
+
+	for (i = 0; i < agg->capacity; i++)
+		agg->entries[i].key = GS1_DL_KEY_INVALID;
+	agg->used = 0;
+
+}
+
+
+bool gs1_aggInit(struct gs1DLaggregator *agg, const char *ai, int options, struct gs1DLaggEntry *entries, size_t capacity, FILE *spill) {
+
+	size_t ailen = strlen(ai);
+
+	*agg->err = '\0';
+
+	if (ailen < 2 || ailen > 4 || !allDigits(ai, ailen)) {
+		strcpy(agg->err, "Aggregation AI must be 2 to 4 digits");
+		return false;
+	}
+	if (capacity < 16 || (capacity & (capacity - 1)) != 0) {
+		strcpy(agg->err, "Aggregation capacity must be a power of two, at least 16");
+		return false;
+	}
+
+	strcpy(agg->ai, ai);
+	agg->options = options;
+	agg->entries = entries;
+	agg->capacity = capacity;
+	agg->spill = spill;
+	agg->numRuns = 0;
+	agg->skipped = 0;
+	aggClear(agg);
+
+	return true;
+
+}
+
+
+static int cmpAggEntry(const void *a, const void *b) {
+
+	const struct gs1DLaggEntry *x = a, *y = b;
+
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	return strcmp(x->lot, y->lot);
+
+}
+
+
+/*
+ *  Compact the occupied slots to the front of the table and sort them
+ *
+ */
+static size_t aggSort(struct gs1DLaggregator *agg) {
+
+	size_t i, n = 0;
+
+	for (i = 0; i < agg->capacity; i++)
+		if (agg->entries[i].key != GS1_DL_KEY_INVALID)
+			agg->entries[n++] = agg->entries[i];
+	qsort(agg->entries, n, sizeof(agg->entries[0]), cmpAggEntry);
+
+	return n;
+
+}
+
+
+static bool aggSpill(struct gs1DLaggregator *agg) {
+
+	size_t n;
+	long pos;
+
+	if (!agg->spill) {
+		strcpy(agg->err, "Aggregation table is full");
+		return false;
+	}
+	if (agg->numRuns >= GS1_DL_AGG_MAX_RUNS) {
+		strcpy(agg->err, "Too many aggregation spill runs");
+		return false;
+	}
+
+	n = aggSort(agg);
+
+	if (fseek(agg->spill, 0, SEEK_END) != 0 || (pos = ftell(agg->spill)) < 0 ||
+	    fwrite(agg->entries, sizeof(agg->entries[0]), n, agg->spill) != n) {
+		strcpy(agg->err, "Failed to write aggregation spill file");
+		aggClear(agg);			// Compacted slots are no longer hashed
+		return false;
+	}
+
+	agg->runs[agg->numRuns].offset = pos;
+	agg->runs[agg->numRuns].count = n;
+	agg->numRuns++;
+
+	aggClear(agg);
+
+	return true;
+
+}
+
+
+static bool aggUpsert(struct gs1DLaggregator *agg, uint64_t key, const char *lot, size_t lotlen,
+		      uint64_t count, int64_t firstSeen, int64_t lastSeen) {
+
+	struct gs1DLaggEntry *e;
+	uint64_t h = key;
+	size_t i, mask = agg->capacity - 1;
+
+	for (i = 0; i < lotlen; i++)
+		h = (h ^ (unsigned char)lot[i]) * UINT64_C(0x100000001B3);
+	h *= UINT64_C(0x9E3779B97F4A7C15);
+
+	for (i = (size_t)(h >> 32) & mask; ; i = (i + 1) & mask) {
+		e = &agg->entries[i];
+		if (e->key == GS1_DL_KEY_INVALID)
+			break;
+		if (e->key == key && strlen(e->lot) == lotlen && memcmp(e->lot, lot, lotlen) == 0) {
+			e->count += count;
+			if (firstSeen < e->firstSeen)
+				e->firstSeen = firstSeen;
+			if (lastSeen > e->lastSeen)
+				e->lastSeen = lastSeen;
+			return true;
+		}
+	}
+
+	// Keep a quarter of the slots free so that probe sequences stay short
+	if ((agg->used + 1) * 4 > agg->capacity * 3) {
+		if (!aggSpill(agg))
+			return false;
+		return aggUpsert(agg, key, lot, lotlen, count, firstSeen, lastSeen);
+	}
+
+	e->key = key;
+	memcpy(e->lot, lot, lotlen);
+	e->lot[lotlen] = '\0';
+	e->count = count;
+	e->firstSeen = firstSeen;
+	e->lastSeen = lastSeen;
+	agg->used++;
+
+	return true;
+
+}
+
+
+bool gs1_aggAdd(struct gs1DLaggregator *agg, const struct gs1DLparser *ctx, int64_t seen) {
+
+	const struct gs1AIelement *e, *lot = NULL;
+	uint64_t key;
+	size_t lotlen = 0;
+
+	*agg->err = '\0';
+
+	if ((e = findAIelement(ctx, agg->ai)) == NULL || !digitsToKey64(e->value, (size_t)e->vallen, &key)) {
+		agg->skipped++;
+		return true;
+	}
+
+	if ((agg->options & GS1_DL_AGG_BY_LOT) && (lot = findAIelement(ctx, "10")) != NULL) {
+		lotlen = (size_t)lot->vallen;
+		if (lotlen > GS1_DL_AGG_MAX_LOT) {
+			agg->skipped++;
+			return true;
+		}
+	}
+
+	return aggUpsert(agg, key, lot ? lot->value : "", lotlen, 1, seen, seen);
+
+}
+
+
+bool gs1_aggAddBatch(struct gs1DLaggregator *agg, const struct gs1DLparser *ctxs, size_t count, const int64_t *seen) {
+
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		if (!gs1_aggAdd(agg, &ctxs[i], seen[i]))
+			return false;
+
+	return true;
+
+}
+
+
+static bool aggSourceFill(struct gs1DLaggregator *agg, struct aggSource *src) {
+
+	size_t n = src->remaining < src->size ? src->remaining : src->size;
+
+	if (n == 0) {
+		src->head = src->end = NULL;
+		return true;
+	}
+
+	if (fseek(agg->spill, src->pos, SEEK_SET) != 0 ||
+	    fread(src->buf, sizeof(src->buf[0]), n, agg->spill) != n) {
+		strcpy(agg->err, "Failed to read aggregation spill file");
+		return false;
+	}
+
+	src->pos += (long)(n * sizeof(src->buf[0]));
+	src->remaining -= n;
+	src->head = src->buf;
+	src->end = src->buf + n;
+
+	return true;
+
+}
+
+
+bool gs1_aggFinish(struct gs1DLaggregator *agg, gs1_aggEmitFunc emit, void *arg) {
+
+	struct aggSource srcs[GS1_DL_AGG_MAX_RUNS + 1];
+	struct gs1DLaggEntry cur;
+	const struct gs1DLaggEntry *min;
+	bool have = false;
+	int i, numSrcs = agg->numRuns + 1, m;
+	size_t n, share;
+	struct gs1DLaggEntry *rest;
+
+	*agg->err = '\0';
+
+	// The table forms the final source, without any reads. It is moved to
+	// the end of the slots so that the free slots precede it.
+	n = aggSort(agg);
+	rest = agg->entries + agg->capacity - n;
+	memmove(rest, agg->entries, n * sizeof(agg->entries[0]));
+	srcs[agg->numRuns].remaining = 0;
+	srcs[agg->numRuns].head = n ? rest : NULL;
+	srcs[agg->numRuns].end = rest + n;
+
+	share = agg->numRuns ? (agg->capacity - n) / (size_t)agg->numRuns : 0;
+	for (i = 0; i < agg->numRuns; i++) {
+		srcs[i].pos = agg->runs[i].offset;
+		srcs[i].remaining = agg->runs[i].count;
+		if (share >= AGG_READ_AHEAD) {
+			srcs[i].buf = agg->entries + (size_t)i * share;
+			srcs[i].size = share;
+		} else {
+			srcs[i].buf = srcs[i].fallback;
+			srcs[i].size = AGG_READ_AHEAD;
+		}
+		if (!aggSourceFill(agg, &srcs[i]))
+			goto fail;
+	}
+
+	memset(&cur, 0, sizeof(cur));
+	for (;;) {
+
+		m = -1;
+		min = NULL;
+		for (i = 0; i < numSrcs; i++)
+			if (srcs[i].head && (!min || cmpAggEntry(srcs[i].head, min) < 0)) {
+				min = srcs[i].head;
+				m = i;
+			}
+
+		if (have && (!min || cmpAggEntry(min, &cur) != 0)) {
+			if (!emit(arg, &cur)) {
+				if (!*agg->err)
+					strcpy(agg->err, "Aggregation output failed");
+				goto fail;
+			}
+			have = false;
+		}
+
+		if (!min)
+			break;
+
+		if (have) {
+			cur.count += min->count;
+			if (min->firstSeen < cur.firstSeen)
+				cur.firstSeen = min->firstSeen;
+			if (min->lastSeen > cur.lastSeen)
+				cur.lastSeen = min->lastSeen;
+		} else {
+			cur = *min;
+			have = true;
+		}
+
+		if (++srcs[m].head == srcs[m].end && !aggSourceFill(agg, &srcs[m]))
+			goto fail;
+
+	}
+
+	aggClear(agg);
+	agg->numRuns = 0;
+
+	return true;
+
+fail:
+
+	aggClear(agg);
+	agg->numRuns = 0;
+
+	return false;
+
+}
+
+
+static bool aggMergeEntry(void *arg, const struct gs1DLaggEntry *entry) {
+	struct gs1DLaggregator *dst = arg;
+	return aggUpsert(dst, entry->key, entry->lot, strlen(entry->lot),
+			 entry->count, entry->firstSeen, entry->lastSeen);
+}
+
+
+bool gs1_aggMerge(struct gs1DLaggregator *dst, struct gs1DLaggregator *src) {
+
+	*dst->err = '\0';
+
+	if (strcmp(dst->ai, src->ai) != 0 || dst->options != src->options) {
+		strcpy(dst->err, "Aggregators have different keys");
+		return false;
+	}
+
+	dst->skipped += src->skipped;
+	src->skipped = 0;
+
+	if (!gs1_aggFinish(src, aggMergeEntry, dst)) {
+		if (!*dst->err)
+			strcpy(dst->err, src->err);
+		return false;
+	}
+
+	return true;
+
+}
+
+/*
+ *  Heavy hitters: a Count-Min sketch alongside a Space-Saving summary
+ *
+ */
+
+#define HH_MAGIC	0x48483147		// "G1HH"
+#define HH_HEADER	32
+#define HH_ENTRY	24			// Serialised key, count and error
+
+static uint64_t mix64(uint64_t x) {
+	x += UINT64_C(0x9E3779B97F4A7C15);
+	x = (x ^ (x >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	x = (x ^ (x >> 27)) * UINT64_C(0x94D049BB133111EB);
+	return x ^ (x >> 31);
+}
+
+
+bool gs1_hhInit(struct gs1DLheavyHitters *hh, const char *ai, int k) {
+
+	size_t ailen = strlen(ai);
+
+	*hh->err = '\0';
+
+	if (ailen < 2 || ailen > 4 || !allDigits(ai, ailen)) {
+		strcpy(hh->err, "Heavy hitter AI must be 2 to 4 digits");
+		return false;
+	}
+	if (k < 1 || k > GS1_DL_TOPK_MAX) {
+		sprintf(hh->err, "Number of heavy hitters must be 1 to %d", GS1_DL_TOPK_MAX);
+		return false;
+	}
+
+	memset(hh->ai, 0, sizeof(hh->ai));
+	strcpy(hh->ai, ai);
+	hh->k = k;
+	hh->total = 0;
+	memset(hh->counts, 0, sizeof(hh->counts));
+	hh->numTop = 0;
+	memset(hh->index, 0, sizeof(hh->index));
+
+	return true;
+
+}
+
+
+/*
+ *  The tracked keys form a min-heap by count, so that the least frequent is
+ *  found for eviction in constant time, with a linear-probing hash index
+ *  that holds the heap position of each key
+ *
+ */
+
+/*
+ *  Column of the counter in row i of the Count-Min sketch for a key whose
+ *  hash is h. The halves of the hash are combined by double hashing; the odd
+ *  stride gives each row a different column.
+ *
+ */
+static size_t hhColumn(uint64_t h, int i) {
+	return (size_t)(((uint32_t)h + (uint32_t)i * ((uint32_t)(h >> 32) | 1)) & (GS1_DL_CMS_WIDTH - 1));
+}
+
+
+static size_t hhHome(uint64_t key) {
+	return (size_t)(mix64(key) & (GS1_DL_HH_SLOTS - 1));
+}
+
+
+static int hhFind(const struct gs1DLheavyHitters *hh, uint64_t key) {
+
+	size_t s;
+	int pos;
+
+	for (s = hhHome(key); (pos = hh->index[s]) != 0; s = (s + 1) & (GS1_DL_HH_SLOTS - 1))
+		if (hh->top[pos - 1].key == key)
+			return pos - 1;
+
+	return -1;
+
+}
+
+
+static void hhIndexAdd(struct gs1DLheavyHitters *hh, int pos) {
+
+	size_t s;
+
+	for (s = hhHome(hh->top[pos].key); hh->index[s] != 0; s = (s + 1) & (GS1_DL_HH_SLOTS - 1))
+		;
+	hh->index[s] = (uint8_t)(pos + 1);
+	hh->slots[pos] = (uint8_t)s;
+
+}
+
+
+static void hhIndexRemove(struct gs1DLheavyHitters *hh, int pos) {
+
+	size_t i = hh->slots[pos], j = i, home;
+
+	// Shift back any following entries whose probe sequence crossed the hole
+	hh->index[i] = 0;
+	for (;;) {
+		j = (j + 1) & (GS1_DL_HH_SLOTS - 1);
+		if (hh->index[j] == 0)
+			break;
+		home = hhHome(hh->top[hh->index[j] - 1].key);
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+		hh->index[i] = hh->index[j];
+		hh->slots[hh->index[j] - 1] = (uint8_t)i;
+		hh->index[j] = 0;
+		i = j;
+	}
+
+}
+
+
+static void hhSwap(struct gs1DLheavyHitters *hh, int a, int b) {
+
+	struct gs1DLhhEntry t = hh->top[a];
+	uint8_t s = hh->slots[a];
+
+	hh->top[a] = hh->top[b];
+	hh->top[b] = t;
+	hh->slots[a] = hh->slots[b];
+	hh->slots[b] = s;
+	hh->index[hh->slots[a]] = (uint8_t)(a + 1);
+	hh->index[hh->slots[b]] = (uint8_t)(b + 1);
+
+}
+
+
+static void hhSiftDown(struct gs1DLheavyHitters *hh, int i) {
+
+	int c;
+
+	for (; (c = 2 * i + 1) < hh->numTop; i = c) {
+		if (c + 1 < hh->numTop && hh->top[c + 1].count < hh->top[c].count)
+			c++;
+		if (hh->top[c].count >= hh->top[i].count)
+			break;
+		hhSwap(hh, i, c);
+	}
+
+}
+
+
+static void hhSiftUp(struct gs1DLheavyHitters *hh, int i) {
+
+	for (; i > 0 && hh->top[i].count < hh->top[(i - 1) / 2].count; i = (i - 1) / 2)
+		hhSwap(hh, i, (i - 1) / 2);
+
+}
+
+
+void gs1_hhAddKey(struct gs1DLheavyHitters *hh, uint64_t key) {
+
+	uint64_t h = mix64(key);
+	uint32_t *c;
+	int i, pos;
+
+	hh->total++;
+
+	for (i = 0; i < GS1_DL_CMS_DEPTH; i++) {
+		c = &hh->counts[i][hhColumn(h, i)];
+		if (*c != UINT32_MAX)
+			(*c)++;
+	}
+
+	if ((pos = hhFind(hh, key)) >= 0) {
+		hh->top[pos].count++;
+		hhSiftDown(hh, pos);
+		return;
+	}
+
+	if (hh->numTop < hh->k) {
+		pos = hh->numTop++;
+		hh->top[pos].key = key;
+		hh->top[pos].count = 1;
+		hh->top[pos].error = 0;
+		hhIndexAdd(hh, pos);
+		hhSiftUp(hh, pos);
+		return;
+	}
+
+	// Evict the least frequent, whose count the newcomer inherits as error
+	hhIndexRemove(hh, 0);
+	hh->top[0].key = key;
+	hh->top[0].error = hh->top[0].count;
+	hh->top[0].count++;
+	hhIndexAdd(hh, 0);
+	hhSiftDown(hh, 0);
+
+}
+
+
+bool gs1_hhAdd(struct gs1DLheavyHitters *hh, const struct gs1DLparser *ctx) {
+
+	const struct gs1AIelement *e;
+	uint64_t key;
+
+	if ((e = findAIelement(ctx, hh->ai)) == NULL || !digitsToKey64(e->value, (size_t)e->vallen, &key))
+		return false;
+
+	gs1_hhAddKey(hh, key);
+
+	return true;
+
+}
+
+
+uint64_t gs1_hhEstimate(const struct gs1DLheavyHitters *hh, uint64_t key) {
+
+	uint64_t h = mix64(key);
+	uint32_t c, min = UINT32_MAX;
+	int i;
+
+	for (i = 0; i < GS1_DL_CMS_DEPTH; i++) {
+		c = hh->counts[i][hhColumn(h, i)];
+		if (c < min)
+			min = c;
+	}
+
+	return min;
+
+}
+
+
+static int cmpHHentry(const void *a, const void *b) {
+
+	const struct gs1DLhhEntry *x = a, *y = b;
+
+	// Most frequent first, then by key for a stable order
+	if (x->count != y->count)
+		return x->count > y->count ? -1 : 1;
+	return x->key < y->key ? -1 : x->key > y->key ? 1 : 0;
+
+}
+
+
+static int hhSorted(const struct gs1DLheavyHitters *hh, struct gs1DLhhEntry *out) {
+
+	memcpy(out, hh->top, (size_t)hh->numTop * sizeof(out[0]));
+	qsort(out, (size_t)hh->numTop, sizeof(out[0]), cmpHHentry);
+
+	return hh->numTop;
+
+}
+
+
+/*
+ *  Replace the tracked keys with n entries sorted by descending count, which
+ *  reversed form a valid heap
+ *
+ */
+static void hhLoad(struct gs1DLheavyHitters *hh, const struct gs1DLhhEntry *sorted, int n) {
+
+	int i;
+
+	memset(hh->index, 0, sizeof(hh->index));
+	for (i = 0; i < n; i++) {
+		hh->top[i] = sorted[n - 1 - i];
+		hhIndexAdd(hh, i);
+	}
+	hh->numTop = n;
+
+}
+
+
+size_t gs1_hhTop(const struct gs1DLheavyHitters *hh, uint64_t *keys, uint64_t *counts, uint64_t *errors, size_t max) {
+
+	struct gs1DLhhEntry top[GS1_DL_TOPK_MAX];
+	size_t i, n = (size_t)hhSorted(hh, top);
+
+	if (n > max)
+		n = max;
+	for (i = 0; i < n; i++) {
+		keys[i] = top[i].key;
+		counts[i] = top[i].count;
+		if (errors)
+			errors[i] = top[i].error;
+	}
+
+	return n;
+
+}
+
+
+/*
+ *  Least count of a full summary, which bounds the count of any key that it
+ *  does not hold
+ *
+ */
+static uint64_t hhFloor(const struct gs1DLheavyHitters *hh) {
+	return hh->numTop < hh->k ? 0 : hh->top[0].count;
+}
+
+
+bool gs1_hhMerge(struct gs1DLheavyHitters *dst, const struct gs1DLheavyHitters *src) {
+
+	struct gs1DLhhEntry all[2 * GS1_DL_TOPK_MAX];
+	uint64_t floorDst, floorSrc, s;
+	int i, j, n;
+
+	*dst->err = '\0';
+
+	if (strcmp(dst->ai, src->ai) != 0 || dst->k != src->k) {
+		strcpy(dst->err, "Heavy hitter summaries have different keys or sizes");
+		return false;
+	}
+
+	dst->total += src->total;
+	for (i = 0; i < GS1_DL_CMS_DEPTH; i++)
+		for (j = 0; j < GS1_DL_CMS_WIDTH; j++) {
+			s = (uint64_t)dst->counts[i][j] + src->counts[i][j];
+			dst->counts[i][j] = s > UINT32_MAX ? UINT32_MAX : (uint32_t)s;
+		}
+
+	// Keys missing from either summary are credited with its floor
+	floorDst = hhFloor(dst);
+	floorSrc = hhFloor(src);
+	n = 0;
+	for (i = 0; i < dst->numTop; i++) {
+		all[n] = dst->top[i];
+		all[n].count += floorSrc;
+		all[n].error += floorSrc;
+		n++;
+	}
+	for (j = 0; j < src->numTop; j++) {
+		if ((i = hhFind(dst, src->top[j].key)) >= 0) {
+			all[i].count = all[i].count - floorSrc + src->top[j].count;
+			all[i].error = all[i].error - floorSrc + src->top[j].error;
+		} else {
+			all[n] = src->top[j];
+			all[n].count += floorDst;
+			all[n].error += floorDst;
+			n++;
+		}
+	}
+
+	qsort(all, (size_t)n, sizeof(all[0]), cmpHHentry);
+	hhLoad(dst, all, n < dst->k ? n : dst->k);
+
+	return true;
+
+}
+
+
+/*
+ *  The serialised form is little-endian: a header of five uint32_t words,
+ *  the AI and the total, then the counters, then the tracked keys in
+ *  descending order of count
+ *
+ */
+
+size_t gs1_hhSerialise(const struct gs1DLheavyHitters *hh, void *buf, size_t maxlen) {
+
+	struct gs1DLhhEntry top[GS1_DL_TOPK_MAX];
+	size_t len = HH_HEADER + GS1_DL_CMS_DEPTH * GS1_DL_CMS_WIDTH * 4 + (size_t)hh->numTop * HH_ENTRY;
+	char *p = buf;
+	int i, j;
+
+	if (!buf || len > maxlen)
+		return len;
+
+	storeLE32(p, HH_MAGIC);
+	storeLE32(p + 4, GS1_DL_CMS_DEPTH);
+	storeLE32(p + 8, GS1_DL_CMS_WIDTH);
+	storeLE32(p + 12, (uint32_t)hh->k);
+	storeLE32(p + 16, (uint32_t)hh->numTop);
+	memcpy(p + 20, hh->ai, 4);
+	storeLE64(p + 24, hh->total);
+	p += HH_HEADER;
+
+	for (i = 0; i < GS1_DL_CMS_DEPTH; i++)
+		for (j = 0; j < GS1_DL_CMS_WIDTH; j++, p += 4)
+			storeLE32(p, hh->counts[i][j]);
+
+	hhSorted(hh, top);
+	for (i = 0; i < hh->numTop; i++, p += HH_ENTRY) {
+		storeLE64(p, top[i].key);
+		storeLE64(p + 8, top[i].count);
+		storeLE64(p + 16, top[i].error);
+	}
+
+	return len;
+
+}
+
+
+bool gs1_hhDeserialise(struct gs1DLheavyHitters *hh, const void *buf, size_t len) {
+
+	struct gs1DLhhEntry top[GS1_DL_TOPK_MAX];
+	const char *p = buf;
+	char ai[5];
+	uint32_t k, numTop;
+	int i, j;
+
+	*hh->err = '\0';
+
+	// Validate before modifying the summary
+	if (len < HH_HEADER)
+		goto fail;
+	k = loadLE32(p + 12);
+	numTop = loadLE32(p + 16);
+	memcpy(ai, p + 20, 4);
+	ai[4] = '\0';
+	if (loadLE32(p) != HH_MAGIC || loadLE32(p + 4) != GS1_DL_CMS_DEPTH || loadLE32(p + 8) != GS1_DL_CMS_WIDTH ||
+	    k < 1 || k > GS1_DL_TOPK_MAX || numTop > k ||
+	    strlen(ai) < 2 || !allDigits(ai, strlen(ai)) ||
+	    len != HH_HEADER + GS1_DL_CMS_DEPTH * GS1_DL_CMS_WIDTH * 4 + numTop * HH_ENTRY)
+		goto fail;
+
+	gs1_hhInit(hh, ai, (int)k);
+	hh->total = loadLE64(p + 24);
+	p += HH_HEADER;
+
+	for (i = 0; i < GS1_DL_CMS_DEPTH; i++)
+		for (j = 0; j < GS1_DL_CMS_WIDTH; j++, p += 4)
+			hh->counts[i][j] = loadLE32(p);
+
+	for (i = 0; i < (int)numTop; i++, p += HH_ENTRY) {
+		top[i].key = loadLE64(p);
+		top[i].count = loadLE64(p + 8);
+		top[i].error = loadLE64(p + 16);
+	}
+	qsort(top, numTop, sizeof(top[0]), cmpHHentry);
+	hhLoad(hh, top, (int)numTop);
+
+	return true;
+
+fail:
+
+	strcpy(hh->err, "Invalid heavy hitter summary");
+	return false;
+
+}
+
+/*
+ *  Fingerprints of AI data and HyperLogLog distinct counting
+ *
+ */
+
+#define HLL_MAGIC	0x4C483147		// "G1HL"
+#define HLL_HEADER	8
+#define HLL_MAX_RANK	(64 - GS1_DL_HLL_PRECISION + 1)
+
+static uint64_t hashBytes(uint64_t h, const char *p, size_t len) {
+
+	char tail[8];
+	size_t n = len;
+
+	for (; n >= 8; p += 8, n -= 8)
+		h = mix64(h ^ loadLE64(p));
+	if (n) {
+		memset(tail, 0, sizeof(tail));
+		memcpy(tail, p, n);
+		h = mix64(h ^ loadLE64(tail));
+	}
+
+	// Length delimits adjacent fields
+	return mix64(h ^ len);
+
+}
+
+
+bool gs1_fingerprint(const struct gs1DLparser *ctx, const char * const *ais, uint64_t *fp) {
+
+	const struct gs1AIelement *e;
+	uint64_t h = 0;
+	int i;
+
+	// Summing per-element hashes makes the whole record order-independent
+	if (!ais) {
+		for (i = 0; i < ctx->numAIs; i++) {
+			e = &ctx->aiData[i];
+			h += mix64(hashBytes(hashBytes(0, e->ai, (size_t)e->ailen), e->value, (size_t)e->vallen));
+		}
+		*fp = h;
+		return true;
+	}
+
+	for (; *ais; ais++) {
+		if ((e = findAIelement(ctx, *ais)) == NULL)
+			return false;
+		h = hashBytes(h, e->ai, (size_t)e->ailen);
+		h = hashBytes(h, e->value, (size_t)e->vallen);
+	}
+
+	*fp = h;
+
+	return true;
+
+}
+
+
+void gs1_hllInit(struct gs1DLhll *hll) {
+	memset(hll->registers, 0, sizeof(hll->registers));
+}
+
+
+void gs1_hllAdd(struct gs1DLhll *hll, uint64_t fingerprint) {
+
+	// Fingerprints are well mixed, but a further round protects against weak ones
+	uint64_t h = mix64(fingerprint);
+	uint64_t w = h << GS1_DL_HLL_PRECISION;
+	size_t idx = (size_t)(h >> (64 - GS1_DL_HLL_PRECISION));
+	uint8_t rank = 1;
+
+	for (; rank < HLL_MAX_RANK && !(w & UINT64_C(0x8000000000000000)); rank++)
+		w <<= 1;
+
+	if (rank > hll->registers[idx])
+		hll->registers[idx] = rank;
+
+}
+
+
+void gs1_hllMerge(struct gs1DLhll *dst, const struct gs1DLhll *src) {
+
+	size_t i = 0;
+
+#ifdef GS1_DL_SSE2
+	for (; i + 16 <= GS1_DL_HLL_REGISTERS; i += 16)
+		_mm_storeu_si128((__m128i *)(void *)(dst->registers + i),
+				 _mm_max_epu8(_mm_loadu_si128((const __m128i *)(const void *)(dst->registers + i)),
+					      _mm_loadu_si128((const __m128i *)(const void *)(src->registers + i))));
+#endif
+
+	for (; i < GS1_DL_HLL_REGISTERS; i++)
+		if (src->registers[i] > dst->registers[i])
+			dst->registers[i] = src->registers[i];
+
+}
+
+
+/*
+ *  Natural logarithm of a positive value, avoiding a dependency on libm
+ *
+ */
+static double lnPositive(double x) {
+
+	double y, y2, term, sum;
+	int e = 0, k;
+
+	for (; x >= 2; x /= 2)
+		e++;
+	for (; x < 1; x *= 2)
+		e--;
+
+	// ln(x) = 2 atanh((x - 1) / (x + 1)), with the argument at most 1/3
+	y = (x - 1) / (x + 1);
+	y2 = y * y;
+	for (sum = 0, term = y, k = 1; k < 40; k += 2, term *= y2)
+		sum += term / k;
+
+	return 2 * sum + e * 0.69314718055994530942;
+
+}
+
+
+uint64_t gs1_hllEstimate(const struct gs1DLhll *hll) {
+
+	const double m = GS1_DL_HLL_REGISTERS;
+	double sum = 0, est;
+	size_t i, zeros = 0;
+
+	for (i = 0; i < GS1_DL_HLL_REGISTERS; i++) {
+		sum += 1.0 / (double)(UINT64_C(1) << hll->registers[i]);
+		if (hll->registers[i] == 0)
+			zeros++;
+	}
+
+	est = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+
+	// Linear counting is more accurate for small cardinalities
+	if (est <= 2.5 * m && zeros > 0)
+		est = m * lnPositive(m / (double)zeros);
+
+	return (uint64_t)(est + 0.5);
+
+}
+
+
+size_t gs1_hllSerialise(const struct gs1DLhll *hll, void *buf, size_t maxlen) {
+
+	unsigned char *p = buf;
+	size_t i;
+	uint32_t v;
+
+	if (!buf || maxlen < GS1_DL_HLL_SERIALISED)
+		return GS1_DL_HLL_SERIALISED;
+
+	storeLE32((char *)p, HLL_MAGIC);
+	storeLE32((char *)p + 4, GS1_DL_HLL_PRECISION);
+	p += HLL_HEADER;
+
+	// Registers hold at most 6 bits, so four pack into three bytes
+	for (i = 0; i < GS1_DL_HLL_REGISTERS; i += 4, p += 3) {
+		v = (uint32_t)hll->registers[i] | (uint32_t)hll->registers[i+1] << 6 |
+		    (uint32_t)hll->registers[i+2] << 12 | (uint32_t)hll->registers[i+3] << 18;
+		p[0] = (unsigned char)v;
+		p[1] = (unsigned char)(v >> 8);
+		p[2] = (unsigned char)(v >> 16);
+	}
+
+	return GS1_DL_HLL_SERIALISED;
+
+}
+
+
+bool gs1_hllDeserialise(struct gs1DLhll *hll, const void *buf, size_t len) {
+
+	struct gs1DLhll tmp;
+	const unsigned char *p = buf;
+	size_t i, j;
+	uint32_t v;
+
+	if (len != GS1_DL_HLL_SERIALISED ||
+	    loadLE32((const char *)p) != HLL_MAGIC || loadLE32((const char *)p + 4) != GS1_DL_HLL_PRECISION)
+		return false;
+	p += HLL_HEADER;
+
+	// Decoded into a copy so that a rejected buffer leaves the estimator intact
+	for (i = 0; i < GS1_DL_HLL_REGISTERS; i += 4, p += 3) {
+		v = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+		for (j = 0; j < 4; j++, v >>= 6) {
+			if ((v & 0x3F) > HLL_MAX_RANK)
+				return false;
+			tmp.registers[i+j] = (uint8_t)(v & 0x3F);
+		}
+	}
+	*hll = tmp;
+
+	return true;
+
+}
+
+/*
+ *  Blocked Bloom filter of packed keys
+ *
+ *  Each key selects one 64-byte block, i.e. a single cache line, and sets
+ *  one bit in each of its eight words.
+ *
+ */
+
+#define BLOOM_MAGIC	0x31464231U		// "1BF1" on little-endian hosts
+#define BLOOM_HEADER	8			// uint64_t words before the blocks
+#define BLOOM_WORDS	8			// uint64_t words per block
+
+static size_t bloomBlock(uint64_t h, uint32_t numBlocks) {
+	return (size_t)(((h >> 32) * numBlocks) >> 32);
+}
+
+
+static void bloomMask(uint64_t h, uint64_t *mask) {
+
+	int i;
+
+	// Six bits of a second hash select the bit within each word
+	for (h = mix64(h), i = 0; i < BLOOM_WORDS; i++, h >>= 6)
+		mask[i] = UINT64_C(1) << (h & 63);
+
+}
+
+
+size_t gs1_buildBloom(const uint64_t *keys, size_t count, int bitsPerKey, void *buf, size_t maxlen) {
+
+	uint64_t *w = buf, *block, mask[BLOOM_WORDS], h;
+	size_t i, numBlocks, len;
+	int j;
+
+	if (bitsPerKey < 1 || bitsPerKey > 64)
+		return 0;
+
+	numBlocks = (count * (size_t)bitsPerKey + BLOOM_WORDS * 64 - 1) / (BLOOM_WORDS * 64);
+	if (numBlocks == 0)
+		numBlocks = 1;
+	if (numBlocks > UINT32_MAX)
+		return 0;
+
+	len = (BLOOM_HEADER + numBlocks * BLOOM_WORDS) * sizeof(uint64_t);
+	if (!buf || len > maxlen)
+		return len;
+
+	memset(w, 0, len);
+	w[0] = BLOOM_MAGIC | (uint64_t)numBlocks << 32;
+	w[1] = count;
+
+	for (i = 0; i < count; i++) {
+		h = mix64(keys[i]);
+		block = w + BLOOM_HEADER + bloomBlock(h, (uint32_t)numBlocks) * BLOOM_WORDS;
+		bloomMask(h, mask);
+		for (j = 0; j < BLOOM_WORDS; j++)
+			block[j] |= mask[j];
+	}
+
+	return len;
+
+}
+
+
+bool gs1_loadBloom(struct gs1DLbloom *bf, const void *buf, size_t len) {
+
+	const uint64_t *w = buf;
+	uint32_t numBlocks;
+
+	if (((uintptr_t)buf & (sizeof(uint64_t) - 1)) != 0 ||
+	    len < BLOOM_HEADER * sizeof(uint64_t) || (uint32_t)w[0] != BLOOM_MAGIC)
+		return false;
+
+	numBlocks = (uint32_t)(w[0] >> 32);
+	if (numBlocks == 0 || len != (BLOOM_HEADER + (size_t)numBlocks * BLOOM_WORDS) * sizeof(uint64_t))
+		return false;
+
+	bf->blocks = w + BLOOM_HEADER;
+	bf->numBlocks = numBlocks;
+
+	return true;
+
+}
+
+
+static bool bloomTest(const uint64_t *block, uint64_t h) {
+
+	uint64_t mask[BLOOM_WORDS], missing = 0;
+	int i;
+
+	bloomMask(h, mask);
+	for (i = 0; i < BLOOM_WORDS; i++)
+		missing |= mask[i] & ~block[i];
+
+	return missing == 0;
+
+}
+
+
+bool gs1_bloomMayContain(const struct gs1DLbloom *bf, uint64_t key) {
+
+	uint64_t h = mix64(key);
+
+	return bloomTest(bf->blocks + bloomBlock(h, bf->numBlocks) * BLOOM_WORDS, h);
+
+}
+
+
+bool gs1_bloomMayContainAI(const struct gs1DLbloom *bf, const struct gs1DLparser *ctx, const char *ai) {
+
+	const struct gs1AIelement *e;
+	uint64_t key;
+
+	if ((e = findAIelement(ctx, ai)) == NULL || !digitsToKey64(e->value, (size_t)e->vallen, &key))
+		return false;
+
+	return gs1_bloomMayContain(bf, key);
+
+}
+
+
+size_t gs1_bloomQueryBatch(const struct gs1DLbloom *bf, const uint64_t *keys, size_t count, uint64_t *bitmap) {
+
+	const uint64_t *blocks[64];
+	uint64_t hs[64], m;
+	size_t base, n, i, found = 0;
+
+	for (base = 0; base < count; base += 64) {
+
+		n = count - base < 64 ? count - base : 64;
+
+		// Locate every block first so that the cache misses overlap
+		for (i = 0; i < n; i++) {
+			hs[i] = mix64(keys[base + i]);
+			blocks[i] = bf->blocks + bloomBlock(hs[i], bf->numBlocks) * BLOOM_WORDS;
+#ifdef GS1_DL_SSE2
+			_mm_prefetch((const char *)blocks[i], _MM_HINT_T0);
+#endif
+		}
+
+		for (m = 0, i = 0; i < n; i++)
+			if (keys[base + i] != GS1_DL_KEY_INVALID && bloomTest(blocks[i], hs[i]))
+				m |= UINT64_C(1) << i;
+
+		bitmap[base / 64] = m;
+		for (; m; m &= m - 1)
+			found++;
+
+	}
+
+	return found;
+
+}
+
+/*
+ *  Shard assignment by jump consistent hashing
+ *
+ *  See "A Fast, Minimal Memory, Consistent Hash Algorithm" (Lamping and
+ *  Veach). Growing the number of shards from n to n + 1 moves only the keys
+ *  that are assigned to the new shard.
+ *
+ */
+
+int gs1_jumpHash(uint64_t key, int numShards) {
+
+	int64_t b = -1, j = 0;
+
+	if (numShards < 1)
+		return -1;
+
+	while (j < numShards) {
+		b = j;
+		key = key * UINT64_C(2862933555777941757) + 1;
+		j = (int64_t)((double)(b + 1) * ((double)(INT64_C(1) << 31) / (double)((key >> 33) + 1)));
+	}
+
+	return (int)b;
+
+}
+
+
+int gs1_shardOf(const struct gs1DLparser *ctx, const char * const *ais, int numShards) {
+
+	uint64_t fp;
+
+	if (!gs1_fingerprint(ctx, ais, &fp))
+		return -1;
+
+	return gs1_jumpHash(fp, numShards);
+
+}
+
+
+size_t gs1_partitionBatch(const struct gs1DLparser *ctxs, size_t count, const char * const *ais, int numShards,
+			  int *shards, size_t *offsets, size_t *rows) {
+
+	size_t i, s, n, assigned = 0;
+
+	if (numShards < 1)
+		return 0;
+	n = (size_t)numShards;
+
+	// Rows without the AIs fall into a final bucket after the shards
+	memset(offsets, 0, (n + 2) * sizeof(offsets[0]));
+	for (i = 0; i < count; i++) {
+		shards[i] = gs1_shardOf(&ctxs[i], ais, numShards);
+		offsets[(shards[i] >= 0 ? (size_t)shards[i] : n) + 1]++;
+	}
+
+	for (s = 0; s <= n; s++)
+		offsets[s + 1] += offsets[s];
+	assigned = offsets[n];
+
+	// Stable scatter of row indices, reusing offsets as cursors
+	for (i = 0; i < count; i++)
+		rows[offsets[shards[i] >= 0 ? (size_t)shards[i] : n]++] = i;
+
+	for (s = n + 1; s > 0; s--)
+		offsets[s] = offsets[s - 1];
+	offsets[0] = 0;
+
+	return assigned;
+
+}
+
+/*
+ *  LSD radix sort of packed keys carrying row indices
+ *
+ *  Eight passes of eight bits each. A pass is split into counting and
+ *  scattering over chunks of the input so that callers can run the chunks of
+ *  a pass on separate threads.
+ *
+ */
+
+void gs1_radixCount(const uint64_t *keys, size_t count, int pass, size_t *hist) {
+
+	size_t i;
+	unsigned int shift = (unsigned int)pass * 8;
+
+	memset(hist, 0, GS1_DL_RADIX_BUCKETS * sizeof(hist[0]));
+	for (i = 0; i < count; i++)
+		hist[(keys[i] >> shift) & 0xFF]++;
+
+}
+
+
+void gs1_radixOffsets(size_t *hists, size_t numChunks) {
+
+	size_t b, c, n, sum = 0;
+
+	// Bucket-major, so each chunk's keys follow those of earlier chunks
+	for (b = 0; b < GS1_DL_RADIX_BUCKETS; b++)
+		for (c = 0; c < numChunks; c++) {
+			n = hists[c * GS1_DL_RADIX_BUCKETS + b];
+			hists[c * GS1_DL_RADIX_BUCKETS + b] = sum;
+			sum += n;
+		}
+
+}
+
+
+void gs1_radixScatter(const uint64_t *keys, const size_t *rows, size_t count, int pass, size_t *offsets,
+		      uint64_t *outKeys, size_t *outRows) {
+
+	size_t i, at;
+	unsigned int shift = (unsigned int)pass * 8;
+
+	for (i = 0; i < count; i++) {
+		at = offsets[(keys[i] >> shift) & 0xFF]++;
+		outKeys[at] = keys[i];
+		outRows[at] = rows[i];
+	}
+
+}
+
+
+void gs1_radixSort(uint64_t *keys, size_t *rows, size_t count, uint64_t *tmpKeys, size_t *tmpRows) {
+
+	size_t hist[8][GS1_DL_RADIX_BUCKETS];
+	uint64_t *k = keys, *kt = tmpKeys, *ks, first = count ? keys[0] : 0;
+	size_t *r = rows, *rt = tmpRows, *rs, i;
+	int pass;
+
+	// All histograms from a single read of the keys
+	memset(hist, 0, sizeof(hist));
+	for (i = 0; i < count; i++)
+		for (pass = 0; pass < 8; pass++)
+			hist[pass][(keys[i] >> (pass * 8)) & 0xFF]++;
+
+	for (pass = 0; pass < 8; pass++) {
+
+		// Skip bytes shared by every key, e.g. the high bytes of GTINs
+		if (hist[pass][(first >> (pass * 8)) & 0xFF] == count)
+			continue;
+
+		gs1_radixOffsets(hist[pass], 1);
+		gs1_radixScatter(k, r, count, pass, hist[pass], kt, rt);
+		ks = k;
+		k = kt;
+		kt = ks;
+		rs = r;
+		r = rt;
+		rt = rs;
+
+	}
+
+	if (k != keys) {
+		memcpy(keys, k, count * sizeof(keys[0]));
+		memcpy(rows, r, count * sizeof(rows[0]));
+	}
+
+}
+
+
+size_t gs1_groupBoundaries(const uint64_t *keys, size_t count, size_t *starts) {
+
+	size_t i, n = 0;
+
+	for (i = 0; i < count; i++)
+		if (i == 0 || keys[i] != keys[i - 1])
+			starts[n++] = i;
+	starts[n] = count;
+
+	return n;
+
+}
+
+/*
+ *  Arrow IPC stream writer
+ *
+ *  Messages are encapsulated as a continuation marker, the length of the
+ *  metadata, the metadata as a FlatBuffers "Message", then the body. The
+ *  FlatBuffers are laid out front to back: each table is preceded by its
+ *  vtable and followed by the objects that it references, whose offsets are
+ *  patched in once they are placed.
+ *
+ */
+
+#define ARROW_CONTINUATION	0xFFFFFFFFU
+#define ARROW_V5		4		// MetadataVersion
+#define ARROW_SCHEMA		1		// MessageHeader
+#define ARROW_RECORD_BATCH	3
+#define ARROW_UTF8		5		// Type
+#define ARROW_MAX_META		4096
+#define ARROW_CHUNK		256
+#define FB_MAX_FIELDS		6		// Fields of the largest table written, Field
+
+struct fbBuilder {
+	unsigned char buf[ARROW_MAX_META];
+	size_t len;
+	bool overflow;
+};
+
+
+static size_t fbPut(struct fbBuilder *fb, const void *data, size_t n) {
+
+	size_t at = fb->len;
+
+	if (fb->len + n > sizeof(fb->buf)) {
+		fb->overflow = true;
+		return at;
+	}
+	if (data)
+		memcpy(fb->buf + fb->len, data, n);
+	else
+		memset(fb->buf + fb->len, 0, n);
+	fb->len += n;
+
+	return at;
+
+}
+
+
+static void fbAlign(struct fbBuilder *fb, size_t align, size_t rem) {
+	while (fb->len % align != rem && !fb->overflow)
+		fbPut(fb, NULL, 1);
+}
+
+
+static size_t fbPutU32(struct fbBuilder *fb, uint32_t v) {
+	return fbPut(fb, &v, sizeof(v));
+}
+
+
+/*
+ *  Point the offset field at "at" to the target position, which follows it
+ *
+ */
+static void fbPatch(struct fbBuilder *fb, size_t at, size_t target) {
+
+	uint32_t off = (uint32_t)(target - at);
+
+	if (!fb->overflow)
+		memcpy(fb->buf + at, &off, sizeof(off));
+
+}
+
+
+/*
+ *  Write a table whose field i has size sizes[i] (0 if absent) and value
+ *  values[i]. Offset fields are written as zero and their positions returned
+ *  in pos for patching. There are at most FB_MAX_FIELDS fields.
+ *
+ */
+static size_t fbTable(struct fbBuilder *fb, int numFields, const unsigned char *sizes, const void * const *values, size_t *pos) {
+
+	uint16_t vt[2 + FB_MAX_FIELDS];
+	size_t off = 4, vtpos, tbl;
+	int32_t soff;
+	int i;
+
+	// Fields aligned to their size, relative to an 8-aligned table start
+	for (i = 0; i < numFields; i++) {
+		vt[2 + i] = 0;
+		if (sizes[i]) {
+			off = (off + sizes[i] - 1) / sizes[i] * sizes[i];
+			vt[2 + i] = (uint16_t)off;
+			off += sizes[i];
+		}
+	}
+	vt[0] = (uint16_t)(4 + 2 * numFields);
+	vt[1] = (uint16_t)off;
+
+	fbAlign(fb, 8, (8 - (size_t)vt[0] % 8) % 8);
+	vtpos = fbPut(fb, vt, vt[0]);
+	tbl = fb->len;
+	soff = (int32_t)(tbl - vtpos);
+	fbPut(fb, &soff, sizeof(soff));
+
+	for (i = 0; i < numFields; i++)
+		if (sizes[i]) {
+			fbAlign(fb, sizes[i], 0);
+			pos[i] = fbPut(fb, values ? values[i] : NULL, sizes[i]);
+		}
+
+	return tbl;
+
+}
+
+
+static void fbString(struct fbBuilder *fb, size_t at, const char *s) {
+	fbAlign(fb, 4, 0);
+	fbPatch(fb, at, fbPutU32(fb, (uint32_t)strlen(s)));
+	fbPut(fb, s, strlen(s) + 1);
+}
+
+
+/*
+ *  Start a Message with the given header type. Returns the position of the
+ *  header offset, to be patched with the header table.
+ *
+ */
+static size_t arrowMessage(struct fbBuilder *fb, uint8_t headerType, int64_t bodyLength) {
+
+	static const unsigned char sizes[4] = { 2, 1, 4, 8 };		// version, header_type, header, bodyLength
+	const int16_t version = ARROW_V5;
+	const void *values[4];
+	size_t root, pos[4];
+
+	values[0] = &version;
+	values[1] = &headerType;
+	values[2] = NULL;
+	values[3] = &bodyLength;
+
+	fb->len = 0;
+	fb->overflow = false;
+	root = fbPutU32(fb, 0);
+	fbPatch(fb, root, fbTable(fb, 4, sizes, values, pos));
+
+	return pos[2];
+
+}
+
+
+static bool arrowWrite(struct gs1DLarrowWriter *w, const void *data, size_t len) {
+	if (!w->write(w->arg, data, len)) {
+		strcpy(w->err, "Failed to write Arrow stream");
+		return false;
+	}
+	return true;
+}
+
+
+/*
+ *  Write an encapsulated message, with the metadata padded to 8 bytes
+ *
+ */
+static bool arrowEmit(struct gs1DLarrowWriter *w, struct fbBuilder *fb) {
+
+	uint32_t hdr[2];
+
+	fbAlign(fb, 8, 0);
+	if (fb->overflow) {
+		strcpy(w->err, "Arrow metadata is too large");
+		return false;
+	}
+
+	hdr[0] = ARROW_CONTINUATION;
+	hdr[1] = (uint32_t)fb->len;
+
+	return arrowWrite(w, hdr, sizeof(hdr)) && arrowWrite(w, fb->buf, fb->len);
+
+}
+
+
+bool gs1_arrowBegin(struct gs1DLarrowWriter *w, const char * const *ais, int numColumns, gs1_writeFunc write, void *arg) {
+
+	static const unsigned char schemaSizes[2] = { 0, 4 };		// endianness (little), fields
+	static const unsigned char fieldSizes[6] = { 4, 1, 1, 4, 0, 4 };	// name, nullable, type_type, type, dictionary, children
+	const uint8_t nullable = 1, typeType = ARROW_UTF8;
+	const void *values[6];
+	const uint16_t one = 1;
+	struct fbBuilder fb;
+	size_t header, vec, pos[6], ailen;
+	int i;
+
+	*w->err = '\0';
+
+	if (*(const unsigned char *)&one != 1) {
+		strcpy(w->err, "Arrow output requires a little-endian host");
+		return false;
+	}
+	if (numColumns < 1 || numColumns > GS1_DL_ARROW_MAX_COLUMNS) {
+		sprintf(w->err, "Number of columns must be 1 to %d", GS1_DL_ARROW_MAX_COLUMNS);
+		return false;
+	}
+	for (i = 0; i < numColumns; i++) {
+		ailen = strlen(ais[i]);
+		if (ailen < 2 || ailen > 4 || !allDigits(ais[i], ailen)) {
+			strcpy(w->err, "Column AI must be 2 to 4 digits");
+			return false;
+		}
+		strcpy(w->ais[i], ais[i]);
+	}
+	w->numColumns = numColumns;
+	w->write = write;
+	w->arg = arg;
+
+	header = arrowMessage(&fb, ARROW_SCHEMA, 0);
+	fbPatch(&fb, header, fbTable(&fb, 2, schemaSizes, NULL, pos));
+
+	// Vector of Field tables, one nullable Utf8 column per AI
+	fbAlign(&fb, 4, 0);
+	fbPatch(&fb, pos[1], fbPutU32(&fb, (uint32_t)numColumns));
+	vec = fb.len;
+	for (i = 0; i < numColumns; i++)
+		fbPutU32(&fb, 0);
+
+	values[1] = &nullable;
+	values[2] = &typeType;
+	values[0] = values[3] = values[4] = values[5] = NULL;
+	for (i = 0; i < numColumns; i++) {
+		fbPatch(&fb, vec + 4 * (size_t)i, fbTable(&fb, 6, fieldSizes, values, pos));
+		fbString(&fb, pos[0], w->ais[i]);
+		fbPatch(&fb, pos[3], fbTable(&fb, 0, NULL, NULL, NULL));	// Utf8 has no fields
+		fbAlign(&fb, 4, 0);
+		fbPatch(&fb, pos[5], fbPutU32(&fb, 0));			// No children
+	}
+
+	return arrowEmit(w, &fb);
+
+}
+
+
+static bool arrowPad(struct gs1DLarrowWriter *w, size_t len) {
+	static const unsigned char zeros[8] = { 0 };
+	return len % 8 == 0 || arrowWrite(w, zeros, 8 - len % 8);
+}
+
+
+static size_t pad8(size_t len) {
+	return (len + 7) / 8 * 8;
+}
+
+
+bool gs1_arrowWriteBatch(struct gs1DLarrowWriter *w, const struct gs1DLparser *ctxs, size_t count) {
+
+	static const unsigned char batchSizes[3] = { 8, 4, 4 };		// length, nodes, buffers
+	const struct gs1AIelement *e;
+	struct fbBuilder fb;
+	const void *values[3];
+	size_t header, pos[3], i, j, n, dataLen[GS1_DL_ARROW_MAX_COLUMNS];
+	int64_t nulls[GS1_DL_ARROW_MAX_COLUMNS], length = (int64_t)count, v[2], body = 0;
+	unsigned char bits[ARROW_CHUNK];
+	int32_t offsets[ARROW_CHUNK], off;
+	int c;
+
+	*w->err = '\0';
+
+	if (count > INT32_MAX / GS1_DL_MAX_AI_LEN) {
+		strcpy(w->err, "Too many rows in Arrow batch");
+		return false;
+	}
+
+	for (c = 0; c < w->numColumns; c++) {
+		nulls[c] = 0;
+		dataLen[c] = 0;
+		for (i = 0; i < count; i++)
+			if ((e = findAIelement(&ctxs[i], w->ais[c])) != NULL)
+				dataLen[c] += (size_t)e->vallen;
+			else
+				nulls[c]++;
+		body += (int64_t)(pad8((count + 7) / 8) + pad8((count + 1) * 4) + pad8(dataLen[c]));
+	}
+
+	values[0] = &length;
+	values[1] = values[2] = NULL;
+	header = arrowMessage(&fb, ARROW_RECORD_BATCH, body);
+	fbPatch(&fb, header, fbTable(&fb, 3, batchSizes, values, pos));
+
+	// FieldNode { length, null_count } per column
+	fbAlign(&fb, 8, 4);
+	fbPatch(&fb, pos[1], fbPutU32(&fb, (uint32_t)w->numColumns));
+	for (c = 0; c < w->numColumns; c++) {
+		v[0] = length;
+		v[1] = nulls[c];
+		fbPut(&fb, v, sizeof(v));
+	}
+
+	// Buffer { offset, length } for the validity, offsets and data of each column
+	fbAlign(&fb, 8, 4);
+	fbPatch(&fb, pos[2], fbPutU32(&fb, (uint32_t)(3 * w->numColumns)));
+	for (body = 0, c = 0; c < w->numColumns; c++) {
+		v[0] = body;
+		v[1] = (int64_t)((count + 7) / 8);
+		fbPut(&fb, v, sizeof(v));
+		body += (int64_t)pad8((size_t)v[1]);
+		v[0] = body;
+		v[1] = (int64_t)((count + 1) * 4);
+		fbPut(&fb, v, sizeof(v));
+		body += (int64_t)pad8((size_t)v[1]);
+		v[0] = body;
+		v[1] = (int64_t)dataLen[c];
+		fbPut(&fb, v, sizeof(v));
+		body += (int64_t)pad8((size_t)v[1]);
+	}
+
+	if (!arrowEmit(w, &fb))
+		return false;
+
+	for (c = 0; c < w->numColumns; c++) {
+
+		// Validity bitmap, least significant bit first
+		for (i = 0; i < count; i += n) {
+			n = count - i < ARROW_CHUNK * 8 ? count - i : ARROW_CHUNK * 8;
+			memset(bits, 0, sizeof(bits));
+			for (j = 0; j < n; j++)
+				if (findAIelement(&ctxs[i + j], w->ais[c]))
+					bits[j / 8] |= (unsigned char)(1 << (j % 8));
+			if (!arrowWrite(w, bits, (n + 7) / 8))
+				return false;
+		}
+		if (!arrowPad(w, (count + 7) / 8))
+			return false;
+
+		// Offsets, with nulls taking no space
+		offsets[0] = off = 0;
+		for (n = 1, i = 0; i < count; i++) {
+			if ((e = findAIelement(&ctxs[i], w->ais[c])) != NULL)
+				off += e->vallen;
+			offsets[n++] = off;
+			if (n == ARROW_CHUNK) {
+				if (!arrowWrite(w, offsets, n * sizeof(offsets[0])))
+					return false;
+				n = 0;
+			}
+		}
+		if (!arrowWrite(w, offsets, n * sizeof(offsets[0])) || !arrowPad(w, (count + 1) * 4))
+			return false;
+
+		// Values are written directly from each context
+		for (i = 0; i < count; i++)
+			if ((e = findAIelement(&ctxs[i], w->ais[c])) != NULL &&
+			    !arrowWrite(w, e->value, (size_t)e->vallen))
+				return false;
+		if (!arrowPad(w, dataLen[c]))
+			return false;
+
+	}
+
+	return true;
+
+}
+
+
+bool gs1_arrowEnd(struct gs1DLarrowWriter *w) {
+
+	static const uint32_t eos[2] = { ARROW_CONTINUATION, 0 };
+
+	*w->err = '\0';
+
+	return arrowWrite(w, eos, sizeof(eos));
+
+}
+
+/*
+ *  Compact binary records
+ *
+ *  A record is a format byte and a varint element count, then for each
+ *  element a flags byte, the AI as a varint, the value length as a varint
+ *  and the value. The flags carry the number of AI digits so that leading
+ *  zeros survive.
+ *
+ */
+
+#define BIN_FORMAT		0xB1
+#define BIN_FLAG_FNC1		0x01
+#define BIN_FLAG_QUERY		0x02
+#define BIN_FLAG_AILEN_SHIFT	2		// Two bits: AI digits - 2
+
+static bool putVarint(unsigned char **p, const unsigned char *end, uint32_t v) {
+
+	do {
+		if (*p == end)
+			return false;
+		*(*p)++ = (unsigned char)((v & 0x7F) | (v > 0x7F ? 0x80 : 0));
+		v >>= 7;
+	} while (v);
+
+	return true;
+
+}
+
+
+/*
+ *  Read a varint, rejecting those that exceed 32 bits or are not in their
+ *  shortest form
+ *
+ */
+static bool getVarint(const unsigned char **p, const unsigned char *end, uint32_t *v) {
+
+	unsigned int shift;
+	unsigned char b;
+
+	for (*v = 0, shift = 0; *p < end && shift < 32; shift += 7) {
+		b = *(*p)++;
+		if (shift == 28 && (b & 0x70) != 0)
+			return false;
+		*v |= (uint32_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+			return b != 0 || shift == 0;
+	}
+
+	return false;
+
+}
+
+
+size_t gs1_writeBinary(struct gs1DLparser *ctx, unsigned char *out, size_t maxlen) {
+
+	const struct gs1AIelement *ai;
+	unsigned char *p = out;
+	const unsigned char *end = out + maxlen;
+	unsigned char flags;
+	uint32_t code;
+	int i, j;
+
+	*ctx->err = '\0';
+
+	if (maxlen == 0)
+		goto overflow;
+	*p++ = BIN_FORMAT;
+	if (!putVarint(&p, end, (uint32_t)ctx->numAIs))
+		goto overflow;
+
+	for (i = 0; i < ctx->numAIs; i++) {
+		ai = &ctx->aiData[i];
+
+		// Not representable, as readers reject empty values
+		if (ai->vallen == 0) {
+			sprintf(ctx->err, "AI (%.*s) value is empty", ai->ailen, ai->ai);
+			return 0;
+		}
+
+		flags = (unsigned char)((ai->fnc1 ? BIN_FLAG_FNC1 : 0) | (ai->inQuery ? BIN_FLAG_QUERY : 0) |
+					(ai->ailen - 2) << BIN_FLAG_AILEN_SHIFT);
+		for (code = 0, j = 0; j < ai->ailen; j++)
+			code = code * 10 + (uint32_t)(ai->ai[j] - '0');
+
+		if (p == end)
+			goto overflow;
+		*p++ = flags;
+		if (!putVarint(&p, end, code) || !putVarint(&p, end, (uint32_t)ai->vallen) ||
+		    (size_t)(end - p) < (size_t)ai->vallen)
+			goto overflow;
+		memcpy(p, ai->value, (size_t)ai->vallen);
+		p += ai->vallen;
+	}
+
+	return (size_t)(p - out);
+
+overflow:
+
+	strcpy(ctx->err, "Output buffer is too small");
+	return 0;
+
+}
+
+
+bool gs1_binaryReaderInit(struct gs1DLbinaryReader *r, const void *buf, size_t len) {
+
+	static const uint32_t aiLimit[] = { 100, 1000, 10000 };
+	const unsigned char *p = buf, *end = p + len;
+	uint32_t count, code, vallen, i, digits;
+
+	// Validate the whole record so that reading elements cannot fail
+	if (len < 2 || *p++ != BIN_FORMAT || !getVarint(&p, end, &count) || count > GS1_DL_MAX_AIS)
+		return false;
+	r->p = p;
+	for (i = 0; i < count; i++) {
+		if (p == end || (digits = (uint32_t)*p >> BIN_FLAG_AILEN_SHIFT) > 2)
+			return false;
+		p++;
+		if (!getVarint(&p, end, &code) || code >= aiLimit[digits] ||
+		    !getVarint(&p, end, &vallen) || vallen == 0 || vallen > GS1_DL_MAX_AI_LEN || (size_t)(end - p) < vallen)
+			return false;
+		p += vallen;
+	}
+	if (p != end)
+		return false;
+
+	r->end = end;
+	r->remaining = (int)count;
+
+	return true;
+
+}
+
+
+bool gs1_binaryNext(struct gs1DLbinaryReader *r, struct gs1DLbinaryElement *elem) {
+
+	uint32_t code, vallen;
+	unsigned char flags;
+	int n;
+
+	if (r->remaining == 0)
+		return false;
+	r->remaining--;
+
+	flags = *r->p++;
+	getVarint(&r->p, r->end, &code);
+	getVarint(&r->p, r->end, &vallen);
+
+	n = 2 + (flags >> BIN_FLAG_AILEN_SHIFT);
+	elem->ai[n] = '\0';
+	while (n--) {
+		elem->ai[n] = (char)('0' + code % 10);
+		code /= 10;
+	}
+	elem->value = (const char *)r->p;
+	elem->vallen = vallen;
+	elem->fnc1 = (flags & BIN_FLAG_FNC1) != 0;
+	elem->inQuery = (flags & BIN_FLAG_QUERY) != 0;
+	r->p += vallen;
+
+	return true;
+
+}
+
+
+bool gs1_parseBinary(struct gs1DLparser *ctx, const void *buf, size_t len) {
+
+	struct gs1DLbinaryReader r;
+	struct gs1DLbinaryElement e;
+
+	*ctx->aiBuf = '\0';
+	*ctx->err = '\0';
+	ctx->numAIs = 0;
+	ctx->numQueryParams = 0;
+	memset(&ctx->uriParts, 0, sizeof(ctx->uriParts));
+
+	if (!gs1_binaryReaderInit(&r, buf, len)) {
+		strcpy(ctx->err, "Invalid binary record");
+		goto fail;
+	}
+
+	while (gs1_binaryNext(&r, &e)) {
+		if (memchr(e.value, '\0', e.vallen)) {
+			strcpy(ctx->err, "Invalid binary record");
+			goto fail;
+		}
+		if (!addAIelement(ctx, e.ai, strlen(e.ai), e.value, e.vallen))
+			goto fail;
+		ctx->aiData[ctx->numAIs - 1].inQuery = e.inQuery;
+	}
+
+	return true;
+
+fail:
+
+	ctx->numAIs = 0;
+	return false;
+
+}
+
+/*
+ *  Position-independent snapshots of a context
+ *
+ *  The snapshot is a header of uint32_t words, then a table of words for the
+ *  AI elements and another for the query parameters, then the string data:
+ *  a copy of aiBuf including its terminator followed by the URI parts and the
+ *  query parameter spans. All locations are offsets into the string data.
+ *
+ */
+
+#define SNAP_MAGIC		0x31534E31U		// "1NS1" on little-endian hosts
+#define SNAP_HEADER		14			// uint32_t words before the AI elements
+#define SNAP_AI_WORDS		3			// Offset of AI, offset of value, lengths and flags
+#define SNAP_QP_WORDS		4			// Offset and length of name, then of value
+#define SNAP_NO_VALUE		0xFFFFFFFFU		// Value offset of a query parameter without "="
+#define SNAP_FLAG_FNC1		0x01
+#define SNAP_FLAG_QUERY		0x02
+
+size_t gs1_writeSnapshot(const struct gs1DLparser *ctx, const char *dlData, void *buf, size_t maxlen) {
+
+	uint32_t *w = buf, *e;
+	char *strings;
+	const struct gs1AIelement *ai;
+	const struct gs1DLqueryParam *qp;
+	const struct gs1DLspan *parts[4];
+	size_t aiBufLen, stringsLen, at, len;
+	int i;
+
+	parts[0] = &ctx->uriParts.scheme;
+	parts[1] = &ctx->uriParts.domain;
+	parts[2] = &ctx->uriParts.stem;
+	parts[3] = &ctx->uriParts.fragment;
+
+	aiBufLen = strlen(ctx->aiBuf);
+	stringsLen = aiBufLen + 1;
+	if (dlData)
+		for (i = 0; i < 4; i++)
+			stringsLen += parts[i]->len;
+	for (i = 0; i < ctx->numQueryParams; i++)
+		stringsLen += ctx->queryParams[i].namelen + ctx->queryParams[i].vallen;
+
+	len = (SNAP_HEADER + (size_t)ctx->numAIs * SNAP_AI_WORDS + (size_t)ctx->numQueryParams * SNAP_QP_WORDS) *
+	      sizeof(uint32_t) + ((stringsLen + 3) & ~(size_t)3);
+	if (!buf || len > maxlen)
+		return len;
+
+	w[0] = SNAP_MAGIC;
+	w[1] = (uint32_t)len;
+	w[2] = (uint32_t)ctx->numAIs;
+	w[3] = (uint32_t)ctx->numQueryParams;
+	w[4] = (uint32_t)aiBufLen;
+	w[5] = (uint32_t)stringsLen;
+
+	e = w + SNAP_HEADER;
+	strings = (char *)(e + ctx->numAIs * SNAP_AI_WORDS + ctx->numQueryParams * SNAP_QP_WORDS);
+
+	for (i = 0; i < ctx->numAIs; i++, e += SNAP_AI_WORDS) {
+		ai = &ctx->aiData[i];
+		e[0] = (uint32_t)(ai->ai - ctx->aiBuf);
+		e[1] = (uint32_t)(ai->value - ctx->aiBuf);
+		e[2] = (uint32_t)ai->ailen | (uint32_t)ai->vallen << 8 |
+		       (uint32_t)((ai->fnc1 ? SNAP_FLAG_FNC1 : 0) | (ai->inQuery ? SNAP_FLAG_QUERY : 0)) << 24;
+	}
+
+	memcpy(strings, ctx->aiBuf, aiBufLen + 1);
+	at = aiBufLen + 1;
+
+	// Header words 6 to 13 locate the URI parts, which are copied since the URI is not
+	for (i = 0; i < 4; i++) {
+		w[6 + 2 * i] = (uint32_t)at;
+		w[7 + 2 * i] = dlData ? (uint32_t)parts[i]->len : 0;
+		if (dlData)
+			memcpy(strings + at, dlData + parts[i]->offset, parts[i]->len);
+		at += w[7 + 2 * i];
+	}
+
+	for (i = 0; i < ctx->numQueryParams; i++, e += SNAP_QP_WORDS) {
+		qp = &ctx->queryParams[i];
+		e[0] = (uint32_t)at;
+		e[1] = (uint32_t)qp->namelen;
+		memcpy(strings + at, qp->name, qp->namelen);
+		at += qp->namelen;
+		e[2] = qp->value ? (uint32_t)at : SNAP_NO_VALUE;
+		e[3] = (uint32_t)qp->vallen;
+		if (qp->value)
+			memcpy(strings + at, qp->value, qp->vallen);
+		at += qp->vallen;
+	}
+	memset(strings + at, 0, (size_t)((char *)w + len - (strings + at)));
+
+	return len;
+
+}
+
+
+bool gs1_loadSnapshot(struct gs1DLsnapshot *snap, const void *buf, size_t len) {
+
+	const uint32_t *w = buf, *e;
+	const char *strings;
+	uint32_t aiBufLen, stringsLen, ailen, vallen, j;
+	int numAIs, numQueryParams, i;
+
+	if (((uintptr_t)buf & (sizeof(uint32_t) - 1)) != 0 ||
+	    len < SNAP_HEADER * sizeof(uint32_t) || w[0] != SNAP_MAGIC || w[1] != len ||
+	    w[2] > GS1_DL_MAX_AIS || w[3] > GS1_DL_MAX_QUERY_PARAMS)
+		return false;
+
+	numAIs = (int)w[2];
+	numQueryParams = (int)w[3];
+	aiBufLen = w[4];
+	stringsLen = w[5];
+	if (aiBufLen >= GS1_DL_MAX_AI_BUF || aiBufLen >= stringsLen ||
+	    len != (SNAP_HEADER + (size_t)numAIs * SNAP_AI_WORDS + (size_t)numQueryParams * SNAP_QP_WORDS) *
+		   sizeof(uint32_t) + ((stringsLen + 3) & ~(size_t)3))
+		return false;
+
+	e = w + SNAP_HEADER;
+	strings = (const char *)(e + numAIs * SNAP_AI_WORDS + numQueryParams * SNAP_QP_WORDS);
+	if (memchr(strings, '\0', aiBufLen) != NULL || strings[aiBufLen] != '\0')
+		return false;
+	for (j = 6; j < SNAP_HEADER; j += 2)
+		if (w[j] > stringsLen || w[j + 1] > stringsLen - w[j])
+			return false;
+
+	// Validate every location so that the accessors cannot read out of bounds
+	for (i = 0; i < numAIs; i++, e += SNAP_AI_WORDS) {
+		ailen = e[2] & 0xFF;
+		vallen = (e[2] >> 8) & 0xFFFF;
+		if (ailen < 2 || ailen > 4 || vallen > GS1_DL_MAX_AI_LEN || ailen > aiBufLen || vallen > aiBufLen ||
+		    e[0] > aiBufLen - ailen || e[1] > aiBufLen - vallen)
+			return false;
+		for (j = 0; j < ailen; j++)
+			if (strings[e[0] + j] < '0' || strings[e[0] + j] > '9')
+				return false;
+	}
+	for (i = 0; i < numQueryParams; i++, e += SNAP_QP_WORDS) {
+		if (e[0] > stringsLen || e[1] > stringsLen - e[0] ||
+		    (e[2] == SNAP_NO_VALUE ? e[3] != 0 : e[2] > stringsLen || e[3] > stringsLen - e[2]))
+			return false;
+	}
+
+	snap->elements = w + SNAP_HEADER;
+	snap->strings = strings;
+	snap->numAIs = numAIs;
+	snap->numQueryParams = numQueryParams;
+	snap->uriParts.scheme.offset = w[6];
+	snap->uriParts.scheme.len = w[7];
+	snap->uriParts.domain.offset = w[8];
+	snap->uriParts.domain.len = w[9];
+	snap->uriParts.stem.offset = w[10];
+	snap->uriParts.stem.len = w[11];
+	snap->uriParts.fragment.offset = w[12];
+	snap->uriParts.fragment.len = w[13];
+
+	return true;
+
+}
+
+
+void gs1_snapshotAI(const struct gs1DLsnapshot *snap, int i, struct gs1DLbinaryElement *elem) {
+
+	const uint32_t *e = snap->elements + i * SNAP_AI_WORDS;
+	size_t ailen = e[2] & 0xFF;
+
+	memcpy(elem->ai, snap->strings + e[0], ailen);
+	elem->ai[ailen] = '\0';
+	elem->value = snap->strings + e[1];
+	elem->vallen = (e[2] >> 8) & 0xFFFF;
+	elem->fnc1 = ((e[2] >> 24) & SNAP_FLAG_FNC1) != 0;
+	elem->inQuery = ((e[2] >> 24) & SNAP_FLAG_QUERY) != 0;
+
+}
+
+
+void gs1_snapshotQueryParam(const struct gs1DLsnapshot *snap, int i, struct gs1DLqueryParam *qp) {
+
+	const uint32_t *e = snap->elements + snap->numAIs * SNAP_AI_WORDS + i * SNAP_QP_WORDS;
+
+	qp->name = snap->strings + e[0];
+	qp->namelen = e[1];
+	qp->value = e[2] == SNAP_NO_VALUE ? NULL : snap->strings + e[2];
+	qp->vallen = e[3];
+
+}
+
+
+void gs1_restoreSnapshot(struct gs1DLparser *ctx, const struct gs1DLsnapshot *snap) {
+
+	struct gs1AIelement *ai;
+	struct gs1DLbinaryElement elem;
+	const uint32_t *e;
+	int i;
+
+	*ctx->err = '\0';
+
+	// The AI data is rebased onto the context's own copy of aiBuf
+	strcpy(ctx->aiBuf, snap->strings);
+	for (i = 0, e = snap->elements; i < snap->numAIs; i++, e += SNAP_AI_WORDS) {
+		gs1_snapshotAI(snap, i, &elem);
+		ai = &ctx->aiData[i];
+		ai->ai = ctx->aiBuf + e[0];
+		ai->ailen = (short)strlen(elem.ai);
+		ai->value = ctx->aiBuf + e[1];
+		ai->vallen = (short)elem.vallen;
+		ai->fnc1 = elem.fnc1;
+		ai->inQuery = elem.inQuery;
+	}
+	ctx->numAIs = snap->numAIs;
+
+	for (i = 0; i < snap->numQueryParams; i++)
+		gs1_snapshotQueryParam(snap, i, &ctx->queryParams[i]);
+	ctx->numQueryParams = snap->numQueryParams;
+
+	memset(&ctx->uriParts, 0, sizeof(ctx->uriParts));
+
+}
+
+#ifdef UNIT_TESTS
+
+#if defined(__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wgnu-folding-constant"
+#pragma clang diagnostic ignored "-Wimplicit-int-float-conversion"
+#pragma clang diagnostic ignored "-Wsign-conversion"
+#pragma clang diagnostic ignored "-Wdeclaration-after-statement"
+#elif defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wdeclaration-after-statement"
+#endif
+#include "acutest.h"
+#if defined(__clang__)
+#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+
+static void test_parseDLuri(struct gs1DLparser *ctx, bool should_succeed, const char *dlData,
+			    const char* expect_unbracketed_unsorted,
+			    const char* expect_unbracketed_ExtraFNC1_unsorted,
+			    const char* expect_bracketed_unsorted,
+			    const char* expect_JSON_unsorted,
+			    const char* expect_unbracketed_sorted,
+			    const char* expect_unbracketed_ExtraFNC1_sorted,
+			    const char* expect_bracketed_sorted,
+			    const char* expect_JSON_sorted) {
+
+	char in[256];
+	char out[256];
+	char casename[256];
+
+	sprintf(casename, "%s", dlData);
+	TEST_CASE(casename);
+
+	strcpy(in, dlData);
+
+	TEST_CHECK(gs1_parseDLuri(ctx, in) ^ (!should_succeed));
+	TEST_MSG("Err: %s", ctx->err);
+
+	TEST_CHECK(strcmp(dlData, in) == 0);
+	TEST_MSG("Input data was erroneously clobbered: %s", in);
+
+	if (!should_succeed)
+		return;
+
+	gs1_writeUnbracketedAIelementString(ctx, false, false, out);
+	TEST_CHECK(strcmp(out, expect_unbracketed_unsorted) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_unbracketed_unsorted, ctx->err);
+
+	gs1_writeUnbracketedAIelementString(ctx, false, true, out);
+	TEST_CHECK(strcmp(out, expect_unbracketed_ExtraFNC1_unsorted) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_unbracketed_ExtraFNC1_unsorted, ctx->err);
+
+	gs1_writeBracketedAIelementString(ctx, false, out);
+	TEST_CHECK(strcmp(out, expect_bracketed_unsorted) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_bracketed_unsorted, ctx->err);
+
+	gs1_writeJSON(ctx, false, out);
+	TEST_CHECK(strcmp(out, expect_JSON_unsorted) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_JSON_unsorted, ctx->err);
+
+	gs1_writeUnbracketedAIelementString(ctx, true, false, out);
+	TEST_CHECK(strcmp(out, expect_unbracketed_sorted) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_unbracketed_sorted, ctx->err);
+
+	gs1_writeUnbracketedAIelementString(ctx, true, true, out);
+	TEST_CHECK(strcmp(out, expect_unbracketed_ExtraFNC1_sorted) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_unbracketed_ExtraFNC1_sorted, ctx->err);
+
+	gs1_writeBracketedAIelementString(ctx, true, out);
+	TEST_CHECK(strcmp(out, expect_bracketed_sorted) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_bracketed_sorted, ctx->err);
+
+	gs1_writeJSON(ctx, true, out);
+	TEST_CHECK(strcmp(out, expect_JSON_sorted) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect_JSON_sorted, ctx->err);
+
+}
+
+static void test_dl_parseDLuri(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+
+	/*
+	 *  Order of expected output params:
+	 *
+	 *    - Unbracketed with standard FNC1s
+	 *    - Unbracketed with extraneous FNC1s
+	 *    - Bracketed syntax
+	 *    - JSON
+	 *    - Unbracketed with standard FNC1s; fixed-length AIs first
+	 *    - Unbracketed with extraneous FNC1s; fixed-length AIs first
+	 *    - Bracketed syntax; fixed-length AIs first
+	 *    - JSON; fixed-length AIs first
+	 *
+	 */
+
+	test_parseDLuri(ctx, false,  "", "", "", "", "", "", "", "", "");
+	test_parseDLuri(ctx, false,  "ftp://", "", "", "", "", "", "", "", "");
+	test_parseDLuri(ctx, false,  "http://", "", "", "", "", "", "", "", "");
+	test_parseDLuri(ctx, false,  "http:///", "", "", "", "", "", "", "", "");	// No domain
+	test_parseDLuri(ctx, false,  "http://a", "", "", "", "", "", "", "", "");	// No path info
+	test_parseDLuri(ctx, false,  "http://a/", "", "", "", "", "", "", "", "");	// Pathelogical minimal domain but no AI info
+	test_parseDLuri(ctx, false,  "http://a/b", "", "", "", "", "", "", "", "");	// Stem, no data
+	test_parseDLuri(ctx, false,  "http://a/b/", "", "", "", "", "", "", "", "");
+
+	test_parseDLuri(ctx, true,					// http
+		"http://a/00/006141411234567890",
+		"^00006141411234567890",
+		"^00006141411234567890",
+		"(00)006141411234567890",
+		"{\"00\":\"006141411234567890\"}",
+		"^00006141411234567890",
+		"^00006141411234567890",
+		"(00)006141411234567890",
+		"{\"00\":\"006141411234567890\"}");
+
+	test_parseDLuri(ctx, true,					// https
+		"https://a/00/006141411234567890",
+		"^00006141411234567890",
+		"^00006141411234567890",
+		"(00)006141411234567890",
+		"{\"00\":\"006141411234567890\"}",
+		"^00006141411234567890",
+		"^00006141411234567890",
+		"(00)006141411234567890",
+		"{\"00\":\"006141411234567890\"}");
+
+	test_parseDLuri(ctx, false,					// No domain
+		"https://00/006141411234567890",
+		"", "", "", "", "", "", "", "");
+
+	test_parseDLuri(ctx, true,
+		"https://a/stem/00/006141411234567890",
+		"^00006141411234567890",
+		"^00006141411234567890",
+		"(00)006141411234567890",
+		"{\"00\":\"006141411234567890\"}",
+		"^00006141411234567890",
+		"^00006141411234567890",
+		"(00)006141411234567890",
+		"{\"00\":\"006141411234567890\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/more/stem/00/006141411234567890",
+		"^00006141411234567890",
+		"^00006141411234567890",
+		"(00)006141411234567890",
+		"{\"00\":\"006141411234567890\"}",
+		"^00006141411234567890",
+		"^00006141411234567890",
+		"(00)006141411234567890",
+		"{\"00\":\"006141411234567890\"}");
+
+	test_parseDLuri(ctx, true,					// Fake AI in stem, stop at rightmost key
+		"https://a/00/faux/00/006141411234567890",
+		"^00006141411234567890",
+		"^00006141411234567890",
+		"(00)006141411234567890",
+		"{\"00\":\"006141411234567890\"}",
+		"^00006141411234567890",
+		"^00006141411234567890",
+		"(00)006141411234567890",
+		"{\"00\":\"006141411234567890\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/01/12312312312333",
+		"^0112312312312333",
+		"^0112312312312333",
+		"(01)12312312312333",
+		"{\"01\":\"12312312312333\"}",
+		"^0112312312312333",
+		"^0112312312312333",
+		"(01)12312312312333",
+		"{\"01\":\"12312312312333\"}");
+
+	test_parseDLuri(ctx, true,					// GTIN-13 -> GTIN-14
+		"https://a/01/2112345678900",
+		"^0102112345678900",
+		"^0102112345678900",
+		"(01)02112345678900",
+		"{\"01\":\"02112345678900\"}",
+		"^0102112345678900",
+		"^0102112345678900",
+		"(01)02112345678900",
+		"{\"01\":\"02112345678900\"}");
+
+	test_parseDLuri(ctx, true,					// GTIN-12 -> GTIN-14
+		"https://a/01/416000336108",
+		"^0100416000336108",
+		"^0100416000336108",
+		"(01)00416000336108",
+		"{\"01\":\"00416000336108\"}",
+		"^0100416000336108",
+		"^0100416000336108",
+		"(01)00416000336108",
+		"{\"01\":\"00416000336108\"}");
+
+	test_parseDLuri(ctx, true,					// GTIN-8 -> GTIN-14
+		"https://a/01/02345673",
+		"^0100000002345673",
+		"^0100000002345673",
+		"(01)00000002345673",
+		"{\"01\":\"00000002345673\"}",
+		"^0100000002345673",
+		"^0100000002345673",
+		"(01)00000002345673",
+		"{\"01\":\"00000002345673\"}");
+
+	// Invalid-length AI components
+	test_parseDLuri(ctx, false,  "https://a/01/12312312312333/9/abc", "", "", "", "", "", "", "", "");
+	test_parseDLuri(ctx, false,  "https://a/01/12312312312333/99999/abc", "", "", "", "", "", "", "", "");
+	test_parseDLuri(ctx, false,  "https://a/01/12312312312333?9=abc", "", "", "", "", "", "", "", "");
+	test_parseDLuri(ctx, false,  "https://a/01/12312312312333?99999=abc", "", "", "", "", "", "", "", "");
+
+	test_parseDLuri(ctx, true,
+		"https://a/01/12312312312333/22/TEST/10/ABC/21/XYZ",
+		"^011231231231233322TEST^10ABC^21XYZ",
+		"^0112312312312333^22TEST^10ABC^21XYZ",
+		"(01)12312312312333(22)TEST(10)ABC(21)XYZ",
+		"{\"01\":\"12312312312333\",\"22\":\"TEST\",\"10\":\"ABC\",\"21\":\"XYZ\"}",
+		"^011231231231233322TEST^10ABC^21XYZ",
+		"^0112312312312333^22TEST^10ABC^21XYZ",
+		"(01)12312312312333(22)TEST(10)ABC(21)XYZ",
+		"{\"01\":\"12312312312333\",\"22\":\"TEST\",\"10\":\"ABC\",\"21\":\"XYZ\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/01/12312312312333/235/TEST",
+		"^0112312312312333235TEST",
+		"^0112312312312333^235TEST",
+		"(01)12312312312333(235)TEST",
+		"{\"01\":\"12312312312333\",\"235\":\"TEST\"}",
+		"^0112312312312333235TEST",
+		"^0112312312312333^235TEST",
+		"(01)12312312312333(235)TEST",
+		"{\"01\":\"12312312312333\",\"235\":\"TEST\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/253/1231231231232",
+		"^2531231231231232",
+		"^2531231231231232",
+		"(253)1231231231232",
+		"{\"253\":\"1231231231232\"}",
+		"^2531231231231232",
+		"^2531231231231232",
+		"(253)1231231231232",
+		"{\"253\":\"1231231231232\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/253/1231231231232TEST5678901234567",
+		"^2531231231231232TEST5678901234567",
+		"^2531231231231232TEST5678901234567",
+		"(253)1231231231232TEST5678901234567",
+		"{\"253\":\"1231231231232TEST5678901234567\"}",
+		"^2531231231231232TEST5678901234567",
+		"^2531231231231232TEST5678901234567",
+		"(253)1231231231232TEST5678901234567",
+		"{\"253\":\"1231231231232TEST5678901234567\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/8018/123456789012345675/8019/123",
+		"^8018123456789012345675^8019123",
+		"^8018123456789012345675^8019123",
+		"(8018)123456789012345675(8019)123",
+		"{\"8018\":\"123456789012345675\",\"8019\":\"123\"}",
+		"^8018123456789012345675^8019123",
+		"^8018123456789012345675^8019123",
+		"(8018)123456789012345675(8019)123",
+		"{\"8018\":\"123456789012345675\",\"8019\":\"123\"}");
+
+	test_parseDLuri(ctx, false,
+		"https://a/stem/00/006141411234567890/", "", "", "", "", "", "", "", ""); 	// Can't end in slash
+
+	test_parseDLuri(ctx, true,					// Empty query params
+		"https://a/00/006141411234567890?",
+		"^00006141411234567890",
+		"^00006141411234567890",
+		"(00)006141411234567890",
+		"{\"00\":\"006141411234567890\"}",
+		"^00006141411234567890",
+		"^00006141411234567890",
+		"(00)006141411234567890",
+		"{\"00\":\"006141411234567890\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/stem/00/006141411234567890?99=ABC",			// Query params; no FNC1 req after pathinfo
+		"^0000614141123456789099ABC",
+		"^00006141411234567890^99ABC",
+		"(00)006141411234567890(99)ABC",
+		"{\"00\":\"006141411234567890\",\"99\":\"ABC\"}",
+		"^0000614141123456789099ABC",
+		"^00006141411234567890^99ABC",
+		"(00)006141411234567890(99)ABC",
+		"{\"00\":\"006141411234567890\",\"99\":\"ABC\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/stem/401/12345678?99=ABC",				// Query params; FNC1 req after pathinfo
+		"^40112345678^99ABC",
+		"^40112345678^99ABC",
+		"(401)12345678(99)ABC",
+		"{\"401\":\"12345678\",\"99\":\"ABC\"}",
+		"^40112345678^99ABC",
+		"^40112345678^99ABC",
+		"(401)12345678(99)ABC",
+		"{\"401\":\"12345678\",\"99\":\"ABC\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/01/12312312312333?99=ABC&98=XYZ",
+		"^011231231231233399ABC^98XYZ",
+		"^0112312312312333^99ABC^98XYZ",
+		"(01)12312312312333(99)ABC(98)XYZ",
+		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}",
+		"^011231231231233399ABC^98XYZ",
+		"^0112312312312333^99ABC^98XYZ",
+		"(01)12312312312333(99)ABC(98)XYZ",
+		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}");
+
+	test_parseDLuri(ctx, false,
+		"https://a/01/12312312312333?99=", "", "", "", "", "", "", "", ""); 	// Can't have empty AI value
+
+	test_parseDLuri(ctx, true,
+		"https://a/01/12312312312333?&&&99=ABC&&&&&&98=XYZ&&&",		// Extraneous query param separators
+		"^011231231231233399ABC^98XYZ",
+		"^0112312312312333^99ABC^98XYZ",
+		"(01)12312312312333(99)ABC(98)XYZ",
+		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}",
+		"^011231231231233399ABC^98XYZ",
+		"^0112312312312333^99ABC^98XYZ",
+		"(01)12312312312333(99)ABC(98)XYZ",
+		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/01/12312312312333?99=ABC&unknown=666&98=XYZ",
+		"^011231231231233399ABC^98XYZ",
+		"^0112312312312333^99ABC^98XYZ",
+		"(01)12312312312333(99)ABC(98)XYZ",
+		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}",
+		"^011231231231233399ABC^98XYZ",
+		"^0112312312312333^99ABC^98XYZ",
+		"(01)12312312312333(99)ABC(98)XYZ",
+		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/01/12312312312333?99=ABC&singleton&98=XYZ",
+		"^011231231231233399ABC^98XYZ",
+		"^0112312312312333^99ABC^98XYZ",
+		"(01)12312312312333(99)ABC(98)XYZ",
+		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}",
+		"^011231231231233399ABC^98XYZ",
+		"^0112312312312333^99ABC^98XYZ",
+		"(01)12312312312333(99)ABC(98)XYZ",
+		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/01/12312312312333?singleton&99=ABC&98=XYZ",
+		"^011231231231233399ABC^98XYZ",
+		"^0112312312312333^99ABC^98XYZ",
+		"(01)12312312312333(99)ABC(98)XYZ",
+		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}",
+		"^011231231231233399ABC^98XYZ",
+		"^0112312312312333^99ABC^98XYZ",
+		"(01)12312312312333(99)ABC(98)XYZ",
+		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/01/12312312312333?99=ABC&98=XYZ&singleton",
+		"^011231231231233399ABC^98XYZ",
+		"^0112312312312333^99ABC^98XYZ",
+		"(01)12312312312333(99)ABC(98)XYZ",
+		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}",
+		"^011231231231233399ABC^98XYZ",
+		"^0112312312312333^99ABC^98XYZ",
+		"(01)12312312312333(99)ABC(98)XYZ",
+		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/01/12312312312333/22/ABC%2d123?99=ABC&98=XYZ%2f987",	// Percent escaped values
+		"^011231231231233322ABC-123^99ABC^98XYZ/987",
+		"^0112312312312333^22ABC-123^99ABC^98XYZ/987",
+		"(01)12312312312333(22)ABC-123(99)ABC(98)XYZ/987",
+		"{\"01\":\"12312312312333\",\"22\":\"ABC-123\",\"99\":\"ABC\",\"98\":\"XYZ/987\"}",
+		"^011231231231233322ABC-123^99ABC^98XYZ/987",
+		"^0112312312312333^22ABC-123^99ABC^98XYZ/987",
+		"(01)12312312312333(22)ABC-123(99)ABC(98)XYZ/987",
+		"{\"01\":\"12312312312333\",\"22\":\"ABC-123\",\"99\":\"ABC\",\"98\":\"XYZ/987\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/01/12312312312333/22/TEST/10/ABC/21/XYZ#fragmemt",	// Ignore fragment after path info
+		"^011231231231233322TEST^10ABC^21XYZ",
+		"^0112312312312333^22TEST^10ABC^21XYZ",
+		"(01)12312312312333(22)TEST(10)ABC(21)XYZ",
+		"{\"01\":\"12312312312333\",\"22\":\"TEST\",\"10\":\"ABC\",\"21\":\"XYZ\"}",
+		"^011231231231233322TEST^10ABC^21XYZ",
+		"^0112312312312333^22TEST^10ABC^21XYZ",
+		"(01)12312312312333(22)TEST(10)ABC(21)XYZ",
+		"{\"01\":\"12312312312333\",\"22\":\"TEST\",\"10\":\"ABC\",\"21\":\"XYZ\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://a/stem/00/006141411234567890?99=ABC#fragment",		// Ignore fragment after query info
+		"^0000614141123456789099ABC",
+		"^00006141411234567890^99ABC",
+		"(00)006141411234567890(99)ABC",
+		"{\"00\":\"006141411234567890\",\"99\":\"ABC\"}",
+		"^0000614141123456789099ABC",
+		"^00006141411234567890^99ABC",
+		"(00)006141411234567890(99)ABC",
+		"{\"00\":\"006141411234567890\",\"99\":\"ABC\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://id.gs1.org/01/09520123456788",
+		"^0109520123456788",
+		"^0109520123456788",
+		"(01)09520123456788",
+		"{\"01\":\"09520123456788\"}",
+		"^0109520123456788",
+		"^0109520123456788",
+		"(01)09520123456788",
+		"{\"01\":\"09520123456788\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://brand.example.com/01/9520123456788",
+		"^0109520123456788",
+		"^0109520123456788",
+		"(01)09520123456788",
+		"{\"01\":\"09520123456788\"}",
+		"^0109520123456788",
+		"^0109520123456788",
+		"(01)09520123456788",
+		"{\"01\":\"09520123456788\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://brand.example.com/some-extra/pathinfo/01/9520123456788",
+		"^0109520123456788",
+		"^0109520123456788",
+		"(01)09520123456788",
+		"{\"01\":\"09520123456788\"}",
+		"^0109520123456788",
+		"^0109520123456788",
+		"(01)09520123456788",
+		"{\"01\":\"09520123456788\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://id.gs1.org/01/09520123456788/22/2A",
+		"^0109520123456788222A",
+		"^0109520123456788^222A",
+		"(01)09520123456788(22)2A",
+		"{\"01\":\"09520123456788\",\"22\":\"2A\"}",
+		"^0109520123456788222A",
+		"^0109520123456788^222A",
+		"(01)09520123456788(22)2A",
+		"{\"01\":\"09520123456788\",\"22\":\"2A\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://id.gs1.org/01/09520123456788/10/ABC123",
+		"^010952012345678810ABC123",
+		"^0109520123456788^10ABC123",
+		"(01)09520123456788(10)ABC123",
+		"{\"01\":\"09520123456788\",\"10\":\"ABC123\"}",
+		"^010952012345678810ABC123",
+		"^0109520123456788^10ABC123",
+		"(01)09520123456788(10)ABC123",
+		"{\"01\":\"09520123456788\",\"10\":\"ABC123\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://id.gs1.org/01/09520123456788/21/12345",
+		"^01095201234567882112345",
+		"^0109520123456788^2112345",
+		"(01)09520123456788(21)12345",
+		"{\"01\":\"09520123456788\",\"21\":\"12345\"}",
+		"^01095201234567882112345",
+		"^0109520123456788^2112345",
+		"(01)09520123456788(21)12345",
+		"{\"01\":\"09520123456788\",\"21\":\"12345\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://id.gs1.org/01/09520123456788/10/ABC1/21/12345?17=180426",
+		"^010952012345678810ABC1^2112345^17180426",
+		"^0109520123456788^10ABC1^2112345^17180426",
+		"(01)09520123456788(10)ABC1(21)12345(17)180426",
+		"{\"01\":\"09520123456788\",\"10\":\"ABC1\",\"21\":\"12345\",\"17\":\"180426\"}",
+		"^01095201234567881718042610ABC1^2112345",
+		"^0109520123456788^17180426^10ABC1^2112345",
+		"(01)09520123456788(17)180426(10)ABC1(21)12345",
+		"{\"01\":\"09520123456788\",\"17\":\"180426\",\"10\":\"ABC1\",\"21\":\"12345\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://id.gs1.org/01/09520123456788?3103=000195",
+		"^01095201234567883103000195",
+		"^0109520123456788^3103000195",
+		"(01)09520123456788(3103)000195",
+		"{\"01\":\"09520123456788\",\"3103\":\"000195\"}",
+		"^01095201234567883103000195",
+		"^0109520123456788^3103000195",
+		"(01)09520123456788(3103)000195",
+		"{\"01\":\"09520123456788\",\"3103\":\"000195\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://example.com/01/9520123456788?3103=000195&3922=0299&17=201225",
+		"^0109520123456788310300019539220299^17201225",
+		"^0109520123456788^3103000195^39220299^17201225",
+		"(01)09520123456788(3103)000195(3922)0299(17)201225",
+		"{\"01\":\"09520123456788\",\"3103\":\"000195\",\"3922\":\"0299\",\"17\":\"201225\"}",
+		"^010952012345678831030001951720122539220299",
+		"^0109520123456788^3103000195^17201225^39220299",
+		"(01)09520123456788(3103)000195(17)201225(3922)0299",
+		"{\"01\":\"09520123456788\",\"3103\":\"000195\",\"17\":\"201225\",\"3922\":\"0299\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://id.gs1.org/01/9520123456788?3103=000195&3922=0299&17=201225",
+		"^0109520123456788310300019539220299^17201225",
+		"^0109520123456788^3103000195^39220299^17201225",
+		"(01)09520123456788(3103)000195(3922)0299(17)201225",
+		"{\"01\":\"09520123456788\",\"3103\":\"000195\",\"3922\":\"0299\",\"17\":\"201225\"}",
+		"^010952012345678831030001951720122539220299",
+		"^0109520123456788^3103000195^17201225^39220299",
+		"(01)09520123456788(3103)000195(17)201225(3922)0299",
+		"{\"01\":\"09520123456788\",\"3103\":\"000195\",\"17\":\"201225\",\"3922\":\"0299\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://id.gs1.org/01/9520123456788?17=201225&3103=000195&3922=0299",
+		"^010952012345678817201225310300019539220299",
+		"^0109520123456788^17201225^3103000195^39220299",
+		"(01)09520123456788(17)201225(3103)000195(3922)0299",
+		"{\"01\":\"09520123456788\",\"17\":\"201225\",\"3103\":\"000195\",\"3922\":\"0299\"}",
+		"^010952012345678817201225310300019539220299",
+		"^0109520123456788^17201225^3103000195^39220299",
+		"(01)09520123456788(17)201225(3103)000195(3922)0299",
+		"{\"01\":\"09520123456788\",\"17\":\"201225\",\"3103\":\"000195\",\"3922\":\"0299\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://id.gs1.org/00/952012345678912345",
+		"^00952012345678912345",
+		"^00952012345678912345",
+		"(00)952012345678912345",
+		"{\"00\":\"952012345678912345\"}",
+		"^00952012345678912345",
+		"^00952012345678912345",
+		"(00)952012345678912345",
+		"{\"00\":\"952012345678912345\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://id.gs1.org/00/952012345678912345?02=09520123456788&37=25&10=ABC123",
+		"^0095201234567891234502095201234567883725^10ABC123",
+		"^00952012345678912345^0209520123456788^3725^10ABC123",
+		"(00)952012345678912345(02)09520123456788(37)25(10)ABC123",
+		"{\"00\":\"952012345678912345\",\"02\":\"09520123456788\",\"37\":\"25\",\"10\":\"ABC123\"}",
+		"^0095201234567891234502095201234567883725^10ABC123",
+		"^00952012345678912345^0209520123456788^3725^10ABC123",
+		"(00)952012345678912345(02)09520123456788(37)25(10)ABC123",
+		"{\"00\":\"952012345678912345\",\"02\":\"09520123456788\",\"37\":\"25\",\"10\":\"ABC123\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://id.gs1.org/414/9520123456788",
+		"^4149520123456788",
+		"^4149520123456788",
+		"(414)9520123456788",
+		"{\"414\":\"9520123456788\"}",
+		"^4149520123456788",
+		"^4149520123456788",
+		"(414)9520123456788",
+		"{\"414\":\"9520123456788\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://id.gs1.org/414/9520123456788/254/32a%2Fb",
+		"^414952012345678825432a/b",
+		"^4149520123456788^25432a/b",
+		"(414)9520123456788(254)32a/b",
+		"{\"414\":\"9520123456788\",\"254\":\"32a/b\"}",
+		"^414952012345678825432a/b",
+		"^4149520123456788^25432a/b",
+		"(414)9520123456788(254)32a/b",
+		"{\"414\":\"9520123456788\",\"254\":\"32a/b\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://example.com/8004/9520614141234567?01=9520123456788",
+		"^80049520614141234567^0109520123456788",
+		"^80049520614141234567^0109520123456788",
+		"(8004)9520614141234567(01)09520123456788",
+		"{\"8004\":\"9520614141234567\",\"01\":\"09520123456788\"}",
+		"^010952012345678880049520614141234567",
+		"^0109520123456788^80049520614141234567",
+		"(01)09520123456788(8004)9520614141234567",
+		"{\"01\":\"09520123456788\",\"8004\":\"9520614141234567\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://example.com/01/9520123456788/89/ABC123?99=XYZ",
+		"^010952012345678889ABC123^99XYZ",
+		"^0109520123456788^89ABC123^99XYZ",
+		"(01)09520123456788(89)ABC123(99)XYZ",
+		"{\"01\":\"09520123456788\",\"89\":\"ABC123\",\"99\":\"XYZ\"}",
+		"^010952012345678889ABC123^99XYZ",
+		"^0109520123456788^89ABC123^99XYZ",
+		"(01)09520123456788(89)ABC123(99)XYZ",
+		"{\"01\":\"09520123456788\",\"89\":\"ABC123\",\"99\":\"XYZ\"}");
+
+	test_parseDLuri(ctx, true,
+		"https://example.com/01/9520123456788?99=XYZ&89=ABC123",
+		"^010952012345678899XYZ^89ABC123",
+		"^0109520123456788^99XYZ^89ABC123",
+		"(01)09520123456788(99)XYZ(89)ABC123",
+		"{\"01\":\"09520123456788\",\"99\":\"XYZ\",\"89\":\"ABC123\"}",
+		"^010952012345678899XYZ^89ABC123",
+		"^0109520123456788^99XYZ^89ABC123",
+		"(01)09520123456788(99)XYZ(89)ABC123",
+		"{\"01\":\"09520123456788\",\"99\":\"XYZ\",\"89\":\"ABC123\"}");
+
+	/*
+	 * Compressed
 	 *
-	 *    - Unbracketed with standard FNC1s
-	 *    - Unbracketed with extraneous FNC1s
-	 *    - Bracketed syntax
-	 *    - JSON
-	 *    - Unbracketed with standard FNC1s; fixed-length AIs first
-	 *    - Unbracketed with extraneous FNC1s; fixed-length AIs first
-	 *    - Bracketed syntax; fixed-length AIs first
-	 *    - JSON; fixed-length AIs first
+	 */
+	test_parseDLuri(ctx, true,
+		"https://id.gs1.org/ARFRJydaKA",
+		"^0109520123456788",
+		"^0109520123456788",
+		"(01)09520123456788",
+		"{\"01\":\"09520123456788\"}",
+		"^0109520123456788",
+		"^0109520123456788",
+		"(01)09520123456788",
+		"{\"01\":\"09520123456788\"}");
+
+	test_parseDLuri(ctx, true,					// Base64url and integer encodings
+		"https://id.gs1.org/ARFRJydaKCCNV4JGQgowOQ",
+		"^010952012345678810ABC123^2112345",
+		"^0109520123456788^10ABC123^2112345",
+		"(01)09520123456788(10)ABC123(21)12345",
+		"{\"01\":\"09520123456788\",\"10\":\"ABC123\",\"21\":\"12345\"}",
+		"^010952012345678810ABC123^2112345",
+		"^0109520123456788^10ABC123^2112345",
+		"(01)09520123456788(10)ABC123(21)12345",
+		"{\"01\":\"09520123456788\",\"10\":\"ABC123\",\"21\":\"12345\"}");
+
+	test_parseDLuri(ctx, true,					// Fixed-length numerics; wildcard AI
+		"https://a/stem/AAFdGUuw5W0jEDAAwxcxIJ",
+		"^00006141411234567890310300019517201225",
+		"^00006141411234567890^3103000195^17201225",
+		"(00)006141411234567890(3103)000195(17)201225",
+		"{\"00\":\"006141411234567890\",\"3103\":\"000195\",\"17\":\"201225\"}",
+		"^00006141411234567890310300019517201225",
+		"^00006141411234567890^3103000195^17201225",
+		"(00)006141411234567890(3103)000195(17)201225",
+		"{\"00\":\"006141411234567890\",\"3103\":\"000195\",\"17\":\"201225\"}");
+
+	test_parseDLuri(ctx, true,					// Two-component AI; variable-length numeric
+		"https://a/JTEeqxmlAHFMRJPnrvz3TXbfjnruAGTHs",
+		"^2531231231231232TEST5678901234567^8019123",
+		"^2531231231231232TEST5678901234567^8019123",
+		"(253)1231231231232TEST5678901234567(8019)123",
+		"{\"253\":\"1231231231232TEST5678901234567\",\"8019\":\"123\"}",
+		"^2531231231231232TEST5678901234567^8019123",
+		"^2531231231231232TEST5678901234567^8019123",
+		"(253)1231231231232TEST5678901234567(8019)123",
+		"{\"253\":\"1231231231232TEST5678901234567\",\"8019\":\"123\"}");
+
+	test_parseDLuri(ctx, true,					// Optional second component is empty
+		"https://a/JTEeqxmlAAA",
+		"^2531231231231232",
+		"^2531231231231232",
+		"(253)1231231231232",
+		"{\"253\":\"1231231231232\"}",
+		"^2531231231231232",
+		"^2531231231231232",
+		"(253)1231231231232",
+		"{\"253\":\"1231231231232\"}");
+
+	test_parseDLuri(ctx, true,					// Likewise, for a variable-length numeric
+		"https://a/JVCO_anbfA",
+		"^2550614141123452",
+		"^2550614141123452",
+		"(255)0614141123452",
+		"{\"255\":\"0614141123452\"}",
+		"^2550614141123452",
+		"^2550614141123452",
+		"(255)0614141123452",
+		"{\"255\":\"0614141123452\"}");
+
+	test_parseDLuri(ctx, false,					// A sole variable component is not optional
+		"https://a/EAA", "", "", "", "", "", "", "", "");
+
+	test_parseDLuri(ctx, true,					// Hex, ASCII and long integer encodings
+		"https://a/ARFRJydaKCBHV4Qo1Xm95FB4V-KZB4Y7pD_bDc-DuTj8K0g",
+		"^010952012345678810abc^21ABCDEF^22a/b^99123456789012345678901234567890",
+		"^0109520123456788^10abc^21ABCDEF^22a/b^99123456789012345678901234567890",
+		"(01)09520123456788(10)abc(21)ABCDEF(22)a/b(99)123456789012345678901234567890",
+		"{\"01\":\"09520123456788\",\"10\":\"abc\",\"21\":\"ABCDEF\",\"22\":\"a/b\",\"99\":\"123456789012345678901234567890\"}",
+		"^010952012345678810abc^21ABCDEF^22a/b^99123456789012345678901234567890",
+		"^0109520123456788^10abc^21ABCDEF^22a/b^99123456789012345678901234567890",
+		"(01)09520123456788(10)abc(21)ABCDEF(22)a/b(99)123456789012345678901234567890",
+		"{\"01\":\"09520123456788\",\"10\":\"abc\",\"21\":\"ABCDEF\",\"22\":\"a/b\",\"99\":\"123456789012345678901234567890\"}");
+
+	test_parseDLuri(ctx, true,					// Compressed with query params
+		"https://a/QUiok5OtFCVIVmywr8Q?17=201225",
+		"^414952012345678825432a/b^17201225",
+		"^4149520123456788^25432a/b^17201225",
+		"(414)9520123456788(254)32a/b(17)201225",
+		"{\"414\":\"9520123456788\",\"254\":\"32a/b\",\"17\":\"201225\"}",
+		"^41495201234567881720122525432a/b",
+		"^4149520123456788^17201225^25432a/b",
+		"(414)9520123456788(17)201225(254)32a/b",
+		"{\"414\":\"9520123456788\",\"17\":\"201225\",\"254\":\"32a/b\"}");
+
+	test_parseDLuri(ctx, false,  "https://a/ARFRJydaKB", "", "", "", "", "", "", "", "");	// Non-zero padding
+	test_parseDLuri(ctx, false,  "https://a/ARFRJyda", "", "", "", "", "", "", "", "");	// Truncated
+	test_parseDLuri(ctx, false,  "https://a/iQ", "", "", "", "", "", "", "", "");		// Unknown AI (89)
+	test_parseDLuri(ctx, false,  "https://a/A", "", "", "", "", "", "", "", "");		// No AIs
+
+	/*
+	 * S4T https://youtu.be/9elyEi1PT00
 	 *
 	 */
+	/*
+	test_parseDLuri(ctx, true,
+		"https://example.com/00/093123450000000012?4300=GS1+Australia&4301=Michiel+Ruighaver&4302=8+Nexus+Court&4304=Mulgrave&4306=Victoria&4307=AU&420=3170&4308=%2B61412830095&s4t",
+		"^000931234500000000124300GS1+Australia^4301Michiel+Ruighaver^43028+Nexus+Court^4304Mulgrave^4306Victoria^4307AU^4203170^4308+61412830095",
+		"^00093123450000000012^4300GS1+Australia^4301Michiel+Ruighaver^43028+Nexus+Court^4304Mulgrave^4306Victoria^4307AU^4203170^4308+61412830095",
+		"(00)093123450000000012(4300)GS1+Australia(4301)Michiel+Ruighaver(4302)8+Nexus+Court(4304)Mulgrave(4306)Victoria(4307)AU(420)3170(4308)+61412830095",
+		"{\"00\":\"093123450000000012\",\"4300\":\"GS1+Australia\",\"4301\":\"Michiel+Ruighaver\",\"4302\":\"8+Nexus+Court\",\"4304\":\"Mulgrave\",\"4306\":\"Victoria\",\"4307\":\"AU\",\"420\":\"3170\",\"4308\":\"+61412830095\"}",
+		"^000931234500000000124300GS1+Australia^4301Michiel+Ruighaver^43028+Nexus+Court^4304Mulgrave^4306Victoria^4307AU^4203170^4308+61412830095",
+		"^00093123450000000012^4300GS1+Australia^4301Michiel+Ruighaver^43028+Nexus+Court^4304Mulgrave^4306Victoria^4307AU^4203170^4308+61412830095",
+		"(00)093123450000000012(4300)GS1+Australia(4301)Michiel+Ruighaver(4302)8+Nexus+Court(4304)Mulgrave(4306)Victoria(4307)AU(420)3170(4308)+61412830095",
+		"{\"00\":\"093123450000000012\",\"4300\":\"GS1+Australia\",\"4301\":\"Michiel+Ruighaver\",\"4302\":\"8+Nexus+Court\",\"4304\":\"Mulgrave\",\"4306\":\"Victoria\",\"4307\":\"AU\",\"420\":\"3170\",\"4308\":\"+61412830095\"}");
+	*/
+
+	free(ctx);
+
+}
+
+
+static void test_writeCompressedDLpath(struct gs1DLparser *ctx, bool should_succeed, const char *dlData, const char *expect) {
+
+	char in[GS1_DL_MAX_OUT_COMP + 10];
+	char out[GS1_DL_MAX_OUT_COMP];
+	char json[256], json2[256];
+
+	TEST_CASE(dlData);
+
+	strcpy(in, dlData);
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_MSG("Err: %s", ctx->err);
+
+	TEST_CHECK(gs1_writeCompressedDLpath(ctx, out) ^ (!should_succeed));
+	TEST_MSG("Err: %s", ctx->err);
+
+	if (!should_succeed)
+		return;
+
+	TEST_CHECK(strcmp(out, expect) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s", dlData, out, expect);
+
+	// Round trip via the decompressor
+	gs1_writeJSON(ctx, false, json);
+	sprintf(in, "https://a/%s", out);
+	TEST_CHECK(gs1_parseDLuri(ctx, in));
+	TEST_MSG("Err: %s", ctx->err);
+	gs1_writeJSON(ctx, false, json2);
+	TEST_CHECK(strcmp(json, json2) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s", in, json2, json);
+
+}
+
+static void test_dl_writeCompressedDLpath(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+
+	test_writeCompressedDLpath(ctx, true,
+		"https://id.gs1.org/01/09520123456788",
+		"ARFRJydaKA");
+	test_writeCompressedDLpath(ctx, true,
+		"https://id.gs1.org/01/09520123456788/10/ABC123/21/12345",
+		"ARFRJydaKCCNV4JGQgowOQ");
+	test_writeCompressedDLpath(ctx, true,
+		"https://a/stem/00/006141411234567890?3103=000195&17=201225",
+		"AAFdGUuw5W0jEDAAwxcxIJ");
+	test_writeCompressedDLpath(ctx, true,
+		"https://a/253/1231231231232TEST5678901234567?8019=123",
+		"JTEeqxmlAHFMRJPnrvz3TXbfjnruAGTHs");
+	test_writeCompressedDLpath(ctx, true,
+		"https://a/01/09520123456788/22/a%2Fb/10/abc/21/ABCDEF?99=123456789012345678901234567890",
+		"ARFRJydaKEUHhX4hAjq8IUarze-ZB4Y7pD_bDc-DuTj8K0g");
+	test_writeCompressedDLpath(ctx, true,
+		"https://a/414/9520123456788/254/32a%2Fb",
+		"QUiok5OtFCVIVmywr8Q");
+	test_writeCompressedDLpath(ctx, true,					// Optional serial components omitted
+		"https://a/253/1231231231232",
+		"JTEeqxmlAAA");
+	test_writeCompressedDLpath(ctx, true,
+		"https://a/8003/09520123456788",
+		"gAMRUScnWigA");
+	test_writeCompressedDLpath(ctx, true,
+		"https://a/255/0614141123452",
+		"JVCO_anbfA");
+	test_writeCompressedDLpath(ctx, true,					// Longest integer in a single word
+		"https://a/01/09520123456788/21/1234567890123456789",
+		"ARFRJydaKEImIkQh6PvTAio");
+	test_writeCompressedDLpath(ctx, true,					// Leading zeros preserved
+		"https://a/01/09520123456788/21/0001",
+		"ARFRJydaKEIIAAg");
+
+	test_writeCompressedDLpath(ctx, false,					// Unknown AI
+		"https://a/01/09520123456788/89/ABC123", "");
+	test_writeCompressedDLpath(ctx, false,					// Bad GTIN length
+		"https://a/01/123", "");
+	test_writeCompressedDLpath(ctx, false,					// Non-numeric GTIN
+		"https://a/01/0952012345678A", "");
+	test_writeCompressedDLpath(ctx, false,					// Too long for the AI
+		"https://a/01/09520123456788/10/ABCDEFGHIJKLMNOPQRSTU", "");
+	test_writeCompressedDLpath(ctx, false,					// Not 7-bit ASCII
+		"https://a/01/09520123456788/10/AB%C3%80", "");
+
+	free(ctx);
+
+}
+
+
+static void test_writeDLuri(struct gs1DLparser *ctx, const char *dlData, const char *domain, const char *stem, unsigned int options, const char *expect) {
+
+	char in[256];
+	char out[256];
+	size_t len;
+
+	TEST_CASE(dlData);
+
+	strcpy(in, dlData);
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_MSG("Err: %s", ctx->err);
+
+	len = gs1_writeDLuri(ctx, domain, stem, options, out, sizeof(out));
+	TEST_CHECK(strcmp(out, expect) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect ? expect : "(none)", ctx->err);
+	TEST_CHECK(len == strlen(expect));
+	TEST_MSG("Got length: %d; Expected: %d", (int)len, (int)strlen(expect));
+
+	// Bounded by the output buffer
+	if (*expect) {
+		TEST_CHECK(gs1_writeDLuri(ctx, domain, stem, options, out, strlen(expect)) == 0);
+		TEST_CHECK(*out == '\0');
+		TEST_CHECK(gs1_writeDLuri(ctx, domain, stem, options, out, strlen(expect) + 1) == strlen(expect));
+	}
+
+}
+
+static void test_dl_writeDLuri(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	char in[256];
+	char out[GS1_DL_MAX_OUT_DLURI + 256];
+
+	test_writeDLuri(ctx,
+		"https://a/01/09520123456788/10/ABC%2F123/21/12345?17=180426",
+		"id.gs1.org", NULL, 0,
+		"https://id.gs1.org/01/09520123456788/10/ABC%2F123/21/12345?17=180426");
+
+	test_writeDLuri(ctx,						// Qualifiers reordered into the path
+		"https://a/01/9520123456788?21=12345&17=180426&10=ABC&22=2A",
+		"example.com", "some/stem", 0,
+		"https://example.com/some/stem/01/09520123456788/22/2A/10/ABC/21/12345?17=180426");
+
+	test_writeDLuri(ctx,						// Non-qualifiers moved to the query
+		"https://a/414/9520123456788/3103/000195/254/32a%2Fb",
+		"example.com", "", 0,
+		"https://example.com/414/9520123456788/254/32a%2Fb?3103=000195");
+
+	test_writeDLuri(ctx,						// First primary key roots the path
+		"https://example.com/8004/9520614141234567?01=9520123456788",
+		"example.com", NULL, 0,
+		"https://example.com/8004/9520614141234567?01=09520123456788");
+
+	test_writeDLuri(ctx,						// Escaping of space, "+" and reserved characters
+		"https://a/00/006141411234567890?99=A+B%2BC%26D%3D&98=%25%2F%3F%23",
+		"a", NULL, 0,
+		"https://a/00/006141411234567890?99=A%20B%2BC%26D%3D&98=%25%2F%3F%23");
+
+	test_writeDLuri(ctx,						// Long runs of unreserved characters
+		"https://a/00/006141411234567890?99=ABCDEFGHIJKLMNOPQRSTUVWXYZ-._~abcdefghijklmnopqrstuvwxyz0123456789&98=ABCDEFGHIJKLMNO%2FPQRSTUVWXYZ",
+		"a", NULL, 0,
+		"https://a/00/006141411234567890?99=ABCDEFGHIJKLMNOPQRSTUVWXYZ-._~abcdefghijklmnopqrstuvwxyz0123456789&98=ABCDEFGHIJKLMNO%2FPQRSTUVWXYZ");
+
+	test_writeDLuri(ctx,						// Non-ASCII data
+		"https://a/00/006141411234567890?99=%C3%80%7F%01",
+		"a", NULL, 0,
+		"https://a/00/006141411234567890?99=%C3%80%7F%01");
+
+	test_writeDLuri(ctx,
+		"https://a/01/09520123456788/10/ABC123/21/12345",
+		"id.gs1.org", NULL, GS1_DL_URI_COMPRESSED,
+		"https://id.gs1.org/ARFRJydaKCCNV4JGQgowOQ");
+
+	test_writeDLuri(ctx,						// Cannot compress AI (89)
+		"https://a/01/09520123456788/89/ABC123",
+		"id.gs1.org", NULL, GS1_DL_URI_COMPRESSED,
+		"");
+
+	// An empty value, e.g. from an edited context, is not an overflow
+	strcpy(in, "https://a/01/09520123456788?99=X");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	ctx->aiData[1].vallen = 0;
+	TEST_CHECK(gs1_writeDLuri(ctx, "a", NULL, 0, out, sizeof(out)) == 31);
+	TEST_CHECK(strcmp(out, "https://a/01/09520123456788?99=") == 0);
+	TEST_MSG("Got %s; err %s", out, ctx->err);
+
+	free(ctx);
+
+}
+
+
+static void test_parseAIelementString(struct gs1DLparser *ctx, bool (*parse)(struct gs1DLparser*, const char*),
+				      bool should_succeed, const char *data, const char *expect_JSON) {
+
+	char out[GS1_DL_MAX_OUT_JSON];
+
+	TEST_CASE(data);
+
+	TEST_CHECK(parse(ctx, data) ^ (!should_succeed));
+	TEST_MSG("Err: %s", ctx->err);
+
+	if (!should_succeed)
+		return;
+
+	gs1_writeJSON(ctx, false, out);
+	TEST_CHECK(strcmp(out, expect_JSON) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s", data, out, expect_JSON);
+
+}
+
+static void test_dl_parseUnbracketedAIelementString(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	char in[128];
+	char out[GS1_DL_MAX_OUT_UNBR];
+
+#define test_parseUnbr(s, d, e) test_parseAIelementString(ctx, gs1_parseUnbracketedAIelementString, s, d, e)
+
+	test_parseUnbr(true,  "^0109520123456788", "{\"01\":\"09520123456788\"}");
+	test_parseUnbr(true,  "^010952012345678810ABC1^2112345^17180426",
+		"{\"01\":\"09520123456788\",\"10\":\"ABC1\",\"21\":\"12345\",\"17\":\"180426\"}");
+	test_parseUnbr(true,  "^0109520123456788^10ABC1^2112345^17180426",			// Extraneous FNC1s
+		"{\"01\":\"09520123456788\",\"10\":\"ABC1\",\"21\":\"12345\",\"17\":\"180426\"}");
+	test_parseUnbr(true,  "^01095201234567881718042610ABC1^2112345",			// Fixed-length AIs first
+		"{\"01\":\"09520123456788\",\"17\":\"180426\",\"10\":\"ABC1\",\"21\":\"12345\"}");
+	test_parseUnbr(true,  "^010952012345678831030001951720122539220299",		// 4-digit AIs
+		"{\"01\":\"09520123456788\",\"3103\":\"000195\",\"17\":\"201225\",\"3922\":\"0299\"}");
+	test_parseUnbr(true,  "^0095201234567891234502095201234567883725^10ABC123",
+		"{\"00\":\"952012345678912345\",\"02\":\"09520123456788\",\"37\":\"25\",\"10\":\"ABC123\"}");
+	test_parseUnbr(true,  "^414952012345678825432a/b",				// 3-digit AIs
+		"{\"414\":\"9520123456788\",\"254\":\"32a/b\"}");
+	test_parseUnbr(true,  "^8018123456789012345675^8019123^",			// Trailing FNC1
+		"{\"8018\":\"123456789012345675\",\"8019\":\"123\"}");
+
+	test_parseUnbr(false, "", "");
+	test_parseUnbr(false, "^", "");						// No AIs
+	test_parseUnbr(false, "0109520123456788", "");				// No leading FNC1
+	test_parseUnbr(false, "^010952012345678", "");				// Fixed-length value too short
+	test_parseUnbr(false, "^99", "");						// Empty value
+	test_parseUnbr(false, "^0109520123456788^^10ABC", "");			// Empty AI
+	test_parseUnbr(false, "^38123", "");						// Unassigned AI prefix
+	test_parseUnbr(false, "^9", "");						// Truncated AI
+	test_parseUnbr(false, "^31", "");						// Truncated 4-digit AI
+	test_parseUnbr(false, "^1A23", "");						// Non-numeric AI
+	test_parseUnbr(false, "^991234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901", "");	// Too long
+
+#undef test_parseUnbr
+
+	// Round trip through the writer
+	strcpy(in, "https://id.gs1.org/01/09520123456788/10/ABC1/21/12345?17=180426&3103=000195");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	gs1_writeUnbracketedAIelementString(ctx, false, false, out);
+	TEST_CHECK(gs1_parseUnbracketedAIelementString(ctx, out));
+	TEST_MSG("Err: %s", ctx->err);
+	TEST_CHECK(gs1_writeDLuri(ctx, "id.gs1.org", NULL, 0, in, sizeof(in)) != 0);
+	TEST_CHECK(strcmp(in, "https://id.gs1.org/01/09520123456788/10/ABC1/21/12345?17=180426&3103=000195") == 0);
+	TEST_MSG("Got: %s", in);
+
+	free(ctx);
+
+}
+
+static void test_dl_parseBracketedAIelementString(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+
+#define test_parseBrkt(s, d, e) test_parseAIelementString(ctx, gs1_parseBracketedAIelementString, s, d, e)
+
+	test_parseBrkt(true,  "(01)09520123456788", "{\"01\":\"09520123456788\"}");
+	test_parseBrkt(true,  "(01)09520123456788(10)ABC1(21)12345(17)180426",
+		"{\"01\":\"09520123456788\",\"10\":\"ABC1\",\"21\":\"12345\",\"17\":\"180426\"}");
+	test_parseBrkt(true,  "(00)006141411234567890(3103)000195(8019)123",
+		"{\"00\":\"006141411234567890\",\"3103\":\"000195\",\"8019\":\"123\"}");
+	test_parseBrkt(true,  "(01)09520123456788(99)a\\(b)c\\(",			// Escaped "("
+		"{\"01\":\"09520123456788\",\"99\":\"a(b)c(\"}");
+	test_parseBrkt(true,  "(99)a\\b",						// Lone backslash
+		"{\"99\":\"a\\\\b\"}");
+
+	test_parseBrkt(false, "", "");
+	test_parseBrkt(false, "01", "");						// No bracket
+	test_parseBrkt(false, "(01", "");						// Unterminated AI
+	test_parseBrkt(false, "(1)23", "");						// AI too short
+	test_parseBrkt(false, "(12345)1", "");					// AI too long
+	test_parseBrkt(false, "(0A)12", "");						// Non-numeric AI
+	test_parseBrkt(false, "(01)", "");						// Empty value
+	test_parseBrkt(false, "(01)09520123456788(", "");				// Trailing bracket
+	test_parseBrkt(false, "(01)09520123456788(10)(21)123", "");			// Empty value
+	test_parseBrkt(false, "(99)1234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901", "");	// Too long
+
+#undef test_parseBrkt
+
+	free(ctx);
+
+}
+
+
+static void test_dl_parseJSON(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	char in[256];
+	char out[GS1_DL_MAX_OUT_JSON], out2[GS1_DL_MAX_OUT_JSON];
 
-	test_parseDLuri(ctx, false,  "", "", "", "", "", "", "", "", "");
-	test_parseDLuri(ctx, false,  "ftp://", "", "", "", "", "", "", "", "");
-	test_parseDLuri(ctx, false,  "http://", "", "", "", "", "", "", "", "");
-	test_parseDLuri(ctx, false,  "http:///", "", "", "", "", "", "", "", "");	// No domain
-	test_parseDLuri(ctx, false,  "http://a", "", "", "", "", "", "", "", "");	// No path info
-	test_parseDLuri(ctx, false,  "http://a/", "", "", "", "", "", "", "", "");	// Pathelogical minimal domain but no AI info
-	test_parseDLuri(ctx, false,  "http://a/b", "", "", "", "", "", "", "", "");	// Stem, no data
-	test_parseDLuri(ctx, false,  "http://a/b/", "", "", "", "", "", "", "", "");
+#define test_parseJSON(s, d, e) test_parseAIelementString(ctx, gs1_parseJSON, s, d, e)
 
-	test_parseDLuri(ctx, true,					// http
-		"http://a/00/006141411234567890",
-		"^00006141411234567890",
-		"^00006141411234567890",
-		"(00)006141411234567890",
-		"{\"00\":\"006141411234567890\"}",
-		"^00006141411234567890",
-		"^00006141411234567890",
-		"(00)006141411234567890",
-		"{\"00\":\"006141411234567890\"}");
+	test_parseJSON(true,  "{\"01\":\"09520123456788\"}", "{\"01\":\"09520123456788\"}");
+	test_parseJSON(true,  "{\"01\":\"09520123456788\",\"10\":\"ABC1\",\"21\":\"12345\",\"17\":\"180426\"}",
+		"{\"01\":\"09520123456788\",\"10\":\"ABC1\",\"21\":\"12345\",\"17\":\"180426\"}");
+	test_parseJSON(true,  " \t{\r\n \"01\" : \"09520123456788\" ,\n\"3103\":\"000195\"\n}\n",		// Whitespace
+		"{\"01\":\"09520123456788\",\"3103\":\"000195\"}");
+	test_parseJSON(true,  "{\"99\":\"a\\\"b\\\\c\\/d\"}",						// Escapes
+		"{\"99\":\"a\\\"b\\\\c/d\"}");
+	test_parseJSON(true,  "{\"99\":\"\\b\\f\\n\\r\\t\"}",
+		"{\"99\":\"\b\f\n\r\t\"}");
+	test_parseJSON(true,  "{\"99\":\"\\u0041\\u00e9\\u20AC\\ud83d\\ude00\"}",				// UTF-8 from 1 to 4 bytes
+		"{\"99\":\"A\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\"}");
+	test_parseJSON(true,  "{\"\\u0039\\u0039\":\"X\"}",						// Escaped key
+		"{\"99\":\"X\"}");
+
+	test_parseJSON(false, "", "");
+	test_parseJSON(false, "[]", "");
+	test_parseJSON(false, "{}", "");								// No AIs
+	test_parseJSON(false, "{\"01\":1}", "");							// Not a string
+	test_parseJSON(false, "{\"0\":\"1\"}", "");							// AI too short
+	test_parseJSON(false, "{\"01234\":\"1\"}", "");						// AI too long
+	test_parseJSON(false, "{\"0A\":\"1\"}", "");							// Non-numeric AI
+	test_parseJSON(false, "{\"01\":\"\"}", "");							// Empty value
+	test_parseJSON(false, "{\"01\":\"x\"", "");							// Unterminated object
+	test_parseJSON(false, "{\"01\":\"x}", "");							// Unterminated string
+	test_parseJSON(false, "{\"01\":\"x\"} x", "");						// Trailing data
+	test_parseJSON(false, "{\"01\":\"x\",}", "");							// Trailing comma
+	test_parseJSON(false, "{\"01\" \"x\"}", "");							// Missing colon
+	test_parseJSON(false, "{\"01\":\"x\" \"10\":\"y\"}", "");					// Missing comma
+	test_parseJSON(false, "{\"01\":\"\\x\"}", "");						// Invalid escape
+	test_parseJSON(false, "{\"01\":\"\\u00\"}", "");						// Short \u escape
+	test_parseJSON(false, "{\"01\":\"\\u0", "");							// Truncated \u escape
+	test_parseJSON(false, "{\"01\":\"\\", "");							// Truncated escape
+	test_parseJSON(false, "{\"01\":\"\\u0000\"}", "");						// NUL
+	test_parseJSON(false, "{\"01\":\"\\ud83d\"}", "");						// Lone high surrogate
+	test_parseJSON(false, "{\"01\":\"\\ude00\"}", "");						// Lone low surrogate
+	test_parseJSON(false, "{\"99\":\"1234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901\"}", "");	// Too long
+
+#undef test_parseJSON
+
+	// Round trip through the writer, including characters that it escapes
+	strcpy(in, "https://id.gs1.org/01/09520123456788/10/ABC1?17=180426&99=a%22b%5Cc");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	gs1_writeJSON(ctx, false, out);
+	TEST_CHECK(gs1_parseJSON(ctx, out));
+	TEST_MSG("Err: %s", ctx->err);
+	gs1_writeJSON(ctx, false, out2);
+	TEST_CHECK(strcmp(out, out2) == 0);
+	TEST_MSG("Got: %s; Expected: %s", out2, out);
 
-	test_parseDLuri(ctx, true,					// https
-		"https://a/00/006141411234567890",
-		"^00006141411234567890",
-		"^00006141411234567890",
-		"(00)006141411234567890",
-		"{\"00\":\"006141411234567890\"}",
-		"^00006141411234567890",
-		"^00006141411234567890",
-		"(00)006141411234567890",
-		"{\"00\":\"006141411234567890\"}");
+	free(ctx);
+
+}
+
+
+static void test_writeBarcodeAIelementString(struct gs1DLparser *ctx, const char *dlData, bool fixedFirst, bool extraFNC1,
+					     char fnc1, const char *symId, const char *expect, size_t expectlen) {
+
+	char in[256];
+	char out[GS1_DL_MAX_OUT_UNBR + 3];
+	size_t len;
+
+	TEST_CASE(dlData);
+
+	strcpy(in, dlData);
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+
+	len = gs1_writeBarcodeAIelementString(ctx, fixedFirst, extraFNC1, fnc1, symId, out, sizeof(out));
+	TEST_CHECK(len == expectlen && memcmp(out, expect, expectlen + 1) == 0);
+	TEST_MSG("Given: %s; Got length %d; Expected length %d", dlData, (int)len, (int)expectlen);
+	TEST_DUMP("Got:", out, len);
+
+	// Bounded by the output buffer
+	TEST_CHECK(gs1_writeBarcodeAIelementString(ctx, fixedFirst, extraFNC1, fnc1, symId, out, expectlen) == 0);
+	TEST_CHECK(gs1_writeBarcodeAIelementString(ctx, fixedFirst, extraFNC1, fnc1, symId, out, expectlen + 1) == expectlen);
+
+}
+
+static void test_dl_writeBarcodeAIelementString(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+
+#define X(s) s, sizeof(s) - 1
+
+	test_writeBarcodeAIelementString(ctx,
+		"https://id.gs1.org/01/09520123456788/10/ABC1/21/12345?17=180426",
+		false, false, '^', NULL,
+		X("^010952012345678810ABC1^2112345^17180426"));
+
+	test_writeBarcodeAIelementString(ctx,
+		"https://id.gs1.org/01/09520123456788/10/ABC1/21/12345?17=180426",
+		false, false, GS1_DL_FNC1_GS, GS1_DL_SYMID_DATAMATRIX,
+		X("]d2010952012345678810ABC1\x1D" "2112345\x1D" "17180426"));
+
+	test_writeBarcodeAIelementString(ctx,
+		"https://id.gs1.org/01/09520123456788/10/ABC1/21/12345?17=180426",
+		true, false, GS1_DL_FNC1_GS, GS1_DL_SYMID_QR,
+		X("]Q301095201234567881718042610ABC1\x1D" "2112345"));
+
+	test_writeBarcodeAIelementString(ctx,
+		"https://id.gs1.org/01/09520123456788/10/ABC1/21/12345?17=180426",
+		true, true, GS1_DL_FNC1_GS, GS1_DL_SYMID_GS1_128,
+		X("]C10109520123456788\x1D" "17180426\x1D" "10ABC1\x1D" "2112345"));
+
+	test_writeBarcodeAIelementString(ctx,					// NUL separators are binary safe
+		"https://id.gs1.org/01/09520123456788/10/ABC1?99=XYZ",
+		false, false, '\0', GS1_DL_SYMID_DATAMATRIX,
+		X("]d2010952012345678810ABC1\0" "99XYZ"));
+
+	test_writeBarcodeAIelementString(ctx,					// Leading FNC1 when no symbology identifier
+		"https://id.gs1.org/01/09520123456788/10/ABC1?99=XYZ",
+		false, false, GS1_DL_FNC1_GS, NULL,
+		X("\x1D" "010952012345678810ABC1\x1D" "99XYZ"));
+
+#undef X
+
+	free(ctx);
+
+}
+
+
+static int test_gcpLength(void *arg, const char *digits, size_t len) {
+
+	static const struct {
+		const char *prefix;
+		int gcplen;
+	} gcps[] = {
+		{ "9520123", 7 },
+		{ "952061", 6 },
+		{ "952999999999", 12 },
+		{ "0614141", 7 },
+		{ "95201", 5 },
+	};
+	size_t i, n;
+
+	(void)arg;
+
+	for (i = 0; i < SIZEOF_ARRAY(gcps); i++) {
+		n = strlen(gcps[i].prefix);
+		if (len >= n && memcmp(digits, gcps[i].prefix, n) == 0)
+			return gcps[i].gcplen;
+	}
+
+	return 0;
+
+}
+
+
+static void test_writeEPCuri(struct gs1DLparser *ctx, const char *dlData, const char *expect) {
+
+	char in[256];
+	char out[GS1_DL_MAX_OUT_EPC];
+	size_t len;
+
+	TEST_CASE(dlData);
+
+	strcpy(in, dlData);
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_MSG("Err: %s", ctx->err);
+
+	len = gs1_writeEPCuri(ctx, test_gcpLength, NULL, out, sizeof(out));
+	TEST_CHECK(strcmp(out, expect) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, out, expect ? expect : "(none)", ctx->err);
+	TEST_CHECK(len == strlen(expect));
+	TEST_CHECK((*ctx->err == '\0') == (len != 0));
+
+	// Bounded by the output buffer
+	if (*expect) {
+		TEST_CHECK(gs1_writeEPCuri(ctx, test_gcpLength, NULL, out, strlen(expect)) == 0);
+		TEST_CHECK(*out == '\0');
+		TEST_CHECK(gs1_writeEPCuri(ctx, test_gcpLength, NULL, out, strlen(expect) + 1) == strlen(expect));
+	}
+
+}
+
+static void test_dl_writeEPCuri(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	struct gs1DLparser *ctxs = malloc(3 * sizeof(struct gs1DLparser));
+	char in[256];
+	char out[3][64];
+	size_t lens[3];
+
+	test_writeEPCuri(ctx, "https://a/01/09520123456788/21/12345", "urn:epc:id:sgtin:9520123.045678.12345");
+	test_writeEPCuri(ctx, "https://a/01/19520614141236/21/A%2FB%3C%22%25", "urn:epc:id:sgtin:952061.1414123.A%2FB%3C%22%25");
+	test_writeEPCuri(ctx, "https://a/01/09529999999999/21/1", "urn:epc:id:sgtin:952999999999.0.1");
+	test_writeEPCuri(ctx, "https://a/01/09520123456788/10/ABC/21/12345?17=201225", "urn:epc:id:sgtin:9520123.045678.12345");
+	test_writeEPCuri(ctx, "https://a/01/09520123456788/10/ABC1", "urn:epc:class:lgtin:9520123.045678.ABC1");
+	test_writeEPCuri(ctx, "https://a/01/09520123456788/235/XYZ", "urn:epc:id:upui:9520123.045678.XYZ");
+	test_writeEPCuri(ctx, "https://a/01/09520123456788", "");					// No serial
+	test_writeEPCuri(ctx, "https://a/01/01234567890128/21/1", "");				// Unknown GCP
+	test_writeEPCuri(ctx, "https://a/01/0952012345678X/21/1", "");				// Non-numeric key
+	test_writeEPCuri(ctx, "https://a/00/395201234567891234", "urn:epc:id:sscc:9520123.3456789123");
+	test_writeEPCuri(ctx, "https://a/414/9520123000008/254/32a%2Fb", "urn:epc:id:sgln:9520123.00000.32a%2Fb");
+	test_writeEPCuri(ctx, "https://a/414/9520123000008", "urn:epc:id:sgln:9520123.00000.0");
+	test_writeEPCuri(ctx, "https://a/417/9520614000003", "urn:epc:id:pgln:952061.400000");
+	test_writeEPCuri(ctx, "https://a/8003/095201234500031234", "urn:epc:id:grai:9520123.45000.1234");
+	test_writeEPCuri(ctx, "https://a/8003/09520123450003", "");				// No serial
+	test_writeEPCuri(ctx, "https://a/8004/9520123ABC%2F1", "urn:epc:id:giai:9520123.ABC%2F1");
+	test_writeEPCuri(ctx, "https://a/8004/9520123", "");					// No asset reference
+	test_writeEPCuri(ctx, "https://a/253/9520123000009ABC", "urn:epc:id:gdti:9520123.00000.ABC");
+	test_writeEPCuri(ctx, "https://a/255/95201230000091234", "urn:epc:id:sgcn:9520123.00000.1234");
+	test_writeEPCuri(ctx, "https://a/401/9520123XYZ", "urn:epc:id:ginc:9520123.XYZ");
+	test_writeEPCuri(ctx, "https://a/402/95201234567890128", "urn:epc:id:gsin:9520123.456789012");
+	test_writeEPCuri(ctx, "https://a/8017/952012345678901237", "urn:epc:id:gsrnp:9520123.4567890123");
+	test_writeEPCuri(ctx, "https://a/8018/952012345678901237", "urn:epc:id:gsrn:9520123.4567890123");
+	test_writeEPCuri(ctx, "https://a/8006/095201234567880102/21/XYZ", "urn:epc:id:itip:9520123.045678.01.02.XYZ");
+	test_writeEPCuri(ctx, "https://a/8006/095201234567880102", "");			// No serial
+	test_writeEPCuri(ctx, "https://a/8010/9520123AB%23C%2F/8011/123", "urn:epc:id:cpi:9520123.AB%23C%2F.123");
+	test_writeEPCuri(ctx, "https://a/8010/9520123AB", "");					// No serial
+	test_writeEPCuri(ctx, "https://a/8013/9520123ABC", "");					// No EPC scheme
+
+	// Batch conversion, with independent failures
+	strcpy(in, "https://a/01/09520123456788/21/12345");
+	TEST_ASSERT(gs1_parseDLuri(&ctxs[0], in));
+	strcpy(in, "https://a/01/09520123456788");
+	TEST_ASSERT(gs1_parseDLuri(&ctxs[1], in));
+	strcpy(in, "https://a/00/395201234567891234");
+	TEST_ASSERT(gs1_parseDLuri(&ctxs[2], in));
+	TEST_CHECK(gs1_writeEPCuriBatch(ctxs, 3, test_gcpLength, NULL, out[0], sizeof(out[0]), lens) == 2);
+	TEST_CHECK(lens[0] == 37 && strcmp(out[0], "urn:epc:id:sgtin:9520123.045678.12345") == 0);
+	TEST_CHECK(lens[1] == 0 && *out[1] == '\0' && *ctxs[1].err != '\0');
+	TEST_CHECK(lens[2] == 34 && strcmp(out[2], "urn:epc:id:sscc:9520123.3456789123") == 0);
+
+	TEST_CHECK(gs1_writeEPCuri(&ctxs[0], NULL, NULL, out[0], sizeof(out[0])) == 0);
+	TEST_CHECK(strcmp(ctxs[0].err, "No GCP length lookup function") == 0);
+
+	free(ctxs);
+	free(ctx);
+
+}
+
+
+static int test_gcpLengthNaive(const struct gs1GCPprefix *prefixes, size_t count, const char *digits) {
+
+	size_t i, n, best = 0;
+	int len = 0;
+
+	for (i = 0; i < count; i++) {
+		n = strlen(prefixes[i].prefix);
+		if (n > best && strncmp(digits, prefixes[i].prefix, n) == 0) {
+			best = n;
+			len = prefixes[i].gcpLength;
+		}
+	}
+
+	return len;
+
+}
+
+static void test_dl_GCPindex(void) {
+
+	struct gs1GCPprefix prefixes[] = {
+		{ "95", 9 },						// Spans many buckets
+		{ "952", 8 },
+		{ "9520123", 7 },
+		{ "952012399", 10 },					// Nested within the above
+		{ "952061", 6 },
+		{ "0", 7 },
+		{ "00000", 0 },						// Not valid as a GCP
+		{ "1234567890", 12 },
+		{ "952999999999", 12 },					// Final key of its bucket
+		{ "999999999999", 11 },					// Final key of the index
+	};
+	struct gs1GCPprefix rnd[500];
+	char digits[sizeof(rnd) / sizeof(rnd[0])][13];
+	struct gs1GCPprefix bad[2] = { { "952", 8 }, { "952", 9 } };
+	struct gs1GCPindex idx;
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	uint32_t *buf;
+	size_t len, i, j;
+	uint32_t seed = 12345;
+	char in[256], out[GS1_DL_MAX_OUT_EPC];
+
+	len = gs1_buildGCPindex(prefixes, SIZEOF_ARRAY(prefixes), NULL, 0);
+	TEST_ASSERT(len > 0);
+	buf = malloc(len);
+	TEST_CHECK(gs1_buildGCPindex(prefixes, SIZEOF_ARRAY(prefixes), buf, len - 1) == len);
+	TEST_CHECK(!gs1_loadGCPindex(&idx, buf, len));			// Not written
+	TEST_CHECK(gs1_buildGCPindex(prefixes, SIZEOF_ARRAY(prefixes), buf, len) == len);
+	TEST_ASSERT(gs1_loadGCPindex(&idx, buf, len));
+	TEST_CHECK(!gs1_loadGCPindex(&idx, buf, len - 4));		// Truncated
+	TEST_CHECK(!gs1_loadGCPindex(&idx, (char *)buf + 1, len - 4));	// Misaligned
+
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "9520123456788", 13) == 7);
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "9520123996788", 13) == 10);
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "9520124000000", 13) == 8);	// Just after a nested prefix
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "9520122999999", 13) == 8);	// Just before
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "9520614141236", 13) == 6);
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "9510000000000", 13) == 9);
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "9599999999999", 13) == 9);
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "9600000000000", 13) == 0);
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "0614141000000", 13) == 7);
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "0000012345678", 13) == 0);
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "1234567890123", 13) == 12);
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "1234567891123", 13) == 0);
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "952999999999", 12) == 12);
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "952999999998", 12) == 8);
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "999999999999", 12) == 11);
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "9520123", 7) == 7);		// Short, zero extended
+	TEST_CHECK(gs1_lookupGCPlength(&idx, "952A123456788", 13) == 0);	// Non-digit
+
+	// Usable directly for EPC conversion
+	strcpy(in, "https://a/01/09520123456788/21/12345");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_CHECK(gs1_writeEPCuri(ctx, gs1_lookupGCPlength, &idx, out, sizeof(out)) > 0);
+	TEST_CHECK(strcmp(out, "urn:epc:id:sgtin:9520123.045678.12345") == 0);
+	TEST_MSG("Got: %s", out);
+
+	free(buf);
+
+	TEST_CHECK(gs1_buildGCPindex(bad, SIZEOF_ARRAY(bad), NULL, 0) == 0);	// Duplicate
+	bad[1].prefix = "9520123456789";
+	TEST_CHECK(gs1_buildGCPindex(bad, SIZEOF_ARRAY(bad), NULL, 0) == 0);	// Too long
+	bad[1].prefix = "95X";
+	TEST_CHECK(gs1_buildGCPindex(bad, SIZEOF_ARRAY(bad), NULL, 0) == 0);	// Non-digit
+
+	// Agrees with a naive longest prefix match over dense, nested prefixes
+	for (i = 0; i < SIZEOF_ARRAY(rnd); i++) {
+		do {
+			seed = seed * 1103515245 + 12345;
+			len = 1 + (seed >> 16) % 12;
+			for (j = 0; j < len; j++) {
+				seed = seed * 1103515245 + 12345;
+				digits[i][j] = (char)('0' + (seed >> 16) % (j < 4 ? 2 : 10));
+			}
+			digits[i][len] = '\0';
+			for (j = 0; j < i && strcmp(digits[i], digits[j]) != 0; j++);
+		} while (j < i);
+		rnd[i].prefix = digits[i];
+		rnd[i].gcpLength = (int)(seed >> 8) % 13;
+	}
+	len = gs1_buildGCPindex(rnd, SIZEOF_ARRAY(rnd), NULL, 0);
+	TEST_ASSERT(len > 0);
+	buf = malloc(len);
+	TEST_ASSERT(gs1_buildGCPindex(rnd, SIZEOF_ARRAY(rnd), buf, len) == len);
+	TEST_ASSERT(gs1_loadGCPindex(&idx, buf, len));
+	for (i = 0; i < 20000; i++) {
+		for (j = 0; j < 12; j++) {
+			seed = seed * 1103515245 + 12345;
+			in[j] = (char)('0' + (seed >> 16) % (j < 4 ? 2 : 10));
+		}
+		if (i % 2 == 0)						// Often start from a prefix
+			memcpy(in, rnd[i % SIZEOF_ARRAY(rnd)].prefix, strlen(rnd[i % SIZEOF_ARRAY(rnd)].prefix));
+		in[12] = '\0';
+		if (!TEST_CHECK(gs1_lookupGCPlength(&idx, in, 12) == test_gcpLengthNaive(rnd, SIZEOF_ARRAY(rnd), in))) {
+			TEST_MSG("Key: %s; Got: %d; Expected: %d", in, gs1_lookupGCPlength(&idx, in, 12),
+				 test_gcpLengthNaive(rnd, SIZEOF_ARRAY(rnd), in));
+			break;
+		}
+	}
+
+	free(buf);
+	free(ctx);
+
+}
+
+
+static void test_writeEPCbinary(struct gs1DLparser *ctx, const char *dlData, unsigned int scheme, unsigned int filter, const char *expect) {
+
+	char in[256];
+	char hex[GS1_DL_EPC_MAX_WORDS * 16 + 1];
+	char json[GS1_DL_MAX_OUT_JSON];
+	char json2[GS1_DL_MAX_OUT_JSON];
+	uint64_t words[GS1_DL_EPC_MAX_WORDS];
+	size_t bits, i;
+	unsigned int f;
+
+	TEST_CASE(dlData);
+
+	strcpy(in, dlData);
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	gs1_writeJSON(ctx, false, json);
+
+	*hex = '\0';
+	bits = gs1_writeEPCbinary(ctx, scheme, filter, test_gcpLength, NULL, words, GS1_DL_EPC_MAX_WORDS);
+	for (i = 0; i < (bits + 63) / 64; i++)
+		sprintf(hex + i * 16, "%08lX%08lX", (unsigned long)(words[i] >> 32), (unsigned long)(words[i] & 0xFFFFFFFF));
+	TEST_CHECK(strcmp(hex, expect) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s; Err: %s", dlData, hex, expect, ctx->err);
+	if (!*expect)
+		return;
+
+	// Decodes back to the same key and serial
+	TEST_CHECK(gs1_parseEPCbinary(ctx, words, (bits + 63) / 64, &f));
+	TEST_MSG("Err: %s", ctx->err);
+	gs1_writeJSON(ctx, false, json2);
+	TEST_CHECK(strcmp(json, json2) == 0);
+	TEST_MSG("Decoded: %s; Expected: %s", json2, json);
+	TEST_CHECK(f == filter);
+
+}
+
+static void test_dl_EPCbinary(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	uint64_t words[GS1_DL_EPC_MAX_WORDS];
+	char json[GS1_DL_MAX_OUT_JSON];
+
+	test_writeEPCbinary(ctx, "https://a/01/80614141123458/21/6789", GS1_DL_EPC_SGTIN_96, 3,
+		"3074257BF7194E4000001A8500000000");
+	test_writeEPCbinary(ctx, "https://a/01/70614141123451/21/32a%2Fb", GS1_DL_EPC_SGTIN_198, 3,
+		"3674257BF6B7A659B2C2BF100000000000000000000000000000000000000000");
+	test_writeEPCbinary(ctx, "https://a/00/106141412345678908", GS1_DL_EPC_SSCC_96, 3,
+		"3174257BF4499602D200000000000000");
+	test_writeEPCbinary(ctx, "https://a/01/09520123456788/21/274877906943", GS1_DL_EPC_SGTIN_96, 0,
+		"3016450FEC2C9BBFFFFFFFFF00000000");					// Largest serial
+	test_writeEPCbinary(ctx, "https://a/01/09529999999993/21/0", GS1_DL_EPC_SGTIN_96, 7,
+		"30E3778CE7E7FC000000000000000000");					// 12-digit GCP
+	test_writeEPCbinary(ctx, "https://a/01/09520123456788/21/ABCDEFGHIJKLMNOPQRST", GS1_DL_EPC_SGTIN_198, 1,
+		"3636450FEC2C9BA0C287122C68F224CA97326CE9F428D2A75000000000000000");
+	test_writeEPCbinary(ctx, "https://a/01/09520123456788/21/274877906944", GS1_DL_EPC_SGTIN_96, 0, "");	// Serial too large
+	test_writeEPCbinary(ctx, "https://a/01/09520123456788/21/0123", GS1_DL_EPC_SGTIN_96, 0, "");		// Leading zero
+	test_writeEPCbinary(ctx, "https://a/01/09520123456788/21/A1", GS1_DL_EPC_SGTIN_96, 0, "");		// Non-numeric
+	test_writeEPCbinary(ctx, "https://a/01/09520123456788/21/ABCDEFGHIJKLMNOPQRSTU", GS1_DL_EPC_SGTIN_198, 0, "");	// Too long
+	test_writeEPCbinary(ctx, "https://a/01/09520123456788/21/A%23B", GS1_DL_EPC_SGTIN_198, 0, "");		// Not in CSET 82
+	test_writeEPCbinary(ctx, "https://a/01/09520123456788/21/A~B", GS1_DL_EPC_SGTIN_198, 0, "");
+	test_writeEPCbinary(ctx, "https://a/01/09520123456788", GS1_DL_EPC_SGTIN_96, 0, "");			// No serial
+	test_writeEPCbinary(ctx, "https://a/01/09520112345678/21/1", GS1_DL_EPC_SGTIN_96, 0, "");		// GCP too short
+	test_writeEPCbinary(ctx, "https://a/01/09520123456788/21/1", GS1_DL_EPC_SGTIN_96, 8, "");		// Bad filter
+	test_writeEPCbinary(ctx, "https://a/01/09520123456788/21/1", GS1_DL_EPC_SSCC_96, 0, "");		// No SSCC
+	test_writeEPCbinary(ctx, "https://a/01/09520123456788/21/1", 0x35, 0, "");				// GID-96
+
+	TEST_CHECK(gs1_writeEPCbinary(ctx, GS1_DL_EPC_SGTIN_198, 0, test_gcpLength, NULL, words, 3) == 0);	// Too few words
+
+	// Decode failures
+	words[0] = UINT64_C(0x3574257BF7194E40);				// Unsupported header
+	words[1] = 0;
+	TEST_CHECK(!gs1_parseEPCbinary(ctx, words, 2, NULL));
+	words[0] = UINT64_C(0x307C257BF7194E40);				// Partition 7
+	TEST_CHECK(!gs1_parseEPCbinary(ctx, words, 2, NULL));
+	words[0] = UINT64_C(0x3077FFFFF7194E40);				// Company prefix exceeds 7 digits
+	TEST_CHECK(!gs1_parseEPCbinary(ctx, words, 2, NULL));
+	words[0] = UINT64_C(0x3074257BF7194E40);
+	TEST_CHECK(!gs1_parseEPCbinary(ctx, words, 1, NULL));			// Truncated
+	TEST_CHECK(gs1_parseEPCbinary(ctx, words, 2, NULL));			// Serial 0
+	gs1_writeJSON(ctx, false, json);
+	TEST_CHECK(strcmp(json, "{\"01\":\"80614141123458\",\"21\":\"0\"}") == 0);
+	TEST_MSG("Got: %s", json);
+
+	words[0] = UINT64_C(0x3674257BF6B7A659);				// SGTIN-198 with serial "32a/b"
+	words[1] = UINT64_C(0xB2C2BF1000000000);
+	words[2] = words[3] = 0;
+	TEST_CHECK(gs1_parseEPCbinary(ctx, words, 4, NULL));
+	words[1] = UINT64_C(0xA3C2BF1000000000);				// "3#a/b" is not in CSET 82
+	TEST_CHECK(!gs1_parseEPCbinary(ctx, words, 4, NULL));
+	words[1] = UINT64_C(0xB2C2BF1000000000);
+	words[3] = UINT64_C(1) << 58;						// Final bit of the padding
+	TEST_CHECK(!gs1_parseEPCbinary(ctx, words, 4, NULL));
+	TEST_CHECK(strcmp(ctx->err, "Non-zero padding in EPC serial number") == 0);
+
+	free(ctx);
+
+}
+
+
+static void test_writeHRI(struct gs1DLparser *ctx, const char *dlData, bool withDataTitles, const char *expect) {
+
+	char in[256];
+	char out[GS1_DL_MAX_OUT_HRI];
+	size_t len;
+
+	TEST_CASE(dlData);
+
+	strcpy(in, dlData);
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+
+	len = gs1_writeHRI(ctx, withDataTitles, out, sizeof(out));
+	TEST_CHECK(strcmp(out, expect) == 0);
+	TEST_MSG("Given: %s; Got: %s; Expected: %s", dlData, out, expect ? expect : "(none)");
+	TEST_CHECK(len == strlen(expect));
+
+	// Bounded by the output buffer
+	TEST_CHECK(gs1_writeHRI(ctx, withDataTitles, out, strlen(expect)) == 0);
+	TEST_CHECK(*out == '\0');
+	TEST_CHECK(gs1_writeHRI(ctx, withDataTitles, out, strlen(expect) + 1) == strlen(expect));
+
+}
+
+static void test_dl_writeHRI(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+
+	test_writeHRI(ctx, "https://a/01/09520123456788/10/ABC%2F123", false,
+		"(01) 09520123456788 (10) ABC/123");
+	test_writeHRI(ctx, "https://a/01/09520123456788/10/ABC%2F123", true,
+		"GTIN (01) 09520123456788 BATCH/LOT (10) ABC/123");
+	test_writeHRI(ctx, "https://a/01/09520123456788/21/12345?3103=000195&17=201225", true,
+		"GTIN (01) 09520123456788 SERIAL (21) 12345 NET WEIGHT (kg) (3103) 000195 USE BY OR EXPIRY (17) 201225");
+	test_writeHRI(ctx, "https://a/00/006141411234567890?99=XYZ&89=ABC", true,		// Untitled AI
+		"SSCC (00) 006141411234567890 INTERNAL (99) XYZ (89) ABC");
+	test_writeHRI(ctx, "https://a/414/9520123000008/254/32a%2Fb", true,
+		"LOC No. (414) 9520123000008 GLN EXTENSION COMPONENT (254) 32a/b");
+
+	free(ctx);
+
+}
+
+
+static void test_dl_parseQueryParams(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	char in[256];
+	char out[256];
+
+	strcpy(in, "https://id.gs1.org/01/09520123456788?linkType=gs1%3Apip&17=201225&context=a+b&flag&lang=en#frag");
+	TEST_ASSERT(gs1_parseDLuriEx(ctx, in, GS1_DL_PARSE_QUERY_PARAMS));
+	TEST_CHECK(ctx->numAIs == 2);
+	TEST_ASSERT(ctx->numQueryParams == 4);
+
+	TEST_CHECK(ctx->queryParams[0].namelen == 8 && strncmp(ctx->queryParams[0].name, "linkType", 8) == 0);
+	TEST_CHECK(ctx->queryParams[0].vallen == 9 && strncmp(ctx->queryParams[0].value, "gs1%3Apip", 9) == 0);
+	TEST_CHECK(gs1_decodeQueryParam(ctx->queryParams[0].value, ctx->queryParams[0].vallen, out) == 7);
+	TEST_CHECK(strcmp(out, "gs1:pip") == 0);
+
+	TEST_CHECK(ctx->queryParams[1].namelen == 7 && strncmp(ctx->queryParams[1].name, "context", 7) == 0);
+	TEST_CHECK(gs1_decodeQueryParam(ctx->queryParams[1].value, ctx->queryParams[1].vallen, out) == 3);
+	TEST_CHECK(strcmp(out, "a b") == 0);
+
+	TEST_CHECK(ctx->queryParams[2].namelen == 4 && strncmp(ctx->queryParams[2].name, "flag", 4) == 0);
+	TEST_CHECK(ctx->queryParams[2].value == NULL && ctx->queryParams[2].vallen == 0);
+
+	TEST_CHECK(ctx->queryParams[3].namelen == 4 && strncmp(ctx->queryParams[3].name, "lang", 4) == 0);
+	TEST_CHECK(ctx->queryParams[3].vallen == 2 && strncmp(ctx->queryParams[3].value, "en", 2) == 0);
+
+	// Input is restored, so the spans remain valid
+	TEST_CHECK(strcmp(in, "https://id.gs1.org/01/09520123456788?linkType=gs1%3Apip&17=201225&context=a+b&flag&lang=en#frag") == 0);
+
+	// Not recorded unless requested
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_CHECK(ctx->numQueryParams == 0);
+
+	// Capped
+	strcpy(in, "https://id.gs1.org/01/09520123456788?a=1&b=2&c=3&d=4&e=5&f=6&g=7&h=8&i=9&j=10&k=11&l=12&m=13&n=14&o=15&p=16&q=17");
+	TEST_ASSERT(gs1_parseDLuriEx(ctx, in, GS1_DL_PARSE_QUERY_PARAMS));
+	TEST_CHECK(ctx->numQueryParams == GS1_DL_MAX_QUERY_PARAMS);
+	TEST_CHECK(ctx->queryParams[GS1_DL_MAX_QUERY_PARAMS-1].namelen == 1 && *ctx->queryParams[GS1_DL_MAX_QUERY_PARAMS-1].name == 'p');
+
+	// Cleared on failure
+	strcpy(in, "https://id.gs1.org/01/09520123456788?lang=en&123456=1");
+	TEST_CHECK(!gs1_parseDLuriEx(ctx, in, GS1_DL_PARSE_QUERY_PARAMS));
+	TEST_CHECK(ctx->numQueryParams == 0);
+
+	free(ctx);
+
+}
+
+
+static void test_uriParts(struct gs1DLparser *ctx, const char *dlData,
+			  const char *scheme, const char *domain, const char *stem, const char *fragment) {
+
+	char in[256];
+
+	TEST_CASE(dlData);
+
+	strcpy(in, dlData);
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+
+#define CHECK_SPAN(span, expect) do {									\
+	TEST_CHECK(ctx->uriParts.span.len == strlen(expect) &&						\
+		   strncmp(in + ctx->uriParts.span.offset, expect, strlen(expect)) == 0);		\
+	TEST_MSG(#span ": Got: %.*s; Expected: %s",							\
+		 (int)ctx->uriParts.span.len, in + ctx->uriParts.span.offset, expect);			\
+} while (0)
+
+	CHECK_SPAN(scheme, scheme);
+	CHECK_SPAN(domain, domain);
+	CHECK_SPAN(stem, stem);
+	CHECK_SPAN(fragment, fragment);
+
+#undef CHECK_SPAN
+
+}
+
+static void test_dl_uriParts(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	char in[256];
+
+	test_uriParts(ctx, "https://id.gs1.org/01/09520123456788", "https", "id.gs1.org", "", "");
+	test_uriParts(ctx, "http://example.com:8080/some/stem/01/09520123456788/10/ABC?17=201225#frag",
+		      "http", "example.com:8080", "some/stem", "frag");
+	test_uriParts(ctx, "https://a/stem/01/09520123456788?linkType=all#", "https", "a", "stem", "");
+	test_uriParts(ctx, "https://a/stem/ARFRJydaKCCNV4JGQgowOQ#x", "https", "a", "stem", "x");	// Compressed
+	test_uriParts(ctx, "https://a/ARFRJydaKCCNV4JGQgowOQ", "https", "a", "", "");
+
+	// Cleared by other parsers
+	TEST_ASSERT(gs1_parseJSON(ctx, "{\"01\":\"09520123456788\"}"));
+	TEST_CHECK(ctx->uriParts.domain.len == 0);
+
+	// Cleared on failure
+	strcpy(in, "https://a/stem/00/123");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	strcpy(in, "https://a/stem/99/123");
+	TEST_CHECK(!gs1_parseDLuri(ctx, in));
+	TEST_CHECK(ctx->uriParts.domain.len == 0 && ctx->uriParts.stem.len == 0);
+
+	free(ctx);
+
+}
+
+
+static void test_dl_datesAndMeasures(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	char in[256];
+	char col[6 * 20 + 1];
+	int32_t days[20], one;
+	uint32_t values[20], value;
+	int decimals;
+	size_t i;
+	uint32_t seed = 1;
+
+	strcpy(in, "https://a/01/09520123456788?17=201225&15=240200&11=241301&3103=000195&3202=123456&13=2402AB");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+
+	TEST_CHECK(gs1_getDate(ctx, "17", 2026, &one) && one == 18621);
+	TEST_CHECK(gs1_getDate(ctx, "15", 2026, &one) && one == 19782);		// DD=00 is end of month
+	TEST_CHECK(!gs1_getDate(ctx, "11", 2026, &one));				// Invalid month
+	TEST_CHECK(!gs1_getDate(ctx, "13", 2026, &one));				// Non-numeric
+	TEST_CHECK(!gs1_getDate(ctx, "16", 2026, &one));				// Absent
+	TEST_CHECK(!gs1_getDate(ctx, "01", 2026, &one));				// Not a date
+
+	TEST_CHECK(gs1_getMeasure(ctx, "3103", &value, &decimals) && value == 195 && decimals == 3);
+	TEST_CHECK(gs1_getMeasure(ctx, "320", &value, &decimals) && value == 123456 && decimals == 2);
+	TEST_CHECK(!gs1_getMeasure(ctx, "3102", &value, &decimals));			// Absent
+	TEST_CHECK(!gs1_getMeasure(ctx, "17", &value, &decimals));			// Not a measure
+
+	// Century sliding window
+	TEST_CHECK(gs1_decodeDates("991231", 1, 2026, days) == 1 && days[0] == 10956);
+	TEST_CHECK(gs1_decodeDates("760101", 1, 2026, days) == 1 && days[0] == 38716);
+	TEST_CHECK(gs1_decodeDates("770101", 1, 2026, days) == 1 && days[0] == 2557);
+	TEST_CHECK(gs1_decodeDates("200101", 1, 2080, days) == 1 && days[0] == 54786);
+	TEST_CHECK(gs1_decodeDates("230200", 1, 2026, days) == 1 && days[0] == 19416);
+	TEST_CHECK(gs1_decodeDates("230229", 1, 2026, days) == 0 && days[0] == GS1_DL_DATE_INVALID);
+	TEST_CHECK(gs1_decodeDates("000101", 1, 2026, days) == 1 && days[0] == 10957);
+
+	// Batches agree with individual decoding, including invalid entries within a block
+	for (i = 0; i < 20; i++) {
+		seed = seed * 1103515245 + 12345;
+		sprintf(col + 6 * i, "%02u%02u%02u", (seed >> 8) % 100, (seed >> 16) % 13, (seed >> 20) % 32);
+	}
+	col[6 * 3 + 2] = 'X';
+	TEST_CHECK(gs1_decodeDates(col, 20, 2026, days) < 20);
+	for (i = 0; i < 20; i++) {
+		TEST_CHECK(gs1_decodeDates(col + 6 * i, 1, 2026, &one) <= 1);
+		TEST_CHECK(days[i] == one);
+		TEST_MSG("Date: %.6s; Batch: %d; Individual: %d", col + 6 * i, (int)days[i], (int)one);
+	}
+
+	TEST_CHECK(gs1_decodeMeasures(col, 20, values) == 19);
+	for (i = 0; i < 20; i++) {
+		TEST_CHECK(gs1_decodeMeasures(col + 6 * i, 1, &value) == (i == 3 ? 0 : 1));
+		TEST_CHECK(values[i] == value);
+	}
+	TEST_CHECK(values[3] == GS1_DL_MEASURE_INVALID);
+	memcpy(in, col, 6);
+	in[6] = '\0';
+	TEST_CHECK(values[0] == (uint32_t)strtoul(in, NULL, 10));
+
+	free(ctx);
+
+}
+
+
+static void test_dl_getKey64(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	struct gs1DLparser *ctxs = malloc(3 * sizeof(struct gs1DLparser));
+	char in[256];
+	uint64_t key, keys[3];
+
+	strcpy(in, "https://a/00/395201234567891234?01=9520123456788&99=9999999999999999999&98=10000000000000000000&97=12A");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+
+	TEST_CHECK(gs1_getKey64(ctx, "00", &key) && key == UINT64_C(395201234567891234));
+	TEST_CHECK(gs1_getKey64(ctx, "01", &key) && key == UINT64_C(9520123456788));	// Padded to 14 digits
+	TEST_CHECK(gs1_getKey64(ctx, "99", &key) && key == UINT64_C(9999999999999999999));
+	TEST_CHECK(!gs1_getKey64(ctx, "98", &key));					// Too long
+	TEST_CHECK(!gs1_getKey64(ctx, "97", &key));					// Non-numeric
+	TEST_CHECK(!gs1_getKey64(ctx, "21", &key));					// Absent
+
+	strcpy(in, "https://a/01/09520123456788");
+	TEST_ASSERT(gs1_parseDLuri(&ctxs[0], in));
+	strcpy(in, "https://a/00/395201234567891234");
+	TEST_ASSERT(gs1_parseDLuri(&ctxs[1], in));
+	strcpy(in, "https://a/01/12345678901231");
+	TEST_ASSERT(gs1_parseDLuri(&ctxs[2], in));
+	TEST_CHECK(gs1_getKeys64(ctxs, 3, "01", keys) == 2);
+	TEST_CHECK(keys[0] == UINT64_C(9520123456788));
+	TEST_CHECK(keys[1] == GS1_DL_KEY_INVALID);
+	TEST_CHECK(keys[2] == UINT64_C(12345678901231));
+
+	free(ctxs);
+	free(ctx);
+
+}
+
+
+static void test_dl_filter(void) {
+
+	struct gs1DLparser *ctxs = malloc(70 * sizeof(struct gs1DLparser));
+	struct gs1DLfilter filter;
+	char in[256];
+	uint64_t bitmap[2];
+	size_t i;
+
+	// Rows alternate between GTINs, with and without a serial; every third is an SSCC
+	for (i = 0; i < 70; i++) {
+		sprintf(in, "https://a/%s%s", i % 3 == 0 ? "01/09520123456788" : i % 3 == 1 ? "01/09529999999993" : "00/395201234567891234",
+			i % 2 == 0 ? "/21/ABC?17=261130" : "?17=270101");
+		TEST_ASSERT(gs1_parseDLuri(&ctxs[i], in));
+	}
+
+	gs1_filterInit(&filter, 2026);
+	TEST_CHECK(gs1_filterBatch(&filter, ctxs, 70, bitmap) == 70);
+	TEST_CHECK(bitmap[0] == ~UINT64_C(0) && bitmap[1] == 0x3F);
+
+	TEST_CHECK(gs1_filterKeyPrefix(&filter, "01", "0952012"));
+	TEST_CHECK(gs1_filterBatch(&filter, ctxs, 70, bitmap) == 24);
+	TEST_CHECK(bitmap[0] == UINT64_C(0x9249249249249249) && bitmap[1] == 0x24);
+
+	TEST_CHECK(gs1_filterHasAI(&filter, "21"));
+	TEST_CHECK(gs1_filterBatch(&filter, ctxs, 70, bitmap) == 12);
+	TEST_CHECK(bitmap[0] == UINT64_C(0x1041041041041041) && bitmap[1] == 0x04);
+
+	// GTINs with serials expire 2026-11-30, others 2027-01-01
+	gs1_filterInit(&filter, 2026);
+	TEST_CHECK(gs1_filterDate(&filter, "17", GS1_DL_FILTER_LT, 2026, 12, 31));
+	TEST_CHECK(gs1_filterBatch(&filter, ctxs, 70, bitmap) == 35);
+	TEST_CHECK(bitmap[0] == UINT64_C(0x5555555555555555) && bitmap[1] == 0x15);
+
+	gs1_filterInit(&filter, 2026);
+	TEST_CHECK(gs1_filterDate(&filter, "17", GS1_DL_FILTER_EQ, 2027, 1, 1));
+	TEST_CHECK(gs1_filterKeyPrefix(&filter, "00", "3"));
+	TEST_CHECK(gs1_filterBatch(&filter, ctxs, 70, bitmap) == 11);
+	TEST_CHECK(bitmap[0] == UINT64_C(0x0820820820820820) && bitmap[1] == 0x02);
+
+	gs1_filterInit(&filter, 2026);
+	TEST_CHECK(gs1_filterDate(&filter, "17", GS1_DL_FILTER_GE, 2026, 11, 30));
+	TEST_CHECK(gs1_filterBatch(&filter, ctxs, 3, bitmap) == 3);	// Short batch
+	TEST_CHECK(bitmap[0] == 0x7);
+	TEST_CHECK(gs1_filterDate(&filter, "17", GS1_DL_FILTER_GT, 2026, 11, 30));
+	TEST_CHECK(gs1_filterBatch(&filter, ctxs, 3, bitmap) == 1);
+	TEST_CHECK(bitmap[0] == 0x2);
+
+	// Builder errors
+	gs1_filterInit(&filter, 2026);
+	TEST_CHECK(!gs1_filterHasAI(&filter, "1"));
+	TEST_CHECK(!gs1_filterHasAI(&filter, "21A"));
+	TEST_CHECK(!gs1_filterKeyPrefix(&filter, "10", "1"));		// Variable length
+	TEST_CHECK(!gs1_filterKeyPrefix(&filter, "17", "26"));		// Not a key
+	TEST_CHECK(!gs1_filterKeyPrefix(&filter, "410", "0952"));	// Not a DL primary key
+	TEST_CHECK(!gs1_filterKeyPrefix(&filter, "01", "095201234567890"));	// Longer than key
+	TEST_CHECK(!gs1_filterKeyPrefix(&filter, "01", "095A"));
+	TEST_CHECK(!gs1_filterDate(&filter, "21", GS1_DL_FILTER_LT, 2026, 1, 1));
+	TEST_CHECK(!gs1_filterDate(&filter, "17", GS1_DL_FILTER_LT, 2026, 2, 29));
+	TEST_CHECK(gs1_filterDate(&filter, "17", GS1_DL_FILTER_LT, 2028, 2, 29));
+	TEST_CHECK(!gs1_filterDate(&filter, "17", 5, 2026, 1, 1));
+	TEST_CHECK(filter.numTerms == 1);
+	for (i = 1; i < GS1_DL_MAX_FILTER_TERMS; i++)
+		TEST_CHECK(gs1_filterHasAI(&filter, "01"));
+	TEST_CHECK(!gs1_filterHasAI(&filter, "01"));
+	TEST_CHECK(strcmp(filter.err, "Too many filter terms") == 0);
+
+	// A short key is not treated as if zero-padded
+	strcpy(in, "https://a/01/95201234567");
+	TEST_ASSERT(gs1_parseDLuri(&ctxs[0], in));
+	gs1_filterInit(&filter, 2026);
+	TEST_CHECK(gs1_filterKeyPrefix(&filter, "01", "000"));
+	TEST_CHECK(gs1_filterBatch(&filter, ctxs, 1, bitmap) == 0);
+
+	free(ctxs);
+
+}
+
+
+struct aggResult {
+	struct gs1DLaggEntry entries[32];
+	int n;
+};
+
+static bool test_aggCollect(void *arg, const struct gs1DLaggEntry *entry) {
+	struct aggResult *r = arg;
+	if (r->n == 32)
+		return false;
+	r->entries[r->n++] = *entry;
+	return true;
+}
+
+struct aggTotals {
+	uint64_t lastKey;
+	uint64_t count;
+	int n;
+	bool ordered;
+};
+
+static bool test_aggTotal(void *arg, const struct gs1DLaggEntry *entry) {
+	struct aggTotals *t = arg;
+	if (t->n > 0 && entry->key <= t->lastKey)
+		t->ordered = false;
+	t->lastKey = entry->key;
+	t->count += entry->count;
+	t->n++;
+	return true;
+}
+
+static void test_dl_aggregate(void) {
+
+	struct gs1DLparser *ctxs = malloc(80 * sizeof(struct gs1DLparser));
+	struct gs1DLaggEntry slotsA[16], slotsB[64];
+	struct gs1DLaggregator a, b;
+	struct aggResult r;
+	struct aggTotals t = { 0, 0, 0, true };
+	int64_t seen[80];
+	char in[256];
+	FILE *spill;
+	int i;
+
+	// 20 keys, each with a single lot, seen at i, i + 20, i + 40 and i + 60
+	for (i = 0; i < 80; i++) {
+		sprintf(in, "https://a/01/%014d/10/L%d", 1 + i % 20, i % 2);
+		TEST_ASSERT(gs1_parseDLuri(&ctxs[i], in));
+		seen[i] = i;
+	}
+
+	TEST_ASSERT((spill = tmpfile()) != NULL);
+	TEST_ASSERT(gs1_aggInit(&a, "01", GS1_DL_AGG_BY_LOT, slotsA, 16, spill));
+	TEST_ASSERT(gs1_aggInit(&b, "01", GS1_DL_AGG_BY_LOT, slotsB, 64, NULL));
+
+	TEST_CHECK(gs1_aggAddBatch(&a, ctxs, 60, seen));
+	TEST_CHECK(a.numRuns > 0);				// Table holds at most 12 keys
+	TEST_CHECK(gs1_aggAddBatch(&b, &ctxs[60], 20, &seen[60]));
+	TEST_CHECK(b.numRuns == 0);
+	strcpy(in, "https://a/00/395201234567891234");
+	TEST_ASSERT(gs1_parseDLuri(&ctxs[0], in));
+	TEST_CHECK(gs1_aggAdd(&b, &ctxs[0], 0));		// No key
+
+	TEST_CHECK(gs1_aggMerge(&a, &b));
+	TEST_CHECK(a.skipped == 1);
+	r.n = 0;
+	TEST_CHECK(gs1_aggFinish(&a, test_aggCollect, &r));
+	TEST_ASSERT(r.n == 20);
+	for (i = 0; i < 20; i++) {
+		sprintf(in, "L%d", i % 2);
+		TEST_CHECK(r.entries[i].key == (uint64_t)(1 + i));
+		TEST_CHECK(strcmp(r.entries[i].lot, in) == 0);
+		TEST_CHECK(r.entries[i].count == 4);
+		TEST_CHECK(r.entries[i].firstSeen == i && r.entries[i].lastSeen == i + 60);
+		TEST_MSG("Entry %d: key %d, count %d", i, (int)r.entries[i].key, (int)r.entries[i].count);
+	}
+
+	// Emptied by finishing
+	r.n = 0;
+	TEST_CHECK(gs1_aggFinish(&a, test_aggCollect, &r));
+	TEST_CHECK(r.n == 0);
+
+	// Per key only, without spilling
+	TEST_ASSERT(gs1_aggInit(&b, "01", 0, slotsB, 64, NULL));
+	TEST_CHECK(gs1_aggAddBatch(&b, &ctxs[1], 79, &seen[1]));
+	r.n = 0;
+	TEST_CHECK(gs1_aggFinish(&b, test_aggCollect, &r));
+	TEST_CHECK(r.n == 20 && r.entries[0].count == 3 && r.entries[1].count == 4);
+	TEST_CHECK(r.entries[0].lot[0] == '\0');
+
+	TEST_ASSERT(gs1_aggInit(&b, "01", 0, slotsA, 16, NULL));
+	TEST_CHECK(!gs1_aggAddBatch(&b, ctxs, 20, seen));
+	TEST_CHECK(strcmp(b.err, "Aggregation table is full") == 0);
+	TEST_ASSERT(gs1_aggInit(&a, "01", GS1_DL_AGG_BY_LOT, slotsA, 16, NULL));
+	TEST_CHECK(!gs1_aggMerge(&a, &b));
+
+	TEST_CHECK(!gs1_aggInit(&a, "01", 0, slotsA, 15, NULL));
+	TEST_CHECK(!gs1_aggInit(&a, "01", 0, slotsA, 8, NULL));
+	TEST_CHECK(!gs1_aggInit(&a, "0A", 0, slotsA, 16, NULL));
+
+	// A run read through the free slots of the table
+	for (i = 0; i < 80; i++) {
+		sprintf(in, "https://a/01/%014d", 80 - i);
+		TEST_ASSERT(gs1_parseDLuri(&ctxs[i], in));
+	}
+	TEST_ASSERT(gs1_aggInit(&b, "01", 0, slotsB, 64, spill));
+	TEST_CHECK(gs1_aggAddBatch(&b, ctxs, 80, seen));
+	TEST_CHECK(gs1_aggAddBatch(&b, ctxs, 10, seen));
+	TEST_CHECK(b.numRuns == 1);
+	TEST_CHECK(gs1_aggFinish(&b, test_aggTotal, &t));
+	TEST_CHECK(t.n == 80 && t.count == 90 && t.ordered);
+	TEST_MSG("Entries %d, count %d", t.n, (int)t.count);
+
+	fclose(spill);
+	free(ctxs);
+
+}
+
+
+static void test_hhStream(struct gs1DLheavyHitters *hh, int from, int to) {
+
+	int i;
 
-	test_parseDLuri(ctx, false,					// No domain
-		"https://00/006141411234567890",
-		"", "", "", "", "", "", "", "");
+	// Key 1 seen 100 times, key 2 50 times and key 3 30 times among 500 singletons
+	for (i = from; i < to; i++) {
+		gs1_hhAddKey(hh, (uint64_t)(1000 + i));
+		if (i % 5 == 0)
+			gs1_hhAddKey(hh, 1);
+		if (i % 10 == 0)
+			gs1_hhAddKey(hh, 2);
+		if (i < 300 && i % 10 == 5)
+			gs1_hhAddKey(hh, 3);
+	}
 
-	test_parseDLuri(ctx, true,
-		"https://a/stem/00/006141411234567890",
-		"^00006141411234567890",
-		"^00006141411234567890",
-		"(00)006141411234567890",
-		"{\"00\":\"006141411234567890\"}",
-		"^00006141411234567890",
-		"^00006141411234567890",
-		"(00)006141411234567890",
-		"{\"00\":\"006141411234567890\"}");
+}
 
-	test_parseDLuri(ctx, true,
-		"https://a/more/stem/00/006141411234567890",
-		"^00006141411234567890",
-		"^00006141411234567890",
-		"(00)006141411234567890",
-		"{\"00\":\"006141411234567890\"}",
-		"^00006141411234567890",
-		"^00006141411234567890",
-		"(00)006141411234567890",
-		"{\"00\":\"006141411234567890\"}");
+static void test_hhCheckTop(const struct gs1DLheavyHitters *hh) {
 
-	test_parseDLuri(ctx, true,					// Fake AI in stem, stop at rightmost key
-		"https://a/00/faux/00/006141411234567890",
-		"^00006141411234567890",
-		"^00006141411234567890",
-		"(00)006141411234567890",
-		"{\"00\":\"006141411234567890\"}",
-		"^00006141411234567890",
-		"^00006141411234567890",
-		"(00)006141411234567890",
-		"{\"00\":\"006141411234567890\"}");
+	uint64_t keys[GS1_DL_TOPK_MAX], counts[GS1_DL_TOPK_MAX], errors[GS1_DL_TOPK_MAX];
 
-	test_parseDLuri(ctx, true,
-		"https://a/01/12312312312333",
-		"^0112312312312333",
-		"^0112312312312333",
-		"(01)12312312312333",
-		"{\"01\":\"12312312312333\"}",
-		"^0112312312312333",
-		"^0112312312312333",
-		"(01)12312312312333",
-		"{\"01\":\"12312312312333\"}");
+	// Keys more frequent than total / k are guaranteed to be tracked
+	TEST_ASSERT(gs1_hhTop(hh, keys, counts, errors, GS1_DL_TOPK_MAX) == 16);
+	TEST_CHECK(keys[0] == 1 && counts[0] >= 100 && counts[0] - errors[0] <= 100);
+	TEST_CHECK(keys[1] == 2 && counts[1] >= 50 && counts[1] - errors[1] <= 50);
+	TEST_CHECK(counts[2] <= counts[1]);
+	TEST_CHECK(gs1_hhTop(hh, keys, counts, NULL, 1) == 1 && keys[0] == 1);
 
-	test_parseDLuri(ctx, true,					// GTIN-13 -> GTIN-14
-		"https://a/01/2112345678900",
-		"^0102112345678900",
-		"^0102112345678900",
-		"(01)02112345678900",
-		"{\"01\":\"02112345678900\"}",
-		"^0102112345678900",
-		"^0102112345678900",
-		"(01)02112345678900",
-		"{\"01\":\"02112345678900\"}");
+	TEST_CHECK(gs1_hhEstimate(hh, 1) >= 100 && gs1_hhEstimate(hh, 1) < 110);
+	TEST_CHECK(gs1_hhEstimate(hh, 3) >= 30 && gs1_hhEstimate(hh, 3) < 40);
+	TEST_CHECK(gs1_hhEstimate(hh, 1000) >= 1 && gs1_hhEstimate(hh, 1000) < 10);
 
-	test_parseDLuri(ctx, true,					// GTIN-12 -> GTIN-14
-		"https://a/01/416000336108",
-		"^0100416000336108",
-		"^0100416000336108",
-		"(01)00416000336108",
-		"{\"01\":\"00416000336108\"}",
-		"^0100416000336108",
-		"^0100416000336108",
-		"(01)00416000336108",
-		"{\"01\":\"00416000336108\"}");
+}
 
-	test_parseDLuri(ctx, true,					// GTIN-8 -> GTIN-14
-		"https://a/01/02345673",
-		"^0100000002345673",
-		"^0100000002345673",
-		"(01)00000002345673",
-		"{\"01\":\"00000002345673\"}",
-		"^0100000002345673",
-		"^0100000002345673",
-		"(01)00000002345673",
-		"{\"01\":\"00000002345673\"}");
+static void test_dl_heavyHitters(void) {
 
-	// Invalid-length AI components
-	test_parseDLuri(ctx, false,  "https://a/01/12312312312333/9/abc", "", "", "", "", "", "", "", "");
-	test_parseDLuri(ctx, false,  "https://a/01/12312312312333/99999/abc", "", "", "", "", "", "", "", "");
-	test_parseDLuri(ctx, false,  "https://a/01/12312312312333?9=abc", "", "", "", "", "", "", "", "");
-	test_parseDLuri(ctx, false,  "https://a/01/12312312312333?99999=abc", "", "", "", "", "", "", "", "");
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	struct gs1DLheavyHitters *hh = malloc(sizeof(struct gs1DLheavyHitters));
+	struct gs1DLheavyHitters *a = malloc(sizeof(struct gs1DLheavyHitters));
+	struct gs1DLheavyHitters *b = malloc(sizeof(struct gs1DLheavyHitters));
+	uint64_t keys[GS1_DL_TOPK_MAX], counts[GS1_DL_TOPK_MAX], errors[GS1_DL_TOPK_MAX], key, sum;
+	uint64_t truth[997];
+	char in[256], *buf;
+	size_t len, n;
+	int i, j;
 
-	test_parseDLuri(ctx, true,
-		"https://a/01/12312312312333/22/TEST/10/ABC/21/XYZ",
-		"^011231231231233322TEST^10ABC^21XYZ",
-		"^0112312312312333^22TEST^10ABC^21XYZ",
-		"(01)12312312312333(22)TEST(10)ABC(21)XYZ",
-		"{\"01\":\"12312312312333\",\"22\":\"TEST\",\"10\":\"ABC\",\"21\":\"XYZ\"}",
-		"^011231231231233322TEST^10ABC^21XYZ",
-		"^0112312312312333^22TEST^10ABC^21XYZ",
-		"(01)12312312312333(22)TEST(10)ABC(21)XYZ",
-		"{\"01\":\"12312312312333\",\"22\":\"TEST\",\"10\":\"ABC\",\"21\":\"XYZ\"}");
+	TEST_ASSERT(gs1_hhInit(hh, "01", 16));
+	test_hhStream(hh, 0, 500);
+	TEST_CHECK(hh->total == 680);
+	test_hhCheckTop(hh);
+
+	// Merging per-thread summaries
+	TEST_ASSERT(gs1_hhInit(a, "01", 16));
+	TEST_ASSERT(gs1_hhInit(b, "01", 16));
+	test_hhStream(a, 0, 250);
+	test_hhStream(b, 250, 500);
+	TEST_CHECK(gs1_hhMerge(a, b));
+	TEST_CHECK(a->total == 680);
+	TEST_CHECK(memcmp(a->counts, hh->counts, sizeof(hh->counts)) == 0);
+	test_hhCheckTop(a);
+	TEST_ASSERT(gs1_hhInit(b, "00", 16));
+	TEST_CHECK(!gs1_hhMerge(a, b));
+	TEST_ASSERT(gs1_hhInit(b, "01", 8));
+	TEST_CHECK(!gs1_hhMerge(a, b));
+
+	// Serialisation
+	len = gs1_hhSerialise(hh, NULL, 0);
+	TEST_CHECK(len == 32 + sizeof(hh->counts) + 16 * 24);
+	TEST_ASSERT((buf = malloc(len)) != NULL);
+	TEST_CHECK(gs1_hhSerialise(hh, buf, len - 1) == len);
+	TEST_CHECK(gs1_hhSerialise(hh, buf, len) == len);
+	TEST_CHECK(gs1_hhDeserialise(b, buf, len));
+	TEST_CHECK(strcmp(b->ai, "01") == 0 && b->k == 16 && b->total == 680);
+	TEST_CHECK(memcmp(b->counts, hh->counts, sizeof(hh->counts)) == 0);
+	test_hhCheckTop(b);
+	TEST_CHECK(memcmp(buf, "G1HH", 4) == 0 && buf[12] == 16 && buf[13] == 0);	// Little-endian
+	TEST_CHECK(!gs1_hhDeserialise(b, buf, len - 1));
+	buf[0]++;
+	TEST_CHECK(!gs1_hhDeserialise(b, buf, len));
+	TEST_CHECK(strcmp(b->err, "Invalid heavy hitter summary") == 0);
+	TEST_CHECK(b->total == 680 && b->numTop == 16);		// Unchanged
+	free(buf);
+
+	// Heavy eviction keeps the tracked counts consistent with the stream
+	TEST_ASSERT(gs1_hhInit(hh, "01", GS1_DL_TOPK_MAX));
+	memset(truth, 0, sizeof(truth));
+	for (i = 0; i < 20000; i++) {
+		key = (uint64_t)((i * i + i / 7) % 997);
+		truth[key]++;
+		gs1_hhAddKey(hh, key);
+	}
+	n = gs1_hhTop(hh, keys, counts, errors, GS1_DL_TOPK_MAX);
+	TEST_CHECK(n == GS1_DL_TOPK_MAX);
+	for (sum = 0, i = 0; i < (int)n; i++) {
+		sum += counts[i];
+		TEST_CHECK(counts[i] >= truth[keys[i]] && counts[i] - errors[i] <= truth[keys[i]]);
+		TEST_MSG("Key %d: count %d, error %d, truth %d", (int)keys[i], (int)counts[i], (int)errors[i], (int)truth[keys[i]]);
+	}
+	TEST_CHECK(sum == 20000);
+	for (i = 1; i < (int)n; i++)
+		for (j = 0; j < i; j++)
+			TEST_CHECK(keys[j] != keys[i]);				// Each key tracked once
+
+	// Rows are independent, so keys sharing the row 0 counter of a heavy key
+	// are not overestimated
+	TEST_ASSERT(gs1_hhInit(hh, "01", 4));
+	for (i = 0; i < 1000; i++)
+		gs1_hhAddKey(hh, 42);
+	for (key = 43, j = 0; j < 50; key++) {
+		if (hhColumn(mix64(key), 0) != hhColumn(mix64(42), 0))
+			continue;
+		TEST_CHECK(hh->counts[0][hhColumn(mix64(key), 0)] == 1000);
+		TEST_CHECK(gs1_hhEstimate(hh, key) == 0);
+		TEST_MSG("Key %d", (int)key);
+		j++;
+	}
+	TEST_CHECK(gs1_hhEstimate(hh, 42) == 1000);
+
+	// Fed from parsed contexts
+	TEST_ASSERT(gs1_hhInit(hh, "01", 4));
+	strcpy(in, "https://a/01/09520123456788/21/ABC");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_CHECK(gs1_hhAdd(hh, ctx));
+	TEST_CHECK(gs1_hhAdd(hh, ctx));
+	TEST_CHECK(gs1_hhEstimate(hh, UINT64_C(9520123456788)) == 2);
+	strcpy(in, "https://a/00/395201234567891234");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_CHECK(!gs1_hhAdd(hh, ctx));
+	TEST_CHECK(hh->total == 2 && hh->numTop == 1);
+
+	TEST_CHECK(!gs1_hhInit(hh, "01", 0));
+	TEST_CHECK(!gs1_hhInit(hh, "01", GS1_DL_TOPK_MAX + 1));
+	TEST_CHECK(!gs1_hhInit(hh, "1", 4));
+
+	free(b);
+	free(a);
+	free(hh);
+	free(ctx);
 
-	test_parseDLuri(ctx, true,
-		"https://a/01/12312312312333/235/TEST",
-		"^0112312312312333235TEST",
-		"^0112312312312333^235TEST",
-		"(01)12312312312333(235)TEST",
-		"{\"01\":\"12312312312333\",\"235\":\"TEST\"}",
-		"^0112312312312333235TEST",
-		"^0112312312312333^235TEST",
-		"(01)12312312312333(235)TEST",
-		"{\"01\":\"12312312312333\",\"235\":\"TEST\"}");
+}
 
-	test_parseDLuri(ctx, true,
-		"https://a/253/1231231231232",
-		"^2531231231231232",
-		"^2531231231231232",
-		"(253)1231231231232",
-		"{\"253\":\"1231231231232\"}",
-		"^2531231231231232",
-		"^2531231231231232",
-		"(253)1231231231232",
-		"{\"253\":\"1231231231232\"}");
 
-	test_parseDLuri(ctx, true,
-		"https://a/253/1231231231232TEST5678901234567",
-		"^2531231231231232TEST5678901234567",
-		"^2531231231231232TEST5678901234567",
-		"(253)1231231231232TEST5678901234567",
-		"{\"253\":\"1231231231232TEST5678901234567\"}",
-		"^2531231231231232TEST5678901234567",
-		"^2531231231231232TEST5678901234567",
-		"(253)1231231231232TEST5678901234567",
-		"{\"253\":\"1231231231232TEST5678901234567\"}");
+static void test_dl_hll(void) {
 
-	test_parseDLuri(ctx, true,
-		"https://a/8018/123456789012345675/8019/123",
-		"^8018123456789012345675^8019123",
-		"^8018123456789012345675^8019123",
-		"(8018)123456789012345675(8019)123",
-		"{\"8018\":\"123456789012345675\",\"8019\":\"123\"}",
-		"^8018123456789012345675^8019123",
-		"^8018123456789012345675^8019123",
-		"(8018)123456789012345675(8019)123",
-		"{\"8018\":\"123456789012345675\",\"8019\":\"123\"}");
+	static const char * const gtin[] = { "01", NULL };
+	static const char * const gtinSerial[] = { "01", "21", NULL };
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	struct gs1DLhll *hll = malloc(sizeof(struct gs1DLhll));
+	struct gs1DLhll *a = malloc(sizeof(struct gs1DLhll));
+	struct gs1DLhll *b = malloc(sizeof(struct gs1DLhll));
+	unsigned char buf[GS1_DL_HLL_SERIALISED];
+	char in[256];
+	uint64_t fp1, fp2, fp3, est;
+	int i;
 
-	test_parseDLuri(ctx, false,
-		"https://a/stem/00/006141411234567890/", "", "", "", "", "", "", "", ""); 	// Can't end in slash
+	// Fingerprints are independent of the AI order in the input
+	strcpy(in, "https://a/01/09520123456788/21/ABC?17=261130");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_CHECK(gs1_fingerprint(ctx, gtinSerial, &fp1));
+	TEST_CHECK(gs1_fingerprint(ctx, gtin, &fp2));
+	TEST_CHECK(fp1 != fp2);
+	strcpy(in, "(17)261130(01)09520123456788(21)ABC");
+	TEST_ASSERT(gs1_parseBracketedAIelementString(ctx, in));
+	TEST_CHECK(gs1_fingerprint(ctx, gtinSerial, &fp3) && fp3 == fp1);
+	strcpy(in, "https://a/01/09520123456788/21/ABD");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_CHECK(gs1_fingerprint(ctx, gtinSerial, &fp3) && fp3 != fp1);
+	TEST_CHECK(gs1_fingerprint(ctx, gtin, &fp3) && fp3 == fp2);
+	strcpy(in, "https://a/01/09520123456788");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_CHECK(!gs1_fingerprint(ctx, gtinSerial, &fp3));
+
+	// Whole records
+	strcpy(in, "https://a/01/09520123456788/21/ABC?17=261130&10=X");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_CHECK(gs1_fingerprint(ctx, NULL, &fp1));
+	strcpy(in, "https://a/01/09520123456788/21/ABC?10=X&17=261130");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_CHECK(gs1_fingerprint(ctx, NULL, &fp2) && fp2 == fp1);
+	strcpy(in, "https://a/01/09520123456788/21/ABC?10=X");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_CHECK(gs1_fingerprint(ctx, NULL, &fp2) && fp2 != fp1);
+
+	// Small cardinalities are counted almost exactly
+	gs1_hllInit(hll);
+	TEST_CHECK(gs1_hllEstimate(hll) == 0);
+	for (i = 0; i < 100; i++) {
+		gs1_hllAdd(hll, (uint64_t)i);
+		gs1_hllAdd(hll, (uint64_t)i);
+	}
+	est = gs1_hllEstimate(hll);
+	TEST_CHECK(est >= 95 && est <= 105);
+	TEST_MSG("Estimate %d", (int)est);
+
+	// Large cardinalities within a few standard errors
+	gs1_hllInit(hll);
+	gs1_hllInit(a);
+	gs1_hllInit(b);
+	for (i = 0; i < 100000; i++) {
+		gs1_hllAdd(hll, (uint64_t)i);
+		gs1_hllAdd(i < 60000 ? a : b, (uint64_t)i);
+		if (i % 2 == 0)
+			gs1_hllAdd(b, (uint64_t)i);		// Overlap
+	}
+	est = gs1_hllEstimate(hll);
+	TEST_CHECK(est >= 95000 && est <= 105000);
+	TEST_MSG("Estimate %d", (int)est);
+
+	gs1_hllMerge(a, b);
+	TEST_CHECK(memcmp(a->registers, hll->registers, sizeof(hll->registers)) == 0);
+	TEST_CHECK(gs1_hllEstimate(a) == est);
+
+	// Serialisation
+	TEST_CHECK(gs1_hllSerialise(hll, NULL, 0) == GS1_DL_HLL_SERIALISED);
+	TEST_CHECK(gs1_hllSerialise(hll, buf, sizeof(buf)) == GS1_DL_HLL_SERIALISED);
+	gs1_hllInit(b);
+	TEST_CHECK(gs1_hllDeserialise(b, buf, sizeof(buf)));
+	TEST_CHECK(memcmp(b->registers, hll->registers, sizeof(hll->registers)) == 0);
+	TEST_CHECK(memcmp(buf, "G1HL\x0C\0\0\0", 8) == 0);		// Little-endian header
+	TEST_CHECK(!gs1_hllDeserialise(b, buf, sizeof(buf) - 1));
+	buf[sizeof(buf) - 1] = 0xFC;				// Rank of the last register out of range
+	gs1_hllInit(b);
+	TEST_CHECK(!gs1_hllDeserialise(b, buf, sizeof(buf)));
+	TEST_CHECK(gs1_hllEstimate(b) == 0);			// Left untouched
+	buf[0]++;
+	TEST_CHECK(!gs1_hllDeserialise(b, buf, sizeof(buf)));
+
+	free(b);
+	free(a);
+	free(hll);
+	free(ctx);
 
-	test_parseDLuri(ctx, true,					// Empty query params
-		"https://a/00/006141411234567890?",
-		"^00006141411234567890",
-		"^00006141411234567890",
-		"(00)006141411234567890",
-		"{\"00\":\"006141411234567890\"}",
-		"^00006141411234567890",
-		"^00006141411234567890",
-		"(00)006141411234567890",
-		"{\"00\":\"006141411234567890\"}");
+}
 
-	test_parseDLuri(ctx, true,
-		"https://a/stem/00/006141411234567890?99=ABC",			// Query params; no FNC1 req after pathinfo
-		"^0000614141123456789099ABC",
-		"^00006141411234567890^99ABC",
-		"(00)006141411234567890(99)ABC",
-		"{\"00\":\"006141411234567890\",\"99\":\"ABC\"}",
-		"^0000614141123456789099ABC",
-		"^00006141411234567890^99ABC",
-		"(00)006141411234567890(99)ABC",
-		"{\"00\":\"006141411234567890\",\"99\":\"ABC\"}");
 
-	test_parseDLuri(ctx, true,
-		"https://a/stem/401/12345678?99=ABC",				// Query params; FNC1 req after pathinfo
-		"^40112345678^99ABC",
-		"^40112345678^99ABC",
-		"(401)12345678(99)ABC",
-		"{\"401\":\"12345678\",\"99\":\"ABC\"}",
-		"^40112345678^99ABC",
-		"^40112345678^99ABC",
-		"(401)12345678(99)ABC",
-		"{\"401\":\"12345678\",\"99\":\"ABC\"}");
+static void test_dl_bloom(void) {
 
-	test_parseDLuri(ctx, true,
-		"https://a/01/12312312312333?99=ABC&98=XYZ",
-		"^011231231231233399ABC^98XYZ",
-		"^0112312312312333^99ABC^98XYZ",
-		"(01)12312312312333(99)ABC(98)XYZ",
-		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}",
-		"^011231231231233399ABC^98XYZ",
-		"^0112312312312333^99ABC^98XYZ",
-		"(01)12312312312333(99)ABC(98)XYZ",
-		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}");
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	uint64_t *keys = malloc(2000 * sizeof(uint64_t));
+	uint64_t *buf, bitmap[32];
+	struct gs1DLbloom bf;
+	char in[256];
+	size_t len, i, fp;
+
+	// 1000 registered GTINs; the next 1000 are not registered
+	for (i = 0; i < 2000; i++)
+		keys[i] = UINT64_C(9520123000000) + i * 7;
+
+	TEST_CHECK(gs1_buildBloom(keys, 1000, 0, NULL, 0) == 0);
+	len = gs1_buildBloom(keys, 1000, 12, NULL, 0);
+	TEST_CHECK(len == 64 + 24 * 64);				// 12000 bits round up to 24 blocks
+	TEST_ASSERT((buf = malloc(len)) != NULL);
+	TEST_CHECK(gs1_buildBloom(keys, 1000, 12, buf, len) == len);
+
+	TEST_CHECK(!gs1_loadBloom(&bf, buf, len - 8));
+	TEST_CHECK(!gs1_loadBloom(&bf, (char *)buf + 4, len - 8));	// Misaligned
+	TEST_ASSERT(gs1_loadBloom(&bf, buf, len));
+
+	for (i = 0; i < 1000; i++)
+		TEST_CHECK(gs1_bloomMayContain(&bf, keys[i]));
+	for (fp = 0, i = 1000; i < 2000; i++)
+		if (gs1_bloomMayContain(&bf, keys[i]))
+			fp++;
+	TEST_CHECK(fp < 30);
+	TEST_MSG("False positives: %d of 1000", (int)fp);
+
+	// Batch results agree with single queries
+	keys[1999] = GS1_DL_KEY_INVALID;
+	TEST_CHECK(gs1_bloomQueryBatch(&bf, keys, 2000, bitmap) == 1000 + fp);
+	for (i = 0; i < 2000; i++)
+		TEST_CHECK(((bitmap[i / 64] >> (i % 64)) & 1) == (uint64_t)(i < 1999 && gs1_bloomMayContain(&bf, keys[i])));
+
+	strcpy(in, "https://a/01/09520123000007/21/ABC");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_CHECK(gs1_bloomMayContainAI(&bf, ctx, "01"));
+	TEST_CHECK(!gs1_bloomMayContainAI(&bf, ctx, "00"));
+
+	// Corrupt header
+	buf[0]++;
+	TEST_CHECK(!gs1_loadBloom(&bf, buf, len));
+
+	// An empty list still forms a valid filter
+	TEST_CHECK(gs1_buildBloom(keys, 0, 12, buf, len) == 64 + 64);
+	TEST_ASSERT(gs1_loadBloom(&bf, buf, 64 + 64));
+	TEST_CHECK(!gs1_bloomMayContain(&bf, keys[0]));
+
+	free(buf);
+	free(keys);
+	free(ctx);
 
-	test_parseDLuri(ctx, false,
-		"https://a/01/12312312312333?99=", "", "", "", "", "", "", "", ""); 	// Can't have empty AI value
+}
 
-	test_parseDLuri(ctx, true,
-		"https://a/01/12312312312333?&&&99=ABC&&&&&&98=XYZ&&&",		// Extraneous query param separators
-		"^011231231231233399ABC^98XYZ",
-		"^0112312312312333^99ABC^98XYZ",
-		"(01)12312312312333(99)ABC(98)XYZ",
-		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}",
-		"^011231231231233399ABC^98XYZ",
-		"^0112312312312333^99ABC^98XYZ",
-		"(01)12312312312333(99)ABC(98)XYZ",
-		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}");
 
-	test_parseDLuri(ctx, true,
-		"https://a/01/12312312312333?99=ABC&unknown=666&98=XYZ",
-		"^011231231231233399ABC^98XYZ",
-		"^0112312312312333^99ABC^98XYZ",
-		"(01)12312312312333(99)ABC(98)XYZ",
-		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}",
-		"^011231231231233399ABC^98XYZ",
-		"^0112312312312333^99ABC^98XYZ",
-		"(01)12312312312333(99)ABC(98)XYZ",
-		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}");
+static void test_dl_shard(void) {
 
-	test_parseDLuri(ctx, true,
-		"https://a/01/12312312312333?99=ABC&singleton&98=XYZ",
-		"^011231231231233399ABC^98XYZ",
-		"^0112312312312333^99ABC^98XYZ",
-		"(01)12312312312333(99)ABC(98)XYZ",
-		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}",
-		"^011231231231233399ABC^98XYZ",
-		"^0112312312312333^99ABC^98XYZ",
-		"(01)12312312312333(99)ABC(98)XYZ",
-		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}");
+	static const char * const gtin[] = { "01", NULL };
+	struct gs1DLparser *ctxs = malloc(10 * sizeof(struct gs1DLparser));
+	int counts[10], shards[10], s, t;
+	size_t offsets[7], rows[10], i;
+	char in[256];
+	uint64_t k;
+
+	TEST_CHECK(gs1_jumpHash(12345, 0) == -1);
+	TEST_CHECK(gs1_jumpHash(12345, 1) == 0);
+
+	// Roughly uniform, and growing moves keys only to the new shard
+	memset(counts, 0, sizeof(counts));
+	for (k = 0; k < 10000; k++) {
+		s = gs1_jumpHash(mix64(k), 9);
+		t = gs1_jumpHash(mix64(k), 10);
+		TEST_ASSERT(s >= 0 && s < 9 && t >= 0 && t < 10);
+		TEST_CHECK(t == s || t == 9);
+		counts[t]++;
+	}
+	for (s = 0; s < 10; s++)
+		TEST_CHECK(counts[s] > 900 && counts[s] < 1100);
+
+	for (i = 0; i < 10; i++) {
+		if (i == 4)
+			strcpy(in, "https://a/00/395201234567891234");
+		else
+			sprintf(in, "https://a/01/%014d/21/S%d", (int)(i % 3), (int)i);
+		TEST_ASSERT(gs1_parseDLuri(&ctxs[i], in));
+	}
 
-	test_parseDLuri(ctx, true,
-		"https://a/01/12312312312333?singleton&99=ABC&98=XYZ",
-		"^011231231231233399ABC^98XYZ",
-		"^0112312312312333^99ABC^98XYZ",
-		"(01)12312312312333(99)ABC(98)XYZ",
-		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}",
-		"^011231231231233399ABC^98XYZ",
-		"^0112312312312333^99ABC^98XYZ",
-		"(01)12312312312333(99)ABC(98)XYZ",
-		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}");
+	// Same GTIN, same shard, regardless of serial
+	TEST_CHECK(gs1_shardOf(&ctxs[0], gtin, 5) == gs1_shardOf(&ctxs[3], gtin, 5));
+	TEST_CHECK(gs1_shardOf(&ctxs[4], gtin, 5) == -1);
+
+	TEST_CHECK(gs1_partitionBatch(ctxs, 10, gtin, 5, shards, offsets, rows) == 9);
+	TEST_CHECK(offsets[0] == 0 && offsets[5] == 9 && offsets[6] == 10);
+	TEST_CHECK(rows[9] == 4 && shards[4] == -1);
+	for (s = 0; s < 5; s++)
+		for (i = offsets[s]; i < offsets[s + 1]; i++) {
+			TEST_CHECK(shards[rows[i]] == s);
+			TEST_CHECK(i == offsets[s] || rows[i] > rows[i - 1]);		// Stable
+		}
 
-	test_parseDLuri(ctx, true,
-		"https://a/01/12312312312333?99=ABC&98=XYZ&singleton",
-		"^011231231231233399ABC^98XYZ",
-		"^0112312312312333^99ABC^98XYZ",
-		"(01)12312312312333(99)ABC(98)XYZ",
-		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}",
-		"^011231231231233399ABC^98XYZ",
-		"^0112312312312333^99ABC^98XYZ",
-		"(01)12312312312333(99)ABC(98)XYZ",
-		"{\"01\":\"12312312312333\",\"99\":\"ABC\",\"98\":\"XYZ\"}");
+	TEST_CHECK(gs1_partitionBatch(ctxs, 10, gtin, 0, shards, offsets, rows) == 0);
+
+	free(ctxs);
+
+}
+
+
+static void test_dl_radixSort(void) {
+
+	uint64_t *orig = malloc(1000 * sizeof(uint64_t)), *keys = malloc(1000 * sizeof(uint64_t));
+	uint64_t *tmpKeys = malloc(1000 * sizeof(uint64_t)), *k, *kt, *ks;
+	size_t *rows = malloc(1000 * sizeof(size_t)), *tmpRows = malloc(1000 * sizeof(size_t)), *r, *rt, *rs;
+	size_t *starts = malloc(1001 * sizeof(size_t)), hists[3][GS1_DL_RADIX_BUCKETS], n, i, c;
+	static const size_t chunk[4] = { 0, 300, 301, 1000 };
+	uint64_t x = 1;
+	int pass;
+
+	// GTIN-like keys with many duplicates, and some missing keys
+	for (i = 0; i < 1000; i++) {
+		x = x * UINT64_C(6364136223846793005) + 1;
+		orig[i] = i % 97 == 0 ? GS1_DL_KEY_INVALID : UINT64_C(9520123000000) + (x >> 33) % 300 * UINT64_C(1000003);
+		keys[i] = orig[i];
+		rows[i] = i;
+	}
 
-	test_parseDLuri(ctx, true,
-		"https://a/01/12312312312333/22/ABC%2d123?99=ABC&98=XYZ%2f987",	// Percent escaped values
-		"^011231231231233322ABC-123^99ABC^98XYZ/987",
-		"^0112312312312333^22ABC-123^99ABC^98XYZ/987",
-		"(01)12312312312333(22)ABC-123(99)ABC(98)XYZ/987",
-		"{\"01\":\"12312312312333\",\"22\":\"ABC-123\",\"99\":\"ABC\",\"98\":\"XYZ/987\"}",
-		"^011231231231233322ABC-123^99ABC^98XYZ/987",
-		"^0112312312312333^22ABC-123^99ABC^98XYZ/987",
-		"(01)12312312312333(22)ABC-123(99)ABC(98)XYZ/987",
-		"{\"01\":\"12312312312333\",\"22\":\"ABC-123\",\"99\":\"ABC\",\"98\":\"XYZ/987\"}");
+	gs1_radixSort(keys, rows, 1000, tmpKeys, tmpRows);
+	for (i = 0; i < 1000; i++) {
+		TEST_CHECK(keys[i] == orig[rows[i]]);
+		TEST_CHECK(i == 0 || keys[i] > keys[i - 1] || (keys[i] == keys[i - 1] && rows[i] > rows[i - 1]));
+	}
+	TEST_CHECK(keys[999] == GS1_DL_KEY_INVALID);
+
+	n = gs1_groupBoundaries(keys, 1000, starts);
+	TEST_CHECK(n > 250 && n <= 301);
+	TEST_CHECK(starts[0] == 0 && starts[n] == 1000);
+	for (i = 0; i < n; i++) {
+		TEST_CHECK(keys[starts[i]] == keys[starts[i + 1] - 1]);
+		TEST_CHECK(i == 0 || keys[starts[i]] != keys[starts[i] - 1]);
+	}
+	TEST_CHECK(keys[starts[n - 1]] == GS1_DL_KEY_INVALID && 1000 - starts[n - 1] == 11);
 
-	test_parseDLuri(ctx, true,
-		"https://a/01/12312312312333/22/TEST/10/ABC/21/XYZ#fragmemt",	// Ignore fragment after path info
-		"^011231231231233322TEST^10ABC^21XYZ",
-		"^0112312312312333^22TEST^10ABC^21XYZ",
-		"(01)12312312312333(22)TEST(10)ABC(21)XYZ",
-		"{\"01\":\"12312312312333\",\"22\":\"TEST\",\"10\":\"ABC\",\"21\":\"XYZ\"}",
-		"^011231231231233322TEST^10ABC^21XYZ",
-		"^0112312312312333^22TEST^10ABC^21XYZ",
-		"(01)12312312312333(22)TEST(10)ABC(21)XYZ",
-		"{\"01\":\"12312312312333\",\"22\":\"TEST\",\"10\":\"ABC\",\"21\":\"XYZ\"}");
+	// Chunked passes, as run in parallel, give the same result
+	for (i = 0; i < 1000; i++) {
+		tmpKeys[i] = orig[i];
+		starts[i] = i;
+	}
+	k = tmpKeys;
+	r = starts;
+	kt = orig;
+	rt = tmpRows;
+	for (pass = 0; pass < 8; pass++) {
+		for (c = 0; c < 3; c++)
+			gs1_radixCount(k + chunk[c], chunk[c + 1] - chunk[c], pass, hists[c]);
+		gs1_radixOffsets(&hists[0][0], 3);
+		for (c = 0; c < 3; c++)
+			gs1_radixScatter(k + chunk[c], r + chunk[c], chunk[c + 1] - chunk[c], pass, hists[c], kt, rt);
+		ks = k;
+		k = kt;
+		kt = ks;
+		rs = r;
+		r = rt;
+		rt = rs;
+	}
+	TEST_CHECK(memcmp(k, keys, 1000 * sizeof(keys[0])) == 0);
+	TEST_CHECK(memcmp(r, rows, 1000 * sizeof(rows[0])) == 0);
 
-	test_parseDLuri(ctx, true,
-		"https://a/stem/00/006141411234567890?99=ABC#fragment",		// Ignore fragment after query info
-		"^0000614141123456789099ABC",
-		"^00006141411234567890^99ABC",
-		"(00)006141411234567890(99)ABC",
-		"{\"00\":\"006141411234567890\",\"99\":\"ABC\"}",
-		"^0000614141123456789099ABC",
-		"^00006141411234567890^99ABC",
-		"(00)006141411234567890(99)ABC",
-		"{\"00\":\"006141411234567890\",\"99\":\"ABC\"}");
+	gs1_radixSort(keys, rows, 0, tmpKeys, tmpRows);
+	TEST_CHECK(gs1_groupBoundaries(keys, 0, starts) == 0 && starts[0] == 0);
 
-	test_parseDLuri(ctx, true,
-		"https://id.gs1.org/01/09520123456788",
-		"^0109520123456788",
-		"^0109520123456788",
-		"(01)09520123456788",
-		"{\"01\":\"09520123456788\"}",
-		"^0109520123456788",
-		"^0109520123456788",
-		"(01)09520123456788",
-		"{\"01\":\"09520123456788\"}");
+	free(starts);
+	free(tmpRows);
+	free(rows);
+	free(tmpKeys);
+	free(keys);
+	free(orig);
 
-	test_parseDLuri(ctx, true,
-		"https://brand.example.com/01/9520123456788",
-		"^0109520123456788",
-		"^0109520123456788",
-		"(01)09520123456788",
-		"{\"01\":\"09520123456788\"}",
-		"^0109520123456788",
-		"^0109520123456788",
-		"(01)09520123456788",
-		"{\"01\":\"09520123456788\"}");
+}
 
-	test_parseDLuri(ctx, true,
-		"https://brand.example.com/some-extra/pathinfo/01/9520123456788",
-		"^0109520123456788",
-		"^0109520123456788",
-		"(01)09520123456788",
-		"{\"01\":\"09520123456788\"}",
-		"^0109520123456788",
-		"^0109520123456788",
-		"(01)09520123456788",
-		"{\"01\":\"09520123456788\"}");
 
-	test_parseDLuri(ctx, true,
-		"https://id.gs1.org/01/09520123456788/22/2A",
-		"^0109520123456788222A",
-		"^0109520123456788^222A",
-		"(01)09520123456788(22)2A",
-		"{\"01\":\"09520123456788\",\"22\":\"2A\"}",
-		"^0109520123456788222A",
-		"^0109520123456788^222A",
-		"(01)09520123456788(22)2A",
-		"{\"01\":\"09520123456788\",\"22\":\"2A\"}");
+struct arrowSink {
+	unsigned char *buf;
+	size_t len, cap;
+};
 
-	test_parseDLuri(ctx, true,
-		"https://id.gs1.org/01/09520123456788/10/ABC123",
-		"^010952012345678810ABC123",
-		"^0109520123456788^10ABC123",
-		"(01)09520123456788(10)ABC123",
-		"{\"01\":\"09520123456788\",\"10\":\"ABC123\"}",
-		"^010952012345678810ABC123",
-		"^0109520123456788^10ABC123",
-		"(01)09520123456788(10)ABC123",
-		"{\"01\":\"09520123456788\",\"10\":\"ABC123\"}");
+static bool test_arrowWrite(void *arg, const void *data, size_t len) {
+	struct arrowSink *s = arg;
+	if (s->len + len > s->cap)
+		return false;
+	memcpy(s->buf + s->len, data, len);
+	s->len += len;
+	return true;
+}
 
-	test_parseDLuri(ctx, true,
-		"https://id.gs1.org/01/09520123456788/21/12345",
-		"^01095201234567882112345",
-		"^0109520123456788^2112345",
-		"(01)09520123456788(21)12345",
-		"{\"01\":\"09520123456788\",\"21\":\"12345\"}",
-		"^01095201234567882112345",
-		"^0109520123456788^2112345",
-		"(01)09520123456788(21)12345",
-		"{\"01\":\"09520123456788\",\"21\":\"12345\"}");
+static uint32_t test_u32(const unsigned char *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
 
-	test_parseDLuri(ctx, true,
-		"https://id.gs1.org/01/09520123456788/10/ABC1/21/12345?17=180426",
-		"^010952012345678810ABC1^2112345^17180426",
-		"^0109520123456788^10ABC1^2112345^17180426",
-		"(01)09520123456788(10)ABC1(21)12345(17)180426",
-		"{\"01\":\"09520123456788\",\"10\":\"ABC1\",\"21\":\"12345\",\"17\":\"180426\"}",
-		"^01095201234567881718042610ABC1^2112345",
-		"^0109520123456788^17180426^10ABC1^2112345",
-		"(01)09520123456788(17)180426(10)ABC1(21)12345",
-		"{\"01\":\"09520123456788\",\"17\":\"180426\",\"10\":\"ABC1\",\"21\":\"12345\"}");
+static bool test_contains(const unsigned char *buf, size_t len, const char *str) {
+	size_t i, n = strlen(str);
+	for (i = 0; i + n <= len; i++)
+		if (memcmp(buf + i, str, n) == 0)
+			return true;
+	return false;
+}
 
-	test_parseDLuri(ctx, true,
-		"https://id.gs1.org/01/09520123456788?3103=000195",
-		"^01095201234567883103000195",
-		"^0109520123456788^3103000195",
-		"(01)09520123456788(3103)000195",
-		"{\"01\":\"09520123456788\",\"3103\":\"000195\"}",
-		"^01095201234567883103000195",
-		"^0109520123456788^3103000195",
-		"(01)09520123456788(3103)000195",
-		"{\"01\":\"09520123456788\",\"3103\":\"000195\"}");
+static void test_dl_arrow(void) {
+
+	static const char * const ais[] = { "01", "21", "17" };
+	static const char * const badAI[] = { "1" };
+	struct gs1DLparser *ctxs = malloc(3 * sizeof(struct gs1DLparser));
+	struct gs1DLarrowWriter w;
+	struct arrowSink s;
+	const unsigned char *meta, *tbl;
+	uint16_t vt[6];
+	size_t at, metaLen, msgs = 0;
+	int64_t bodyLen;
+	char in[256];
 
-	test_parseDLuri(ctx, true,
-		"https://example.com/01/9520123456788?3103=000195&3922=0299&17=201225",
-		"^0109520123456788310300019539220299^17201225",
-		"^0109520123456788^3103000195^39220299^17201225",
-		"(01)09520123456788(3103)000195(3922)0299(17)201225",
-		"{\"01\":\"09520123456788\",\"3103\":\"000195\",\"3922\":\"0299\",\"17\":\"201225\"}",
-		"^010952012345678831030001951720122539220299",
-		"^0109520123456788^3103000195^17201225^39220299",
-		"(01)09520123456788(3103)000195(17)201225(3922)0299",
-		"{\"01\":\"09520123456788\",\"3103\":\"000195\",\"17\":\"201225\",\"3922\":\"0299\"}");
+	strcpy(in, "https://a/01/09520123456788/21/ABC?17=261130");
+	TEST_ASSERT(gs1_parseDLuri(&ctxs[0], in));
+	strcpy(in, "https://a/00/395201234567891234");
+	TEST_ASSERT(gs1_parseDLuri(&ctxs[1], in));
+	strcpy(in, "https://a/01/09529999999993/21/XY");
+	TEST_ASSERT(gs1_parseDLuri(&ctxs[2], in));
+
+	s.cap = 4096;
+	s.len = 0;
+	TEST_ASSERT((s.buf = malloc(s.cap)) != NULL);
+
+	TEST_CHECK(!gs1_arrowBegin(&w, ais, 0, test_arrowWrite, &s));
+	TEST_CHECK(!gs1_arrowBegin(&w, badAI, 1, test_arrowWrite, &s));
+	TEST_CHECK(s.len == 0);
+
+	TEST_ASSERT(gs1_arrowBegin(&w, ais, 3, test_arrowWrite, &s));
+	TEST_ASSERT(gs1_arrowWriteBatch(&w, ctxs, 3));
+	TEST_ASSERT(gs1_arrowWriteBatch(&w, ctxs, 0));
+	TEST_ASSERT(gs1_arrowEnd(&w));
+
+	// Walk the encapsulated messages, reading each Message's bodyLength
+	for (at = 0; ; msgs++) {
+		TEST_ASSERT(at + 8 <= s.len);
+		TEST_CHECK(test_u32(s.buf + at) == 0xFFFFFFFF);
+		metaLen = test_u32(s.buf + at + 4);
+		at += 8;
+		if (metaLen == 0)
+			break;
+		TEST_CHECK(metaLen % 8 == 0);
+		TEST_ASSERT(at + metaLen <= s.len);
+		meta = s.buf + at;
+		tbl = meta + test_u32(meta);
+		memcpy(vt, tbl - (int32_t)test_u32(tbl), sizeof(vt));
+		TEST_ASSERT(vt[0] == 12 && vt[5] != 0);			// Four fields, with bodyLength
+		memcpy(&bodyLen, tbl + vt[5], sizeof(bodyLen));
+		TEST_CHECK(bodyLen % 8 == 0);
+		at += metaLen + (size_t)bodyLen;
+	}
+	TEST_CHECK(msgs == 3);
+	TEST_CHECK(at == s.len);
 
-	test_parseDLuri(ctx, true,
-		"https://id.gs1.org/01/9520123456788?3103=000195&3922=0299&17=201225",
-		"^0109520123456788310300019539220299^17201225",
-		"^0109520123456788^3103000195^39220299^17201225",
-		"(01)09520123456788(3103)000195(3922)0299(17)201225",
-		"{\"01\":\"09520123456788\",\"3103\":\"000195\",\"3922\":\"0299\",\"17\":\"201225\"}",
-		"^010952012345678831030001951720122539220299",
-		"^0109520123456788^3103000195^17201225^39220299",
-		"(01)09520123456788(3103)000195(17)201225(3922)0299",
-		"{\"01\":\"09520123456788\",\"3103\":\"000195\",\"17\":\"201225\",\"3922\":\"0299\"}");
+	// Values of each column are contiguous in the body of the first batch
+	TEST_CHECK(test_contains(s.buf, s.len, "0952012345678809529999999993"));
+	TEST_CHECK(test_contains(s.buf, s.len, "ABCXY"));
 
-	test_parseDLuri(ctx, true,
-		"https://id.gs1.org/01/9520123456788?17=201225&3103=000195&3922=0299",
-		"^010952012345678817201225310300019539220299",
-		"^0109520123456788^17201225^3103000195^39220299",
-		"(01)09520123456788(17)201225(3103)000195(3922)0299",
-		"{\"01\":\"09520123456788\",\"17\":\"201225\",\"3103\":\"000195\",\"3922\":\"0299\"}",
-		"^010952012345678817201225310300019539220299",
-		"^0109520123456788^17201225^3103000195^39220299",
-		"(01)09520123456788(17)201225(3103)000195(3922)0299",
-		"{\"01\":\"09520123456788\",\"17\":\"201225\",\"3103\":\"000195\",\"3922\":\"0299\"}");
+	// Output failure
+	s.len = s.cap;
+	TEST_CHECK(!gs1_arrowWriteBatch(&w, ctxs, 3));
+	TEST_CHECK(strcmp(w.err, "Failed to write Arrow stream") == 0);
 
-	test_parseDLuri(ctx, true,
-		"https://id.gs1.org/00/952012345678912345",
-		"^00952012345678912345",
-		"^00952012345678912345",
-		"(00)952012345678912345",
-		"{\"00\":\"952012345678912345\"}",
-		"^00952012345678912345",
-		"^00952012345678912345",
-		"(00)952012345678912345",
-		"{\"00\":\"952012345678912345\"}");
+	free(s.buf);
+	free(ctxs);
 
-	test_parseDLuri(ctx, true,
-		"https://id.gs1.org/00/952012345678912345?02=09520123456788&37=25&10=ABC123",
-		"^0095201234567891234502095201234567883725^10ABC123",
-		"^00952012345678912345^0209520123456788^3725^10ABC123",
-		"(00)952012345678912345(02)09520123456788(37)25(10)ABC123",
-		"{\"00\":\"952012345678912345\",\"02\":\"09520123456788\",\"37\":\"25\",\"10\":\"ABC123\"}",
-		"^0095201234567891234502095201234567883725^10ABC123",
-		"^00952012345678912345^0209520123456788^3725^10ABC123",
-		"(00)952012345678912345(02)09520123456788(37)25(10)ABC123",
-		"{\"00\":\"952012345678912345\",\"02\":\"09520123456788\",\"37\":\"25\",\"10\":\"ABC123\"}");
+}
 
-	test_parseDLuri(ctx, true,
-		"https://id.gs1.org/414/9520123456788",
-		"^4149520123456788",
-		"^4149520123456788",
-		"(414)9520123456788",
-		"{\"414\":\"9520123456788\"}",
-		"^4149520123456788",
-		"^4149520123456788",
-		"(414)9520123456788",
-		"{\"414\":\"9520123456788\"}");
 
-	test_parseDLuri(ctx, true,
-		"https://id.gs1.org/414/9520123456788/254/32a%2Fb",
-		"^414952012345678825432a/b",
-		"^4149520123456788^25432a/b",
-		"(414)9520123456788(254)32a/b",
-		"{\"414\":\"9520123456788\",\"254\":\"32a/b\"}",
-		"^414952012345678825432a/b",
-		"^4149520123456788^25432a/b",
-		"(414)9520123456788(254)32a/b",
-		"{\"414\":\"9520123456788\",\"254\":\"32a/b\"}");
+static void test_dl_binary(void) {
 
-	test_parseDLuri(ctx, true,
-		"https://example.com/8004/9520614141234567?01=9520123456788",
-		"^80049520614141234567^0109520123456788",
-		"^80049520614141234567^0109520123456788",
-		"(8004)9520614141234567(01)09520123456788",
-		"{\"8004\":\"9520614141234567\",\"01\":\"09520123456788\"}",
-		"^010952012345678880049520614141234567",
-		"^0109520123456788^80049520614141234567",
-		"(01)09520123456788(8004)9520614141234567",
-		"{\"01\":\"09520123456788\",\"8004\":\"9520614141234567\"}");
+	static const unsigned char badAI[] = { 0xB1, 1, 0x00, 123, 1, 'X' };	// Three digits for a two-digit AI
+	static const unsigned char emptyValue[] = { 0xB1, 1, 0x00, 99, 0 };
+	static const unsigned char goodAI[] = { 0xB1, 1, 0x04, 123, 1, 'X' };
+	static const unsigned char wideLength[] = { 0xB1, 1, 0x00, 99, 0x81, 0x80, 0x80, 0x80, 0x10, 'X' };	// Beyond 32 bits
+	static const unsigned char overlongLength[] = { 0xB1, 1, 0x00, 99, 0x81, 0x00, 'X' };
+	static const unsigned char overlongAI[] = { 0xB1, 1, 0x00, 0xE3, 0x00, 1, 'X' };
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	struct gs1DLparser *ctx2 = malloc(sizeof(struct gs1DLparser));
+	struct gs1DLbinaryReader r;
+	struct gs1DLbinaryElement e;
+	unsigned char bin[GS1_DL_MAX_OUT_BINARY], bad[GS1_DL_MAX_OUT_BINARY];
+	char json[GS1_DL_MAX_OUT_JSON], json2[GS1_DL_MAX_OUT_JSON];
+	char in[256];
+	size_t len;
+
+	strcpy(in, "https://a/01/09520123456788/10/ABC%2F1?3103=000195&99=XYZ");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+
+	len = gs1_writeBinary(ctx, bin, sizeof(bin));
+	TEST_ASSERT(len > 0);
+	gs1_writeJSON(ctx, false, json);
+	TEST_CHECK(len < strlen(json));
+	TEST_MSG("Binary %d, JSON %d", (int)len, (int)strlen(json));
+
+	// Every truncated output buffer fails
+	TEST_CHECK(gs1_writeBinary(ctx, bin, len - 1) == 0);
+	TEST_CHECK(strcmp(ctx->err, "Output buffer is too small") == 0);
+	TEST_CHECK(gs1_writeBinary(ctx, bin, 0) == 0);
+	TEST_ASSERT(gs1_writeBinary(ctx, bin, len) == len);
+	ctx->aiData[3].vallen = 0;
+	TEST_CHECK(gs1_writeBinary(ctx, bad, sizeof(bad)) == 0);
+	TEST_CHECK(strcmp(ctx->err, "AI (99) value is empty") == 0);
+	ctx->aiData[3].vallen = 3;
+
+	// Zero-copy read of the elements, in their original order
+	TEST_ASSERT(gs1_binaryReaderInit(&r, bin, len));
+	TEST_ASSERT(gs1_binaryNext(&r, &e));
+	TEST_CHECK(strcmp(e.ai, "01") == 0 && e.vallen == 14 && memcmp(e.value, "09520123456788", 14) == 0);
+	TEST_CHECK(!e.fnc1 && !e.inQuery);
+	TEST_CHECK((const unsigned char *)e.value > bin && (const unsigned char *)e.value < bin + len);
+	TEST_ASSERT(gs1_binaryNext(&r, &e));
+	TEST_CHECK(strcmp(e.ai, "10") == 0 && e.vallen == 5 && memcmp(e.value, "ABC/1", 5) == 0);
+	TEST_CHECK(e.fnc1 && !e.inQuery);
+	TEST_ASSERT(gs1_binaryNext(&r, &e));
+	TEST_CHECK(strcmp(e.ai, "3103") == 0 && e.vallen == 6 && memcmp(e.value, "000195", 6) == 0);
+	TEST_CHECK(!e.fnc1 && e.inQuery);
+	TEST_ASSERT(gs1_binaryNext(&r, &e));
+	TEST_CHECK(strcmp(e.ai, "99") == 0 && e.vallen == 3 && e.inQuery);
+	TEST_CHECK(!gs1_binaryNext(&r, &e));
+
+	// Round trip through a context
+	TEST_ASSERT(gs1_parseBinary(ctx2, bin, len));
+	TEST_CHECK(ctx2->numAIs == 4);
+	TEST_CHECK(!ctx2->aiData[1].inQuery && ctx2->aiData[2].inQuery);
+	gs1_writeJSON(ctx2, false, json2);
+	TEST_CHECK(strcmp(json, json2) == 0);
+	TEST_MSG("Given %s; got %s", json, json2);
+
+	// Leading zeros of an AI survive
+	strcpy(in, "https://a/00/395201234567891234");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	TEST_ASSERT((len = gs1_writeBinary(ctx, bin, sizeof(bin))) > 0);
+	TEST_ASSERT(gs1_parseBinary(ctx2, bin, len));
+	TEST_CHECK(ctx2->aiData[0].ailen == 2 && memcmp(ctx2->aiData[0].ai, "00", 2) == 0);
+
+	// Malformed records
+	TEST_CHECK(!gs1_binaryReaderInit(&r, bin, 0));
+	TEST_CHECK(!gs1_binaryReaderInit(&r, bin, len - 1));
+	memcpy(bad, bin, len);
+	bad[len] = 0;
+	TEST_CHECK(!gs1_binaryReaderInit(&r, bad, len + 1));
+	bad[0] = 0;
+	TEST_CHECK(!gs1_binaryReaderInit(&r, bad, len));
+	memcpy(bad, bin, len);
+	bad[1] = 0x7F;
+	TEST_CHECK(!gs1_binaryReaderInit(&r, bad, len));
+	TEST_CHECK(!gs1_binaryReaderInit(&r, badAI, sizeof(badAI)));
+	TEST_CHECK(!gs1_parseBinary(ctx2, badAI, sizeof(badAI)));
+	TEST_CHECK(!gs1_binaryReaderInit(&r, emptyValue, sizeof(emptyValue)));
+	TEST_CHECK(!gs1_binaryReaderInit(&r, wideLength, sizeof(wideLength)));
+	TEST_CHECK(!gs1_binaryReaderInit(&r, overlongLength, sizeof(overlongLength)));
+	TEST_CHECK(!gs1_binaryReaderInit(&r, overlongAI, sizeof(overlongAI)));
+	TEST_CHECK(gs1_binaryReaderInit(&r, goodAI, sizeof(goodAI)));
+	TEST_CHECK(gs1_binaryNext(&r, &e) && strcmp(e.ai, "123") == 0);
+	memcpy(bad, bin, len);
+	bad[len - 1] = '\0';
+	TEST_CHECK(gs1_binaryReaderInit(&r, bad, len));
+	TEST_CHECK(!gs1_parseBinary(ctx2, bad, len));
+	TEST_CHECK(strcmp(ctx2->err, "Invalid binary record") == 0);
+	TEST_CHECK(ctx2->numAIs == 0);
+
+	// An empty record
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	ctx->numAIs = 0;
+	TEST_CHECK(gs1_writeBinary(ctx, bin, sizeof(bin)) == 2);
+	TEST_CHECK(gs1_parseBinary(ctx2, bin, 2));
+	TEST_CHECK(ctx2->numAIs == 0);
 
-	test_parseDLuri(ctx, true,
-		"https://example.com/01/9520123456788/89/ABC123?99=XYZ",
-		"^010952012345678889ABC123^99XYZ",
-		"^0109520123456788^89ABC123^99XYZ",
-		"(01)09520123456788(89)ABC123(99)XYZ",
-		"{\"01\":\"09520123456788\",\"89\":\"ABC123\",\"99\":\"XYZ\"}",
-		"^010952012345678889ABC123^99XYZ",
-		"^0109520123456788^89ABC123^99XYZ",
-		"(01)09520123456788(89)ABC123(99)XYZ",
-		"{\"01\":\"09520123456788\",\"89\":\"ABC123\",\"99\":\"XYZ\"}");
+	free(ctx2);
+	free(ctx);
 
-	test_parseDLuri(ctx, true,
-		"https://example.com/01/9520123456788?99=XYZ&89=ABC123",
-		"^010952012345678899XYZ^89ABC123",
-		"^0109520123456788^99XYZ^89ABC123",
-		"(01)09520123456788(99)XYZ(89)ABC123",
-		"{\"01\":\"09520123456788\",\"99\":\"XYZ\",\"89\":\"ABC123\"}",
-		"^010952012345678899XYZ^89ABC123",
-		"^0109520123456788^99XYZ^89ABC123",
-		"(01)09520123456788(99)XYZ(89)ABC123",
-		"{\"01\":\"09520123456788\",\"99\":\"XYZ\",\"89\":\"ABC123\"}");
+}
 
-	/*
-	 * S4T https://youtu.be/9elyEi1PT00
-	 *
-	 */
-	/*
-	test_parseDLuri(ctx, true,
-		"https://example.com/00/093123450000000012?4300=GS1+Australia&4301=Michiel+Ruighaver&4302=8+Nexus+Court&4304=Mulgrave&4306=Victoria&4307=AU&420=3170&4308=%2B61412830095&s4t",
-		"^000931234500000000124300GS1+Australia^4301Michiel+Ruighaver^43028+Nexus+Court^4304Mulgrave^4306Victoria^4307AU^4203170^4308+61412830095",
-		"^00093123450000000012^4300GS1+Australia^4301Michiel+Ruighaver^43028+Nexus+Court^4304Mulgrave^4306Victoria^4307AU^4203170^4308+61412830095",
-		"(00)093123450000000012(4300)GS1+Australia(4301)Michiel+Ruighaver(4302)8+Nexus+Court(4304)Mulgrave(4306)Victoria(4307)AU(420)3170(4308)+61412830095",
-		"{\"00\":\"093123450000000012\",\"4300\":\"GS1+Australia\",\"4301\":\"Michiel+Ruighaver\",\"4302\":\"8+Nexus+Court\",\"4304\":\"Mulgrave\",\"4306\":\"Victoria\",\"4307\":\"AU\",\"420\":\"3170\",\"4308\":\"+61412830095\"}",
-		"^000931234500000000124300GS1+Australia^4301Michiel+Ruighaver^43028+Nexus+Court^4304Mulgrave^4306Victoria^4307AU^4203170^4308+61412830095",
-		"^00093123450000000012^4300GS1+Australia^4301Michiel+Ruighaver^43028+Nexus+Court^4304Mulgrave^4306Victoria^4307AU^4203170^4308+61412830095",
-		"(00)093123450000000012(4300)GS1+Australia(4301)Michiel+Ruighaver(4302)8+Nexus+Court(4304)Mulgrave(4306)Victoria(4307)AU(420)3170(4308)+61412830095",
-		"{\"00\":\"093123450000000012\",\"4300\":\"GS1+Australia\",\"4301\":\"Michiel+Ruighaver\",\"4302\":\"8+Nexus+Court\",\"4304\":\"Mulgrave\",\"4306\":\"Victoria\",\"4307\":\"AU\",\"420\":\"3170\",\"4308\":\"+61412830095\"}");
-	*/
 
+static void test_dl_snapshot(void) {
+
+	struct gs1DLparser *ctx = malloc(sizeof(struct gs1DLparser));
+	struct gs1DLparser *ctx2 = malloc(sizeof(struct gs1DLparser));
+	struct gs1DLsnapshot snap;
+	struct gs1DLbinaryElement e;
+	struct gs1DLqueryParam qp;
+	uint32_t buf[256], moved[256];
+	char json[GS1_DL_MAX_OUT_JSON], json2[GS1_DL_MAX_OUT_JSON];
+	char in[256];
+	size_t len;
+
+	strcpy(in, "https://example.com/stem/01/09520123456788/10/ABC%2F1?linkType=gs1%3Apip&17=261130&flag#frag");
+	TEST_ASSERT(gs1_parseDLuriEx(ctx, in, GS1_DL_PARSE_QUERY_PARAMS));
+	TEST_ASSERT(ctx->numAIs == 3 && ctx->numQueryParams == 2);
+
+	len = gs1_writeSnapshot(ctx, in, NULL, 0);
+	TEST_ASSERT(len > 0 && len <= sizeof(buf) && len % 4 == 0);
+	TEST_CHECK(gs1_writeSnapshot(ctx, in, buf, len - 1) == len);
+	TEST_ASSERT(gs1_writeSnapshot(ctx, in, buf, sizeof(buf)) == len);
+	TEST_CHECK(gs1_writeSnapshot(ctx, NULL, NULL, 0) == len - 24);	// Without the URI parts
+
+	// Relocate the snapshot and discard the URI that it was parsed from
+	memcpy(moved, buf, len);
+	memset(buf, 0, sizeof(buf));
+	memset(in, 0, sizeof(in));
+
+	TEST_ASSERT(gs1_loadSnapshot(&snap, moved, len));
+	TEST_CHECK(snap.numAIs == 3 && snap.numQueryParams == 2);
+	TEST_CHECK(snap.uriParts.scheme.len == 5 && memcmp(snap.strings + snap.uriParts.scheme.offset, "https", 5) == 0);
+	TEST_CHECK(snap.uriParts.domain.len == 11 &&
+		   memcmp(snap.strings + snap.uriParts.domain.offset, "example.com", 11) == 0);
+	TEST_CHECK(snap.uriParts.stem.len == 4 && memcmp(snap.strings + snap.uriParts.stem.offset, "stem", 4) == 0);
+	TEST_CHECK(snap.uriParts.fragment.len == 4 && memcmp(snap.strings + snap.uriParts.fragment.offset, "frag", 4) == 0);
+
+	gs1_snapshotAI(&snap, 1, &e);
+	TEST_CHECK(strcmp(e.ai, "10") == 0 && e.vallen == 5 && memcmp(e.value, "ABC/1", 5) == 0);
+	TEST_CHECK(e.fnc1 && !e.inQuery);
+	TEST_CHECK(e.value > (const char *)moved && e.value < (const char *)moved + len);
+	gs1_snapshotAI(&snap, 2, &e);
+	TEST_CHECK(strcmp(e.ai, "17") == 0 && e.inQuery);
+
+	gs1_snapshotQueryParam(&snap, 0, &qp);
+	TEST_CHECK(qp.namelen == 8 && memcmp(qp.name, "linkType", 8) == 0);
+	TEST_CHECK(qp.vallen == 9 && memcmp(qp.value, "gs1%3Apip", 9) == 0);
+	gs1_snapshotQueryParam(&snap, 1, &qp);
+	TEST_CHECK(qp.namelen == 4 && memcmp(qp.name, "flag", 4) == 0 && qp.value == NULL);
+
+	// A restored context writes the same output as the original
+	gs1_restoreSnapshot(ctx2, &snap);
+	gs1_writeJSON(ctx, false, json);
+	gs1_writeJSON(ctx2, false, json2);
+	TEST_CHECK(strcmp(json, json2) == 0);
+	TEST_MSG("Given %s; got %s", json, json2);
+	TEST_CHECK(ctx2->aiData[0].ai >= ctx2->aiBuf && ctx2->aiData[0].ai < ctx2->aiBuf + GS1_DL_MAX_AI_BUF);
+	TEST_CHECK(ctx2->numQueryParams == 2 && ctx2->queryParams[1].namelen == 4);
+	TEST_CHECK(ctx2->uriParts.domain.len == 0 && ctx2->uriParts.fragment.len == 0);
+
+	// Malformed snapshots
+	TEST_CHECK(!gs1_loadSnapshot(&snap, moved, len - 4));
+	TEST_CHECK(!gs1_loadSnapshot(&snap, (const char *)moved + 1, len));
+	memcpy(buf, moved, len);
+	buf[0]++;
+	TEST_CHECK(!gs1_loadSnapshot(&snap, buf, len));
+	memcpy(buf, moved, len);
+	buf[14] = 0xFFFF;						// Offset of the first AI
+	TEST_CHECK(!gs1_loadSnapshot(&snap, buf, len));
+	memcpy(buf, moved, len);
+	buf[4] = 0;							// aiBuf length
+	TEST_CHECK(!gs1_loadSnapshot(&snap, buf, len));
+	memcpy(buf, moved, len);
+	buf[11] = 0xFFFF;						// Length of the stem
+	TEST_CHECK(!gs1_loadSnapshot(&snap, buf, len));
+	memcpy(buf, moved, len);
+	((char *)buf)[snap.strings - (const char *)moved + 2] = '\0';	// Within the copy of aiBuf
+	TEST_CHECK(!gs1_loadSnapshot(&snap, buf, len));
+
+	// An empty context
+	strcpy(in, "https://a/01/09520123456788");
+	TEST_ASSERT(gs1_parseDLuri(ctx, in));
+	ctx->numAIs = 0;
+	*ctx->aiBuf = '\0';
+	TEST_ASSERT((len = gs1_writeSnapshot(ctx, NULL, buf, sizeof(buf))) > 0);
+	TEST_ASSERT(gs1_loadSnapshot(&snap, buf, len));
+	TEST_CHECK(snap.numAIs == 0 && snap.numQueryParams == 0);
+
+	free(ctx2);
 	free(ctx);
 
 }
@@ -1231,6 +8355,30 @@ static void test_dl_URIunescape(void) {
 TEST_LIST = {
 	{ "dl_gs1_parseDLuri", test_dl_parseDLuri },
 	{ "dl_URIunescape", test_dl_URIunescape },
+	{ "dl_parseQueryParams", test_dl_parseQueryParams },
+	{ "dl_uriParts", test_dl_uriParts },
+	{ "dl_writeCompressedDLpath", test_dl_writeCompressedDLpath },
+	{ "dl_writeDLuri", test_dl_writeDLuri },
+	{ "dl_parseUnbracketedAIelementString", test_dl_parseUnbracketedAIelementString },
+	{ "dl_parseBracketedAIelementString", test_dl_parseBracketedAIelementString },
+	{ "dl_parseJSON", test_dl_parseJSON },
+	{ "dl_writeBarcodeAIelementString", test_dl_writeBarcodeAIelementString },
+	{ "dl_writeEPCuri", test_dl_writeEPCuri },
+	{ "dl_GCPindex", test_dl_GCPindex },
+	{ "dl_EPCbinary", test_dl_EPCbinary },
+	{ "dl_writeHRI", test_dl_writeHRI },
+	{ "dl_datesAndMeasures", test_dl_datesAndMeasures },
+	{ "dl_getKey64", test_dl_getKey64 },
+	{ "dl_filter", test_dl_filter },
+	{ "dl_aggregate", test_dl_aggregate },
+	{ "dl_heavyHitters", test_dl_heavyHitters },
+	{ "dl_hll", test_dl_hll },
+	{ "dl_bloom", test_dl_bloom },
+	{ "dl_shard", test_dl_shard },
+	{ "dl_radixSort", test_dl_radixSort },
+	{ "dl_arrow", test_dl_arrow },
+	{ "dl_binary", test_dl_binary },
+	{ "dl_snapshot", test_dl_snapshot },
 	{ NULL, NULL }
 };
 
@@ -1244,11 +8392,20 @@ int LLVMFuzzerTestOneInput(const char *buf, size_t len) {
 
 	static struct gs1DLparser ctx;
 	static char in[65536];
+	uint64_t words[GS1_DL_EPC_MAX_WORDS];
 
 	memcpy(in, buf, len);
 	in[len] = '\0';
 
-	gs1_parseDLuri(&ctx, in);
+	gs1_parseDLuriEx(&ctx, in, GS1_DL_PARSE_QUERY_PARAMS);
+	gs1_parseUnbracketedAIelementString(&ctx, in);
+	gs1_parseBracketedAIelementString(&ctx, in);
+	gs1_parseJSON(&ctx, in);
+
+	if (len >= sizeof(words)) {
+		memcpy(words, buf, sizeof(words));
+		gs1_parseEPCbinary(&ctx, words, GS1_DL_EPC_MAX_WORDS, NULL);
+	}
 
 	return 0;
 
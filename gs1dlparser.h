@@ -24,6 +24,9 @@
 
 /// \cond
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 /// \endcond
 
 
@@ -34,11 +37,94 @@ extern "C" {
 
 #define GS1_DL_MAX_AI_LEN	90							///< Set to maximum length of an AI value; currently X..90
 #define GS1_DL_MAX_AIS		64							///< Set to maximum number of AIs in a Digital Link URI
+#define GS1_DL_MAX_QUERY_PARAMS	16							///< Maximum number of non-AI query parameters recorded by gs1_parseDLuriEx()
 #define GS1_DL_MAX_AI_BUF	(GS1_DL_MAX_AIS * (4 + GS1_DL_MAX_AI_LEN))		///< Capacity of the internal AI data buffer
 
 #define GS1_DL_MAX_OUT_JSON	(GS1_DL_MAX_AIS * (4 + GS1_DL_MAX_AI_LEN + 6) + 2)	///< Maximum length for JSON output data
 #define GS1_DL_MAX_OUT_UNBR	(GS1_DL_MAX_AIS * (4 + GS1_DL_MAX_AI_LEN + 1) + 1)	///< Maximum length for unbracketed AI output data
 #define GS1_DL_MAX_OUT_BRKT	(GS1_DL_MAX_AIS * (4 + GS1_DL_MAX_AI_LEN*2 + 2) + 1)	///< Maximum length for bracketed AI output data; "(" escaped as "\("
+#define GS1_DL_MAX_OUT_DLURI	(GS1_DL_MAX_AIS * (4 + GS1_DL_MAX_AI_LEN*3 + 2) + 10)	///< Maximum length for DL URI output data, excluding the domain and stem; values percent-encoded
+#define GS1_DL_MAX_OUT_COMP	((GS1_DL_MAX_AIS * (16 + 3 + 7 + GS1_DL_MAX_AI_LEN*7) + 5) / 6 + 1)	///< Maximum length for compressed DL path data; 7-bit characters
+
+#define GS1_DL_MAX_OUT_HRI	(GS1_DL_MAX_AIS * (24 + 4 + 5 + GS1_DL_MAX_AI_LEN) + 1)	///< Maximum length for HRI output data, including data titles
+#define GS1_DL_MAX_OUT_EPC	(24 + GS1_DL_MAX_AI_LEN*3*2 + 1)				///< Maximum length for EPC URN output data; two percent-encoded components
+#define GS1_DL_MAX_OUT_BINARY	(2 + GS1_DL_MAX_AIS * (1 + 2 + 1 + GS1_DL_MAX_AI_LEN))	///< Maximum length for binary record output data
+
+#define GS1_DL_FNC1_GS		'\x1D'							///< FNC1 as transmitted by a scanner, i.e. ASCII Group Separator
+#define GS1_DL_SYMID_GS1_128	"]C1"							///< AIM symbology identifier for GS1-128
+#define GS1_DL_SYMID_DATAMATRIX	"]d2"							///< AIM symbology identifier for GS1 DataMatrix
+#define GS1_DL_SYMID_QR		"]Q3"							///< AIM symbology identifier for GS1 QR Code
+
+#define GS1_DL_URI_COMPRESSED	0x01							///< gs1_writeDLuri() option: Write a compressed DL URI
+
+#define GS1_DL_PARSE_QUERY_PARAMS	0x01						///< gs1_parseDLuriEx() option: Record non-AI query parameters
+
+#define GS1_DL_EPC_SGTIN_96	0x30							///< EPC binary header for SGTIN-96
+#define GS1_DL_EPC_SSCC_96	0x31							///< EPC binary header for SSCC-96
+#define GS1_DL_EPC_SGTIN_198	0x36							///< EPC binary header for SGTIN-198
+#define GS1_DL_EPC_MAX_WORDS	4							///< Maximum number of 64-bit words in an EPC binary encoding
+
+#define GS1_DL_DATE_INVALID	INT32_MIN						///< gs1_decodeDates() result for an invalid date
+#define GS1_DL_MEASURE_INVALID	UINT32_MAX						///< gs1_decodeMeasures() result for an invalid value
+#define GS1_DL_KEY_INVALID	UINT64_MAX						///< gs1_getKeys64() result for a missing or invalid key
+
+#define GS1_DL_MAX_FILTER_TERMS	8							///< Maximum number of terms in a ::gs1DLfilter
+
+#define GS1_DL_FILTER_HAS_AI	0							///< Filter term kind: AI is present
+#define GS1_DL_FILTER_KEY_PREFIX	1						///< Filter term kind: numeric key starts with a prefix
+#define GS1_DL_FILTER_DATE	2							///< Filter term kind: date compares with a constant
+
+#define GS1_DL_FILTER_LT	0							///< gs1_filterDate() comparison: before
+#define GS1_DL_FILTER_LE	1							///< gs1_filterDate() comparison: on or before
+#define GS1_DL_FILTER_EQ	2							///< gs1_filterDate() comparison: on
+#define GS1_DL_FILTER_GE	3							///< gs1_filterDate() comparison: on or after
+#define GS1_DL_FILTER_GT	4							///< gs1_filterDate() comparison: after
+
+#define GS1_DL_AGG_BY_LOT	0x01							///< gs1_aggInit() option: Aggregate per key and AI (10) batch/lot
+#define GS1_DL_AGG_MAX_LOT	20							///< Maximum length of an AI (10) value
+#define GS1_DL_AGG_MAX_RUNS	32							///< Maximum number of runs spilled by a ::gs1DLaggregator
+
+#define GS1_DL_CMS_DEPTH	4							///< Number of rows in the Count-Min sketch of a ::gs1DLheavyHitters
+#define GS1_DL_CMS_WIDTH	2048							///< Number of counters per row, a power of two
+#define GS1_DL_TOPK_MAX		64							///< Maximum number of keys tracked by a ::gs1DLheavyHitters
+#define GS1_DL_HH_SLOTS		(2 * GS1_DL_TOPK_MAX)					///< Size of the hash index over the keys tracked by a ::gs1DLheavyHitters
+
+#define GS1_DL_HLL_PRECISION	12							///< Number of fingerprint bits selecting a ::gs1DLhll register
+#define GS1_DL_HLL_REGISTERS	(1 << GS1_DL_HLL_PRECISION)				///< Number of ::gs1DLhll registers
+#define GS1_DL_HLL_SERIALISED	(8 + GS1_DL_HLL_REGISTERS * 6 / 8)			///< Size of a ::gs1DLhll serialised by gs1_hllSerialise()
+
+#define GS1_DL_RADIX_BUCKETS	256							///< Size of a histogram for gs1_radixCount()
+
+#define GS1_DL_ARROW_MAX_COLUMNS	32						///< Maximum number of AI columns written by a ::gs1DLarrowWriter
+
+
+/**
+ *  @brief Lookup for the length of the GS1 Company Prefix that begins a key,
+ *  used when converting to EPC URNs.
+ *
+ *  @param [in] arg User data, as passed to gs1_writeEPCuri()
+ *  @param [in] digits Digits beginning with the GS1 Company Prefix; not NUL-terminated
+ *  @param [in] len Number of digits available
+ *  @return length of the GS1 Company Prefix, or 0 if it is unknown
+ */
+typedef int (*gs1_gcpLengthFunc)(void *arg, const char *digits, size_t len);
+
+
+/// A GS1 Company Prefix and the length of the GCPs that it begins, as input to
+/// gs1_buildGCPindex()
+struct gs1GCPprefix {
+	const char *prefix;                     ///< Leading digits, 1 to 12 characters
+	int gcpLength;                          ///< Length of the GCPs beginning with prefix, or 0 if none are valid
+};
+
+
+/// Compact GS1 Company Prefix length index that references a buffer built by
+/// gs1_buildGCPindex(), as loaded by gs1_loadGCPindex()
+struct gs1GCPindex {
+	const uint32_t *dir;                    ///< Index of the first entry for each four-digit bucket
+	const uint32_t *entries;                ///< Sorted range starts and lengths
+	uint32_t count;                         ///< Number of entries
+};
 
 
 /// Represents an AI element as offsets in the aiBuf field of gs1DLparser, e.g.
@@ -49,6 +135,182 @@ struct gs1AIelement {
 	const char *value;                      ///< Pointer to offset in aiBuf representing an AI value
 	short vallen;                           ///< Length of the AI's value
 	bool fnc1;                              ///< Whether an FNC1 separator is required
+	bool inQuery;                           ///< Whether the AI was extracted from the query info of a DL URI
+};
+
+
+/// Represents a non-AI query parameter, e.g. "linkType=gs1:pip", as spans of
+/// the URI given to gs1_parseDLuriEx(). The spans are not percent-decoded; see
+/// gs1_decodeQueryParam().
+struct gs1DLqueryParam {
+	const char *name;                       ///< Pointer into the URI at the parameter name
+	size_t namelen;                         ///< Length of the name
+	const char *value;                      ///< Pointer into the URI at the value, or NULL if the parameter has no "="
+	size_t vallen;                          ///< Length of the value
+};
+
+
+/// Location of a part of the URI given to gs1_parseDLuri(), as an offset from
+/// its start
+struct gs1DLspan {
+	size_t offset;                          ///< Offset of the first character
+	size_t len;                             ///< Length, or 0 if the part is empty or absent
+};
+
+
+/// Locations of the parts of a Digital Link URI, e.g. for
+/// "https://example.com/stem/01/09520123456788#frag": "https", "example.com",
+/// "stem" and "frag"
+struct gs1DLuriParts {
+	struct gs1DLspan scheme;                ///< Scheme, without "://"
+	struct gs1DLspan domain;                ///< Domain, including any port
+	struct gs1DLspan stem;                  ///< Path info preceding the AI data, without the surrounding "/"
+	struct gs1DLspan fragment;              ///< Fragment, without "#"
+};
+
+
+/// A compiled filter term. Populated by the gs1_filter*() builders.
+struct gs1DLfilterTerm {
+	int kind;                               ///< GS1_DL_FILTER_HAS_AI, GS1_DL_FILTER_KEY_PREFIX or GS1_DL_FILTER_DATE
+	char ai[5];                             ///< The AI
+	int op;                                 ///< Date comparison, e.g. GS1_DL_FILTER_LT
+	uint64_t lo;                            ///< Lowest key matching the prefix
+	uint64_t span;                          ///< Number of keys matching the prefix
+	int keylen;                             ///< Length of the key value
+	int32_t days;                           ///< Date compared against, as days since 1970-01-01
+};
+
+
+/// A conjunction of predicates over the AI data of parsed contexts, applied
+/// to a batch of contexts by gs1_filterBatch().
+struct gs1DLfilter {
+	struct gs1DLfilterTerm terms[GS1_DL_MAX_FILTER_TERMS]; ///< Compiled terms
+	int numTerms;                           ///< Number of terms
+	int refYear;                            ///< Reference year for resolving dates, as per gs1_getDate()
+	char err[128];                          ///< Error message from the most recent builder
+};
+
+
+/// Scan count for a key, or a key and batch/lot. Also the slot type of a
+/// ::gs1DLaggregator table.
+struct gs1DLaggEntry {
+	uint64_t key;                           ///< Packed key, as per gs1_getKey64(); ::GS1_DL_KEY_INVALID for an empty slot
+	uint64_t count;                         ///< Number of scans
+	int64_t firstSeen;                      ///< Earliest timestamp given for the scans
+	int64_t lastSeen;                       ///< Latest timestamp given for the scans
+	char lot[GS1_DL_AGG_MAX_LOT+1];         ///< AI (10) value when aggregating by lot, otherwise empty
+};
+
+
+/// Location of a sorted run of ::gs1DLaggEntry records in a spill file
+struct gs1DLaggRun {
+	long offset;                            ///< File offset of the first record
+	size_t count;                           ///< Number of records
+};
+
+
+/// Streaming aggregation of scans per key. Set up by gs1_aggInit(); a
+/// separate aggregator, with its own spill file, is needed for each thread.
+struct gs1DLaggregator {
+	struct gs1DLaggEntry *entries;          ///< Hash table slots, provided by the caller
+	size_t capacity;                        ///< Number of slots
+	size_t used;                            ///< Number of occupied slots
+	char ai[5];                             ///< AI providing the key
+	int options;                            ///< Options given to gs1_aggInit()
+	FILE *spill;                            ///< Spill file, or NULL
+	struct gs1DLaggRun runs[GS1_DL_AGG_MAX_RUNS]; ///< Runs written to the spill file
+	int numRuns;                            ///< Number of runs written to the spill file
+	uint64_t skipped;                       ///< Number of scans without a valid key
+	char err[128];                          ///< Error message
+};
+
+
+/// Receives each aggregated entry from gs1_aggFinish(). Return false to stop.
+typedef bool (*gs1_aggEmitFunc)(void *arg, const struct gs1DLaggEntry *entry);
+
+
+/// A key tracked by a ::gs1DLheavyHitters summary
+struct gs1DLhhEntry {
+	uint64_t key;                           ///< Packed key, as per gs1_getKey64()
+	uint64_t count;                         ///< Count, which may overestimate
+	uint64_t error;                         ///< Maximum overestimate of the count
+};
+
+
+/// Fixed-size summary of the most frequent keys in a stream. A Count-Min
+/// sketch estimates the count of any key and a Space-Saving summary tracks the
+/// k most frequent keys. Set up by gs1_hhInit().
+struct gs1DLheavyHitters {
+	char ai[5];                             ///< AI providing the key
+	int k;                                  ///< Number of keys to track
+	uint64_t total;                         ///< Number of keys counted
+	uint32_t counts[GS1_DL_CMS_DEPTH][GS1_DL_CMS_WIDTH]; ///< Count-Min sketch counters
+	int numTop;                             ///< Number of keys tracked
+	struct gs1DLhhEntry top[GS1_DL_TOPK_MAX]; ///< Tracked keys, as a min-heap by count
+	uint8_t index[GS1_DL_HH_SLOTS];         ///< Hash index of the tracked keys, holding heap position + 1, or 0 if empty
+	uint8_t slots[GS1_DL_TOPK_MAX];         ///< Index slot of each tracked key
+	char err[128];                          ///< Error message
+};
+
+
+/// HyperLogLog estimator of the number of distinct fingerprints, with a
+/// standard error of about 1.6%. Set up by gs1_hllInit().
+struct gs1DLhll {
+	uint8_t registers[GS1_DL_HLL_REGISTERS]; ///< Maximum rank seen per register
+};
+
+
+/// Blocked Bloom filter of packed keys that references a buffer built by
+/// gs1_buildBloom(), as loaded by gs1_loadBloom()
+struct gs1DLbloom {
+	const uint64_t *blocks;                 ///< 64-byte blocks of eight words
+	uint32_t numBlocks;                     ///< Number of blocks
+};
+
+
+/// Receives output data from a writer, e.g. by calling fwrite(). Return false
+/// on failure.
+typedef bool (*gs1_writeFunc)(void *arg, const void *data, size_t len);
+
+
+/// Writer of an Arrow IPC stream with a nullable string column per AI. Set
+/// up by gs1_arrowBegin().
+struct gs1DLarrowWriter {
+	char ais[GS1_DL_ARROW_MAX_COLUMNS][5];  ///< AI of each column, which is also the column name
+	int numColumns;                         ///< Number of columns
+	gs1_writeFunc write;                    ///< Output callback
+	void *arg;                              ///< Argument passed to the output callback
+	char err[128];                          ///< Error message
+};
+
+
+/// Reader of a binary record written by gs1_writeBinary(). Set up by
+/// gs1_binaryReaderInit().
+struct gs1DLbinaryReader {
+	const unsigned char *p;                 ///< Next element
+	const unsigned char *end;               ///< End of the record
+	int remaining;                          ///< Number of elements not yet read
+};
+
+
+/// An AI element read from a binary record by gs1_binaryNext()
+struct gs1DLbinaryElement {
+	char ai[5];                             ///< The AI
+	const char *value;                      ///< Pointer into the record at the value; not NUL-terminated
+	size_t vallen;                          ///< Length of the value
+	bool fnc1;                              ///< Whether an FNC1 separator is required
+	bool inQuery;                           ///< Whether the AI was extracted from the query info of a DL URI
+};
+
+
+/// Snapshot of a context that references a buffer written by
+/// gs1_writeSnapshot(), as loaded by gs1_loadSnapshot()
+struct gs1DLsnapshot {
+	const uint32_t *elements;               ///< AI element and query parameter tables
+	const char *strings;                    ///< String data, starting with a copy of aiBuf
+	int numAIs;                             ///< Number of AI elements
+	int numQueryParams;                     ///< Number of non-AI query parameters
+	struct gs1DLuriParts uriParts;          ///< Locations of the URI parts within strings
 };
 
 
@@ -58,15 +320,22 @@ struct gs1DLparser {
 	char aiBuf[GS1_DL_MAX_AI_BUF];			///< Opaque buffer for storing AI element string data
 	struct gs1AIelement aiData[GS1_DL_MAX_AIS];	///< Extracted AI elements
 	int numAIs;					///< Number of AI elements extracted from DL URI
+	struct gs1DLqueryParam queryParams[GS1_DL_MAX_QUERY_PARAMS];	///< Non-AI query parameters, if requested
+	int numQueryParams;				///< Number of non-AI query parameters recorded
+	struct gs1DLuriParts uriParts;			///< Locations of the URI parts; zero unless parsed from a DL URI
 	char err[128];					///< Error message
 };
 
 
 /**
- *  @brief Extract the AI data from an uncompressed Digital Link URI
+ *  @brief Extract the AI data from a Digital Link URI
  *
  *  This performs a lightweight parse, sufficient for extracting the AIs.
  *
+ *  If the path info contains no Digital Link primary key then the final path
+ *  component is decoded as compressed AI data. Only AIs whose formats are
+ *  known to the library can be decompressed.
+ *
  *  It does not validate the structure of the DL URI, nor the data relationships
  *  between the extracted AIs, nor the content of the AIs.
  *
@@ -84,6 +353,85 @@ struct gs1DLparser {
 bool gs1_parseDLuri(struct gs1DLparser *ctx, char *dlData);
 
 
+/**
+ *  @brief As gs1_parseDLuri(), with options.
+ *
+ *  With ::GS1_DL_PARSE_QUERY_PARAMS the non-AI query parameters, such as
+ *  linkType, context and lang, are recorded in ctx->queryParams as spans of
+ *  dlData, without decoding. The spans remain valid for as long as dlData
+ *  does. Parameters beyond ::GS1_DL_MAX_QUERY_PARAMS are not recorded.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [in] dlData The candidate Digital Link URI from which AI elements will be extracted
+ *  @param [in] options Bitwise OR of GS1_DL_PARSE_* options, e.g. ::GS1_DL_PARSE_QUERY_PARAMS
+ *  @return true if parsing succeeded, otherwise false
+ */
+bool gs1_parseDLuriEx(struct gs1DLparser *ctx, char *dlData, unsigned int options);
+
+
+/**
+ *  @brief Decode a percent-encoded query parameter name or value span, as
+ *  recorded by gs1_parseDLuriEx(), with "+" representing space.
+ *
+ *  @param [in] in Span to decode
+ *  @param [in] inlen Length of the span
+ *  @param [out] out User-provided buffer of at least inlen + 1 bytes into which the NUL-terminated result will be written
+ *  @return length of the decoded data
+ */
+size_t gs1_decodeQueryParam(const char *in, size_t inlen, char *out);
+
+
+/**
+ *  @brief Extract the AI data from an unbracketed AI element string in which
+ *  a "^" character represents FNC1, e.g. ^011231231231233310ABC^21XYZ
+ *
+ *  The element string must begin with FNC1. AIs are identified using their
+ *  length as determined by their first two digits. AIs having a predefined
+ *  fixed length need not be terminated by FNC1, otherwise the value extends
+ *  to the next FNC1 or the end of the data.
+ *
+ *  The AI values are not validated.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [in] data The unbracketed element string
+ *  @return true if parsing succeeded, otherwise false
+ */
+bool gs1_parseUnbracketedAIelementString(struct gs1DLparser *ctx, const char *data);
+
+
+/**
+ *  @brief Extract the AI data from a bracketed AI element string, e.g.
+ *  (01)12312312312333(10)ABC(21)XYZ
+ *
+ *  A "(" within a value is represented as "\(", as emitted by
+ *  gs1_writeBracketedAIelementString().
+ *
+ *  The AI values are not validated.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [in] data The bracketed element string
+ *  @return true if parsing succeeded, otherwise false
+ */
+bool gs1_parseBracketedAIelementString(struct gs1DLparser *ctx, const char *data);
+
+
+/**
+ *  @brief Extract the AI data from a flat JSON object of AI strings, as
+ *  emitted by gs1_writeJSON(), e.g. {"01":"12312312312333","10":"ABC"}
+ *
+ *  Each key must be a 2-4 digit AI and each value a non-empty string.
+ *  Escaped code points are decoded as UTF-8. Unescaped control characters
+ *  are accepted since gs1_writeJSON() does not escape them.
+ *
+ *  The AI values are not validated.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [in] json The JSON object
+ *  @return true if parsing succeeded, otherwise false
+ */
+bool gs1_parseJSON(struct gs1DLparser *ctx, const char *json);
+
+
 /**
  *  @brief Write the extracted AI elements as an unbracketed AI element string
  *  in which a "^" character represents FNC1, e.g. ^011231231231233398ABC^99XYZ
@@ -96,6 +444,29 @@ bool gs1_parseDLuri(struct gs1DLparser *ctx, char *dlData);
 void gs1_writeUnbracketedAIelementString(struct gs1DLparser *ctx, bool fixedFirst, bool extraFNC1, char *out);
 
 
+/**
+ *  @brief Write the extracted AI elements as barcode message data, i.e. an
+ *  unbracketed AI element string with a given FNC1 byte and an optional AIM
+ *  symbology identifier, e.g. "]d2011231231231233398ABC<GS>99XYZ"
+ *
+ *  When a symbology identifier is given it replaces the leading FNC1.
+ *
+ *  Since the FNC1 byte may be any value, including NUL, the length of the
+ *  output is returned. The output is nevertheless NUL terminated.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [in] fixedFirst If true, sort predefined fixed-length AIs ahead of the others in the output
+ *  @param [in] extraFNC1 If true, emit superflous FNC1 separaters between each AI, even when not strictly required
+ *  @param [in] fnc1 The byte that represents FNC1, e.g. ::GS1_DL_FNC1_GS
+ *  @param [in] symId Optional symbology identifier, e.g. ::GS1_DL_SYMID_DATAMATRIX; may be NULL
+ *  @param [out] out User-provided buffer into which the message will be written. A buffer of ::GS1_DL_MAX_OUT_UNBR bytes plus the length of the symbology identifier suffices for general inputs.
+ *  @param [in] maxlen Size of the out buffer, including the terminating NUL
+ *  @return length of the message, or 0 if it does not fit or there are no AI elements
+ */
+size_t gs1_writeBarcodeAIelementString(struct gs1DLparser *ctx, bool fixedFirst, bool extraFNC1,
+				       char fnc1, const char *symId, char *out, size_t maxlen);
+
+
 /**
  *  @brief Write the extracted AI elements as a bracketed AI element string,
  *  e.g. (01)12312312312333(98)ABC(99)XYZ
@@ -118,6 +489,923 @@ void gs1_writeBracketedAIelementString(struct gs1DLparser *ctx, bool fixedFirst,
 void gs1_writeJSON(struct gs1DLparser *ctx, bool fixedFirst, char *out);
 
 
+/**
+ *  @brief Write the extracted AI elements as the human readable
+ *  interpretation for a label, e.g. (01) 09520123456788 (10) ABC/123
+ *
+ *  The AIs are written in the order in which they were extracted. Data
+ *  titles are only available for common AIs.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [in] withDataTitles If true, precede each AI with its data title, e.g. GTIN (01) 09520123456788
+ *  @param [out] out User-provided buffer into which the HRI will be written. A buffer of ::GS1_DL_MAX_OUT_HRI bytes suffices for general inputs.
+ *  @param [in] maxlen Size of the out buffer, including the terminating NUL
+ *  @return length of the HRI, or 0 if there are no AIs or on failure with an error message in ctx->err
+ */
+size_t gs1_writeHRI(struct gs1DLparser *ctx, bool withDataTitles, char *out, size_t maxlen);
+
+
+/**
+ *  @brief Write the extracted AI elements as the base64url path component of
+ *  a compressed Digital Link URI, e.g. ARFRJydaKCCNV4JGQgowOQ
+ *
+ *  Each alphanumeric value is written using whichever of the available
+ *  encodings yields the shortest output.
+ *
+ *  The AIs are written in the order in which they were extracted. Only AIs
+ *  whose formats are known to the library can be compressed.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [out] out User-provided buffer into which the compressed data will be written. The buffer must be at least ::GS1_DL_MAX_OUT_COMP bytes for general inputs.
+ *  @return true if compression succeeded, otherwise false with an error message in ctx->err
+ */
+bool gs1_writeCompressedDLpath(struct gs1DLparser *ctx, char *out);
+
+
+/**
+ *  @brief Write the extracted AI elements as a Digital Link URI, e.g.
+ *  https://id.gs1.org/01/09520123456788/10/ABC%2F123?17=201225
+ *
+ *  The first Digital Link primary key among the AI elements is written to
+ *  the path info, followed by any of its key qualifiers in their predefined
+ *  order. The remaining AI elements are written as query parameters in the
+ *  order in which they were extracted. Values are percent-encoded.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [in] domain Domain name of the URI, e.g. "id.gs1.org"
+ *  @param [in] stem Optional path info that precedes the AI data, without leading or trailing "/"; may be NULL
+ *  @param [in] options Bitwise OR of GS1_DL_URI_* options, e.g. ::GS1_DL_URI_COMPRESSED
+ *  @param [out] out User-provided buffer into which the URI will be written. A buffer of ::GS1_DL_MAX_OUT_DLURI bytes plus the lengths of the domain and stem suffices for general inputs.
+ *  @param [in] maxlen Size of the out buffer, including the terminating NUL
+ *  @return length of the URI, or 0 on failure with an error message in ctx->err
+ */
+size_t gs1_writeDLuri(struct gs1DLparser *ctx, const char *domain, const char *stem, unsigned int options, char *out, size_t maxlen);
+
+
+
+/**
+ *  @brief Write the extracted AI elements as an EPC Pure Identity URN, e.g.
+ *  urn:epc:id:sgtin:9520123.045678.12345
+ *
+ *  The EPC scheme is determined by the first Digital Link primary key among
+ *  the AI elements together with its qualifiers: (01)+(21) SGTIN, (01)+(235)
+ *  UPUI, (01)+(10) LGTIN class, (00) SSCC, (414)+(254) SGLN, (417) PGLN,
+ *  (8003) GRAI, (8004) GIAI, (253) GDTI, (255) SGCN, (401) GINC, (402) GSIN,
+ *  (8017) GSRNP, (8018) GSRN, (8006)+(21) ITIP and (8010)+(8011) CPI.
+ *
+ *  No memory is allocated.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [in] gcpLength Lookup for the length of the GS1 Company Prefix
+ *  @param [in] arg User data passed to gcpLength
+ *  @param [out] out User-provided buffer into which the URN will be written. A buffer of ::GS1_DL_MAX_OUT_EPC bytes suffices for general inputs.
+ *  @param [in] maxlen Size of the out buffer, including the terminating NUL
+ *  @return length of the URN, or 0 on failure with an error message in ctx->err
+ */
+size_t gs1_writeEPCuri(struct gs1DLparser *ctx, gs1_gcpLengthFunc gcpLength, void *arg, char *out, size_t maxlen);
+
+
+/**
+ *  @brief Write EPC Pure Identity URNs for an array of contexts, as per
+ *  gs1_writeEPCuri().
+ *
+ *  @param [in,out] ctxs Array of count ::gs1DLparser contexts, each receiving its own error message on failure
+ *  @param [in] count Number of contexts
+ *  @param [in] gcpLength Lookup for the length of the GS1 Company Prefix
+ *  @param [in] arg User data passed to gcpLength
+ *  @param [out] out User-provided buffer of count * stride bytes; the URN for ctxs[i] is written at out + i * stride
+ *  @param [in] stride Size of each output slot, including the terminating NUL
+ *  @param [out] lens Array of count lengths; 0 where the conversion failed
+ *  @return number of contexts that were successfully converted
+ */
+size_t gs1_writeEPCuriBatch(struct gs1DLparser *ctxs, size_t count, gs1_gcpLengthFunc gcpLength, void *arg,
+			    char *out, size_t stride, size_t *lens);
+
+
+
+/**
+ *  @brief Compile a list of GS1 Company Prefixes into a compact binary
+ *  index of GCP lengths that can be saved and later loaded in place with
+ *  gs1_loadGCPindex(), e.g. from a memory-mapped file.
+ *
+ *  Where prefixes are nested the most specific one applies. The binary
+ *  format uses the host byte order.
+ *
+ *  Call with buf set to NULL to determine the required buffer size.
+ *
+ *  @param [in,out] prefixes Array of prefixes, which is sorted in place
+ *  @param [in] count Number of prefixes
+ *  @param [out] buf User-provided buffer, aligned to 4 bytes, into which the index will be written; may be NULL
+ *  @param [in] maxlen Size of buf
+ *  @return size of the index in bytes, which was written only if it does not exceed maxlen, or 0 if a prefix is invalid or duplicated
+ */
+size_t gs1_buildGCPindex(struct gs1GCPprefix *prefixes, size_t count, void *buf, size_t maxlen);
+
+
+/**
+ *  @brief Reference an index built by gs1_buildGCPindex() without copying it.
+ *
+ *  The buffer must remain valid while the index is used.
+ *
+ *  @param [out] idx ::gs1GCPindex to initialise
+ *  @param [in] buf Buffer containing the index, aligned to 4 bytes
+ *  @param [in] len Size of the buffer
+ *  @return true if the buffer holds a well-formed index, otherwise false
+ */
+bool gs1_loadGCPindex(struct gs1GCPindex *idx, const void *buf, size_t len);
+
+
+/**
+ *  @brief Lookup the length of the GS1 Company Prefix that begins a key.
+ *
+ *  Suitable as the ::gs1_gcpLengthFunc for gs1_writeEPCuri(), with a pointer
+ *  to a loaded ::gs1GCPindex as its user data.
+ *
+ *  @param [in] arg Pointer to a ::gs1GCPindex
+ *  @param [in] digits Digits beginning with the GS1 Company Prefix; any beyond len up to 12 are taken as zero
+ *  @param [in] len Number of digits available
+ *  @return length of the GS1 Company Prefix, or 0 if it is unknown
+ */
+int gs1_lookupGCPlength(void *arg, const char *digits, size_t len);
+
+
+
+/**
+ *  @brief Encode the extracted AI elements as an EPC binary tag encoding:
+ *  SGTIN-96 or SGTIN-198 from (01) and (21), or SSCC-96 from (00).
+ *
+ *  The bits are packed most significant first into 64-bit words so that
+ *  the EPC header is the top byte of words[0]. Unused trailing bits are
+ *  zero. An SGTIN-198 serial must be drawn from the GS1 AI encodable
+ *  character set 82.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [in] scheme One of ::GS1_DL_EPC_SGTIN_96, ::GS1_DL_EPC_SGTIN_198 or ::GS1_DL_EPC_SSCC_96
+ *  @param [in] filter EPC filter value, 0 to 7
+ *  @param [in] gcpLength Lookup for the length of the GS1 Company Prefix, which must be 6 to 12 digits
+ *  @param [in] arg User data passed to gcpLength
+ *  @param [out] words User-provided buffer of 64-bit words; ::GS1_DL_EPC_MAX_WORDS suffices for all schemes
+ *  @param [in] maxwords Number of words in the buffer
+ *  @return number of bits in the encoding, or 0 on failure with an error message in ctx->err
+ */
+size_t gs1_writeEPCbinary(struct gs1DLparser *ctx, unsigned int scheme, unsigned int filter,
+			  gs1_gcpLengthFunc gcpLength, void *arg, uint64_t *words, size_t maxwords);
+
+
+/**
+ *  @brief Decode an SGTIN-96, SGTIN-198 or SSCC-96 EPC binary tag encoding,
+ *  packed as by gs1_writeEPCbinary(), into AI elements (01) and (21), or
+ *  (00), recomputing the check digit. An SGTIN-198 serial must be drawn
+ *  from character set 82 and zero padded.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [in] words EPC binary data, most significant bit first
+ *  @param [in] numwords Number of words available
+ *  @param [out] filter Receives the EPC filter value; may be NULL
+ *  @return true if decoding succeeded, otherwise false with an error message in ctx->err
+ */
+bool gs1_parseEPCbinary(struct gs1DLparser *ctx, const uint64_t *words, size_t numwords, unsigned int *filter);
+
+
+
+/**
+ *  @brief Get the value of a date AI, (11), (12), (13), (15), (16) or (17),
+ *  as the number of days since 1970-01-01.
+ *
+ *  The century is determined from the two-digit year using the sliding
+ *  window of the GS1 General Specifications, i.e. within 49 years into the
+ *  past or 50 years into the future relative to refYear. A day of "00"
+ *  denotes the last day of the month.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [in] ai The date AI, e.g. "17"
+ *  @param [in] refYear Reference year for resolving the century, typically the current year
+ *  @param [out] days Number of days since 1970-01-01
+ *  @return true if the AI is present with a valid date, otherwise false with an error message in ctx->err
+ */
+bool gs1_getDate(struct gs1DLparser *ctx, const char *ai, int refYear, int32_t *days);
+
+
+/**
+ *  @brief Get the value of a measure AI, (310n) to (369n), as a fixed-point
+ *  integer, e.g. 000195 for (3103) is 195 with 3 decimal places.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [in] ai The measure AI, either in full, e.g. "3103", or without the decimal places indicator, e.g. "310"
+ *  @param [out] value The value, excluding the decimal point
+ *  @param [out] decimals Number of implied decimal places
+ *  @return true if the AI is present with a valid value, otherwise false with an error message in ctx->err
+ */
+bool gs1_getMeasure(struct gs1DLparser *ctx, const char *ai, uint32_t *value, int *decimals);
+
+
+/**
+ *  @brief Decode a column of YYMMDD dates, as per gs1_getDate().
+ *
+ *  @param [in] yymmdd Contiguous array of count six-digit dates, without separators or terminators
+ *  @param [in] count Number of dates
+ *  @param [in] refYear Reference year for resolving the century, typically the current year
+ *  @param [out] days Array of count results; ::GS1_DL_DATE_INVALID for an invalid date
+ *  @return number of valid dates
+ */
+size_t gs1_decodeDates(const char *yymmdd, size_t count, int refYear, int32_t *days);
+
+
+/**
+ *  @brief Decode a column of six-digit measure values, as per
+ *  gs1_getMeasure(). The number of decimal places is given by the AI.
+ *
+ *  @param [in] digits Contiguous array of count six-digit values, without separators or terminators
+ *  @param [in] count Number of values
+ *  @param [out] values Array of count results; ::GS1_DL_MEASURE_INVALID for an invalid value
+ *  @return number of valid values
+ */
+size_t gs1_decodeMeasures(const char *digits, size_t count, uint32_t *values);
+
+
+
+/**
+ *  @brief Get the value of a numeric AI of up to 19 digits, such as the
+ *  GTIN (01) or SSCC (00), as a 64-bit integer.
+ *
+ *  Leading zeros are not represented, so the key length is implied by the
+ *  AI; e.g. a GTIN-14 is formed by zero-padding the decimal value to 14
+ *  digits.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [in] ai The AI, e.g. "01"
+ *  @param [out] key The value
+ *  @return true if the AI is present with a numeric value, otherwise false with an error message in ctx->err
+ */
+bool gs1_getKey64(struct gs1DLparser *ctx, const char *ai, uint64_t *key);
+
+
+/**
+ *  @brief Get the value of a numeric AI for an array of contexts, as per
+ *  gs1_getKey64().
+ *
+ *  @param [in,out] ctxs Array of count ::gs1DLparser contexts, each receiving its own error message on failure
+ *  @param [in] count Number of contexts
+ *  @param [in] ai The AI, e.g. "01"
+ *  @param [out] keys Array of count results; ::GS1_DL_KEY_INVALID where the AI is missing or invalid
+ *  @return number of valid keys
+ */
+size_t gs1_getKeys64(struct gs1DLparser *ctxs, size_t count, const char *ai, uint64_t *keys);
+
+
+
+/**
+ *  @brief Initialise an empty filter, which selects every context
+ *
+ *  @param [out] filter ::gs1DLfilter to initialise
+ *  @param [in] refYear Reference year for resolving dates, as per gs1_getDate()
+ */
+void gs1_filterInit(struct gs1DLfilter *filter, int refYear);
+
+
+/**
+ *  @brief Add a term requiring that an AI is present
+ *
+ *  @param [in,out] filter ::gs1DLfilter
+ *  @param [in] ai The AI, e.g. "21"
+ *  @return true on success, otherwise false with an error message in filter->err
+ */
+bool gs1_filterHasAI(struct gs1DLfilter *filter, const char *ai);
+
+
+/**
+ *  @brief Add a term requiring that a numeric identification key with a
+ *  predefined length, such as a GTIN or SSCC, starts with the given digits
+ *
+ *  A GS1 Company Prefix makes a typical prefix, e.g. "0952012" for AI (01).
+ *  Keys that do not have the predefined length never match.
+ *
+ *  @param [in,out] filter ::gs1DLfilter
+ *  @param [in] ai The AI, e.g. "01"
+ *  @param [in] prefix Leading digits of the key
+ *  @return true on success, otherwise false with an error message in filter->err
+ */
+bool gs1_filterKeyPrefix(struct gs1DLfilter *filter, const char *ai, const char *prefix);
+
+
+/**
+ *  @brief Add a term comparing a date AI with a given date
+ *
+ *  Contexts without the AI, or with an invalid date, are not selected.
+ *
+ *  @param [in,out] filter ::gs1DLfilter
+ *  @param [in] ai The AI, e.g. "17"
+ *  @param [in] op Comparison, e.g. ::GS1_DL_FILTER_LT selects dates before the given date
+ *  @param [in] year Year, e.g. 2026
+ *  @param [in] month Month, 1 to 12
+ *  @param [in] day Day of the month
+ *  @return true on success, otherwise false with an error message in filter->err
+ */
+bool gs1_filterDate(struct gs1DLfilter *filter, const char *ai, int op, int year, int month, int day);
+
+
+/**
+ *  @brief Select the contexts in a batch that satisfy every term of a filter
+ *
+ *  @param [in] filter ::gs1DLfilter
+ *  @param [in] ctxs Array of count ::gs1DLparser contexts, each holding parsed AI data
+ *  @param [in] count Number of contexts
+ *  @param [out] bitmap Selection bitmap of (count + 63) / 64 words; bit i % 64 of word i / 64 is set if context i is selected
+ *  @return number of selected contexts
+ */
+size_t gs1_filterBatch(const struct gs1DLfilter *filter, const struct gs1DLparser *ctxs, size_t count, uint64_t *bitmap);
+
+
+/**
+ *  @brief Initialise an aggregator of scan counts per key
+ *
+ *  The table holds at most three quarters of its capacity. When it is full
+ *  its contents are written to the spill file as a sorted run and it is
+ *  emptied, so that memory use remains bounded by the capacity.
+ *
+ *  @param [out] agg ::gs1DLaggregator to initialise
+ *  @param [in] ai AI providing the key, e.g. "01"
+ *  @param [in] options Bitwise OR of options, e.g. ::GS1_DL_AGG_BY_LOT
+ *  @param [in] entries Caller-provided table of capacity slots, which must outlive the aggregator
+ *  @param [in] capacity Number of slots; a power of two, at least 16
+ *  @param [in] spill Binary file opened for update, e.g. with tmpfile(), or NULL to fail when the table is full
+ *  @return true on success, otherwise false with an error message in agg->err
+ */
+bool gs1_aggInit(struct gs1DLaggregator *agg, const char *ai, int options, struct gs1DLaggEntry *entries, size_t capacity, FILE *spill);
+
+
+/**
+ *  @brief Count a scan
+ *
+ *  Scans without a numeric value for the key AI are counted in agg->skipped.
+ *
+ *  If the full table cannot be written to the spill file then its counts
+ *  are discarded, so the aggregator should be initialised again.
+ *
+ *  @param [in,out] agg ::gs1DLaggregator
+ *  @param [in] ctx ::gs1DLparser context holding the parsed scan
+ *  @param [in] seen Timestamp of the scan, in any unit
+ *  @return true on success, otherwise false with an error message in agg->err
+ */
+bool gs1_aggAdd(struct gs1DLaggregator *agg, const struct gs1DLparser *ctx, int64_t seen);
+
+
+/**
+ *  @brief Count a batch of scans, as per gs1_aggAdd()
+ *
+ *  @param [in,out] agg ::gs1DLaggregator
+ *  @param [in] ctxs Array of count ::gs1DLparser contexts
+ *  @param [in] count Number of contexts
+ *  @param [in] seen Array of count timestamps
+ *  @return true on success, otherwise false with an error message in agg->err
+ */
+bool gs1_aggAddBatch(struct gs1DLaggregator *agg, const struct gs1DLparser *ctxs, size_t count, const int64_t *seen);
+
+
+/**
+ *  @brief Merge the counts of one aggregator into another, e.g. to combine
+ *  per-thread aggregators
+ *
+ *  The source is emptied, as per gs1_aggFinish().
+ *
+ *  @param [in,out] dst ::gs1DLaggregator receiving the counts
+ *  @param [in,out] src ::gs1DLaggregator with the same key AI and options
+ *  @return true on success, otherwise false with an error message in dst->err
+ */
+bool gs1_aggMerge(struct gs1DLaggregator *dst, struct gs1DLaggregator *src);
+
+
+/**
+ *  @brief Output the aggregated counts and empty the aggregator
+ *
+ *  Entries are output once per key, or key and batch/lot, in ascending order,
+ *  combining the table with any runs in the spill file. The free slots of
+ *  the table serve as read buffers for the runs, so a larger table reads the
+ *  spill file in larger blocks. The spill file is not truncated.
+ *
+ *  @param [in,out] agg ::gs1DLaggregator
+ *  @param [in] emit Callback receiving each entry
+ *  @param [in] arg Argument passed to the callback
+ *  @return true on success, otherwise false with an error message in agg->err
+ */
+bool gs1_aggFinish(struct gs1DLaggregator *agg, gs1_aggEmitFunc emit, void *arg);
+
+
+/**
+ *  @brief Initialise an empty heavy hitter summary
+ *
+ *  @param [out] hh ::gs1DLheavyHitters to initialise
+ *  @param [in] ai AI providing the key, e.g. "01"
+ *  @param [in] k Number of most frequent keys to track, 1 to ::GS1_DL_TOPK_MAX
+ *  @return true on success, otherwise false with an error message in hh->err
+ */
+bool gs1_hhInit(struct gs1DLheavyHitters *hh, const char *ai, int k);
+
+
+/**
+ *  @brief Count a packed key, as returned by gs1_getKey64()
+ *
+ *  The cost is constant for the sketch and logarithmic in k for the
+ *  tracked keys.
+ *
+ *  @param [in,out] hh ::gs1DLheavyHitters
+ *  @param [in] key The key
+ */
+void gs1_hhAddKey(struct gs1DLheavyHitters *hh, uint64_t key);
+
+
+/**
+ *  @brief Count the key of a parsed context
+ *
+ *  @param [in,out] hh ::gs1DLheavyHitters
+ *  @param [in] ctx ::gs1DLparser context holding the parsed scan
+ *  @return true if the context has a numeric value for the AI, otherwise false
+ */
+bool gs1_hhAdd(struct gs1DLheavyHitters *hh, const struct gs1DLparser *ctx);
+
+
+/**
+ *  @brief Estimate the count of any key from the Count-Min sketch
+ *
+ *  @param [in] hh ::gs1DLheavyHitters
+ *  @param [in] key The key
+ *  @return estimated count, which is never less than the true count
+ */
+uint64_t gs1_hhEstimate(const struct gs1DLheavyHitters *hh, uint64_t key);
+
+
+/**
+ *  @brief Get the most frequent keys, most frequent first
+ *
+ *  @param [in] hh ::gs1DLheavyHitters
+ *  @param [out] keys Array of max keys
+ *  @param [out] counts Array of max counts, each no less than the true count
+ *  @param [out] errors Array of max maximum overestimates of the counts; may be NULL
+ *  @param [in] max Size of the arrays
+ *  @return number of keys written
+ */
+size_t gs1_hhTop(const struct gs1DLheavyHitters *hh, uint64_t *keys, uint64_t *counts, uint64_t *errors, size_t max);
+
+
+/**
+ *  @brief Merge a summary into another, e.g. to combine per-thread or
+ *  per-interval summaries
+ *
+ *  @param [in,out] dst ::gs1DLheavyHitters receiving the counts
+ *  @param [in] src ::gs1DLheavyHitters with the same AI and k
+ *  @return true on success, otherwise false with an error message in dst->err
+ */
+bool gs1_hhMerge(struct gs1DLheavyHitters *dst, const struct gs1DLheavyHitters *src);
+
+
+/**
+ *  @brief Serialise a summary for storage or transmission
+ *
+ *  The binary format is little-endian, so summaries can be merged across
+ *  hosts.
+ *
+ *  Call with buf set to NULL to determine the required buffer size.
+ *
+ *  @param [in] hh ::gs1DLheavyHitters
+ *  @param [out] buf User-provided buffer; may be NULL
+ *  @param [in] maxlen Size of buf
+ *  @return size of the serialised summary in bytes, which was written only if it does not exceed maxlen
+ */
+size_t gs1_hhSerialise(const struct gs1DLheavyHitters *hh, void *buf, size_t maxlen);
+
+
+/**
+ *  @brief Load a summary serialised by gs1_hhSerialise()
+ *
+ *  @param [out] hh ::gs1DLheavyHitters to load
+ *  @param [in] buf Serialised summary
+ *  @param [in] len Size of the serialised summary
+ *  @return true on success, otherwise false with an error message in hh->err
+ */
+bool gs1_hhDeserialise(struct gs1DLheavyHitters *hh, const void *buf, size_t len);
+
+
+/**
+ *  @brief Compute a 64-bit fingerprint of the values of the given AIs, e.g.
+ *  { "01", "21", NULL } to identify a serialised item, or of every AI
+ *  element.
+ *
+ *  The fingerprint does not depend upon the order of the AIs in the input.
+ *
+ *  @param [in] ctx ::gs1DLparser context holding parsed AI data
+ *  @param [in] ais NULL-terminated array of AIs, or NULL for every AI element
+ *  @param [out] fp The fingerprint
+ *  @return true if every AI is present, otherwise false
+ */
+bool gs1_fingerprint(const struct gs1DLparser *ctx, const char * const *ais, uint64_t *fp);
+
+
+/**
+ *  @brief Initialise an empty HyperLogLog estimator
+ *
+ *  @param [out] hll ::gs1DLhll to initialise
+ */
+void gs1_hllInit(struct gs1DLhll *hll);
+
+
+/**
+ *  @brief Add a fingerprint, as computed by gs1_fingerprint()
+ *
+ *  @param [in,out] hll ::gs1DLhll
+ *  @param [in] fingerprint The fingerprint
+ */
+void gs1_hllAdd(struct gs1DLhll *hll, uint64_t fingerprint);
+
+
+/**
+ *  @brief Merge an estimator into another, e.g. to combine per-thread or
+ *  per-host estimators
+ *
+ *  @param [in,out] dst ::gs1DLhll receiving the union
+ *  @param [in] src ::gs1DLhll
+ */
+void gs1_hllMerge(struct gs1DLhll *dst, const struct gs1DLhll *src);
+
+
+/**
+ *  @brief Estimate the number of distinct fingerprints added
+ *
+ *  @param [in] hll ::gs1DLhll
+ *  @return the estimate
+ */
+uint64_t gs1_hllEstimate(const struct gs1DLhll *hll);
+
+
+/**
+ *  @brief Serialise an estimator, packing each register into 6 bits
+ *
+ *  The binary format is little-endian, so estimators can be merged across
+ *  hosts.
+ *
+ *  @param [in] hll ::gs1DLhll
+ *  @param [out] buf User-provided buffer; may be NULL
+ *  @param [in] maxlen Size of buf
+ *  @return ::GS1_DL_HLL_SERIALISED, the number of bytes that were written if maxlen is sufficient
+ */
+size_t gs1_hllSerialise(const struct gs1DLhll *hll, void *buf, size_t maxlen);
+
+
+/**
+ *  @brief Load an estimator serialised by gs1_hllSerialise()
+ *
+ *  @param [out] hll ::gs1DLhll to load
+ *  @param [in] buf Serialised estimator
+ *  @param [in] len Size of the serialised estimator
+ *  @return true on success, otherwise false, leaving hll unchanged
+ */
+bool gs1_hllDeserialise(struct gs1DLhll *hll, const void *buf, size_t len);
+
+
+/**
+ *  @brief Build a blocked Bloom filter from a list of packed keys, e.g. the
+ *  GTINs of registered products, that can be saved and later loaded in place
+ *  with gs1_loadBloom(), e.g. from a memory-mapped file.
+ *
+ *  Each key sets eight bits within a single 64-byte block, so a query costs
+ *  at most one cache miss when the buffer is aligned to 64 bytes. With 12
+ *  bits per key the false positive rate is below 1%. The binary format
+ *  uses the host byte order.
+ *
+ *  Call with buf set to NULL to determine the required buffer size.
+ *
+ *  @param [in] keys Array of keys, as per gs1_getKey64()
+ *  @param [in] count Number of keys
+ *  @param [in] bitsPerKey Size of the filter per key, 1 to 64
+ *  @param [out] buf User-provided buffer, aligned to 8 bytes, into which the filter will be written; may be NULL
+ *  @param [in] maxlen Size of buf
+ *  @return size of the filter in bytes, which was written only if it does not exceed maxlen, or 0 if bitsPerKey is invalid
+ */
+size_t gs1_buildBloom(const uint64_t *keys, size_t count, int bitsPerKey, void *buf, size_t maxlen);
+
+
+/**
+ *  @brief Reference a filter built by gs1_buildBloom() without copying it.
+ *
+ *  The buffer must remain valid while the filter is used.
+ *
+ *  @param [out] bf ::gs1DLbloom to initialise
+ *  @param [in] buf Buffer containing the filter, aligned to 8 bytes
+ *  @param [in] len Size of the buffer
+ *  @return true if the buffer holds a well-formed filter, otherwise false
+ */
+bool gs1_loadBloom(struct gs1DLbloom *bf, const void *buf, size_t len);
+
+
+/**
+ *  @brief Test whether a key may be in the filter
+ *
+ *  @param [in] bf ::gs1DLbloom
+ *  @param [in] key The key
+ *  @return false if the key is certainly absent, otherwise true
+ */
+bool gs1_bloomMayContain(const struct gs1DLbloom *bf, uint64_t key);
+
+
+/**
+ *  @brief Test whether the key for an AI of a parsed context may be in the
+ *  filter
+ *
+ *  @param [in] bf ::gs1DLbloom
+ *  @param [in] ctx ::gs1DLparser context holding parsed AI data
+ *  @param [in] ai The AI, e.g. "01"
+ *  @return false if the AI is missing or not numeric, or its key is certainly absent, otherwise true
+ */
+bool gs1_bloomMayContainAI(const struct gs1DLbloom *bf, const struct gs1DLparser *ctx, const char *ai);
+
+
+/**
+ *  @brief Test a batch of keys, as per gs1_bloomMayContain()
+ *
+ *  @param [in] bf ::gs1DLbloom
+ *  @param [in] keys Array of count keys, e.g. from gs1_getKeys64(); ::GS1_DL_KEY_INVALID is never present
+ *  @param [in] count Number of keys
+ *  @param [out] bitmap Result bitmap of (count + 63) / 64 words; bit i % 64 of word i / 64 is set if key i may be present
+ *  @return number of keys that may be present
+ */
+size_t gs1_bloomQueryBatch(const struct gs1DLbloom *bf, const uint64_t *keys, size_t count, uint64_t *bitmap);
+
+
+/**
+ *  @brief Map a 64-bit key or fingerprint to one of a number of shards by
+ *  jump consistent hashing
+ *
+ *  When the number of shards grows, only the keys assigned to the new
+ *  shards change.
+ *
+ *  @param [in] key The key
+ *  @param [in] numShards Number of shards
+ *  @return shard in the range 0 to numShards - 1, or -1 if numShards is less than 1
+ */
+int gs1_jumpHash(uint64_t key, int numShards);
+
+
+/**
+ *  @brief Map a parsed context to a shard by the fingerprint of its primary
+ *  key and any qualifiers, as per gs1_fingerprint() and gs1_jumpHash()
+ *
+ *  @param [in] ctx ::gs1DLparser context holding parsed AI data
+ *  @param [in] ais NULL-terminated array of AIs, e.g. { "01", NULL }
+ *  @param [in] numShards Number of shards
+ *  @return shard in the range 0 to numShards - 1, or -1 if an AI is missing or numShards is less than 1
+ */
+int gs1_shardOf(const struct gs1DLparser *ctx, const char * const *ais, int numShards);
+
+
+/**
+ *  @brief Partition a batch of parsed contexts by shard, as per gs1_shardOf()
+ *
+ *  The rows of shard s are rows[offsets[s]] to rows[offsets[s + 1] - 1], in
+ *  their original order, e.g. for copying the corresponding URIs into a
+ *  buffer per shard. Rows missing an AI follow, up to offsets[numShards + 1].
+ *
+ *  @param [in] ctxs Array of count ::gs1DLparser contexts
+ *  @param [in] count Number of contexts
+ *  @param [in] ais NULL-terminated array of AIs, e.g. { "01", NULL }
+ *  @param [in] numShards Number of shards
+ *  @param [out] shards Array of count shards; -1 where an AI is missing
+ *  @param [out] offsets Array of numShards + 2 offsets into rows
+ *  @param [out] rows Array of count row indices, grouped by shard
+ *  @return number of rows assigned to a shard
+ */
+size_t gs1_partitionBatch(const struct gs1DLparser *ctxs, size_t count, const char * const *ais, int numShards,
+			  int *shards, size_t *offsets, size_t *rows);
+
+
+/**
+ *  @brief Sort packed keys in ascending order, e.g. as returned by
+ *  gs1_getKeys64(), carrying their row indices
+ *
+ *  The sort is a stable LSD radix sort that skips the bytes shared by every
+ *  key. To sort in parallel instead, for each pass from 0 to 7 split the
+ *  input into chunks, call gs1_radixCount() on each chunk, gs1_radixOffsets()
+ *  over all of the histograms, then gs1_radixScatter() on each chunk with its
+ *  histogram, swapping the input and output arrays between passes.
+ *
+ *  @param [in,out] keys Array of count keys
+ *  @param [in,out] rows Array of count row indices, permuted with the keys
+ *  @param [in] count Number of keys
+ *  @param [out] tmpKeys Scratch array of count keys
+ *  @param [out] tmpRows Scratch array of count row indices
+ */
+void gs1_radixSort(uint64_t *keys, size_t *rows, size_t count, uint64_t *tmpKeys, size_t *tmpRows);
+
+
+/**
+ *  @brief Count the keys of a chunk by their byte for a radix sort pass
+ *
+ *  @param [in] keys Array of count keys
+ *  @param [in] count Number of keys
+ *  @param [in] pass Radix sort pass, 0 to 7, sorting on byte pass of each key
+ *  @param [out] hist Histogram of ::GS1_DL_RADIX_BUCKETS counts
+ */
+void gs1_radixCount(const uint64_t *keys, size_t count, int pass, size_t *hist);
+
+
+/**
+ *  @brief Convert the histograms of consecutive chunks for a radix sort pass
+ *  into the output offset of each bucket for each chunk
+ *
+ *  @param [in,out] hists numChunks consecutive histograms of ::GS1_DL_RADIX_BUCKETS counts
+ *  @param [in] numChunks Number of chunks
+ */
+void gs1_radixOffsets(size_t *hists, size_t numChunks);
+
+
+/**
+ *  @brief Scatter the keys of a chunk for a radix sort pass
+ *
+ *  @param [in] keys Array of count keys
+ *  @param [in] rows Array of count row indices
+ *  @param [in] count Number of keys
+ *  @param [in] pass Radix sort pass, 0 to 7
+ *  @param [in,out] offsets The chunk's offsets from gs1_radixOffsets(), advanced as keys are placed
+ *  @param [out] outKeys Output array of keys for all chunks
+ *  @param [out] outRows Output array of row indices for all chunks
+ */
+void gs1_radixScatter(const uint64_t *keys, const size_t *rows, size_t count, int pass, size_t *offsets,
+		      uint64_t *outKeys, size_t *outRows);
+
+
+/**
+ *  @brief Find the groups of equal keys in a sorted array
+ *
+ *  Group g consists of the keys from starts[g] to starts[g + 1] - 1.
+ *
+ *  @param [in] keys Array of count sorted keys
+ *  @param [in] count Number of keys
+ *  @param [out] starts Array of up to count + 1 group start offsets, ending with count
+ *  @return number of groups
+ */
+size_t gs1_groupBoundaries(const uint64_t *keys, size_t count, size_t *starts);
+
+
+/**
+ *  @brief Start an Arrow IPC stream, writing its schema
+ *
+ *  The schema has a nullable Utf8 column for each of the given AIs, named
+ *  after the AI, e.g. "01". Each context forms a row, which is null in the
+ *  columns of the AIs that it lacks. Requires a little-endian host.
+ *
+ *  @param [out] w ::gs1DLarrowWriter to initialise
+ *  @param [in] ais Array of numColumns AIs, e.g. { "01", "10", "17", "21" }
+ *  @param [in] numColumns Number of columns, 1 to ::GS1_DL_ARROW_MAX_COLUMNS
+ *  @param [in] write Output callback
+ *  @param [in] arg Argument passed to the output callback
+ *  @return true on success, otherwise false with an error message in w->err
+ */
+bool gs1_arrowBegin(struct gs1DLarrowWriter *w, const char * const *ais, int numColumns, gs1_writeFunc write, void *arg);
+
+
+/**
+ *  @brief Write a batch of parsed contexts to an Arrow IPC stream as a
+ *  record batch
+ *
+ *  AI values are passed to the output callback directly from each context,
+ *  without being gathered into an intermediate buffer.
+ *
+ *  @param [in,out] w ::gs1DLarrowWriter
+ *  @param [in] ctxs Array of count ::gs1DLparser contexts
+ *  @param [in] count Number of contexts
+ *  @return true on success, otherwise false with an error message in w->err
+ */
+bool gs1_arrowWriteBatch(struct gs1DLarrowWriter *w, const struct gs1DLparser *ctxs, size_t count);
+
+
+/**
+ *  @brief Finish an Arrow IPC stream
+ *
+ *  @param [in,out] w ::gs1DLarrowWriter
+ *  @return true on success, otherwise false with an error message in w->err
+ */
+bool gs1_arrowEnd(struct gs1DLarrowWriter *w);
+
+
+/**
+ *  @brief Write the AI data as a compact binary record, e.g. for transport
+ *  between services
+ *
+ *  Each AI element is written as a flags byte recording the FNC1 requirement
+ *  and whether the AI was extracted from the query info, the AI and the
+ *  value length as varints, then the value. Empty values cannot be written.
+ *
+ *  @param [in,out] ctx ::gs1DLparser context
+ *  @param [out] out User-provided buffer into which the record will be written. A buffer of ::GS1_DL_MAX_OUT_BINARY bytes suffices.
+ *  @param [in] maxlen Size of the out buffer
+ *  @return length of the record, or 0 on failure with an error message in ctx->err
+ */
+size_t gs1_writeBinary(struct gs1DLparser *ctx, unsigned char *out, size_t maxlen);
+
+
+/**
+ *  @brief Start reading a binary record in place
+ *
+ *  The record is validated in full, so subsequent reads cannot fail. It must
+ *  remain valid while its elements are used.
+ *
+ *  @param [out] r ::gs1DLbinaryReader to initialise
+ *  @param [in] buf Record written by gs1_writeBinary()
+ *  @param [in] len Length of the record
+ *  @return true if the record is well formed, otherwise false
+ */
+bool gs1_binaryReaderInit(struct gs1DLbinaryReader *r, const void *buf, size_t len);
+
+
+/**
+ *  @brief Read the next AI element of a binary record
+ *
+ *  @param [in,out] r ::gs1DLbinaryReader
+ *  @param [out] elem The element, whose value references the record
+ *  @return true if an element was read, or false at the end of the record
+ */
+bool gs1_binaryNext(struct gs1DLbinaryReader *r, struct gs1DLbinaryElement *elem);
+
+
+/**
+ *  @brief Load the AI data of a binary record into a context, e.g. for
+ *  writing in other formats
+ *
+ *  @param [out] ctx ::gs1DLparser context
+ *  @param [in] buf Record written by gs1_writeBinary()
+ *  @param [in] len Length of the record
+ *  @return true on success, otherwise false with an error message in ctx->err
+ */
+bool gs1_parseBinary(struct gs1DLparser *ctx, const void *buf, size_t len);
+
+
+/**
+ *  @brief Write a position-independent snapshot of a context, e.g. to hand a
+ *  parsed context to another process through shared memory or a socket
+ *
+ *  The snapshot holds only offsets, so it can be copied anywhere and then
+ *  used in place with gs1_loadSnapshot(). It includes copies of the non-AI
+ *  query parameters and, if dlData is given, of the URI parts. The binary
+ *  format uses the host byte order.
+ *
+ *  Call with buf set to NULL to determine the required buffer size.
+ *
+ *  @param [in] ctx ::gs1DLparser context
+ *  @param [in] dlData The DL URI that ctx was parsed from, whose parts are copied; NULL to omit the URI parts
+ *  @param [out] buf User-provided buffer, aligned to 4 bytes, into which the snapshot will be written; may be NULL
+ *  @param [in] maxlen Size of buf
+ *  @return size of the snapshot in bytes, which was written only if it does not exceed maxlen
+ */
+size_t gs1_writeSnapshot(const struct gs1DLparser *ctx, const char *dlData, void *buf, size_t maxlen);
+
+
+/**
+ *  @brief Reference a snapshot written by gs1_writeSnapshot() without
+ *  copying it.
+ *
+ *  The snapshot is validated in full. The buffer must remain valid while the
+ *  snapshot is used.
+ *
+ *  @param [out] snap ::gs1DLsnapshot to initialise
+ *  @param [in] buf Buffer containing the snapshot, aligned to 4 bytes
+ *  @param [in] len Size of the buffer
+ *  @return true if the buffer holds a well-formed snapshot, otherwise false
+ */
+bool gs1_loadSnapshot(struct gs1DLsnapshot *snap, const void *buf, size_t len);
+
+
+/**
+ *  @brief Read an AI element of a snapshot in place
+ *
+ *  @param [in] snap ::gs1DLsnapshot
+ *  @param [in] i Index of the element, less than snap->numAIs
+ *  @param [out] elem The element, whose value references the snapshot
+ */
+void gs1_snapshotAI(const struct gs1DLsnapshot *snap, int i, struct gs1DLbinaryElement *elem);
+
+
+/**
+ *  @brief Read a non-AI query parameter of a snapshot in place
+ *
+ *  @param [in] snap ::gs1DLsnapshot
+ *  @param [in] i Index of the parameter, less than snap->numQueryParams
+ *  @param [out] qp The parameter, whose spans reference the snapshot
+ */
+void gs1_snapshotQueryParam(const struct gs1DLsnapshot *snap, int i, struct gs1DLqueryParam *qp);
+
+
+/**
+ *  @brief Restore a context from a snapshot, e.g. for use with the gs1_write*()
+ *  functions
+ *
+ *  The AI data is copied into the context. The query parameters reference
+ *  the snapshot, which must remain valid while they are used. The URI parts
+ *  are cleared, since there is no URI for them to locate; they remain
+ *  available from snap->uriParts.
+ *
+ *  @param [out] ctx ::gs1DLparser context
+ *  @param [in] snap ::gs1DLsnapshot loaded by gs1_loadSnapshot()
+ */
+void gs1_restoreSnapshot(struct gs1DLparser *ctx, const struct gs1DLsnapshot *snap);
+
 #ifdef __cplusplus
 }
 #endif